@@ -0,0 +1,7 @@
+#version 450
+
+layout(location = 0) out vec4 FragColor;
+
+void main() {
+    FragColor = vec4(0.25, 0.5, 0.75, 1.0);
+}
\ No newline at end of file
@@ -0,0 +1,8 @@
+#version 450
+
+// A triangle covering the whole framebuffer, for the device selection fill rate benchmark
+
+void main() {
+    vec2 position = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
+    gl_Position = vec4(position * 2.0 - 1.0, 0.0, 1.0);
+}
\ No newline at end of file
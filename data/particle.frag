@@ -0,0 +1,15 @@
+#version 450
+
+layout(location = 0) in vec4 Color;
+layout(location = 1) in vec2 Corner;
+
+layout(location = 0) out vec4 FragColor;
+
+void main() {
+    // Round particles with a soft edge
+    float alpha = Color.a * (1.0 - smoothstep(0.5, 1.0, length(Corner)));
+    if (alpha < 1.0 / 255.0) {
+        discard;
+    }
+    FragColor = vec4(Color.rgb, alpha);
+}
\ No newline at end of file
@@ -0,0 +1,47 @@
+#version 450
+
+// Camera facing quads for the sorted particles, back to front. No vertex input, the instance picks the particle
+// and the vertex index the corner of its quad.
+
+layout(location = 0) out vec4 Color;
+layout(location = 1) out vec2 Corner;
+
+struct Particle {
+    vec4 position_life;
+    vec4 velocity_lifetime;
+    vec4 color;
+};
+
+// See ParticleSystem
+layout(std430, binding = 0) readonly buffer Particles {
+    Particle particles[];
+};
+
+layout(std430, binding = 4) readonly buffer SortEntries {
+    uvec2 entries[];
+};
+
+layout(push_constant) uniform Camera {
+    mat4 view_projection;
+    // World space camera axes, half the particle size in w of right
+    vec4 right_size;
+    vec4 up;
+} camera;
+
+const vec2 corners[6] = vec2[](
+    vec2(-1.0, -1.0), vec2(1.0, -1.0), vec2(1.0, 1.0),
+    vec2(1.0, 1.0), vec2(-1.0, 1.0), vec2(-1.0, -1.0)
+);
+
+void main() {
+    Particle p = particles[entries[gl_InstanceIndex].y];
+    vec2 corner = corners[gl_VertexIndex];
+    vec3 offset = camera.right_size.xyz * corner.x + camera.up.xyz * corner.y;
+    vec3 position = p.position_life.xyz + offset * camera.right_size.w;
+
+    // Fade out over the last quarter of the life
+    float fade = clamp(p.position_life.w / (0.25 * p.velocity_lifetime.w), 0.0, 1.0);
+    Color = vec4(p.color.rgb, p.color.a * fade);
+    Corner = corner;
+    gl_Position = camera.view_projection * vec4(position, 1.0);
+}
\ No newline at end of file
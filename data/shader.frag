@@ -1,12 +1,166 @@
 #version 450
 
 layout(location = 0) in vec3 VertColor;
-layout(location = 1) in vec2 TexCoords;
+// Atlas layer in z
+layout(location = 1) in vec3 TexCoords;
+layout(location = 2) in vec3 WorldPos;
+layout(location = 3) in vec3 WorldNormal;
+layout(location = 4) in float ViewDepth;
 
-layout(binding = 1) uniform sampler2D tex_sampler;
+// Every texture of the scene, packed into the layers of an atlas
+layout(binding = 1) uniform sampler2DArray tex_sampler;
+
+struct Light {
+    vec4 position_radius;
+    vec4 color_intensity;
+};
+
+// See ClusteredLighting
+layout(std430, set = 1, binding = 0) readonly buffer Lights {
+    mat4 view;
+    mat4 inverse_projection;
+    // Clusters along x, y and z, and the amount of lights
+    uvec4 grid;
+    // Near and far plane, framebuffer width and height
+    vec4 params;
+    Light lights[];
+} lighting;
+
+layout(std430, set = 1, binding = 1) readonly buffer ClusterCounts {
+    uint counts[];
+} clusters;
+
+layout(std430, set = 1, binding = 2) readonly buffer ClusterIndices {
+    uint indices[];
+} cluster_lights;
+
+// See VirtualTexture. Slot x and y of a page in the atlas, and the mip level of what is in the slot, which is an
+// ancestor of the page while the page itself is not resident.
+layout(set = 2, binding = 0) uniform usampler2D page_table;
+layout(set = 2, binding = 1) uniform sampler2D page_atlas;
+
+// Must match VirtualTexture
+const float VT_SIZE = 16384.0;
+const float VT_PAGE_SIZE = 128.0;
+const float VT_PAGE_BORDER = 4.0;
+const float VT_TILE_SIZE = 136.0;
+const uint VT_MIP_COUNT = 8;
+const uint VT_PAGE_COUNT = ((1u << (2 * VT_MIP_COUNT)) - 1u) / 3;
+
+// Fragment shaders can only write storage buffers with fragmentStoresAndAtomics. Only the variant compiled with
+// -DVIRTUAL_TEXTURE_FEEDBACK writes the feedback, and it is only used on devices that have the feature.
+#ifdef VIRTUAL_TEXTURE_FEEDBACK
+#define FEEDBACK_ACCESS
+#else
+#define FEEDBACK_ACCESS readonly
+#endif
+
+// Every page the fragments would like to sample, appended once: the first fragment to set a page's bit in seen
+// appends it to pages
+layout(std430, set = 2, binding = 2) FEEDBACK_ACCESS buffer PageRequests {
+    uint count;
+    uint seen[(VT_PAGE_COUNT + 31) / 32];
+    uint pages[VT_PAGE_COUNT];
+} feedback;
+
+// Must match ClusteredLighting::max_lights_per_cluster
+const uint MAX_LIGHTS_PER_CLUSTER = 128;
+const vec3 AMBIENT = vec3(0.1);
 
 layout(location = 0) out vec4 FragColor;
 
+// Pipeline permutations toggle these, see ShaderFeature
+layout(constant_id = 0) const bool USE_VERTEX_COLOR = false;
+layout(constant_id = 1) const bool ALPHA_CUTOUT = false;
+layout(constant_id = 2) const bool LIGHTING = false;
+layout(constant_id = 3) const bool CLUSTERED_LIGHTS = false;
+layout(constant_id = 4) const bool VIRTUAL_TEXTURE = false;
+
+vec3 point_light(Light light, vec3 normal) {
+    vec3 to_light = light.position_radius.xyz - WorldPos;
+    float dist = length(to_light);
+    // Reaches zero at the radius, so lights that were not binned into a cluster contribute nothing there anyway
+    float falloff = clamp(1.0 - dist / light.position_radius.w, 0.0, 1.0);
+    float diffuse = max(dot(normal, to_light / max(dist, 1e-4)), 0.0);
+    return light.color_intensity.rgb * light.color_intensity.w * diffuse * falloff * falloff;
+}
+
+uint cluster_index() {
+    uvec3 grid = lighting.grid.xyz;
+    float near = lighting.params.x;
+    float far = lighting.params.y;
+    uvec2 tile = uvec2(gl_FragCoord.xy / lighting.params.zw * vec2(grid.xy));
+    // Slices are spaced exponentially, see cluster_lights.comp
+    uint slice = uint(max(log(ViewDepth / near) / log(far / near) * float(grid.z), 0.0));
+    tile = min(tile, grid.xy - 1);
+    slice = min(slice, grid.z - 1);
+    return tile.x + grid.x * (tile.y + grid.y * slice);
+}
+
+// Same as VirtualTexture::page_id
+uint page_id(uint mip, uvec2 page) {
+    uint level_offset = ((1u << (2 * VT_MIP_COUNT)) - (1u << (2 * (VT_MIP_COUNT - mip)))) / 3;
+    return level_offset + page.y * (uint(VT_SIZE / VT_PAGE_SIZE) >> mip) + page.x;
+}
+
+vec4 sample_virtual_texture(vec2 uv) {
+    uv = clamp(uv, 0.0, 1.0 - 1.0 / VT_SIZE);
+    vec2 texel = uv * VT_SIZE;
+    vec2 dx = dFdx(texel);
+    vec2 dy = dFdy(texel);
+    float lod = clamp(0.5 * log2(max(dot(dx, dx), dot(dy, dy))), 0.0, float(VT_MIP_COUNT - 1));
+    uint mip = uint(lod);
+    uvec2 page = uvec2(texel / VT_PAGE_SIZE) >> mip;
+
+    // Neighbouring pixels almost always want the same page, one in 16 is enough to find every visible page
+#ifdef VIRTUAL_TEXTURE_FEEDBACK
+    if ((uint(gl_FragCoord.x) & 3) == 0 && (uint(gl_FragCoord.y) & 3) == 0) {
+        uint id = page_id(mip, page);
+        uint bit = 1u << (id & 31);
+        if ((atomicOr(feedback.seen[id >> 5], bit) & bit) == 0) {
+            feedback.pages[atomicAdd(feedback.count, 1)] = id;
+        }
+    }
+#endif
+
+    // Falls back to the closest resident ancestor
+    uvec4 entry = texelFetch(page_table, ivec2(page), int(mip));
+    vec2 resident_texel = texel / float(1u << entry.z);
+    vec2 in_page = fract(resident_texel / VT_PAGE_SIZE) * VT_PAGE_SIZE;
+    vec2 atlas_texel = vec2(entry.xy) * VT_TILE_SIZE + VT_PAGE_BORDER + in_page;
+    return textureLod(page_atlas, atlas_texel / vec2(textureSize(page_atlas, 0)), 0.0);
+}
+
 void main() {
-    FragColor = texture(tex_sampler, TexCoords);
+    vec4 color;
+    if (VIRTUAL_TEXTURE) {
+        // One huge texture stretched over the whole scene
+        color = sample_virtual_texture(WorldPos.xy * 0.5 + 0.5);
+    } else {
+        color = texture(tex_sampler, TexCoords);
+    }
+    if (USE_VERTEX_COLOR) {
+        color.rgb *= VertColor;
+    }
+    if (ALPHA_CUTOUT && color.a < 0.5) {
+        discard;
+    }
+    if (LIGHTING) {
+        vec3 normal = normalize(gl_FrontFacing ? WorldNormal : -WorldNormal);
+        vec3 light = AMBIENT;
+        if (CLUSTERED_LIGHTS) {
+            // Only the lights that touch this fragment's cluster
+            uint cluster = cluster_index();
+            uint count = clusters.counts[cluster];
+            for (uint i = 0; i < count; ++i) {
+                light += point_light(lighting.lights[cluster_lights.indices[cluster * MAX_LIGHTS_PER_CLUSTER + i]], normal);
+            }
+        } else {
+            for (uint i = 0; i < lighting.grid.w; ++i) {
+                light += point_light(lighting.lights[i], normal);
+            }
+        }
+        color.rgb *= light;
+    }
+    FragColor = color;
 }
\ No newline at end of file
@@ -5,16 +5,53 @@ layout(location = 1) in vec3 iColor;
 layout(location = 2) in vec2 iTexCoords;
 
 layout(location = 0) out vec3 VertColor;
-layout(location = 1) out vec2 TexCoords;
+// Atlas layer in z
+layout(location = 1) out vec3 TexCoords;
+layout(location = 2) out vec3 WorldPos;
+layout(location = 3) out vec3 WorldNormal;
+layout(location = 4) out float ViewDepth;
 
+// Per-view data, bound with a dynamic offset for the current frame
 layout(binding = 0) uniform Matrices {
-    mat4 model;
     mat4 view;
     mat4 projection;
 } matrices;
 
+// Per-object world matrices of the current frame, also bound with a dynamic offset
+layout(std430, binding = 2) readonly buffer Objects {
+    mat4 models[];
+} objects;
+
+// Where every texture is in the atlas, see GpuAtlasRect
+struct AtlasRect {
+    // Offset in xy, scale in zw
+    vec4 uv_rect;
+    uint layer;
+};
+
+layout(std430, binding = 3) readonly buffer TextureRects {
+    AtlasRect rects[];
+} atlas;
+
+// Per-draw data, see DrawConstants
+layout(push_constant) uniform Draw {
+    mat4 model;
+    uvec2 vertices;
+    uint vertex_format;
+    uint first_object;
+    uint texture_index;
+} draw;
+
 void main() {
+    mat4 model = draw.model * objects.models[draw.first_object + gl_InstanceIndex];
     VertColor = iColor;
-    TexCoords = iTexCoords;
-    gl_Position = matrices.projection * matrices.view * matrices.model * vec4(iPos, 1.0);
+    AtlasRect rect = atlas.rects[draw.texture_index];
+    TexCoords = vec3(iTexCoords * rect.uv_rect.zw + rect.uv_rect.xy, float(rect.layer));
+    vec4 world_pos = model * vec4(iPos, 1.0);
+    vec4 view_pos = matrices.view * world_pos;
+    WorldPos = world_pos.xyz;
+    // Every mesh lies in its XY plane
+    WorldNormal = mat3(model) * vec3(0.0, 0.0, 1.0);
+    ViewDepth = -view_pos.z;
+    gl_Position = matrices.projection * view_pos;
 }
\ No newline at end of file
@@ -0,0 +1,92 @@
+#version 450
+#extension GL_EXT_buffer_reference : require
+#extension GL_EXT_buffer_reference_uvec2 : require
+
+// Same as shader.vert, but vertices are read from memory through a device address instead of vertex input, so one
+// pipeline can draw meshes with any layout it knows how to decode. No vertex input is used at all.
+
+layout(location = 0) out vec3 VertColor;
+// Atlas layer in z
+layout(location = 1) out vec3 TexCoords;
+layout(location = 2) out vec3 WorldPos;
+layout(location = 3) out vec3 WorldNormal;
+layout(location = 4) out float ViewDepth;
+
+layout(binding = 0) uniform Matrices {
+    mat4 view;
+    mat4 projection;
+} matrices;
+
+layout(std430, binding = 2) readonly buffer Objects {
+    mat4 models[];
+} objects;
+
+// See VertexFormat
+const uint VERTEX_FORMAT_STANDARD = 0;
+const uint VERTEX_FORMAT_COMPACT = 1;
+
+// Layout of the Vertex struct, in 32 bit words. Vector members are 16 byte aligned.
+const uint STANDARD_STRIDE = 12;
+const uint STANDARD_COLOR = 4;
+const uint STANDARD_TEX_COORDS = 8;
+
+// Layout of CompactVertex, in 32 bit words
+const uint COMPACT_STRIDE = 5;
+const uint COMPACT_COLOR = 3;
+const uint COMPACT_TEX_COORDS = 4;
+
+layout(buffer_reference, std430, buffer_reference_align = 4) readonly buffer Words {
+    uint data[];
+};
+
+// Where every texture is in the atlas, see GpuAtlasRect
+struct AtlasRect {
+    // Offset in xy, scale in zw
+    vec4 uv_rect;
+    uint layer;
+};
+
+layout(std430, binding = 3) readonly buffer TextureRects {
+    AtlasRect rects[];
+} atlas;
+
+// Per-draw data, see DrawConstants
+layout(push_constant) uniform Draw {
+    mat4 model;
+    uvec2 vertices;
+    uint vertex_format;
+    uint first_object;
+    uint texture_index;
+} draw;
+
+void main() {
+    Words words = Words(draw.vertices);
+
+    vec3 pos;
+    vec2 tex_coords;
+    if (draw.vertex_format == VERTEX_FORMAT_COMPACT) {
+        uint base = uint(gl_VertexIndex) * COMPACT_STRIDE;
+        pos = uintBitsToFloat(uvec3(words.data[base], words.data[base + 1], words.data[base + 2]));
+        VertColor = unpackUnorm4x8(words.data[base + COMPACT_COLOR]).rgb;
+        tex_coords = unpackUnorm2x16(words.data[base + COMPACT_TEX_COORDS]);
+    } else {
+        uint base = uint(gl_VertexIndex) * STANDARD_STRIDE;
+        pos = uintBitsToFloat(uvec3(words.data[base], words.data[base + 1], words.data[base + 2]));
+        uint color = base + STANDARD_COLOR;
+        VertColor = uintBitsToFloat(uvec3(words.data[color], words.data[color + 1], words.data[color + 2]));
+        uint uv = base + STANDARD_TEX_COORDS;
+        tex_coords = uintBitsToFloat(uvec2(words.data[uv], words.data[uv + 1]));
+    }
+
+    AtlasRect rect = atlas.rects[draw.texture_index];
+    TexCoords = vec3(tex_coords * rect.uv_rect.zw + rect.uv_rect.xy, float(rect.layer));
+
+    mat4 model = draw.model * objects.models[draw.first_object + gl_InstanceIndex];
+    vec4 world_pos = model * vec4(pos, 1.0);
+    vec4 view_pos = matrices.view * world_pos;
+    WorldPos = world_pos.xyz;
+    // Every mesh lies in its XY plane
+    WorldNormal = mat3(model) * vec3(0.0, 0.0, 1.0);
+    ViewDepth = -view_pos.z;
+    gl_Position = matrices.projection * view_pos;
+}
\ No newline at end of file
@@ -0,0 +1,21 @@
+#version 450
+
+// Stretches the part of the offscreen target the scene was drawn to over the whole swapchain image
+
+layout(location = 0) in vec2 UV;
+
+layout(location = 0) out vec4 FragColor;
+
+layout(binding = 0) uniform sampler2D scene;
+
+// See DynamicResolution::record_upscale
+layout(push_constant) uniform Upscale {
+    // Rendered fraction of the target in xy, the last texel center that was rendered in zw
+    vec4 uv_scale_max;
+} upscale;
+
+void main() {
+    // Clamping keeps the bilinear filter from blending in texels outside of the rendered area
+    vec2 uv = min(UV * upscale.uv_scale_max.xy, upscale.uv_scale_max.zw);
+    FragColor = texture(scene, uv);
+}
\ No newline at end of file
@@ -0,0 +1,10 @@
+#version 450
+
+// A triangle covering the whole swapchain image, with UVs from 0 to 1 over the image
+
+layout(location = 0) out vec2 UV;
+
+void main() {
+    UV = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
+    gl_Position = vec4(UV * 2.0 - 1.0, 0.0, 1.0);
+}
\ No newline at end of file
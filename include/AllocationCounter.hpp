@@ -0,0 +1,18 @@
+#ifndef ALLOCATION_COUNTER_HPP_
+#define ALLOCATION_COUNTER_HPP_
+
+#include <cstdint>
+
+// With VK_PLAYGROUND_COUNT_ALLOCATIONS the global operator new is replaced by one that counts every allocation of the
+// calling thread, so a code path can be checked to not touch the heap. Allocations made by C libraries like the
+// Vulkan driver go through malloc directly and are not counted.
+#ifdef VK_PLAYGROUND_COUNT_ALLOCATIONS
+constexpr bool allocation_counting_compiled = true;
+#else
+constexpr bool allocation_counting_compiled = false;
+#endif
+
+// Heap allocations made by the calling thread so far. Always 0 when counting is compiled out.
+uint64_t thread_allocation_count();
+
+#endif
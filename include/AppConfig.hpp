@@ -0,0 +1,90 @@
+#ifndef APP_CONFIG_HPP_
+#define APP_CONFIG_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Which present modes to prefer. Each policy falls back to FIFO, which is always available.
+enum class PresentModePolicy {
+    // Classic vsync, lowest throughput but never tears
+    Fifo,
+    // Vsync, but late frames are presented right away instead of waiting for the next vblank
+    FifoRelaxed,
+    // Render as fast as possible, and only present the newest frame at vblank
+    Mailbox,
+    // Present right away, tears but has the lowest latency
+    Immediate
+};
+
+struct AppConfig {
+    // Physical device index or part of its name. Empty to pick the fastest device, going by benchmarks cached per
+    // device and driver version.
+    std::string device;
+    // Benchmark the devices again even if there are cached results
+    bool benchmark_devices = false;
+
+    size_t frames_in_flight = 2;
+    PresentModePolicy present_mode = PresentModePolicy::Mailbox;
+    // Frames per second to limit to, 0 means unlimited
+    double fps_limit = 0.0;
+    // Draw the scene at a lower resolution when needed to keep its GPU time at this many milliseconds, and upscale it
+    std::optional<double> dynamic_resolution_ms;
+    // Samples per pixel of the scene, resolved before it is presented. Lowered to what the device supports.
+    uint32_t msaa_samples = 1;
+
+    // Recompile and rebuild the graphics pipeline when the GLSL sources change
+    bool shader_hot_reload = false;
+    std::string shader_source_dir = "data";
+
+    // Read vertices from storage buffers in the vertex shader instead of using fixed-function vertex input
+    bool vertex_pulling = false;
+
+    // Point lights in the scene, 0 turns lighting off
+    size_t light_count = 256;
+
+    // Texture atlas packed offline with --pack-textures. Empty to pack the scene textures at startup.
+    std::string atlas_file;
+    // Pack these images into atlas_file and exit
+    std::vector<std::string> pack_textures;
+
+    // Texture the scene with a huge virtual texture, streaming in only the pages that are visible
+    bool virtual_texture = false;
+
+    // Capacity of the GPU particle system, 0 turns particles off
+    size_t particle_count = 65536;
+
+    // Animated characters skinned on the GPU, 0 turns them off
+    size_t character_count = 64;
+
+    // Write a Chrome trace of the first profile_frames frames to this file. Empty to not capture.
+    std::string profile_file;
+    size_t profile_frames = 300;
+
+    // Record the inputs of every frame to this file. Empty to not capture.
+    std::string capture_file;
+    // Draw the frames of a capture as fast as possible in a hidden window, report the frame times and exit
+    std::string replay_file;
+
+    // Device local memory to stay within, on top of the budget the driver gives us. 0 means no extra limit.
+    size_t memory_budget_mib = 0;
+
+    // Run the scene transform benchmark with this amount of nodes instead of starting the application
+    std::optional<size_t> bench_transforms;
+    // Compare vertex pulling against fixed-function vertex input on a large mesh and exit
+    bool bench_vertex_pulling = false;
+    // Compare clustered lighting against looping over every light at 10 to 10000 lights and exit
+    bool bench_lights = false;
+    // Simulate and sort this amount of GPU particles without a window and exit
+    std::optional<size_t> bench_particles;
+};
+
+// Throws std::invalid_argument on unknown or malformed options
+AppConfig parse_app_config(int argc, char** argv);
+
+void print_usage(std::ostream& out, char const* program);
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef ASYNC_FILE_READER_HPP_
+#define ASYNC_FILE_READER_HPP_
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+class ThreadPool;
+
+// Reads ranges of files into memory owned by the caller, in the background. On Linux the reads go through io_uring,
+// so many of them can be in flight without a thread each. Elsewhere, or when the kernel does not allow io_uring, they
+// run as jobs on a thread pool. Queued reads start in priority order, so a read for something on screen overtakes a
+// batch of prefetches submitted before it.
+class AsyncFileReader {
+public:
+    enum class Priority : uint8_t {
+        Prefetch,
+        Normal,
+        // Needed for what is on screen right now
+        Visible
+    };
+
+    struct Result {
+        // Less than requested when the file ends early
+        size_t bytes_read = 0;
+        // errno of the failure, 0 on success
+        int error = 0;
+    };
+
+    struct Read {
+        std::string path;
+        uint64_t offset = 0;
+        size_t size = 0;
+        // Where the bytes go, for example persistently mapped staging memory. Has to stay valid until on_complete
+        // ran, or the read was cancelled.
+        void* destination = nullptr;
+        Priority priority = Priority::Normal;
+        // Called on a background thread once the read finished or failed. Not called for cancelled reads.
+        std::function<void(Result const&)> on_complete;
+    };
+
+    using Ticket = uint64_t;
+
+    // io_uring keeps up to queue_depth reads in flight. The thread pool is only used as the fallback.
+    AsyncFileReader(ThreadPool& workers, uint32_t queue_depth = 64);
+    // Cancels the queued reads and waits for those in flight
+    ~AsyncFileReader();
+
+    AsyncFileReader(AsyncFileReader const&) = delete;
+    AsyncFileReader& operator=(AsyncFileReader const&) = delete;
+
+    // Queue a batch of reads. The tickets are in the same order as the reads.
+    std::vector<Ticket> submit(std::vector<Read> reads);
+    // Drop a read that has not started yet. Returns false if it already started, its on_complete runs as usual then.
+    bool cancel(Ticket ticket);
+    // Block until every read submitted so far completed or was cancelled
+    void wait_idle();
+
+    bool uses_io_uring() const;
+
+private:
+    struct Ring;
+
+    ThreadPool& workers;
+    std::unique_ptr<Ring> ring;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::condition_variable idle_cv;
+    // Highest priority first, then in submission order
+    std::map<std::pair<int, Ticket>, Read> queued;
+    Ticket next_ticket = 1;
+    size_t in_flight = 0;
+    // Thread pool jobs that have not finished yet, they may still touch this object
+    size_t jobs_outstanding = 0;
+    bool stopping = false;
+
+    std::thread io_thread;
+
+    static std::pair<int, Ticket> queue_key(Priority priority, Ticket ticket);
+    // Pop the most important queued read, counting it as in flight. Returns false if nothing is queued.
+    bool take_next(Ticket& ticket, Read& read);
+    void finish(Read const& read, Result const& result);
+
+    void run_pool_job();
+    void io_loop();
+};
+
+// Read whole files in one batch and wait for all of them. Throws std::runtime_error if any cannot be read.
+std::vector<std::string> read_files(AsyncFileReader& reader, std::vector<std::string> const& paths,
+                                    AsyncFileReader::Priority priority = AsyncFileReader::Priority::Normal);
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef CLUSTERED_LIGHTING_HPP_
+#define CLUSTERED_LIGHTING_HPP_
+
+#include <vulkan/vulkan.hpp>
+#include <glm/glm.hpp>
+
+#include "DescriptorAllocator.hpp"
+#include "VkBuffer.hpp"
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct PointLight {
+    glm::vec3 position = glm::vec3(0.0f);
+    // Distance at which the light fades out completely
+    float radius = 1.0f;
+    glm::vec3 color = glm::vec3(1.0f);
+    float intensity = 1.0f;
+};
+
+// Clustered forward shading. Every frame the lights are uploaded to a storage buffer, and a compute pass sorts them
+// into a grid of view space clusters, so the fragment shader only has to loop over the lights of its own cluster.
+// Buffers have one slice per swapchain image, selected with dynamic offsets like the other per-frame data.
+class ClusteredLighting {
+public:
+    // Clusters along the x and y axes of the screen and along the view direction
+    static constexpr uint32_t grid_x = 16;
+    static constexpr uint32_t grid_y = 9;
+    static constexpr uint32_t grid_z = 24;
+    static constexpr uint32_t cluster_count = grid_x * grid_y * grid_z;
+    // Lights past this are dropped from a cluster
+    static constexpr uint32_t max_lights_per_cluster = 128;
+
+    ClusteredLighting(vk::PhysicalDevice physical_device, vk::Device device, vk::PipelineCache cache,
+                      std::string const& binning_spirv, uint32_t max_lights, size_t slice_count);
+    ~ClusteredLighting();
+
+    ClusteredLighting(ClusteredLighting const&) = delete;
+    ClusteredLighting& operator=(ClusteredLighting const&) = delete;
+
+    // Layout of the set used by both the binning pass and the fragment shader
+    vk::DescriptorSetLayout set_layout() const;
+    // Contents of that set, covering one slice. dynamic_offsets picks the slice when binding.
+    DescriptorSetContents descriptors();
+    std::array<uint32_t, 3> dynamic_offsets(size_t slice) const;
+
+    // Copy the camera and lights of a frame into a slice. Lights past max_lights are dropped.
+    void upload(size_t slice, glm::mat4 const& view, glm::mat4 const& projection, float near, float far,
+                vk::Extent2D extent, std::vector<PointLight> const& lights);
+
+    // Bin the lights of a slice into clusters. Has to be recorded outside of a render pass, before the draws.
+    void record_binning(vk::CommandBuffer cmd, vk::DescriptorSet set, size_t slice);
+
+    uint32_t max_lights() const;
+
+private:
+    vk::Device device;
+    uint32_t light_capacity;
+
+    Buffer lights;
+    Buffer counts;
+    Buffer indices;
+    uint8_t* lights_mapping = nullptr;
+    vk::DeviceSize lights_stride = 0;
+    vk::DeviceSize counts_stride = 0;
+    vk::DeviceSize indices_stride = 0;
+
+    vk::DescriptorSetLayout descriptor_set_layout;
+    vk::PipelineLayout pipeline_layout;
+    vk::Pipeline binning_pipeline;
+};
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef DESCRIPTOR_ALLOCATOR_HPP_
+#define DESCRIPTOR_ALLOCATOR_HPP_
+
+#include <vulkan/vulkan.hpp>
+
+#include <array>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+// Everything a descriptor set points to. Two sets with equal contents and layouts are interchangeable. The bindings
+// are stored inline, so building contents every frame does not allocate.
+class DescriptorSetContents {
+public:
+    static constexpr uint32_t max_bindings = 8;
+
+    DescriptorSetContents& buffer(uint32_t binding, vk::DescriptorType type, vk::Buffer buffer, 
+                                  vk::DeviceSize offset, vk::DeviceSize range);
+    DescriptorSetContents& image(uint32_t binding, vk::DescriptorType type, vk::Sampler sampler, 
+                                 vk::ImageView view, vk::ImageLayout layout);
+
+    uint64_t hash() const;
+    bool operator==(DescriptorSetContents const& rhs) const;
+
+private:
+    friend class DescriptorAllocator;
+
+    struct Binding {
+        uint32_t binding;
+        vk::DescriptorType type;
+        // Only one of these is used, depending on the type
+        vk::DescriptorBufferInfo buffer_info;
+        vk::DescriptorImageInfo image_info;
+    };
+
+    std::array<Binding, max_bindings> bindings;
+    uint32_t binding_count = 0;
+
+    Binding& add_binding();
+};
+
+// Hands out descriptor sets that live for one frame. Every frame in flight owns a list of pools, which grows when
+// the pools run out of space and is reset as a whole once the frame is done on the GPU. Sets with identical 
+// contents requested in the same frame are only allocated and written once.
+class DescriptorAllocator {
+public:
+    struct Stats {
+        size_t sets_allocated = 0;
+        size_t cache_hits = 0;
+        size_t descriptor_writes = 0;
+        size_t pools_created = 0;
+
+        // Print the average per frame
+        void report(std::ostream& out, size_t frames) const;
+    };
+
+    DescriptorAllocator(vk::Device device, size_t frames_in_flight);
+    ~DescriptorAllocator();
+
+    DescriptorAllocator(DescriptorAllocator const&) = delete;
+    DescriptorAllocator& operator=(DescriptorAllocator const&) = delete;
+
+    // Start allocating for a frame slot. The GPU must be done with the previous frame that used this slot, since
+    // all of its sets are freed.
+    void begin_frame(size_t frame_slot);
+
+    // Allocate an empty set for the current frame
+    vk::DescriptorSet allocate(vk::DescriptorSetLayout layout);
+    // Returns a set with the given contents, reusing one written earlier in the current frame if possible
+    vk::DescriptorSet get(vk::DescriptorSetLayout layout, DescriptorSetContents const& contents);
+
+    // Statistics since the last call
+    Stats take_stats();
+
+private:
+    struct CachedSet {
+        uint64_t key;
+        vk::DescriptorSetLayout layout;
+        DescriptorSetContents contents;
+        vk::DescriptorSet set;
+    };
+
+    struct Frame {
+        // Pools in use by this frame, sets are allocated from the last one
+        std::vector<vk::DescriptorPool> pools;
+        // Only a handful of distinct sets are used per frame, so a flat list is quicker to search than a hash map,
+        // and keeps its capacity from frame to frame
+        std::vector<CachedSet> cache;
+    };
+
+    vk::Device device;
+    std::vector<Frame> frames;
+    size_t current_frame = 0;
+    // Pools that were reset and can be handed to any frame
+    std::vector<vk::DescriptorPool> free_pools;
+    // Size of the next pool that is created, grows with every new pool
+    uint32_t sets_per_pool = 32;
+    Stats stats;
+
+    vk::DescriptorPool acquire_pool();
+};
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef DEVICE_BENCHMARK_HPP_
+#define DEVICE_BENCHMARK_HPP_
+
+#include "HeadlessContext.hpp"
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+struct DeviceBenchmarkShaders {
+    std::string fill_vert;
+    std::string fill_frag;
+    std::string compute;
+};
+
+struct DeviceBenchmarkResult {
+    // Billions of pixels written per second
+    double fill_rate = 0.0;
+    // GB per second copied from host visible to device local memory
+    double transfer_rate = 0.0;
+    // Billions of floating point operations per second
+    double compute_rate = 0.0;
+
+    // Geometric mean of the three, so no single one dominates
+    double score() const;
+};
+
+// Measure a device on its own instance and logical device. Every test is repeated with twice the work until it takes
+// long enough to be timed reliably, which keeps the whole run well under a second on real GPUs.
+DeviceBenchmarkResult benchmark_device(DeviceUuid const& device_uuid, DeviceBenchmarkShaders const& shaders);
+
+// Benchmark results by device and driver version, kept in a text file between runs
+class DeviceBenchmarkCache {
+public:
+    // Starts out empty if the file does not exist or cannot be read
+    explicit DeviceBenchmarkCache(std::string path);
+
+    std::optional<DeviceBenchmarkResult> find(DeviceUuid const& device_uuid, uint32_t driver_version) const;
+    void store(DeviceUuid const& device_uuid, uint32_t driver_version, DeviceBenchmarkResult const& result);
+
+    // Throws std::runtime_error if the file cannot be written
+    void save() const;
+
+private:
+    struct Entry {
+        DeviceUuid device_uuid;
+        uint32_t driver_version;
+        DeviceBenchmarkResult result;
+    };
+
+    std::string path;
+    std::vector<Entry> entries;
+};
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef DRAW_LIST_HPP_
+#define DRAW_LIST_HPP_
+
+#include <vulkan/vulkan.hpp>
+#include <glm/glm.hpp>
+
+#include "VertexFormat.hpp"
+
+#include <array>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+class ThreadPool;
+
+enum class RenderPassType : uint8_t {
+    Opaque = 0,
+    Transparent = 1
+};
+
+// Sort keys are laid out so that sorting them minimizes state changes, from most to least significant bits:
+//  [63..60] render pass
+//  [59..48] pipeline id
+//  [47..32] material (descriptor set) id
+//  [31..0]  depth. Front to back for opaque draws to help early z, back to front for transparent draws.
+uint64_t make_sort_key(RenderPassType pass, uint32_t pipeline_id, uint32_t material_id, float depth);
+
+// Per-draw push constants shared by every pipeline, with the same layout as the Draw block in the vertex shaders
+struct DrawConstants {
+    // Applied on top of every object matrix of the draw
+    glm::mat4 model = glm::mat4(1.0f);
+    // Address of the first vertex of the mesh when vertex pulling is used
+    vk::DeviceAddress vertices = 0;
+    VertexFormat vertex_format = VertexFormat::Standard;
+    // Index of the world matrix of the first instance in the object storage buffer
+    uint32_t first_object = 0;
+    // Entry of the texture atlas to sample
+    uint32_t texture_index = 0;
+    // Explicit, so comparing constants never reads uninitialized padding
+    uint32_t padding[3] = {};
+};
+
+static_assert(sizeof(DrawConstants) == 96, "DrawConstants does not match the push constant block in the shaders");
+
+struct DrawCommand {
+    uint64_t sort_key = 0;
+
+    vk::Pipeline pipeline;
+    vk::DescriptorSet descriptor_set;
+    // Offsets of the per-view uniform buffer and the object storage buffer
+    std::array<uint32_t, 2> dynamic_offsets = {};
+    // Left empty for vertex pulling pipelines
+    vk::Buffer vertex_buffer;
+    vk::Buffer index_buffer;
+    DrawConstants constants;
+
+    uint32_t index_count = 0;
+    uint32_t first_index = 0;
+    int32_t vertex_offset = 0;
+    uint32_t instance_count = 1;
+    uint32_t first_instance = 0;
+};
+
+struct DrawStats {
+    size_t draws = 0;
+    size_t pipeline_binds = 0;
+    size_t descriptor_binds = 0;
+    size_t vertex_buffer_binds = 0;
+    size_t index_buffer_binds = 0;
+    size_t push_constant_updates = 0;
+    // Binds skipped because the state was already bound
+    size_t binds_elided = 0;
+
+    DrawStats& operator+=(DrawStats const& rhs);
+    // Print the average per frame
+    void report(std::ostream& out, size_t frames) const;
+};
+
+class DrawList {
+public:
+    void clear();
+    void add(DrawCommand const& draw);
+    size_t size() const;
+
+    // Sort draws by key with a radix sort, spread over the worker threads for large lists
+    void sort(ThreadPool& workers);
+
+    // Record all draws in sorted order, skipping binds of state that is already bound
+    void record(vk::CommandBuffer cmd_buf, vk::PipelineLayout layout, DrawStats& stats) const;
+
+private:
+    struct SortEntry {
+        uint64_t key;
+        uint32_t index;
+    };
+
+    std::vector<DrawCommand> draws;
+    // Indices into draws, in sorted order
+    std::vector<SortEntry> order;
+    std::vector<SortEntry> scratch;
+    // One histogram per chunk of the list
+    std::vector<std::array<uint32_t, 256>> histograms;
+};
+
+#endif
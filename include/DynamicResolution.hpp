@@ -0,0 +1,108 @@
+#ifndef DYNAMIC_RESOLUTION_HPP_
+#define DYNAMIC_RESOLUTION_HPP_
+
+#include <vulkan/vulkan.hpp>
+
+#include "GpuTimer.hpp"
+#include "Multisampling.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Draws the scene into an offscreen target at a fraction of the swapchain resolution, and stretches it over the
+// swapchain image afterwards. The fraction is adjusted every frame from the GPU time of the scene work, measured with
+// timestamp queries, so the frame time stays close to a target as the load changes. The target is as large as the
+// swapchain, only its top left corner is drawn to when the scale is below 1.
+class DynamicResolution {
+public:
+    // Scale of each axis, the pixel count goes down with its square
+    static constexpr float min_scale = 0.5f;
+    static constexpr float max_scale = 1.0f;
+
+    struct Stats {
+        size_t frames = 0;
+        double scale_sum = 0.0;
+        float lowest_scale = max_scale;
+        double gpu_milliseconds_sum = 0.0;
+        size_t timed_frames = 0;
+        double target_milliseconds = 0.0;
+
+        void report(std::ostream& out) const;
+    };
+
+    struct Shaders {
+        std::string upscale_vert;
+        std::string upscale_frag;
+    };
+
+    // format and extent are those of the swapchain. The scene render pass is a create_color_render_pass with
+    // samples, so pipelines made for any such pass of the same format and sample count can draw in it. Upscaling is
+    // drawn in present_pass. Every slot has its own timestamp queries, like the other per-swapchain-image data.
+    DynamicResolution(vk::PhysicalDevice physical_device, vk::Device device, vk::PipelineCache cache,
+                      vk::Format format, vk::Extent2D extent, vk::SampleCountFlagBits samples,
+                      vk::RenderPass present_pass, Shaders const& shaders, double target_milliseconds,
+                      size_t slot_count);
+    ~DynamicResolution();
+
+    DynamicResolution(DynamicResolution const&) = delete;
+    DynamicResolution& operator=(DynamicResolution const&) = delete;
+
+    // Adjust the scale to the GPU time the slot's previous frame took. The GPU must be done with that frame.
+    void update(size_t slot);
+    // Size the scene is drawn at until the next update
+    vk::Extent2D render_extent() const;
+
+    vk::RenderPass scene_render_pass() const;
+    vk::Framebuffer scene_framebuffer() const;
+
+    // Time the scene work of the slot's frame. Has to be recorded outside of a render pass.
+    void begin_timing(vk::CommandBuffer cmd, size_t slot);
+    void end_timing(vk::CommandBuffer cmd, size_t slot);
+
+    // Stretch the render extent over the whole swapchain image. Inside a present_pass render pass, after the scene
+    // render pass ended.
+    void record_upscale(vk::CommandBuffer cmd);
+
+    // Statistics since the last call
+    Stats take_stats();
+
+private:
+    vk::Device device;
+    vk::Extent2D extent;
+    double target_ms;
+    bool timestamps_supported;
+
+    float scale = max_scale;
+    // Exponential moving average of the measured GPU time, negative until the first measurement
+    double smoothed_ms = -1.0;
+
+    vk::Image image;
+    vk::DeviceMemory image_memory;
+    vk::ImageView image_view;
+    // Drawn to and resolved into image when multisampling, null otherwise
+    std::unique_ptr<MultisampleTarget> multisample_target;
+    vk::RenderPass render_pass;
+    vk::Framebuffer framebuffer;
+
+    vk::Sampler sampler;
+    vk::DescriptorSetLayout descriptor_set_layout;
+    vk::DescriptorPool descriptor_pool;
+    vk::DescriptorSet descriptor_set;
+    vk::PipelineLayout upscale_layout;
+    vk::Pipeline upscale_pipeline;
+
+    std::vector<std::unique_ptr<GpuTimer>> timers;
+    // Whether the slot's timer holds a frame that has not been read yet
+    std::vector<bool> timed;
+
+    Stats stats;
+
+    void create_target(vk::PhysicalDevice physical_device, vk::Format format, vk::SampleCountFlagBits samples);
+    void create_upscale_pipeline(vk::PipelineCache cache, vk::RenderPass present_pass, Shaders const& shaders);
+    void adjust(double gpu_milliseconds);
+};
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef FRAME_CAPTURE_HPP_
+#define FRAME_CAPTURE_HPP_
+
+#include <glm/glm.hpp>
+
+#include "ClusteredLighting.hpp"
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// What a capture was recorded with. A replay has to draw the same scene, at the same size.
+struct CaptureHeader {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t instance_count = 0;
+    uint32_t light_count = 0;
+};
+
+// Reads only the header of a capture. Throws std::runtime_error if it cannot be read or is not a capture.
+CaptureHeader read_capture_header(std::string const& path);
+
+// Records the inputs of every drawn frame: the simulation time, the camera, and the instance transforms and lights.
+// Transforms and lights are stored as runs of elements that changed since the previous frame, so a scene that mostly
+// stands still takes little space. Everything else the renderer does follows from these, which makes a replay draw
+// exactly the same frames regardless of how fast it runs.
+class CaptureWriter {
+public:
+    // Throws std::runtime_error if the file cannot be created
+    CaptureWriter(std::string const& path, CaptureHeader const& header);
+
+    CaptureWriter(CaptureWriter const&) = delete;
+    CaptureWriter& operator=(CaptureWriter const&) = delete;
+
+    // instances and lights hold as many elements as the header says. Throws std::runtime_error on I/O errors.
+    void write_frame(float time, glm::mat4 const& view, glm::mat4 const& projection, glm::mat4 const* instances,
+                     PointLight const* lights);
+
+    size_t frame_count() const;
+
+private:
+    std::string path;
+    std::ofstream file;
+    CaptureHeader header;
+    size_t frames = 0;
+
+    // Last frame written, to find what changed
+    std::vector<glm::mat4> previous_instances;
+    std::vector<PointLight> previous_lights;
+};
+
+class CaptureReader {
+public:
+    // Throws std::runtime_error if the file cannot be read or is not a capture
+    explicit CaptureReader(std::string const& path);
+
+    CaptureReader(CaptureReader const&) = delete;
+    CaptureReader& operator=(CaptureReader const&) = delete;
+
+    CaptureHeader const& header() const;
+
+    // Read the next frame, false at the end of the capture. instances and lights hold as many elements as the header
+    // says, and the previous frame read into them, since only the changes are stored. Throws std::runtime_error if
+    // the file is truncated or malformed.
+    bool read_frame(float& time, glm::mat4& view, glm::mat4& projection, glm::mat4* instances, PointLight* lights);
+
+private:
+    std::string path;
+    std::ifstream file;
+    CaptureHeader capture_header;
+};
+
+#endif
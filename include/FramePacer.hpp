@@ -0,0 +1,54 @@
+#ifndef FRAME_PACER_HPP_
+#define FRAME_PACER_HPP_
+
+#include <chrono>
+#include <cstddef>
+#include <ostream>
+#include <vector>
+
+// Limits the frame rate and measures input latency.
+// Instead of sleeping after a frame is presented, the limiter sleeps right before input is sampled, for as long as
+// it can while still making the next frame deadline. Input is then as fresh as possible when the frame is presented.
+class FramePacer {
+public:
+    using clock = std::chrono::steady_clock;
+
+    // A limit of 0 disables the limiter, latency is still measured
+    FramePacer(double fps_limit, size_t frames_in_flight);
+
+    // Sleep until the latest point at which input can be sampled for the next frame
+    void wait_for_input_sample();
+    void input_sampled(size_t frame_slot);
+    void presented(size_t frame_slot);
+    // Called once the GPU is known to have finished the last frame submitted in frame_slot
+    void gpu_completed(size_t frame_slot);
+
+    // Print statistics every few seconds and start measuring again. Returns true if anything was printed.
+    bool report(std::ostream& out);
+
+private:
+    clock::duration frame_period = clock::duration::zero();
+    clock::time_point next_deadline;
+    // Moving average of the CPU time between sampling input and presenting
+    clock::duration work_estimate = clock::duration::zero();
+    // Extra slack so small variations in frame time do not cause missed deadlines
+    clock::duration safety_margin = std::chrono::microseconds(500);
+
+    struct FrameTimes {
+        clock::time_point input;
+        bool in_flight = false;
+    };
+    std::vector<FrameTimes> frames;
+
+    struct Stats {
+        size_t frames = 0;
+        size_t completed_frames = 0;
+        double present_latency_total = 0.0;
+        double present_latency_max = 0.0;
+        double gpu_latency_total = 0.0;
+        double gpu_latency_max = 0.0;
+        clock::time_point start = clock::now();
+    } stats;
+};
+
+#endif
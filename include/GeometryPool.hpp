@@ -0,0 +1,82 @@
+#ifndef GEOMETRY_POOL_HPP_
+#define GEOMETRY_POOL_HPP_
+
+#include <vulkan/vulkan.hpp>
+
+#include "RangeAllocator.hpp"
+#include "VkBuffer.hpp"
+
+#include <cstdint>
+#include <vector>
+
+using MeshHandle = uint32_t;
+
+// Where a mesh lives inside the pool's buffers. Indices are relative to the mesh, so they are drawn with
+// vertex_offset as the base vertex.
+struct MeshRange {
+    int32_t vertex_offset = 0;
+    uint32_t vertex_count = 0;
+    uint32_t first_index = 0;
+    uint32_t index_count = 0;
+};
+
+// Packs the geometry of many meshes into one device local vertex buffer and one index buffer, so all of them can
+// be drawn with a single vertex and index buffer bind. Every mesh in a pool shares the same vertex format.
+class GeometryPool {
+public:
+    // Pass eStorageBuffer | eShaderDeviceAddress as extra_vertex_usage to allow vertex pulling
+    GeometryPool(vk::PhysicalDevice physical_device, vk::Device device, uint32_t vertex_stride, 
+                 uint32_t vertex_capacity, uint32_t index_capacity, vk::BufferUsageFlags extra_vertex_usage = {});
+
+    GeometryPool(GeometryPool const&) = delete;
+    GeometryPool& operator=(GeometryPool const&) = delete;
+
+    // Reserve space for a mesh and queue its data for upload. Throws if the pool is out of space.
+    MeshHandle add_mesh(void const* vertex_data, uint32_t vertex_count, uint32_t const* index_data, uint32_t index_count);
+    // Release the space used by a mesh. The caller has to make sure no frame in flight still draws it.
+    void remove_mesh(MeshHandle mesh);
+
+    MeshRange const& mesh(MeshHandle mesh) const;
+
+    // Upload every mesh added since the last flush with a single submission, and wait for it to finish
+    void flush(vk::CommandPool cmd_pool, vk::Queue queue);
+    // Record the uploads of every mesh added since the last flush into cmd instead, followed by a barrier that makes
+    // them visible to the draws after it. Outside of a render pass. Returns the staging buffer, which has to live
+    // until the GPU is done with cmd.
+    Buffer record_uploads(vk::CommandBuffer cmd);
+    bool has_pending_uploads() const;
+
+    vk::Buffer vertex_buffer();
+    vk::Buffer index_buffer();
+    // Device address of the first vertex of a mesh, for vertex pulling
+    vk::DeviceAddress vertex_address(MeshHandle mesh) const;
+
+    uint32_t vertices_used() const;
+    uint32_t indices_used() const;
+
+private:
+    vk::PhysicalDevice physical_device;
+    vk::Device device;
+    uint32_t vertex_stride;
+
+    Buffer vertices;
+    Buffer indices;
+    vk::DeviceAddress vertices_address = 0;
+    RangeAllocator vertex_ranges;
+    RangeAllocator index_ranges;
+
+    // Indexed by handle. Unused slots have no indices.
+    std::vector<MeshRange> meshes;
+    std::vector<MeshHandle> free_handles;
+
+    // Data waiting for the next flush, all packed into one staging buffer
+    struct PendingUpload {
+        MeshHandle mesh;
+        vk::DeviceSize vertex_data_offset;
+        vk::DeviceSize index_data_offset;
+    };
+    std::vector<PendingUpload> pending;
+    std::vector<uint8_t> staging_data;
+};
+
+#endif
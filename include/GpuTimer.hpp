@@ -0,0 +1,36 @@
+#ifndef GPU_TIMER_HPP_
+#define GPU_TIMER_HPP_
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// Measures GPU time of ranges of commands with timestamp queries
+class GpuTimer {
+public:
+    GpuTimer(vk::PhysicalDevice physical_device, vk::Device device, uint32_t range_count);
+    ~GpuTimer();
+
+    GpuTimer(GpuTimer const&) = delete;
+    GpuTimer& operator=(GpuTimer const&) = delete;
+
+    // Has to be recorded before the first range, outside of a render pass
+    void reset(vk::CommandBuffer cmd_buf);
+    void begin(vk::CommandBuffer cmd_buf, uint32_t range);
+    void end(vk::CommandBuffer cmd_buf, uint32_t range);
+
+    // Duration of each range in milliseconds. Waits for the results if the commands are still executing.
+    std::vector<double> read_milliseconds();
+    // Same for a single range, without allocating
+    double read_milliseconds(uint32_t range);
+
+private:
+    vk::Device device;
+    vk::QueryPool query_pool;
+    uint32_t range_count;
+    // Nanoseconds per timestamp tick
+    double timestamp_period;
+};
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef HEADLESS_CONTEXT_HPP_
+#define HEADLESS_CONTEXT_HPP_
+
+#include <vulkan/vulkan.hpp>
+
+#include <array>
+#include <cstdint>
+#include <functional>
+
+using DeviceUuid = std::array<uint8_t, VK_UUID_SIZE>;
+
+// Identifies a physical device across instances. Devices older than Vulkan 1.1 fall back to the pipeline cache UUID,
+// which is the same for identical devices with the same driver.
+DeviceUuid physical_device_uuid(vk::PhysicalDevice device);
+
+// Instance, device and a queue without a window or swapchain, for benchmarks and tools that only need the GPU.
+// Prefers a discrete GPU, and picks a queue family that can do both graphics and compute.
+class HeadlessContext {
+public:
+    HeadlessContext();
+    // Use a specific device. Throws std::runtime_error if it is not there or has no graphics and compute queue.
+    explicit HeadlessContext(DeviceUuid const& device_uuid);
+    ~HeadlessContext();
+
+    HeadlessContext(HeadlessContext const&) = delete;
+    HeadlessContext& operator=(HeadlessContext const&) = delete;
+
+    vk::PhysicalDevice physical_device() const;
+    vk::Device device() const;
+    vk::Queue queue() const;
+    uint32_t queue_family() const;
+    vk::CommandPool command_pool() const;
+
+    // Record a command buffer with record, submit it and wait until it is done
+    void run(std::function<void(vk::CommandBuffer)> const& record);
+
+private:
+    vk::Instance instance;
+    vk::PhysicalDevice gpu;
+    vk::Device logical_device;
+    uint32_t family = 0;
+    vk::Queue device_queue;
+    vk::CommandPool pool;
+
+    void create_instance();
+    void create_device();
+};
+
+#endif
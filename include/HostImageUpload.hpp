@@ -0,0 +1,80 @@
+#ifndef HOST_IMAGE_UPLOAD_HPP_
+#define HOST_IMAGE_UPLOAD_HPP_
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// Ways to get texels from host memory into a sampled image
+enum class ImageUploadPath {
+    // Copy into a staging buffer, then into the image on the queue
+    Staging,
+    // VK_EXT_host_image_copy: the driver writes the image from the CPU, without a buffer or a queue submission
+    HostImageCopy,
+    // A linear tiled image in memory that is both device local and host visible, written through a mapping. Only
+    // picked on integrated GPUs, where that memory is all there is. Still needs one layout transition on the queue.
+    LinearImage
+};
+
+char const* to_string(ImageUploadPath path);
+
+// What it takes to enable VK_EXT_host_image_copy on a device. Only supported when built against headers that know
+// the extension. Has to stay alive until the device is created, the create info points into it.
+class HostImageCopyFeatures {
+public:
+    explicit HostImageCopyFeatures(vk::PhysicalDevice physical_device);
+
+    bool supported() const;
+    // Append the extensions, and chain the feature struct in front of info.pNext
+    void enable(std::vector<char const*>& extensions, vk::DeviceCreateInfo& info);
+
+private:
+    bool is_supported = false;
+    std::vector<char const*> extension_names;
+#ifdef VK_EXT_host_image_copy
+    VkPhysicalDeviceHostImageCopyFeaturesEXT features = {};
+#endif
+};
+
+// Creates 2D array textures straight from host memory where the device allows it, and tells the caller when it has
+// to go through a staging buffer instead.
+class HostImageUploader {
+public:
+    // host_image_copy_enabled says whether HostImageCopyFeatures were enabled on the device
+    HostImageUploader(vk::PhysicalDevice physical_device, vk::Device device, bool host_image_copy_enabled);
+
+    // Fastest path for a sampled image of this size
+    ImageUploadPath choose_path(vk::Format format, uint32_t width, uint32_t height, uint32_t layer_count) const;
+
+    // Create a sampled image with one layer per element of layers, each width * height * 4 bytes, through a path
+    // other than Staging. The image is in ShaderReadOnlyOptimal layout afterwards. The linear path records its
+    // layout transition into a command buffer from pool, and waits for the queue. Throws std::runtime_error if the
+    // driver fails to copy.
+    void create_image(ImageUploadPath path, vk::Format format, uint32_t width, uint32_t height,
+                      std::vector<std::vector<uint8_t>> const& layers, vk::CommandPool pool, vk::Queue queue,
+                      vk::Image& image, vk::DeviceMemory& memory) const;
+
+private:
+    vk::PhysicalDevice physical_device;
+    vk::Device device;
+    bool host_image_copy = false;
+    // Integrated GPU with a memory type that is device local and host visible
+    bool unified_memory = false;
+
+#ifdef VK_EXT_host_image_copy
+    PFN_vkCopyMemoryToImageEXT copy_memory_to_image = nullptr;
+    PFN_vkTransitionImageLayoutEXT transition_image_layout = nullptr;
+#endif
+
+    bool host_image_copy_supports(vk::Format format, uint32_t width, uint32_t height, uint32_t layer_count) const;
+    bool linear_image_supports(vk::Format format, uint32_t width, uint32_t height, uint32_t layer_count) const;
+    void copy_with_host_image_copy(vk::Format format, uint32_t width, uint32_t height,
+                                   std::vector<std::vector<uint8_t>> const& layers, vk::Image& image,
+                                   vk::DeviceMemory& memory) const;
+    void write_linear_image(vk::Format format, uint32_t width, uint32_t height,
+                            std::vector<std::vector<uint8_t>> const& layers, vk::CommandPool pool, vk::Queue queue,
+                            vk::Image& image, vk::DeviceMemory& memory) const;
+};
+
+#endif
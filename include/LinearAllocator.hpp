@@ -0,0 +1,71 @@
+#ifndef LINEAR_ALLOCATOR_HPP_
+#define LINEAR_ALLOCATOR_HPP_
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Bump allocator for host memory that only lives for one frame. Allocating is a pointer increment, and everything is
+// freed at once by reset. The renderer keeps one per frame in flight and resets it once the GPU is done with the
+// frame, so temporary lists built while recording never touch the heap in steady state.
+class LinearAllocator {
+public:
+    explicit LinearAllocator(size_t capacity);
+
+    LinearAllocator(LinearAllocator const&) = delete;
+    LinearAllocator& operator=(LinearAllocator const&) = delete;
+
+    // Never fails for lack of capacity. What does not fit comes from the heap until the next reset.
+    void* allocate(size_t size, size_t alignment);
+    // Free everything. If the allocations since the last reset did not fit, the buffer grows so they will next time.
+    void reset();
+
+    size_t capacity() const;
+    // Bytes handed out since the last reset, including what went to the heap
+    size_t used() const;
+
+private:
+    std::unique_ptr<std::byte[]> buffer;
+    size_t buffer_size;
+    size_t offset = 0;
+    // Allocations that did not fit in the buffer
+    std::vector<std::unique_ptr<std::byte[]>> overflow;
+    size_t overflow_size = 0;
+};
+
+// Lets standard containers allocate from a LinearAllocator. Deallocating does nothing, the memory is reclaimed when
+// the allocator is reset, so containers using it must not outlive the frame.
+template <typename T>
+class LinearStlAllocator {
+public:
+    using value_type = T;
+
+    LinearStlAllocator(LinearAllocator& arena) noexcept : arena(&arena) {}
+    template <typename U>
+    LinearStlAllocator(LinearStlAllocator<U> const& other) noexcept : arena(other.arena) {}
+
+    T* allocate(size_t count) {
+        return static_cast<T*>(arena->allocate(count * sizeof(T), alignof(T)));
+    }
+    void deallocate(T*, size_t) noexcept {}
+
+    template <typename U>
+    bool operator==(LinearStlAllocator<U> const& rhs) const noexcept {
+        return arena == rhs.arena;
+    }
+    template <typename U>
+    bool operator!=(LinearStlAllocator<U> const& rhs) const noexcept {
+        return arena != rhs.arena;
+    }
+
+private:
+    template <typename U>
+    friend class LinearStlAllocator;
+
+    LinearAllocator* arena;
+};
+
+template <typename T>
+using LinearVector = std::vector<T, LinearStlAllocator<T>>;
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef MEMORY_BUDGET_HPP_
+#define MEMORY_BUDGET_HPP_
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <vector>
+
+// Usage and budget of every memory heap. With VK_EXT_memory_budget both come from the driver, which also accounts
+// for other processes. Without it, usage is what was allocated through allocate_device_memory, and the budget is a
+// fixed share of the heap.
+class MemoryBudget {
+public:
+    struct Heap {
+        vk::DeviceSize size = 0;
+        vk::DeviceSize budget = 0;
+        vk::DeviceSize usage = 0;
+        bool device_local = false;
+    };
+
+    // extension_enabled must only be set if VK_EXT_memory_budget was enabled on the device
+    MemoryBudget(vk::PhysicalDevice physical_device, bool extension_enabled);
+
+    // Current values, cheap enough to query every frame
+    std::vector<Heap> query() const;
+    // Sum of all device local heaps
+    Heap device_local() const;
+
+    void report(std::ostream& out) const;
+
+private:
+    vk::PhysicalDevice physical_device;
+    bool extension_enabled;
+};
+
+// Allocates device memory and counts it against its heap. All device memory should be allocated through here, so
+// the fallback budget sees it. If the allocation fails for lack of memory, the pressure handler gets one chance to
+// free some before the error is thrown.
+vk::DeviceMemory allocate_device_memory(vk::PhysicalDevice physical_device, vk::Device device,
+                                        vk::MemoryAllocateInfo const& info);
+void free_device_memory(vk::Device device, vk::DeviceMemory memory);
+
+// Bytes currently allocated from a heap through allocate_device_memory
+vk::DeviceSize allocated_device_memory(uint32_t heap);
+
+// Called with the heap and size of a failed allocation. Returns true if memory was freed and the allocation should be
+// retried. Pass an empty function to remove the handler.
+void set_memory_pressure_handler(std::function<bool(uint32_t heap, vk::DeviceSize size)> handler);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef MULTISAMPLING_HPP_
+#define MULTISAMPLING_HPP_
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+#include <ostream>
+
+// Highest sample count of at most requested that color attachments of the device support
+vk::SampleCountFlagBits choose_sample_count(vk::PhysicalDevice physical_device, uint32_t requested);
+
+// Multisampled color attachment that only exists within a render pass: cleared on load, resolved into a single
+// sample image at the end of the subpass and never stored. On tile based GPUs the samples then never leave tile
+// memory. Where the device has lazily allocated memory the image is backed by it, and the driver may never commit
+// any memory to it at all.
+class MultisampleTarget {
+public:
+    MultisampleTarget(vk::PhysicalDevice physical_device, vk::Device device, vk::Format format, vk::Extent2D extent,
+                      vk::SampleCountFlagBits samples);
+    ~MultisampleTarget();
+
+    MultisampleTarget(MultisampleTarget const&) = delete;
+    MultisampleTarget& operator=(MultisampleTarget const&) = delete;
+
+    vk::ImageView view() const;
+    vk::SampleCountFlagBits samples() const;
+    bool lazily_allocated() const;
+    // Memory the image asked for
+    vk::DeviceSize size() const;
+    // Memory the driver actually backs the image with, only lazily allocated memory can have less than size()
+    vk::DeviceSize committed_size() const;
+
+private:
+    vk::Device device;
+    vk::SampleCountFlagBits sample_count;
+    bool lazy = false;
+    vk::DeviceSize memory_size = 0;
+
+    vk::Image image;
+    vk::DeviceMemory memory;
+    vk::ImageView image_view;
+};
+
+// Render pass with a single subpass drawing into one color attachment of the given format. With more than one
+// sample, attachment 0 is a MultisampleTarget and attachment 1 the single sample image it is resolved into, which is
+// overwritten in full and so never loaded. The single sample image ends up in final_layout.
+vk::RenderPass create_color_render_pass(vk::Device device, vk::Format format, vk::SampleCountFlagBits samples,
+                                        vk::ImageLayout final_layout,
+                                        vk::ArrayProxy<vk::SubpassDependency const> dependencies);
+
+// Print what every sample count the device supports costs for a color target of this format and extent: memory of
+// the multisampled image, and estimated external memory traffic per frame when the samples are resolved on chip,
+// compared to storing them and resolving afterwards
+void report_multisampling(std::ostream& out, vk::PhysicalDevice physical_device, vk::Device device,
+                          vk::Format format, vk::Extent2D extent);
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef PARTICLE_SYSTEM_HPP_
+#define PARTICLE_SYSTEM_HPP_
+
+#include <vulkan/vulkan.hpp>
+#include <glm/glm.hpp>
+
+#include "VkBuffer.hpp"
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+// Where and how particles are spawned
+struct ParticleEmitter {
+    glm::vec3 position = glm::vec3(0.0f);
+    glm::vec3 velocity = glm::vec3(0.0f, 0.0f, 2.0f);
+    // Random extra velocity in every direction, up to this much along each axis
+    float spread = 0.5f;
+    // Average life in seconds, each particle lives between half and one and a half times this
+    float lifetime = 2.0f;
+    glm::vec4 color = glm::vec4(1.0f, 0.6f, 0.2f, 0.8f);
+};
+
+// Particles that live entirely on the GPU. Emission, simulation and compaction of the alive list are compute passes
+// working on storage buffers, and the particle count only ever exists on the GPU: a tiny pass turns it into the
+// arguments of an indirect dispatch and an indirect draw. For alpha blending, alive particles are sorted back to
+// front with a bitonic sort before drawing.
+class ParticleSystem {
+public:
+    struct Shaders {
+        std::string emit;
+        std::string counters;
+        std::string simulate;
+        std::string sort_keys;
+        std::string sort;
+    };
+
+    // Capacity is rounded up to a power of two for the sort. Starts out without particles.
+    ParticleSystem(vk::PhysicalDevice physical_device, vk::Device device, vk::PipelineCache cache,
+                   Shaders const& shaders, uint32_t capacity, vk::CommandPool cmd_pool, vk::Queue queue);
+    ~ParticleSystem();
+
+    ParticleSystem(ParticleSystem const&) = delete;
+    ParticleSystem& operator=(ParticleSystem const&) = delete;
+
+    // Only needed to draw, simulating works without it. Viewport and scissor are dynamic state.
+    void create_render_pipeline(vk::RenderPass render_pass, vk::SampleCountFlagBits samples,
+                                std::string const& vert_spirv, std::string const& frag_spirv);
+
+    // Spawn up to emit_count particles and advance every particle by dt seconds. Outside of a render pass.
+    void record_simulation(vk::CommandBuffer cmd, float dt, uint32_t emit_count, ParticleEmitter const& emitter);
+    // Sort the alive particles back to front. Outside of a render pass, after record_simulation.
+    void record_sort(vk::CommandBuffer cmd, glm::mat4 const& view);
+    // Draw the sorted particles, inside a render pass compatible with the one the render pipeline was made for
+    void record_draw(vk::CommandBuffer cmd, glm::mat4 const& view, glm::mat4 const& projection, float size);
+
+    uint32_t capacity() const;
+
+private:
+    vk::Device device;
+    vk::PipelineCache cache;
+    uint32_t particle_capacity;
+    // Alive list the next simulation step reads from
+    uint32_t current = 0;
+    uint32_t seed = 0;
+
+    Buffer particles;
+    Buffer dead_list;
+    Buffer alive_lists;
+    Buffer counters;
+    Buffer sort_entries;
+
+    vk::DescriptorSetLayout descriptor_set_layout;
+    vk::DescriptorPool descriptor_pool;
+    vk::DescriptorSet descriptor_set;
+
+    vk::PipelineLayout compute_layout;
+    vk::Pipeline emit_pipeline;
+    vk::Pipeline counters_pipeline;
+    vk::Pipeline simulate_pipeline;
+    vk::Pipeline sort_keys_pipeline;
+    vk::Pipeline sort_pipeline;
+
+    vk::PipelineLayout render_layout;
+    vk::Pipeline render_pipeline;
+
+    vk::Pipeline create_compute_pipeline(std::string const& spirv);
+};
+
+// Simulates and sorts up to particle_count particles without a window, and reports the GPU time per million
+void benchmark_particles(ParticleSystem::Shaders const& shaders, size_t particle_count);
+
+#endif
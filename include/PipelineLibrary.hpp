@@ -0,0 +1,142 @@
+#ifndef PIPELINE_LIBRARY_HPP_
+#define PIPELINE_LIBRARY_HPP_
+
+#include <vulkan/vulkan.hpp>
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class ThreadPool;
+
+enum class BlendMode : uint8_t {
+    Opaque,
+    Alpha,
+    Additive
+};
+
+// Bits of PipelineKey::shader_features. Bit i is passed to the shaders as boolean specialization constant i.
+enum ShaderFeature : uint32_t {
+    shader_feature_vertex_color = 1 << 0,
+    shader_feature_alpha_cutout = 1 << 1,
+    // Shade with point lights, looping over all of them
+    shader_feature_lighting = 1 << 2,
+    // Together with lighting, only loop over the lights of the fragment's cluster
+    shader_feature_clustered_lights = 1 << 3,
+    // Sample the virtual texture instead of the atlas, see VirtualTexture
+    shader_feature_virtual_texture = 1 << 4
+};
+
+constexpr uint32_t shader_feature_count = 5;
+
+// Describes one permutation of the graphics pipeline
+struct PipelineKey {
+    vk::CullModeFlagBits cull_mode = vk::CullModeFlagBits::eBack;
+    vk::PolygonMode polygon_mode = vk::PolygonMode::eFill;
+    vk::PrimitiveTopology topology = vk::PrimitiveTopology::eTriangleList;
+    BlendMode blend_mode = BlendMode::Opaque;
+    // Index into the vertex layouts the library was created with
+    uint8_t vertex_layout = 0;
+    uint32_t shader_features = 0;
+
+    // All of the above packed into 64 bits, used for hashing and comparing keys
+    uint64_t pack() const;
+
+    // Key of the pipeline to use while this one is being compiled. Only state that has to match for a draw to be
+    // valid (vertex layout and topology) is kept.
+    PipelineKey generic() const;
+};
+
+struct VertexInputLayout {
+    std::vector<vk::VertexInputBindingDescription> bindings;
+    std::vector<vk::VertexInputAttributeDescription> attributes;
+    // Vertices are read by the vertex pulling shader, the bindings above only describe instance data
+    bool vertex_pulling = false;
+};
+
+// Owns every permutation of the graphics pipeline. Missing permutations are compiled on worker threads, and a 
+// generic pipeline is handed out in the meantime, so asking for a pipeline never stalls the frame. Generic pipelines
+// are compiled up front with prewarm.
+class PipelineLibrary {
+public:
+    struct Shaders {
+        std::string vert_spirv;
+        std::string frag_spirv;
+        // Vertex shader for layouts that use vertex pulling, may be left empty if there are none
+        std::string pull_vert_spirv;
+    };
+
+    // State shared by all permutations
+    struct CreateInfo {
+        vk::Device device;
+        vk::PipelineCache cache;
+        vk::PipelineLayout layout;
+        vk::RenderPass render_pass;
+        vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1;
+        std::vector<VertexInputLayout> vertex_layouts;
+    };
+
+    PipelineLibrary(CreateInfo info, Shaders shaders, ThreadPool& workers);
+    ~PipelineLibrary();
+
+    PipelineLibrary(PipelineLibrary const&) = delete;
+    PipelineLibrary& operator=(PipelineLibrary const&) = delete;
+
+    // Compile the generic pipeline for key on the calling thread, and start compiling key in the background. For
+    // startup, so that get has a fallback for every key it is asked for later.
+    void prewarm(PipelineKey const& key);
+    // Returns the pipeline for key if it is compiled. Otherwise compilation is started in the background and the
+    // generic pipeline for key is returned. Never waits for a compile: if the generic pipeline is not done either,
+    // because key was not prewarmed, it returns a null handle and the caller skips the draw.
+    vk::Pipeline get(PipelineKey const& key);
+    // Returns the pipeline for key, compiling it on the calling thread if needed. For benchmarks and tools that
+    // can afford to wait.
+    vk::Pipeline get_compiled(PipelineKey const& key);
+
+    // Recompile every known permutation with new shaders in the background. Until a permutation is done, the old
+    // version is returned. Shaders left empty keep their current code.
+    void reload_shaders(Shaders shaders);
+
+    // Pipelines replaced by a reload. The caller is responsible for destroying them once the GPU is done with them.
+    std::vector<vk::Pipeline> take_retired();
+
+private:
+    struct Entry {
+        PipelineKey key;
+        vk::Pipeline pipeline;
+        // Version of the shaders the pipeline was built with
+        uint64_t generation = 0;
+    };
+
+    CreateInfo info;
+    ThreadPool& workers;
+
+    std::shared_mutex mutex;
+    std::unordered_map<uint64_t, Entry> pipelines;
+    std::shared_ptr<Shaders const> shaders;
+    uint64_t generation = 0;
+    std::vector<vk::Pipeline> retired;
+
+    // Compile jobs still running, the destructor has to wait for these
+    std::mutex jobs_mutex;
+    std::condition_variable jobs_cv;
+    size_t jobs_in_flight = 0;
+
+    vk::Pipeline get_blocking(PipelineKey const& key);
+    // Returns the pipeline for key if it is compiled, and starts compiling it if it is not known yet. Caller must
+    // hold the lock on mutex.
+    vk::Pipeline request(PipelineKey const& key);
+    // Caller must hold the lock on mutex
+    void queue_compile(PipelineKey const& key, std::shared_ptr<Shaders const> shaders, uint64_t generation);
+    // Store a compiled pipeline unless an equally new or newer one is already there, in which case the new one is 
+    // destroyed. Returns the pipeline that ends up in the library.
+    vk::Pipeline store(PipelineKey const& key, vk::Pipeline pipeline, uint64_t generation);
+    vk::Pipeline build(PipelineKey const& key, Shaders const& shaders) const;
+};
+
+#endif
@@ -0,0 +1,131 @@
+#ifndef PROFILER_HPP_
+#define PROFILER_HPP_
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// CPU and GPU zones on one timeline, exported as Chrome trace JSON (chrome://tracing or ui.perfetto.dev).
+// CPU zones are recorded into a lock-free ring buffer per thread, which the frame loop drains with profiler_collect.
+// GPU zones are timed with timestamp queries and converted to the CPU clock. Zones only record anything while a
+// capture is running. Without VK_PLAYGROUND_PROFILER the zone macros compile to nothing.
+#ifdef VK_PLAYGROUND_PROFILER
+constexpr bool profiler_compiled = true;
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profile_zone_, __LINE__)(name)
+#define PROFILE_GPU_ZONE(profiler, cmd, name) GpuZone PROFILE_CONCAT(gpu_zone_, __LINE__)(profiler, cmd, name)
+#else
+constexpr bool profiler_compiled = false;
+#define PROFILE_ZONE(name) ((void)0)
+#define PROFILE_GPU_ZONE(profiler, cmd, name) ((void)0)
+#endif
+
+class ProfileTrack;
+
+// Nanoseconds on the clock every event is recorded with
+int64_t profiler_now();
+
+// Names the calling thread's track in the trace
+void profiler_set_thread_name(std::string name);
+// A track for events that do not happen on a CPU thread. Only one thread may record into it.
+ProfileTrack* profiler_add_track(std::string name);
+// Record a finished zone. Zone names have to outlive the capture, string literals are best.
+void profiler_record(ProfileTrack* track, char const* name, int64_t start, int64_t end);
+
+void profiler_start_capture();
+void profiler_stop_capture();
+bool profiler_capturing();
+// Move the events recorded so far out of the ring buffers. Has to be called often enough that they do not overflow,
+// once per frame is plenty, and only from one thread.
+void profiler_collect();
+// Write everything collected since the capture started and clear it. Throws std::runtime_error on I/O errors.
+void profiler_write_chrome_trace(std::string const& path);
+
+// Records the time from construction to destruction on the calling thread's track
+class ProfileZone {
+public:
+    explicit ProfileZone(char const* name);
+    ~ProfileZone();
+
+    ProfileZone(ProfileZone const&) = delete;
+    ProfileZone& operator=(ProfileZone const&) = delete;
+
+private:
+    char const* name;
+    // Negative if no capture was running when the zone started
+    int64_t start;
+};
+
+// Times zones of command buffers with timestamp queries, and labels them with debug utils labels so they also show
+// up in graphics debuggers. Every slot has its own queries, like the other per-swapchain-image data.
+class GpuProfiler {
+public:
+    // Zones per slot, past this they are only labelled
+    static constexpr uint32_t max_zones = 64;
+
+    // Labels are emitted if dispatcher is not null. Measures the offset between the GPU and CPU clocks by
+    // submitting a timestamp to queue.
+    GpuProfiler(vk::PhysicalDevice physical_device, vk::Device device, uint32_t queue_family, size_t slot_count,
+                vk::DispatchLoaderDynamic const* dispatcher, vk::CommandPool cmd_pool, vk::Queue queue);
+    ~GpuProfiler();
+
+    GpuProfiler(GpuProfiler const&) = delete;
+    GpuProfiler& operator=(GpuProfiler const&) = delete;
+
+    // Collect the zones recorded the last time the slot was used and start recording new ones. The GPU must be done
+    // with the slot. Has to be recorded first, outside of a render pass.
+    void begin_frame(vk::CommandBuffer cmd, size_t slot);
+    // Collect the zones of every slot, for the end of a capture. The GPU must be done with all of them.
+    void collect();
+    void begin_zone(vk::CommandBuffer cmd, char const* name);
+    void end_zone(vk::CommandBuffer cmd);
+
+private:
+    struct Zone {
+        char const* name;
+        uint32_t query;
+    };
+
+    struct Slot {
+        vk::QueryPool query_pool;
+        std::vector<Zone> zones;
+    };
+
+    vk::Device device;
+    vk::DispatchLoaderDynamic const* dispatcher;
+    bool timestamps_supported = false;
+    // Nanoseconds per timestamp tick
+    double timestamp_period = 1.0;
+    uint64_t timestamp_mask = ~uint64_t(0);
+    // Added to GPU nanoseconds to get profiler_now time
+    int64_t clock_offset = 0;
+    ProfileTrack* track = nullptr;
+
+    std::vector<Slot> slots;
+    Slot* current = nullptr;
+    // Zones begun but not ended yet, -1 for zones without queries
+    std::vector<int32_t> open_zones;
+
+    // Hand the zones the slot recorded to the profiler and forget them
+    void read_back(Slot& slot);
+    int64_t to_cpu_time(uint64_t timestamp) const;
+};
+
+// Times a GPU zone from construction to destruction. Does nothing without a profiler.
+class GpuZone {
+public:
+    GpuZone(GpuProfiler* profiler, vk::CommandBuffer cmd, char const* name);
+    ~GpuZone();
+
+    GpuZone(GpuZone const&) = delete;
+    GpuZone& operator=(GpuZone const&) = delete;
+
+private:
+    GpuProfiler* profiler;
+    vk::CommandBuffer cmd;
+};
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef RANGE_ALLOCATOR_HPP_
+#define RANGE_ALLOCATOR_HPP_
+
+#include <cstdint>
+#include <map>
+#include <optional>
+
+// Hands out ranges of [0, capacity) in arbitrary units. Freed ranges are merged with free neighbours, so
+// streaming ranges in and out does not slowly fragment the space.
+class RangeAllocator {
+public:
+    explicit RangeAllocator(uint64_t capacity);
+
+    // Returns the offset of the range, or nothing if no free range is large enough
+    std::optional<uint64_t> allocate(uint64_t size);
+    void free(uint64_t offset, uint64_t size);
+
+    uint64_t capacity() const;
+    uint64_t used() const;
+    uint64_t largest_free_range() const;
+
+private:
+    uint64_t total;
+    uint64_t in_use = 0;
+    // Offset -> size of every free range
+    std::map<uint64_t, uint64_t> free_ranges;
+};
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef RESIDENCY_MANAGER_HPP_
+#define RESIDENCY_MANAGER_HPP_
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <vector>
+
+using ResourceId = uint32_t;
+
+// Keeps a set of resources within a memory budget. Every resource has a list of detail levels, like mips of a
+// texture or LODs of a mesh, ordered from full detail down. A level of size 0 means the resource is evicted.
+// When over budget, the least recently used resources are demoted first. Resources that were used in the current
+// frame are streamed back in one level per update while there is room. Uses are timeline values of the queue the
+// resources are used on, one per frame.
+class ResidencyManager {
+public:
+    // Moves a resource to another level. The owner streams the new level in, and destroys the old one once the
+    // timeline reaches last_used.
+    using SetLevel = std::function<void(uint32_t level, uint64_t last_used)>;
+
+    struct Stats {
+        size_t promotions = 0;
+        size_t demotions = 0;
+        size_t evictions = 0;
+        vk::DeviceSize bytes_streamed = 0;
+
+        void report(std::ostream& out, char const* name) const;
+    };
+
+    ResidencyManager() = default;
+
+    ResidencyManager(ResidencyManager const&) = delete;
+    ResidencyManager& operator=(ResidencyManager const&) = delete;
+
+    // The resource has to be at initial_level already, set_level is only called for later changes
+    ResourceId add(std::vector<vk::DeviceSize> level_sizes, uint32_t initial_level, SetLevel set_level);
+
+    // Mark a resource as used by the frame that signals value
+    void touch(ResourceId resource, uint64_t value);
+
+    uint32_t level(ResourceId resource) const;
+    // Total size of the current level of every resource
+    vk::DeviceSize resident_size() const;
+
+    // Call once per frame with the value of the frame, after every resource used in the frame was touched. Demotes
+    // resources if the resident size is over budget, or promotes the ones used in this frame if there is enough room
+    // left.
+    void update(uint64_t value, vk::DeviceSize budget);
+
+    // For allocation failures: evict resources last used by work up to submitted, least recently used first, until
+    // at least size bytes were freed. Returns the amount freed. Resources the work being recorded uses are kept,
+    // nothing could wait for it. Once the owner waited for the evicted levels to be unused and destroyed them, their
+    // memory is free.
+    vk::DeviceSize evict_unused(uint64_t submitted, vk::DeviceSize size);
+
+    // Statistics since the last call
+    Stats take_stats();
+
+private:
+    struct Resource {
+        std::vector<vk::DeviceSize> level_sizes;
+        uint32_t level = 0;
+        uint64_t last_used = 0;
+        SetLevel set_level;
+    };
+
+    std::vector<Resource> resources;
+    vk::DeviceSize resident = 0;
+    // Set while levels are changed, so an allocation failure inside a SetLevel callback can't recurse into here
+    bool changing_levels = false;
+    Stats stats;
+
+    // Least recently used first
+    std::vector<ResourceId> lru_order() const;
+    void change_level(Resource& resource, uint32_t level);
+};
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef SCENE_HPP_
+#define SCENE_HPP_
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// Transform hierarchy stored as structure-of-arrays, so batches of nodes can be processed with SIMD.
+// Nodes can only be parented to nodes that already exist, which guarantees that a parent always has a lower
+// index than its children. A single forward pass over the arrays is then enough to update the whole hierarchy.
+class Scene {
+public:
+    static constexpr uint32_t no_parent = UINT32_MAX;
+
+    void reserve(size_t count);
+    size_t size() const;
+
+    uint32_t add_node(uint32_t parent, glm::vec3 const& position, glm::quat const& rotation, glm::vec3 const& scale);
+
+    void set_position(uint32_t node, glm::vec3 const& position);
+    void set_rotation(uint32_t node, glm::quat const& rotation);
+    void set_scale(uint32_t node, glm::vec3 const& scale);
+
+    // Recompute the world matrix of every dirty node, and every node below a dirty node.
+    // Returns the amount of nodes that were updated.
+    size_t update_transforms();
+
+    // Copy all world matrices to dest using non-temporal stores. dest is meant to be mapped (write-combined)
+    // GPU memory, which we never want to pull into the cache.
+    void write_instances(glm::mat4* dest) const;
+
+    // Copy all world matrices to dest using regular stores
+    void copy_instances(glm::mat4* dest) const;
+
+    glm::mat4 const* world_matrices() const;
+
+private:
+    std::vector<float> pos_x, pos_y, pos_z;
+    std::vector<float> rot_x, rot_y, rot_z, rot_w;
+    std::vector<float> scale_x, scale_y, scale_z;
+    std::vector<uint32_t> parents;
+    std::vector<uint8_t> dirty;
+
+    std::vector<glm::mat4> local;
+    std::vector<glm::mat4> world;
+
+    // Scratch list of nodes to update, kept around to avoid reallocating it every frame
+    std::vector<uint32_t> dirty_nodes;
+
+    void compute_local_matrices();
+    void compute_world_matrices();
+};
+
+// Copy count matrices to dest with non-temporal stores, for writing to mapped (write-combined) GPU memory
+void stream_matrices(glm::mat4* dest, glm::mat4 const* src, size_t count);
+
+// Compares the SoA/SIMD update against computing every matrix with glm, one object at a time.
+void benchmark_scene_transforms(size_t node_count);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef SHADER_HOT_RELOAD_HPP_
+#define SHADER_HOT_RELOAD_HPP_
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Watches the GLSL sources of the graphics pipeline and recompiles them to SPIR-V on a background thread whenever
+// they change.
+class ShaderHotReload {
+public:
+    struct ShaderFile {
+        std::string glsl_path;
+        std::string spirv_path;
+        // Passed to the compiler as well, for example defines picking a variant
+        std::string options;
+    };
+
+    // Called on the background thread with the SPIR-V of every watched file, in the order they were passed, after a
+    // successful recompile. Must be safe to call concurrently with rendering.
+    using ShadersChanged = std::function<void(std::vector<std::string> spirv)>;
+
+    ShaderHotReload(std::vector<ShaderFile> files, ShadersChanged on_change);
+    ~ShaderHotReload();
+
+    ShaderHotReload(ShaderHotReload const&) = delete;
+    ShaderHotReload& operator=(ShaderHotReload const&) = delete;
+
+private:
+    std::vector<ShaderFile> files;
+    ShadersChanged on_change;
+
+    std::thread thread;
+    std::atomic<bool> running = true;
+
+    void watch_loop();
+    bool compile(ShaderFile const& shader);
+};
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef SKINNING_HPP_
+#define SKINNING_HPP_
+
+#include <vulkan/vulkan.hpp>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "VkBuffer.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class ThreadPool;
+
+// Up to four joints moving a vertex. Kept in a vertex stream of its own, next to the regular vertices.
+struct SkinWeights {
+    // One joint index per byte
+    uint32_t joints;
+    // Matching weights as unorm8, adding up to 255
+    uint32_t weights;
+};
+
+// Normalizes the weights, and rounds them so they still add up to exactly one
+SkinWeights make_skin_weights(glm::uvec4 const& joints, glm::vec4 const& weights);
+
+// A joint hierarchy with one looping animation clip of keyed joint rotations. Like Scene, everything is stored as
+// structure-of-arrays and parents always come before their children, so a pose is evaluated four joints at a time
+// and the hierarchy in a single forward pass.
+class SkeletalAnimation {
+public:
+    static constexpr uint32_t no_parent = UINT32_MAX;
+    // SkinWeights stores joint indices in a byte
+    static constexpr size_t max_joints = 256;
+
+    // position is relative to the parent. Joints are unrotated in the bind pose.
+    uint32_t add_joint(uint32_t parent, glm::vec3 const& position);
+    size_t joint_count() const;
+
+    // Start a new clip of key_count evenly spaced keys over duration seconds, with every joint unrotated. Joints
+    // have to be added first.
+    void set_clip(size_t key_count, float duration);
+    void set_rotation(size_t key, uint32_t joint, glm::quat const& rotation);
+    float duration() const;
+
+    // Sample the clip at time, wrapping around, and write one skinning matrix per joint to palette. A skinning
+    // matrix takes a bind pose vertex to where its joint moved it. scratch needs room for joint_count() matrices.
+    void evaluate(float time, glm::mat4* scratch, glm::mat4* palette) const;
+
+private:
+    std::vector<uint32_t> parents;
+    std::vector<float> pos_x, pos_y, pos_z;
+    std::vector<glm::mat4> inverse_bind;
+
+    size_t key_count = 0;
+    float clip_duration = 0.0f;
+    // Rotation of every joint in every key, joint_count() entries per key
+    std::vector<float> rot_x, rot_y, rot_z, rot_w;
+};
+
+// Characters sharing one skinned mesh and animation, each at its own point in the clip. Their poses are evaluated on
+// the CPU into joint palettes, and a compute pass skins the vertices of every character once per frame into an
+// output buffer with the layout of the bind pose vertices. Every pass drawing the characters reads that buffer like
+// a regular vertex buffer, so skinning costs the same no matter how many passes draw them.
+class SkinnedCharacters {
+public:
+    struct Mesh {
+        // Bind pose in the layout of VertexFormat::Standard
+        void const* vertices = nullptr;
+        SkinWeights const* weights = nullptr;
+        uint32_t vertex_count = 0;
+        uint32_t const* indices = nullptr;
+        uint32_t index_count = 0;
+    };
+
+    // There is a palette and a part of the output buffer for each of slot_count slots, so a frame can skin into one
+    // slot while the GPU still draws another. Pass eShaderDeviceAddress as extra_output_usage for vertex pulling.
+    SkinnedCharacters(vk::PhysicalDevice physical_device, vk::Device device, vk::PipelineCache cache,
+                      std::string const& spirv, Mesh const& mesh, SkeletalAnimation animation,
+                      uint32_t character_count, uint32_t slot_count, vk::BufferUsageFlags extra_output_usage,
+                      vk::CommandPool cmd_pool, vk::Queue queue);
+    ~SkinnedCharacters();
+
+    SkinnedCharacters(SkinnedCharacters const&) = delete;
+    SkinnedCharacters& operator=(SkinnedCharacters const&) = delete;
+
+    // Evaluate the pose of every character at time into the palettes of a slot the GPU is done with
+    void update_palettes(uint32_t slot, float time, ThreadPool& workers);
+    // Skin every character into its part of the slot's output, and make it visible to vertex input and vertex
+    // shaders. Outside of a render pass, before any pass drawing the characters.
+    void record_skinning(vk::CommandBuffer cmd, uint32_t slot);
+
+    uint32_t character_count() const;
+    vk::Buffer output_buffer();
+    vk::Buffer index_buffer();
+    uint32_t index_count() const;
+    // Base vertex of a character's skinned vertices in the output buffer
+    int32_t vertex_offset(uint32_t slot, uint32_t character) const;
+    // Address of a character's first skinned vertex, for vertex pulling
+    vk::DeviceAddress vertex_address(uint32_t slot, uint32_t character) const;
+
+private:
+    vk::Device device;
+    SkeletalAnimation animation;
+    uint32_t characters;
+    uint32_t slots;
+    uint32_t vertex_count;
+    uint32_t indices;
+
+    Buffer bind_vertices;
+    Buffer weights;
+    Buffer index_data;
+    Buffer palettes;
+    Buffer output;
+    glm::mat4* palette_mapping = nullptr;
+    vk::DeviceAddress output_address = 0;
+
+    // Two matrices per joint for every chunk palettes are evaluated in
+    std::vector<glm::mat4> scratch;
+
+    vk::DescriptorSetLayout descriptor_set_layout;
+    vk::DescriptorPool descriptor_pool;
+    vk::DescriptorSet descriptor_set;
+    vk::PipelineLayout pipeline_layout;
+    vk::Pipeline pipeline;
+
+    void evaluate_characters(uint32_t slot, float time, size_t chunk, size_t begin, size_t end);
+};
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef TEXTURE_PACKER_HPP_
+#define TEXTURE_PACKER_HPP_
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+// An RGBA8 image, rows tightly packed
+struct TextureImage {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<uint8_t> pixels;
+};
+
+// Where a texture ended up in an atlas
+struct AtlasEntry {
+    // Array layer holding the texture
+    uint32_t layer = 0;
+    // Texels of the texture itself, without its padding
+    uint32_t x = 0;
+    uint32_t y = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    // Offset in xy and scale in zw: the texture's own coordinates map into the layer as uv * scale + offset
+    std::array<float, 4> uv_rect = {};
+};
+
+struct AtlasLayout {
+    // Width and height of every layer, a power of two
+    uint32_t page_size = 0;
+    uint32_t layer_count = 0;
+    // Texels of repeated edge around every texture
+    uint32_t padding = 0;
+    // In the order the textures were passed in
+    std::vector<AtlasEntry> entries;
+};
+
+struct Atlas {
+    AtlasLayout layout;
+    // One RGBA8 image of page_size x page_size per layer
+    std::vector<std::vector<uint8_t>> layers;
+};
+
+// Packs rectangles into a fixed size page by tracking the top edge of everything placed so far, and putting each
+// rectangle where that edge is lowest.
+class SkylinePacker {
+public:
+    SkylinePacker(uint32_t width, uint32_t height);
+
+    // Top left corner of the space reserved for a width x height rectangle, or nothing if it does not fit
+    std::optional<std::array<uint32_t, 2>> insert(uint32_t width, uint32_t height);
+
+private:
+    struct Segment {
+        uint32_t x;
+        uint32_t y;
+        uint32_t width;
+    };
+
+    uint32_t width;
+    uint32_t height;
+    // Left to right, covering the whole width
+    std::vector<Segment> skyline;
+
+    // Height the rectangle would be placed at if its left edge were at segment index, if it fits there
+    std::optional<uint32_t> fit(size_t index, uint32_t rect_width, uint32_t rect_height) const;
+};
+
+// Padding and alignment that keep textures from bleeding into each other in every one of mip_levels levels, where
+// every level halves the atlas. Textures start at a multiple of the alignment and are padded to one, so their edges
+// stay on texel boundaries all the way down.
+uint32_t atlas_alignment(uint32_t mip_levels);
+
+// Smallest power of two page, at least min_page_size, that fits the largest texture with its padding. Throws
+// std::invalid_argument if that is larger than max_page_size.
+uint32_t choose_atlas_page_size(std::vector<TextureImage> const& images, uint32_t mip_levels,
+                                uint32_t min_page_size, uint32_t max_page_size);
+
+// Place textures of the given sizes into as few layers of page_size x page_size as possible, tallest first. Throws
+// std::invalid_argument if a texture does not fit in a layer at all.
+AtlasLayout pack_textures(std::vector<std::array<uint32_t, 2>> const& sizes, uint32_t page_size, uint32_t mip_levels);
+
+// Pack the images and copy them into their layers, filling the padding with their edge texels
+Atlas build_atlas(std::vector<TextureImage> const& images, uint32_t page_size, uint32_t mip_levels);
+
+// Atlases can be packed offline and loaded at startup instead. Both throw std::runtime_error on I/O errors. Loading
+// also throws if the atlas is corrupt, or has larger pages or more layers than the device takes.
+void save_atlas(std::string const& path, Atlas const& atlas);
+Atlas load_atlas(std::string const& path, uint32_t max_page_size, uint32_t max_layers);
+
+#endif
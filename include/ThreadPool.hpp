@@ -0,0 +1,69 @@
+#ifndef THREAD_POOL_HPP_
+#define THREAD_POOL_HPP_
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads executing jobs in FIFO order
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t thread_count);
+    ~ThreadPool();
+
+    ThreadPool(ThreadPool const&) = delete;
+    ThreadPool& operator=(ThreadPool const&) = delete;
+
+    size_t size() const;
+
+    void submit(std::function<void()> job);
+
+    // Split [0, count) into one range per worker plus the calling thread, and wait until all ranges are processed.
+    // func is called as func(chunk_index, begin, end). Returns the amount of chunks used. Chunks bypass the job
+    // queue and nothing is allocated, so it is fine to call every frame. Calls from several threads take turns, and
+    // it must not be called from a job.
+    template <typename Func>
+    size_t parallel_for(size_t count, Func const& func) {
+        return run_parallel(count, &func, [](void const* context, size_t chunk, size_t begin, size_t end) {
+            (*static_cast<Func const*>(context))(chunk, begin, end);
+        });
+    }
+
+    // Amount of chunks parallel_for will split work into
+    size_t chunk_count() const;
+
+private:
+    std::vector<std::thread> threads;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::queue<std::function<void()>> jobs;
+    bool stopping = false;
+
+    // The parallel_for in progress, if any. Workers claim its chunks before any queued job.
+    using ChunkFunction = void (*)(void const* context, size_t chunk, size_t begin, size_t end);
+    struct ParallelTask {
+        void const* context = nullptr;
+        ChunkFunction function = nullptr;
+        size_t count = 0;
+        size_t chunk_size = 0;
+        size_t chunks = 0;
+        size_t next_chunk = 0;
+        size_t unfinished = 0;
+    };
+    ParallelTask task;
+    // Taken for a whole parallel_for, so only one runs at a time
+    std::mutex parallel_mutex;
+    std::condition_variable task_done_cv;
+
+    size_t run_parallel(size_t count, void const* context, ChunkFunction function);
+    // Run chunks of the current task until none are left to claim. Called and returns with lock held.
+    void run_chunks(std::unique_lock<std::mutex>& lock);
+    void worker_loop();
+};
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef TIMELINE_HPP_
+#define TIMELINE_HPP_
+
+#include <vulkan/vulkan.hpp>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// Entry points of timeline semaphores, from the core or from VK_KHR_timeline_semaphore
+struct TimelineFunctions {
+    PFN_vkWaitSemaphores wait_semaphores = nullptr;
+    PFN_vkGetSemaphoreCounterValue get_semaphore_counter_value = nullptr;
+};
+
+// What it takes to enable timeline semaphores on a device: the feature is core in Vulkan 1.2, and an extension on
+// 1.1. Has to stay alive until the device is created, the create info points into it.
+class TimelineSemaphoreFeatures {
+public:
+    explicit TimelineSemaphoreFeatures(vk::PhysicalDevice physical_device);
+
+    bool supported() const;
+    // Append the extension if needed, and chain the feature struct in front of info.pNext
+    void enable(std::vector<char const*>& extensions, vk::DeviceCreateInfo& info);
+    // For a device created with the features enabled
+    TimelineFunctions load(vk::Device device) const;
+
+private:
+    bool is_supported = false;
+    bool core = false;
+    vk::PhysicalDeviceTimelineSemaphoreFeatures features;
+};
+
+class QueueTimeline;
+
+// Command buffers of one batch of a submission, with the semaphores it waits for and signals on top of the timeline
+// of the queue it is submitted to. The semaphores are held in place, so building a submission does not allocate.
+// The command buffers have to stay where they are until the batch is submitted.
+class SubmitBatch {
+public:
+    static constexpr size_t max_semaphores = 4;
+
+    explicit SubmitBatch(vk::ArrayProxy<vk::CommandBuffer const> command_buffers);
+
+    // Wait for a binary semaphore, like the one a swapchain image is acquired with, before stage
+    SubmitBatch& wait(vk::Semaphore semaphore, vk::PipelineStageFlags stage);
+    // Wait for the timeline of another queue to reach value before stage
+    SubmitBatch& wait(QueueTimeline const& timeline, uint64_t value, vk::PipelineStageFlags stage);
+    // Signal a binary semaphore once the batch is done, like the one presenting waits for
+    SubmitBatch& signal(vk::Semaphore semaphore);
+
+private:
+    friend class QueueTimeline;
+
+    vk::CommandBuffer const* command_buffers;
+    uint32_t command_buffer_count;
+    uint32_t wait_count = 0;
+    std::array<vk::Semaphore, max_semaphores> wait_semaphores;
+    // Ignored for binary semaphores
+    std::array<uint64_t, max_semaphores> wait_values = {};
+    std::array<vk::PipelineStageFlags, max_semaphores> wait_stages;
+    uint32_t signal_count = 0;
+    std::array<vk::Semaphore, max_semaphores> signal_semaphores;
+};
+
+// A queue and a timeline semaphore that every submission through it advances by one. Everything the GPU did on the
+// queue up to a submission is then a single increasing value: the CPU waits for values, other queues wait for
+// values, and resources are retired until the value of the last submission that used them is reached, instead of
+// keeping a fence or binary semaphore for each of these.
+class QueueTimeline {
+public:
+    static constexpr size_t max_batches = 4;
+
+    QueueTimeline(vk::Device device, vk::Queue queue, TimelineFunctions functions);
+    ~QueueTimeline();
+
+    QueueTimeline(QueueTimeline const&) = delete;
+    QueueTimeline& operator=(QueueTimeline const&) = delete;
+
+    vk::Queue queue() const;
+    vk::Semaphore semaphore() const;
+
+    // Value the next submission will signal
+    uint64_t next_value() const;
+    // Value the newest submission signals, 0 before the first one
+    uint64_t last_submitted() const;
+
+    // Highest value the GPU has reached, asked from the driver
+    uint64_t completed();
+    // Whether the GPU has reached value. Only asks the driver if the last known value is below it.
+    bool reached(uint64_t value);
+    // Block until the GPU has reached value. Returns right away if it is already known to have, so waiting for an
+    // older value than one waited for before costs nothing.
+    void wait(uint64_t value);
+
+    // Submit batches in order. The last one signals next_value(), which covers every batch before it. Returns the
+    // signaled value.
+    uint64_t submit(vk::ArrayProxy<SubmitBatch const> batches);
+
+private:
+    vk::Device device;
+    vk::Queue device_queue;
+    TimelineFunctions functions;
+    vk::Semaphore timeline;
+    uint64_t submitted = 0;
+    uint64_t known_completed = 0;
+};
+
+#endif
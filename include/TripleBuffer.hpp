@@ -0,0 +1,53 @@
+#ifndef TRIPLE_BUFFER_HPP_
+#define TRIPLE_BUFFER_HPP_
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Lock-free single producer, single consumer handoff of whole objects.
+// The producer owns the back buffer and the consumer owns the front buffer. The third (middle) buffer is exchanged
+// atomically with either of them, so neither side ever waits for the other. The consumer always sees the most
+// recently published object, older unconsumed objects are simply overwritten.
+template<typename T>
+class TripleBuffer {
+public:
+    // Buffer the producer is allowed to write to
+    T& write_buffer() {
+        return buffers[back];
+    }
+
+    // Hand the back buffer over to the consumer
+    void publish() {
+        uint8_t const old_middle = middle.exchange(back | fresh_bit, std::memory_order_acq_rel);
+        back = old_middle & index_mask;
+    }
+
+    // Grab the latest published buffer if there is one. Returns false if nothing new was published since the last call.
+    bool acquire() {
+        if (!(middle.load(std::memory_order_relaxed) & fresh_bit)) {
+            return false;
+        }
+        uint8_t const old_middle = middle.exchange(front, std::memory_order_acq_rel);
+        front = old_middle & index_mask;
+        return true;
+    }
+
+    // Buffer the consumer is allowed to read from
+    T const& read_buffer() const {
+        return buffers[front];
+    }
+
+private:
+    static constexpr uint8_t index_mask = 0x3;
+    // Set when the middle buffer holds an object the consumer has not seen yet
+    static constexpr uint8_t fresh_bit = 0x4;
+
+    std::array<T, 3> buffers;
+
+    uint8_t back = 0;
+    std::atomic<uint8_t> middle = 1;
+    uint8_t front = 2;
+};
+
+#endif
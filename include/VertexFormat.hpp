@@ -0,0 +1,24 @@
+#ifndef VERTEX_FORMAT_HPP_
+#define VERTEX_FORMAT_HPP_
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+
+// Vertex layouts the vertex pulling shader (data/shader_pull.vert) knows how to decode
+enum class VertexFormat : uint32_t {
+    // Same layout as fixed-function vertex input uses: float position, color and texture coordinates
+    Standard = 0,
+    // Float position, RGBA8 color and 16 bit normalized texture coordinates
+    Compact = 1
+};
+
+struct CompactVertex {
+    float pos[3];
+    uint32_t color;
+    uint32_t tex_coords;
+};
+
+CompactVertex make_compact_vertex(glm::vec3 const& pos, glm::vec3 const& color, glm::vec2 const& tex_coords);
+
+#endif
@@ -0,0 +1,193 @@
+#ifndef VIRTUAL_TEXTURE_HPP_
+#define VIRTUAL_TEXTURE_HPP_
+
+#include <vulkan/vulkan.hpp>
+
+#include "DescriptorAllocator.hpp"
+#include "LinearAllocator.hpp"
+#include "VkBuffer.hpp"
+
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+class ThreadPool;
+
+// Maps pages to a fixed amount of slots, evicting the least recently used page when the slots run out. Pinned slots
+// are never evicted.
+class PageCache {
+public:
+    static constexpr uint32_t no_page = UINT32_MAX;
+
+    struct Allocation {
+        uint32_t slot;
+        // Page that was in the slot before, or no_page if the slot was free
+        uint32_t evicted;
+    };
+
+    explicit PageCache(uint32_t slot_count);
+
+    std::optional<uint32_t> find(uint32_t page) const;
+    // Mark a slot as used in a frame
+    void touch(uint32_t slot, uint64_t frame);
+    // Take a free slot, or the least recently used one that was not used in frame. The slot starts out pinned.
+    std::optional<Allocation> allocate(uint32_t page, uint64_t frame);
+    // Let a slot be evicted again
+    void unpin(uint32_t slot);
+
+    uint32_t page(uint32_t slot) const;
+    // Slots holding a page
+    size_t size() const;
+
+private:
+    struct Slot {
+        uint32_t page = no_page;
+        uint64_t last_used = 0;
+        bool pinned = false;
+        std::list<uint32_t>::iterator lru_position;
+    };
+
+    std::vector<Slot> slots;
+    std::vector<uint32_t> free_slots;
+    // Unpinned slots in use, least recently used first
+    std::list<uint32_t> lru;
+    std::unordered_map<uint32_t, uint32_t> page_slots;
+};
+
+// Fills width x height RGBA8 texels of a mip level of the virtual texture, starting at texel x, y. The region may
+// reach past the edges of the level, those texels should repeat the nearest edge. Called from worker threads.
+using PageSource = std::function<void(uint32_t mip, int32_t x, int32_t y, uint32_t width, uint32_t height,
+                                      uint8_t* rgba)>;
+
+// Procedural stand-in content: coloured blocks with a checker pattern, and a line along every page edge
+void procedural_page_source(uint32_t mip, int32_t x, int32_t y, uint32_t width, uint32_t height, uint8_t* rgba);
+
+// A texture far larger than what is kept in device memory. It is split into pages, and only the pages that were
+// visible recently are resident, in the slots of a physical page atlas. A page table image with one texel per page
+// and a mip level per texture mip tells the fragment shader where a page is, or where its closest resident ancestor
+// is while it is still loading.
+// The fragment shader appends the pages it would like to sample to a feedback list with one slice per swapchain
+// image, each page once. Once the GPU is done with a slice, update() reads back the pages in its list, loads missing
+// pages on the thread pool, and uploads finished pages and the new page table.
+class VirtualTexture {
+public:
+    // Texels along each side of the full resolution texture
+    static constexpr uint32_t virtual_size = 16384;
+    static constexpr uint32_t page_size = 128;
+    // Texels repeated from the neighbouring pages around every page, so filtering does not need to know about slots
+    static constexpr uint32_t page_border = 4;
+    static constexpr uint32_t tile_size = page_size + 2 * page_border;
+    // Down to a single page covering the whole texture
+    static constexpr uint32_t mip_count = 8;
+    static constexpr uint32_t pages_per_side = virtual_size / page_size;
+    static_assert(pages_per_side >> (mip_count - 1) == 1, "The last mip level has to be a single page");
+    // Finished pages uploaded per update, so a burst of new pages does not stall a single frame
+    static constexpr uint32_t max_uploads_per_update = 16;
+
+    struct Stats {
+        size_t pages_requested = 0;
+        size_t pages_uploaded = 0;
+        size_t pages_evicted = 0;
+        size_t resident_pages = 0;
+        vk::DeviceSize resident_size = 0;
+
+        // Print the average per frame
+        void report(std::ostream& out, size_t frames) const;
+    };
+
+    // The atlas has atlas_tiles x atlas_tiles slots, at most 256 x 256. The coarsest page is loaded right away and
+    // always stays resident.
+    VirtualTexture(vk::PhysicalDevice physical_device, vk::Device device, ThreadPool& workers, PageSource source,
+                   uint32_t atlas_tiles, size_t slice_count, vk::CommandPool cmd_pool, vk::Queue queue);
+    ~VirtualTexture();
+
+    VirtualTexture(VirtualTexture const&) = delete;
+    VirtualTexture& operator=(VirtualTexture const&) = delete;
+
+    // Layout of the set read by the fragment shader: page table, physical atlas and feedback
+    vk::DescriptorSetLayout set_layout() const;
+    // Contents of that set, with the feedback of a slice. The feedback is a plain storage buffer rather than a
+    // dynamic one: the scene layout already uses the 4 dynamic storage buffers every device supports.
+    DescriptorSetContents descriptors(size_t slice);
+
+    // Read the feedback of a slice and record the uploads of finished pages. The GPU must be done with the
+    // previous frame that used the slice. Has to be recorded outside of a render pass. Temporary lists go to
+    // frame_memory.
+    void update(vk::CommandBuffer cmd, size_t slice, uint64_t frame, LinearAllocator& frame_memory);
+    // Make the feedback written by the frame's draws visible to the host. Recorded after the render pass.
+    void record_feedback_barrier(vk::CommandBuffer cmd, size_t slice);
+
+    // Statistics since the last call
+    Stats take_stats();
+
+    // Index of a page in the page table, and what the feedback lists
+    static uint32_t page_id(uint32_t mip, uint32_t x, uint32_t y);
+    // Pages in all mip levels together
+    static uint32_t page_count();
+
+private:
+    enum class PageState : uint8_t { Absent, Loading, Resident };
+
+    struct LoadedPage {
+        uint32_t page;
+        uint32_t slot;
+        std::vector<uint8_t> texels;
+    };
+
+    vk::Device device;
+    ThreadPool& workers;
+    PageSource source;
+    uint32_t atlas_tiles;
+
+    vk::Image atlas_image;
+    vk::DeviceMemory atlas_memory;
+    vk::ImageView atlas_view;
+    vk::Image page_table_image;
+    vk::DeviceMemory page_table_memory;
+    vk::ImageView page_table_view;
+    vk::Sampler atlas_sampler;
+    vk::Sampler page_table_sampler;
+
+    Buffer feedback;
+    uint8_t* feedback_mapping = nullptr;
+    vk::DeviceSize feedback_stride = 0;
+    // One slice per swapchain image: the page table, followed by room for max_uploads_per_update pages
+    Buffer staging;
+    uint8_t* staging_mapping = nullptr;
+    vk::DeviceSize staging_stride = 0;
+
+    vk::DescriptorSetLayout descriptor_set_layout;
+
+    PageCache cache;
+    std::vector<PageState> page_states;
+    // Slot, mip level and a valid flag per page, laid out like the feedback
+    std::vector<uint8_t> page_table;
+    bool page_table_dirty = true;
+
+    std::mutex loaded_mutex;
+    std::condition_variable loaded_cv;
+    std::vector<LoadedPage> loaded_pages;
+    size_t loads_in_flight = 0;
+
+    Stats stats;
+
+    std::vector<uint8_t> load_page(uint32_t page) const;
+    // Make sure the page and its ancestors stay resident, and start loading the ones that are missing
+    void request_page(uint32_t page, uint64_t frame, LinearVector<uint32_t>& missing);
+    // False if every slot is in use this frame
+    bool start_load(uint32_t page, uint64_t frame);
+    void rebuild_page_table();
+    // Copy the page table and up to max_uploads_per_update finished pages into a staging slice, and record the
+    // copies into the images
+    void record_uploads(vk::CommandBuffer cmd, size_t slice, LoadedPage const* pages, size_t upload_count, bool table,
+                        LinearAllocator& frame_memory);
+};
+
+#endif
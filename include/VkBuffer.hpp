@@ -21,6 +21,8 @@ public:
 
     vk::Buffer handle();
     vk::DeviceMemory memory_handle();
+    // Only valid for buffers created with eShaderDeviceAddress usage
+    vk::DeviceAddress device_address();
 
     void destroy();
 
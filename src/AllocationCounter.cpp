@@ -0,0 +1,118 @@
+#include "AllocationCounter.hpp"
+
+#include <cstdlib>
+#include <new>
+
+#ifdef VK_PLAYGROUND_COUNT_ALLOCATIONS
+
+// Plain data, so it is usable from operator new before anything else of the thread is initialized
+static thread_local uint64_t allocation_count = 0;
+
+uint64_t thread_allocation_count() {
+    return allocation_count;
+}
+
+static void* counted_allocate(size_t size) {
+    ++allocation_count;
+    // malloc may return null for 0 bytes, but operator new has to return a unique pointer
+    void* const pointer = std::malloc(size > 0 ? size : 1);
+    if (!pointer) {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+static void* counted_allocate_aligned(size_t size, std::align_val_t alignment) {
+    ++allocation_count;
+    size_t const align = static_cast<size_t>(alignment);
+#ifdef _WIN32
+    void* const pointer = _aligned_malloc(size > 0 ? size : 1, align);
+#else
+    // aligned_alloc wants the size to be a multiple of the alignment
+    void* const pointer = std::aligned_alloc(align, (size + align - 1) / align * align + (size == 0 ? align : 0));
+#endif
+    if (!pointer) {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+static void free_aligned(void* pointer) {
+#ifdef _WIN32
+    _aligned_free(pointer);
+#else
+    std::free(pointer);
+#endif
+}
+
+void* operator new(size_t size) {
+    return counted_allocate(size);
+}
+
+void* operator new[](size_t size) {
+    return counted_allocate(size);
+}
+
+void* operator new(size_t size, std::nothrow_t const&) noexcept {
+    try {
+        return counted_allocate(size);
+    } catch (std::bad_alloc const&) {
+        return nullptr;
+    }
+}
+
+void* operator new[](size_t size, std::nothrow_t const&) noexcept {
+    try {
+        return counted_allocate(size);
+    } catch (std::bad_alloc const&) {
+        return nullptr;
+    }
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+    return counted_allocate_aligned(size, alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+    return counted_allocate_aligned(size, alignment);
+}
+
+void operator delete(void* pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::align_val_t) noexcept {
+    free_aligned(pointer);
+}
+
+void operator delete[](void* pointer, std::align_val_t) noexcept {
+    free_aligned(pointer);
+}
+
+void operator delete(void* pointer, size_t, std::align_val_t) noexcept {
+    free_aligned(pointer);
+}
+
+void operator delete[](void* pointer, size_t, std::align_val_t) noexcept {
+    free_aligned(pointer);
+}
+
+#else
+
+uint64_t thread_allocation_count() {
+    return 0;
+}
+
+#endif
@@ -0,0 +1,152 @@
+#include "AppConfig.hpp"
+
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+static PresentModePolicy parse_present_mode(std::string_view name) {
+    if (name == "fifo") {
+        return PresentModePolicy::Fifo;
+    }
+    if (name == "relaxed") {
+        return PresentModePolicy::FifoRelaxed;
+    }
+    if (name == "mailbox") {
+        return PresentModePolicy::Mailbox;
+    }
+    if (name == "immediate") {
+        return PresentModePolicy::Immediate;
+    }
+    throw std::invalid_argument("Unknown present mode: " + std::string(name));
+}
+
+AppConfig parse_app_config(int argc, char** argv) {
+    AppConfig config;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string_view const option = argv[i];
+        // Returns the value following the current option
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("Missing value for option " + std::string(option));
+            }
+            return argv[++i];
+        };
+        // Returns the value following the current option, if there is one
+        auto optional_value = [&]() -> std::optional<std::string> {
+            if (i + 1 >= argc || argv[i + 1][0] == '-') {
+                return std::nullopt;
+            }
+            return argv[++i];
+        };
+
+        if (option == "--device") {
+            config.device = value();
+        } else if (option == "--benchmark-devices") {
+            config.benchmark_devices = true;
+        } else if (option == "--frames-in-flight") {
+            config.frames_in_flight = std::stoul(value());
+            if (config.frames_in_flight == 0) {
+                throw std::invalid_argument("At least one frame has to be in flight");
+            }
+        } else if (option == "--present-mode") {
+            config.present_mode = parse_present_mode(value());
+        } else if (option == "--fps-limit") {
+            config.fps_limit = std::stod(value());
+        } else if (option == "--dynamic-resolution") {
+            auto const milliseconds = optional_value();
+            config.dynamic_resolution_ms = milliseconds ? std::stod(*milliseconds) : 16.0;
+            if (*config.dynamic_resolution_ms <= 0.0) {
+                throw std::invalid_argument("The dynamic resolution target has to be above 0 ms");
+            }
+        } else if (option == "--msaa") {
+            config.msaa_samples = std::stoul(value());
+            if (config.msaa_samples == 0) {
+                throw std::invalid_argument("At least one sample per pixel is needed");
+            }
+        } else if (option == "--hot-reload") {
+            config.shader_hot_reload = true;
+        } else if (option == "--shader-source-dir") {
+            config.shader_source_dir = value();
+        } else if (option == "--vertex-pulling") {
+            config.vertex_pulling = true;
+        } else if (option == "--lights") {
+            config.light_count = std::stoul(value());
+        } else if (option == "--atlas") {
+            config.atlas_file = value();
+        } else if (option == "--pack-textures") {
+            config.atlas_file = value();
+            // Every following argument up to the next option is an image
+            while (auto const image = optional_value()) {
+                config.pack_textures.push_back(*image);
+            }
+            if (config.pack_textures.empty()) {
+                throw std::invalid_argument("--pack-textures needs at least one image");
+            }
+        } else if (option == "--virtual-texture") {
+            config.virtual_texture = true;
+        } else if (option == "--particles") {
+            config.particle_count = std::stoul(value());
+        } else if (option == "--characters") {
+            config.character_count = std::stoul(value());
+        } else if (option == "--profile") {
+            config.profile_file = value();
+            auto const frames = optional_value();
+            if (frames) {
+                config.profile_frames = std::stoul(*frames);
+            }
+        } else if (option == "--capture") {
+            config.capture_file = value();
+        } else if (option == "--replay") {
+            config.replay_file = value();
+        } else if (option == "--memory-budget") {
+            config.memory_budget_mib = std::stoul(value());
+        } else if (option == "--bench-transforms") {
+            auto const count = optional_value();
+            config.bench_transforms = count ? std::stoul(*count) : 250000;
+        } else if (option == "--bench-vertex-pulling") {
+            config.bench_vertex_pulling = true;
+        } else if (option == "--bench-lights") {
+            config.bench_lights = true;
+        } else if (option == "--bench-particles") {
+            auto const count = optional_value();
+            config.bench_particles = count ? std::stoul(*count) : 1 << 20;
+        } else {
+            throw std::invalid_argument("Unknown option: " + std::string(option));
+        }
+    }
+
+    if (!config.capture_file.empty() && !config.replay_file.empty()) {
+        throw std::invalid_argument("--capture and --replay cannot be used together");
+    }
+
+    return config;
+}
+
+void print_usage(std::ostream& out, char const* program) {
+    out << "Usage: " << program << " [options]\n"
+        << "  --device <index|name>           Use this physical device instead of the fastest one\n"
+        << "  --benchmark-devices             Benchmark the physical devices again instead of using cached results\n"
+        << "  --frames-in-flight <n>          Amount of frames the CPU may run ahead of the GPU (default 2)\n"
+        << "  --present-mode <mode>           fifo, relaxed, mailbox or immediate (default mailbox)\n"
+        << "  --fps-limit <fps>               Limit the frame rate, sampling input as late as possible\n"
+        << "  --dynamic-resolution [ms]       Scale the scene resolution to hold a GPU frame time (default 16 ms)\n"
+        << "  --msaa <samples>                Multisample the scene, resolved on chip (default 1, off)\n"
+        << "  --hot-reload                    Rebuild the pipeline when the GLSL shaders change\n"
+        << "  --shader-source-dir <dir>       Directory containing the GLSL shaders (default data)\n"
+        << "  --vertex-pulling                Fetch vertices in the vertex shader through buffer device addresses\n"
+        << "  --lights <n>                    Amount of point lights, 0 turns lighting off (default 256)\n"
+        << "  --atlas <file>                  Use a texture atlas packed with --pack-textures\n"
+        << "  --pack-textures <out> <img>...  Pack images into a texture atlas file and exit\n"
+        << "  --virtual-texture               Texture the scene with a 16k virtual texture streamed in by visibility\n"
+        << "  --particles <n>                 Capacity of the GPU particle system, 0 turns it off (default 65536)\n"
+        << "  --characters <n>                Amount of skinned, animated characters, 0 turns them off (default 64)\n"
+        << "  --profile <file> [frames]       Write a Chrome trace of the first frames (default 300) to file\n"
+        << "  --capture <file>                Record the inputs of every frame to file\n"
+        << "  --replay <file>                 Draw the frames of a capture without a visible window, report and exit\n"
+        << "  --memory-budget <MiB>           Demote textures and evict meshes to stay within this much device memory\n"
+        << "  --bench-transforms [count]      Benchmark the scene transform update and exit\n"
+        << "  --bench-vertex-pulling          Benchmark vertex pulling against fixed-function vertex input and exit\n"
+        << "  --bench-lights                  Benchmark clustered against brute force lighting and exit\n"
+        << "  --bench-particles [count]       Benchmark GPU particle simulation and sorting without a window and exit\n";
+}
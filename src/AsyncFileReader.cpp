@@ -0,0 +1,518 @@
+#include "AsyncFileReader.hpp"
+#include "Profiler.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define ASYNC_FILE_READER_IO_URING
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#ifdef ASYNC_FILE_READER_IO_URING
+
+// io_uring without liburing. The submission and completion queues are shared with the kernel through mmap, and only
+// the I/O thread touches them.
+struct AsyncFileReader::Ring {
+    // user_data and unsubmitted entry of the read of wake_fd
+    static constexpr uint32_t wake_slot = UINT32_MAX;
+
+    struct Slot {
+        Ticket ticket = 0;
+        Read read;
+        int fd = -1;
+        // Bytes read so far, reads can come back short
+        size_t done = 0;
+        iovec vector = {};
+    };
+
+    int fd = -1;
+    void* sq_memory = MAP_FAILED;
+    size_t sq_memory_size = 0;
+    void* cq_memory = MAP_FAILED;
+    size_t cq_memory_size = 0;
+    void* sqe_memory = MAP_FAILED;
+    size_t sqe_memory_size = 0;
+
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_mask = nullptr;
+    unsigned* sq_array = nullptr;
+    io_uring_sqe* sqes = nullptr;
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned* cq_mask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+
+    // A read of this eventfd is always queued, so writing to it ends a wait for completions when new reads arrive
+    int wake_fd = -1;
+    uint64_t wake_count = 0;
+    iovec wake_vector = {};
+
+    std::vector<Slot> slots;
+    std::vector<uint32_t> free_slots;
+    // Prepared but not handed to the kernel yet, in submission queue order
+    std::vector<uint32_t> unsubmitted;
+
+    ~Ring() {
+        if (sqe_memory != MAP_FAILED) {
+            munmap(sqe_memory, sqe_memory_size);
+        }
+        if (cq_memory != MAP_FAILED && cq_memory != sq_memory) {
+            munmap(cq_memory, cq_memory_size);
+        }
+        if (sq_memory != MAP_FAILED) {
+            munmap(sq_memory, sq_memory_size);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        if (wake_fd >= 0) {
+            close(wake_fd);
+        }
+    }
+
+    // False if the kernel does not support io_uring, or a sandbox does not allow it
+    bool create(uint32_t entries) {
+        io_uring_params params = {};
+        wake_fd = eventfd(0, EFD_CLOEXEC);
+        if (wake_fd < 0) {
+            return false;
+        }
+        fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (fd < 0) {
+            return false;
+        }
+
+        sq_memory_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_memory_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool const single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single_mmap) {
+            sq_memory_size = cq_memory_size = std::max(sq_memory_size, cq_memory_size);
+        }
+        sq_memory = mmap(nullptr, sq_memory_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                         IORING_OFF_SQ_RING);
+        if (sq_memory == MAP_FAILED) {
+            return false;
+        }
+        cq_memory = single_mmap ? sq_memory : mmap(nullptr, cq_memory_size, PROT_READ | PROT_WRITE,
+                                                   MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cq_memory == MAP_FAILED) {
+            return false;
+        }
+        sqe_memory_size = params.sq_entries * sizeof(io_uring_sqe);
+        sqe_memory = mmap(nullptr, sqe_memory_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                          IORING_OFF_SQES);
+        if (sqe_memory == MAP_FAILED) {
+            return false;
+        }
+
+        char* const sq = static_cast<char*>(sq_memory);
+        sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        sqes = static_cast<io_uring_sqe*>(sqe_memory);
+        char* const cq = static_cast<char*>(cq_memory);
+        cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        // Never more reads in flight than the submission queue holds next to the wake read, so it cannot overflow
+        uint32_t const slot_count = params.sq_entries - 1;
+        slots.resize(slot_count);
+        for (uint32_t i = 0; i < slot_count; ++i) {
+            free_slots.push_back(slot_count - 1 - i);
+        }
+        prepare_wake();
+        return true;
+    }
+
+    // From any thread
+    void wake() const {
+        uint64_t const one = 1;
+        [[maybe_unused]] ssize_t const written = write(wake_fd, &one, sizeof(one));
+    }
+
+    size_t active() const {
+        return slots.size() - free_slots.size();
+    }
+
+    // Queue a read of what is left of the slot's range
+    void prepare_read(uint32_t slot_index) {
+        Slot& slot = slots[slot_index];
+        slot.vector.iov_base = static_cast<char*>(slot.read.destination) + slot.done;
+        slot.vector.iov_len = slot.read.size - slot.done;
+        push_readv(slot_index, slot.fd, &slot.vector, slot.read.offset + slot.done);
+    }
+
+    // Queue the read of wake_fd again, after the last one completed
+    void prepare_wake() {
+        wake_vector.iov_base = &wake_count;
+        wake_vector.iov_len = sizeof(wake_count);
+        push_readv(wake_slot, wake_fd, &wake_vector, 0);
+    }
+
+    void push_readv(uint32_t slot_index, int file, iovec const* vector, uint64_t offset) {
+        unsigned const tail = *sq_tail;
+        unsigned const index = tail & *sq_mask;
+        io_uring_sqe& sqe = sqes[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_READV;
+        sqe.fd = file;
+        sqe.addr = reinterpret_cast<uint64_t>(vector);
+        sqe.len = 1;
+        sqe.off = offset;
+        sqe.user_data = slot_index;
+        sq_array[index] = index;
+        // The kernel must see the entry before the new tail
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        unsubmitted.push_back(slot_index);
+    }
+
+    // Hand the prepared reads to the kernel, and if wait is set block until at least one read completed. Returns the
+    // reads the kernel refused with error, which are taken back out of the submission queue.
+    std::vector<uint32_t> enter(bool wait, int& error) {
+        unsigned const flags = wait ? IORING_ENTER_GETEVENTS : 0;
+        long const result = syscall(__NR_io_uring_enter, fd, static_cast<unsigned>(unsubmitted.size()), wait ? 1 : 0,
+                                    flags, nullptr, 0);
+        if (result >= 0) {
+            unsubmitted.erase(unsubmitted.begin(), unsubmitted.begin() + std::min<size_t>(result, unsubmitted.size()));
+            return {};
+        }
+        // Interrupted, or the kernel is short on resources. Try again on the next round.
+        if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+            return {};
+        }
+        // The kernel did not consume any of them, so the tail can be moved back over them
+        error = errno;
+        std::vector<uint32_t> refused;
+        refused.swap(unsubmitted);
+        *sq_tail -= static_cast<unsigned>(refused.size());
+        return refused;
+    }
+};
+
+#else
+
+struct AsyncFileReader::Ring {};
+
+#endif
+
+AsyncFileReader::AsyncFileReader(ThreadPool& workers, uint32_t queue_depth) : workers(workers) {
+#ifdef ASYNC_FILE_READER_IO_URING
+    auto io_ring = std::make_unique<Ring>();
+    if (io_ring->create(queue_depth)) {
+        ring = std::move(io_ring);
+        io_thread = std::thread([this] { io_loop(); });
+    }
+#else
+    (void)queue_depth;
+#endif
+}
+
+AsyncFileReader::~AsyncFileReader() {
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+        queued.clear();
+    }
+    cv.notify_all();
+#ifdef ASYNC_FILE_READER_IO_URING
+    if (ring) {
+        ring->wake();
+    }
+#endif
+    if (io_thread.joinable()) {
+        io_thread.join();
+    }
+    std::unique_lock lock(mutex);
+    idle_cv.wait(lock, [this] { return in_flight == 0 && jobs_outstanding == 0; });
+}
+
+std::vector<AsyncFileReader::Ticket> AsyncFileReader::submit(std::vector<Read> reads) {
+    std::vector<Ticket> tickets;
+    tickets.reserve(reads.size());
+    {
+        std::lock_guard lock(mutex);
+        for (auto& read : reads) {
+            Ticket const ticket = next_ticket++;
+            queued.emplace(queue_key(read.priority, ticket), std::move(read));
+            tickets.push_back(ticket);
+        }
+        if (!ring) {
+            jobs_outstanding += tickets.size();
+        }
+    }
+
+    if (ring) {
+        // The I/O thread waits on the cv when idle, and in the kernel while reads are in flight
+        cv.notify_one();
+#ifdef ASYNC_FILE_READER_IO_URING
+        ring->wake();
+#endif
+    } else {
+        // Every job starts whatever is most important by the time it runs, not necessarily the read it was
+        // submitted for
+        for (size_t i = 0; i < tickets.size(); ++i) {
+            workers.submit([this] { run_pool_job(); });
+        }
+    }
+    return tickets;
+}
+
+bool AsyncFileReader::cancel(Ticket ticket) {
+    std::lock_guard lock(mutex);
+    auto const it = std::find_if(queued.begin(), queued.end(), [&](auto const& entry) {
+        return entry.first.second == ticket;
+    });
+    if (it == queued.end()) {
+        return false;
+    }
+    queued.erase(it);
+    if (queued.empty() && in_flight == 0) {
+        idle_cv.notify_all();
+    }
+    return true;
+}
+
+void AsyncFileReader::wait_idle() {
+    std::unique_lock lock(mutex);
+    idle_cv.wait(lock, [this] { return queued.empty() && in_flight == 0; });
+}
+
+bool AsyncFileReader::uses_io_uring() const {
+    return ring != nullptr;
+}
+
+std::pair<int, AsyncFileReader::Ticket> AsyncFileReader::queue_key(Priority priority, Ticket ticket) {
+    return { -static_cast<int>(priority), ticket };
+}
+
+bool AsyncFileReader::take_next(Ticket& ticket, Read& read) {
+    if (queued.empty()) {
+        return false;
+    }
+    auto const it = queued.begin();
+    ticket = it->first.second;
+    read = std::move(it->second);
+    queued.erase(it);
+    ++in_flight;
+    return true;
+}
+
+void AsyncFileReader::finish(Read const& read, Result const& result) {
+    if (read.on_complete) {
+        read.on_complete(result);
+    }
+    std::lock_guard lock(mutex);
+    --in_flight;
+    if (in_flight == 0) {
+        idle_cv.notify_all();
+    }
+}
+
+void AsyncFileReader::run_pool_job() {
+    Ticket ticket;
+    Read read;
+    bool started;
+    {
+        std::lock_guard lock(mutex);
+        started = take_next(ticket, read);
+    }
+    if (started) {
+        PROFILE_ZONE("Read file");
+        Result result;
+        errno = 0;
+        std::ifstream file(read.path, std::ios::binary);
+        if (!file) {
+            result.error = errno != 0 ? errno : EIO;
+        } else {
+            // Seeking past the end fails the stream, which then reads nothing, like a read at the end of the file
+            file.seekg(read.offset);
+            file.read(static_cast<char*>(read.destination), read.size);
+            result.bytes_read = static_cast<size_t>(file.gcount());
+            if (file.bad()) {
+                result.error = EIO;
+            }
+        }
+        finish(read, result);
+    }
+
+    std::lock_guard lock(mutex);
+    if (--jobs_outstanding == 0) {
+        idle_cv.notify_all();
+    }
+}
+
+#ifdef ASYNC_FILE_READER_IO_URING
+
+void AsyncFileReader::io_loop() {
+    profiler_set_thread_name("File I/O");
+    std::vector<uint32_t> started;
+
+    auto complete = [&](uint32_t slot_index, int error) {
+        Ring::Slot& slot = ring->slots[slot_index];
+        if (slot.fd >= 0) {
+            close(slot.fd);
+            slot.fd = -1;
+        }
+        Result result;
+        result.bytes_read = slot.done;
+        result.error = error;
+        finish(slot.read, result);
+        slot.read = Read{};
+        ring->free_slots.push_back(slot_index);
+    };
+
+    while (true) {
+        {
+            std::unique_lock lock(mutex);
+            // With reads in flight the thread waits for their completions in the kernel instead, where submit wakes
+            // it up through the eventfd read
+            cv.wait(lock, [&] { return stopping || !queued.empty() || ring->active() > 0; });
+            if (stopping && ring->active() == 0) {
+                return;
+            }
+            while (!ring->free_slots.empty()) {
+                Ticket ticket;
+                Read read;
+                if (!take_next(ticket, read)) {
+                    break;
+                }
+                uint32_t const slot_index = ring->free_slots.back();
+                ring->free_slots.pop_back();
+                ring->slots[slot_index].ticket = ticket;
+                ring->slots[slot_index].read = std::move(read);
+                started.push_back(slot_index);
+            }
+        }
+
+        // Opening blocks this thread, but only for the metadata lookup
+        for (uint32_t slot_index : started) {
+            Ring::Slot& slot = ring->slots[slot_index];
+            slot.done = 0;
+            slot.fd = open(slot.read.path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (slot.fd < 0) {
+                complete(slot_index, errno);
+            } else if (slot.read.size == 0) {
+                complete(slot_index, 0);
+            } else {
+                ring->prepare_read(slot_index);
+            }
+        }
+        started.clear();
+
+        if (ring->active() == 0) {
+            continue;
+        }
+        int error = 0;
+        for (uint32_t slot_index : ring->enter(true, error)) {
+            if (slot_index == Ring::wake_slot) {
+                // New reads then only start once one in flight completes
+                std::cerr << "io_uring refused the wake up read: " << std::strerror(error) << "\n";
+                continue;
+            }
+            std::cerr << "io_uring refused a read of " << ring->slots[slot_index].read.path << ": "
+                      << std::strerror(error) << "\n";
+            complete(slot_index, error);
+        }
+
+        PROFILE_ZONE("Complete reads");
+        unsigned head = *ring->cq_head;
+        unsigned const tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            io_uring_cqe const& cqe = ring->cqes[head & *ring->cq_mask];
+            uint32_t const slot_index = static_cast<uint32_t>(cqe.user_data);
+            if (slot_index == Ring::wake_slot) {
+                // Reading the eventfd reset it, new reads are picked up on the next round. If it failed, new reads
+                // only start once one in flight completes.
+                if (cqe.res >= 0 || cqe.res == -EINTR || cqe.res == -EAGAIN) {
+                    ring->prepare_wake();
+                }
+                continue;
+            }
+            Ring::Slot& slot = ring->slots[slot_index];
+            if (cqe.res == -EINTR || cqe.res == -EAGAIN) {
+                ring->prepare_read(slot_index);
+            } else if (cqe.res < 0) {
+                complete(slot_index, -cqe.res);
+            } else if (cqe.res == 0) {
+                // End of the file
+                complete(slot_index, 0);
+            } else {
+                slot.done += static_cast<size_t>(cqe.res);
+                if (slot.done < slot.read.size) {
+                    ring->prepare_read(slot_index);
+                } else {
+                    complete(slot_index, 0);
+                }
+            }
+        }
+        // Let the kernel reuse the entries
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+}
+
+#else
+
+void AsyncFileReader::io_loop() {}
+
+#endif
+
+std::vector<std::string> read_files(AsyncFileReader& reader, std::vector<std::string> const& paths,
+                                    AsyncFileReader::Priority priority) {
+    std::vector<std::string> contents(paths.size());
+    std::vector<AsyncFileReader::Result> results(paths.size());
+    std::mutex done_mutex;
+    std::condition_variable done_cv;
+    size_t remaining = paths.size();
+
+    std::vector<AsyncFileReader::Read> reads;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        std::ifstream file(paths[i], std::ios::binary | std::ios::ate);
+        if (!file) {
+            throw std::runtime_error("Failed to open " + paths[i]);
+        }
+        contents[i].resize(static_cast<size_t>(file.tellg()));
+
+        AsyncFileReader::Read read;
+        read.path = paths[i];
+        read.size = contents[i].size();
+        read.destination = contents[i].data();
+        read.priority = priority;
+        read.on_complete = [&, i](AsyncFileReader::Result const& result) {
+            results[i] = result;
+            // Decrement under the lock, otherwise we could return and destroy the cv before it is notified
+            std::lock_guard lock(done_mutex);
+            if (--remaining == 0) {
+                done_cv.notify_one();
+            }
+        };
+        reads.push_back(std::move(read));
+    }
+    reader.submit(std::move(reads));
+
+    {
+        std::unique_lock lock(done_mutex);
+        done_cv.wait(lock, [&] { return remaining == 0; });
+    }
+    for (size_t i = 0; i < paths.size(); ++i) {
+        if (results[i].error != 0) {
+            throw std::runtime_error("Failed to read " + paths[i] + ": " + std::strerror(results[i].error));
+        }
+        // The file shrank since we looked at its size
+        contents[i].resize(results[i].bytes_read);
+    }
+    return contents;
+}
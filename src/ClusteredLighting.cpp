@@ -0,0 +1,152 @@
+#include "ClusteredLighting.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+// Start of every slice of the light buffer, followed by the lights. Same layout as the Lights block in the shaders.
+struct LightingHeader {
+    glm::mat4 view;
+    glm::mat4 inverse_projection;
+    // Clusters along x, y and z, and the amount of lights
+    glm::uvec4 grid;
+    // Near and far plane, framebuffer width and height
+    glm::vec4 params;
+};
+
+struct GpuLight {
+    glm::vec4 position_radius;
+    glm::vec4 color_intensity;
+};
+
+static_assert(sizeof(LightingHeader) == 160 && sizeof(GpuLight) == 32, "Light layout does not match the shaders");
+
+// Must match local_size_x in cluster_lights.comp
+constexpr uint32_t binning_group_size = 64;
+
+static vk::DeviceSize align_up(vk::DeviceSize size, vk::DeviceSize alignment) {
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+ClusteredLighting::ClusteredLighting(vk::PhysicalDevice physical_device, vk::Device device, vk::PipelineCache cache,
+                                     std::string const& binning_spirv, uint32_t max_lights, size_t slice_count)
+    : device(device), light_capacity(max_lights) {
+
+    vk::DeviceSize const alignment = physical_device.getProperties().limits.minStorageBufferOffsetAlignment;
+    lights_stride = align_up(sizeof(LightingHeader) + max_lights * sizeof(GpuLight), alignment);
+    counts_stride = align_up(cluster_count * sizeof(uint32_t), alignment);
+    indices_stride = align_up(cluster_count * max_lights_per_cluster * sizeof(uint32_t), alignment);
+
+    lights = Buffer(physical_device, device, lights_stride * slice_count, vk::BufferUsageFlagBits::eStorageBuffer,
+                    vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+    lights_mapping = static_cast<uint8_t*>(device.mapMemory(lights.memory_handle(), 0, VK_WHOLE_SIZE));
+    // Only ever touched by the GPU
+    counts = Buffer(physical_device, device, counts_stride * slice_count, vk::BufferUsageFlagBits::eStorageBuffer,
+                    vk::MemoryPropertyFlagBits::eDeviceLocal);
+    indices = Buffer(physical_device, device, indices_stride * slice_count, vk::BufferUsageFlagBits::eStorageBuffer,
+                     vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+    std::array<vk::DescriptorSetLayoutBinding, 3> bindings;
+    for (uint32_t i = 0; i < bindings.size(); ++i) {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = vk::DescriptorType::eStorageBufferDynamic;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = vk::ShaderStageFlagBits::eCompute | vk::ShaderStageFlagBits::eFragment;
+    }
+    vk::DescriptorSetLayoutCreateInfo layout_info;
+    layout_info.bindingCount = bindings.size();
+    layout_info.pBindings = bindings.data();
+    descriptor_set_layout = device.createDescriptorSetLayout(layout_info);
+
+    vk::PipelineLayoutCreateInfo pipeline_layout_info;
+    pipeline_layout_info.setLayoutCount = 1;
+    pipeline_layout_info.pSetLayouts = &descriptor_set_layout;
+    pipeline_layout = device.createPipelineLayout(pipeline_layout_info);
+
+    vk::ShaderModuleCreateInfo module_info;
+    module_info.codeSize = binning_spirv.size();
+    module_info.pCode = reinterpret_cast<uint32_t const*>(binning_spirv.data());
+    vk::ShaderModule const module = device.createShaderModule(module_info);
+
+    vk::ComputePipelineCreateInfo pipeline_info;
+    pipeline_info.stage.stage = vk::ShaderStageFlagBits::eCompute;
+    pipeline_info.stage.module = module;
+    pipeline_info.stage.pName = "main";
+    pipeline_info.layout = pipeline_layout;
+    try {
+        binning_pipeline = device.createComputePipeline(cache, pipeline_info);
+    } catch (...) {
+        device.destroyShaderModule(module);
+        throw;
+    }
+    device.destroyShaderModule(module);
+}
+
+ClusteredLighting::~ClusteredLighting() {
+    device.destroyPipeline(binning_pipeline);
+    device.destroyPipelineLayout(pipeline_layout);
+    device.destroyDescriptorSetLayout(descriptor_set_layout);
+    device.unmapMemory(lights.memory_handle());
+}
+
+vk::DescriptorSetLayout ClusteredLighting::set_layout() const {
+    return descriptor_set_layout;
+}
+
+DescriptorSetContents ClusteredLighting::descriptors() {
+    DescriptorSetContents contents;
+    contents.buffer(0, vk::DescriptorType::eStorageBufferDynamic, lights.handle(), 0, lights_stride);
+    contents.buffer(1, vk::DescriptorType::eStorageBufferDynamic, counts.handle(), 0, counts_stride);
+    contents.buffer(2, vk::DescriptorType::eStorageBufferDynamic, indices.handle(), 0, indices_stride);
+    return contents;
+}
+
+std::array<uint32_t, 3> ClusteredLighting::dynamic_offsets(size_t slice) const {
+    return { static_cast<uint32_t>(slice * lights_stride), static_cast<uint32_t>(slice * counts_stride),
+             static_cast<uint32_t>(slice * indices_stride) };
+}
+
+void ClusteredLighting::upload(size_t slice, glm::mat4 const& view, glm::mat4 const& projection, float near, float far,
+                               vk::Extent2D extent, std::vector<PointLight> const& point_lights) {
+    uint32_t const count = std::min<size_t>(point_lights.size(), light_capacity);
+    uint8_t* const base = lights_mapping + slice * lights_stride;
+
+    LightingHeader header;
+    header.view = view;
+    header.inverse_projection = glm::inverse(projection);
+    header.grid = glm::uvec4(grid_x, grid_y, grid_z, count);
+    header.params = glm::vec4(near, far, extent.width, extent.height);
+    std::memcpy(base, &header, sizeof(header));
+
+    GpuLight* const gpu_lights = reinterpret_cast<GpuLight*>(base + sizeof(LightingHeader));
+    for (uint32_t i = 0; i < count; ++i) {
+        PointLight const& light = point_lights[i];
+        gpu_lights[i] = GpuLight{ glm::vec4(light.position, light.radius), glm::vec4(light.color, light.intensity) };
+    }
+}
+
+void ClusteredLighting::record_binning(vk::CommandBuffer cmd, vk::DescriptorSet set, size_t slice) {
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, binning_pipeline);
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipeline_layout, 0, set, dynamic_offsets(slice));
+    cmd.dispatch((cluster_count + binning_group_size - 1) / binning_group_size, 1, 1);
+
+    // The fragment shader reads what was just written
+    std::array<vk::BufferMemoryBarrier, 2> barriers;
+    barriers[0].buffer = counts.handle();
+    barriers[0].offset = slice * counts_stride;
+    barriers[0].size = counts_stride;
+    barriers[1].buffer = indices.handle();
+    barriers[1].offset = slice * indices_stride;
+    barriers[1].size = indices_stride;
+    for (auto& barrier : barriers) {
+        barrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+        barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    }
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eFragmentShader, {},
+                        nullptr, barriers, nullptr);
+}
+
+uint32_t ClusteredLighting::max_lights() const {
+    return light_capacity;
+}
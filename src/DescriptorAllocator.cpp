@@ -0,0 +1,218 @@
+#include "DescriptorAllocator.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <stdexcept>
+
+// Upper limit for the amount of sets in a single pool
+constexpr uint32_t max_sets_per_pool = 4096;
+
+// Amount of descriptors of each type a pool gets, per set it can hold
+constexpr std::array<std::pair<vk::DescriptorType, uint32_t>, 6> pool_ratios = {{
+    { vk::DescriptorType::eUniformBuffer, 1 },
+    { vk::DescriptorType::eUniformBufferDynamic, 1 },
+    { vk::DescriptorType::eStorageBuffer, 1 },
+    { vk::DescriptorType::eStorageBufferDynamic, 2 },
+    { vk::DescriptorType::eCombinedImageSampler, 2 },
+    { vk::DescriptorType::eStorageImage, 1 }
+}};
+
+// Raw bits of a Vulkan handle, which is either a pointer or a 64 bit integer depending on the platform
+template<typename Handle>
+static uint64_t handle_bits(Handle handle) {
+    auto const raw = static_cast<typename Handle::CType>(handle);
+    uint64_t bits = 0;
+    std::memcpy(&bits, &raw, sizeof(raw));
+    return bits;
+}
+
+static void hash_combine(uint64_t& hash, uint64_t value) {
+    hash ^= value + 0x9E3779B97F4A7C15ull + (hash << 6) + (hash >> 2);
+}
+
+DescriptorSetContents::Binding& DescriptorSetContents::add_binding() {
+    if (binding_count == max_bindings) {
+        throw std::length_error("Too many bindings in a descriptor set");
+    }
+    Binding& entry = bindings[binding_count++];
+    entry = Binding{};
+    return entry;
+}
+
+DescriptorSetContents& DescriptorSetContents::buffer(uint32_t binding, vk::DescriptorType type, vk::Buffer buffer,
+                                                     vk::DeviceSize offset, vk::DeviceSize range) {
+    Binding& entry = add_binding();
+    entry.binding = binding;
+    entry.type = type;
+    entry.buffer_info.buffer = buffer;
+    entry.buffer_info.offset = offset;
+    entry.buffer_info.range = range;
+    return *this;
+}
+
+DescriptorSetContents& DescriptorSetContents::image(uint32_t binding, vk::DescriptorType type, vk::Sampler sampler,
+                                                    vk::ImageView view, vk::ImageLayout layout) {
+    Binding& entry = add_binding();
+    entry.binding = binding;
+    entry.type = type;
+    entry.image_info.sampler = sampler;
+    entry.image_info.imageView = view;
+    entry.image_info.imageLayout = layout;
+    return *this;
+}
+
+uint64_t DescriptorSetContents::hash() const {
+    uint64_t hash = 0;
+    for (uint32_t i = 0; i < binding_count; ++i) {
+        Binding const& entry = bindings[i];
+        hash_combine(hash, entry.binding);
+        hash_combine(hash, static_cast<uint64_t>(entry.type));
+        hash_combine(hash, handle_bits(entry.buffer_info.buffer));
+        hash_combine(hash, entry.buffer_info.offset);
+        hash_combine(hash, entry.buffer_info.range);
+        hash_combine(hash, handle_bits(entry.image_info.sampler));
+        hash_combine(hash, handle_bits(entry.image_info.imageView));
+        hash_combine(hash, static_cast<uint64_t>(entry.image_info.imageLayout));
+    }
+    return hash;
+}
+
+bool DescriptorSetContents::operator==(DescriptorSetContents const& rhs) const {
+    return std::equal(bindings.begin(), bindings.begin() + binding_count, 
+                      rhs.bindings.begin(), rhs.bindings.begin() + rhs.binding_count,
+        [](Binding const& a, Binding const& b) {
+            return a.binding == b.binding && a.type == b.type && a.buffer_info == b.buffer_info 
+                && a.image_info == b.image_info;
+        });
+}
+
+void DescriptorAllocator::Stats::report(std::ostream& out, size_t frames) const {
+    if (frames == 0) {
+        return;
+    }
+    out << "descriptors per frame: " << sets_allocated / frames << " sets allocated, "
+        << cache_hits / frames << " cache hits, "
+        << descriptor_writes / frames << " descriptor writes, "
+        << pools_created << " pools created\n";
+}
+
+DescriptorAllocator::DescriptorAllocator(vk::Device device, size_t frames_in_flight) 
+    : device(device), frames(frames_in_flight) {}
+
+DescriptorAllocator::~DescriptorAllocator() {
+    for (auto const& frame : frames) {
+        for (auto pool : frame.pools) {
+            device.destroyDescriptorPool(pool);
+        }
+    }
+    for (auto pool : free_pools) {
+        device.destroyDescriptorPool(pool);
+    }
+}
+
+void DescriptorAllocator::begin_frame(size_t frame_slot) {
+    current_frame = frame_slot;
+    Frame& frame = frames[frame_slot];
+
+    // Freeing every set of a pool at once is much cheaper than freeing them one by one
+    for (auto pool : frame.pools) {
+        device.resetDescriptorPool(pool);
+        free_pools.push_back(pool);
+    }
+    frame.pools.clear();
+    frame.cache.clear();
+}
+
+vk::DescriptorSet DescriptorAllocator::allocate(vk::DescriptorSetLayout layout) {
+    Frame& frame = frames[current_frame];
+    if (frame.pools.empty()) {
+        frame.pools.push_back(acquire_pool());
+    }
+
+    vk::DescriptorSetAllocateInfo info;
+    info.descriptorPool = frame.pools.back();
+    info.descriptorSetCount = 1;
+    info.pSetLayouts = &layout;
+
+    ++stats.sets_allocated;
+    // The enhanced overload returns a vector, this one does not allocate
+    vk::DescriptorSet set;
+    vk::Result result = device.allocateDescriptorSets(&info, &set);
+    if (result == vk::Result::eErrorOutOfPoolMemory || result == vk::Result::eErrorFragmentedPool) {
+        // The current pool is full, continue in another one
+        frame.pools.push_back(acquire_pool());
+        info.descriptorPool = frame.pools.back();
+        result = device.allocateDescriptorSets(&info, &set);
+    }
+    if (result != vk::Result::eSuccess) {
+        throw std::runtime_error("Failed to allocate a descriptor set: " + vk::to_string(result));
+    }
+    return set;
+}
+
+vk::DescriptorSet DescriptorAllocator::get(vk::DescriptorSetLayout layout, DescriptorSetContents const& contents) {
+    uint64_t key = contents.hash();
+    hash_combine(key, handle_bits(layout));
+
+    auto& cache = frames[current_frame].cache;
+    for (auto const& cached : cache) {
+        if (cached.key == key && cached.layout == layout && cached.contents == contents) {
+            ++stats.cache_hits;
+            return cached.set;
+        }
+    }
+
+    vk::DescriptorSet const set = allocate(layout);
+
+    std::array<vk::WriteDescriptorSet, DescriptorSetContents::max_bindings> writes;
+    uint32_t const write_count = contents.binding_count;
+    for (uint32_t i = 0; i < write_count; ++i) {
+        auto const& entry = contents.bindings[i];
+        writes[i].dstSet = set;
+        writes[i].dstBinding = entry.binding;
+        writes[i].dstArrayElement = 0;
+        writes[i].descriptorCount = 1;
+        writes[i].descriptorType = entry.type;
+        if (entry.image_info.imageView || entry.image_info.sampler) {
+            writes[i].pImageInfo = &entry.image_info;
+        } else {
+            writes[i].pBufferInfo = &entry.buffer_info;
+        }
+    }
+    device.updateDescriptorSets(vk::ArrayProxy<vk::WriteDescriptorSet const>(write_count, writes.data()), nullptr);
+    stats.descriptor_writes += write_count;
+
+    cache.push_back(CachedSet{ key, layout, contents, set });
+    return set;
+}
+
+DescriptorAllocator::Stats DescriptorAllocator::take_stats() {
+    Stats result = stats;
+    stats = Stats{};
+    return result;
+}
+
+vk::DescriptorPool DescriptorAllocator::acquire_pool() {
+    if (!free_pools.empty()) {
+        vk::DescriptorPool const pool = free_pools.back();
+        free_pools.pop_back();
+        return pool;
+    }
+
+    std::array<vk::DescriptorPoolSize, pool_ratios.size()> sizes;
+    for (size_t i = 0; i < sizes.size(); ++i) {
+        sizes[i].type = pool_ratios[i].first;
+        sizes[i].descriptorCount = pool_ratios[i].second * sets_per_pool;
+    }
+
+    vk::DescriptorPoolCreateInfo info;
+    info.maxSets = sets_per_pool;
+    info.poolSizeCount = sizes.size();
+    info.pPoolSizes = sizes.data();
+
+    ++stats.pools_created;
+    // Frames that needed more than one pool are likely to need more again
+    sets_per_pool = std::min(sets_per_pool * 2, max_sets_per_pool);
+    return device.createDescriptorPool(info);
+}
@@ -0,0 +1,375 @@
+#include "DeviceBenchmark.hpp"
+
+#include "GpuTimer.hpp"
+#include "MemoryBudget.hpp"
+#include "VkBuffer.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+
+// Runs shorter than this are dominated by timer resolution and launch overhead
+constexpr double min_benchmark_ms = 2.0;
+
+constexpr uint32_t fill_size = 2048;
+constexpr vk::DeviceSize transfer_size = 64 * 1024 * 1024;
+// Must match local_size_x in bench_compute.comp
+constexpr uint32_t compute_group_size = 256;
+constexpr uint32_t compute_groups = 1024;
+constexpr double flops_per_iteration = 32.0;
+
+double DeviceBenchmarkResult::score() const {
+    return std::cbrt(fill_rate * transfer_rate * compute_rate);
+}
+
+// Run with twice the work until a run takes long enough. Returns the amount of work and its milliseconds.
+static std::pair<uint32_t, double> calibrate(uint32_t work, uint32_t max_work,
+                                             std::function<double(uint32_t)> const& run) {
+    double milliseconds = run(work);
+    while (milliseconds < min_benchmark_ms && work < max_work) {
+        work *= 2;
+        milliseconds = run(work);
+    }
+    return { work, std::max(milliseconds, 1e-6) };
+}
+
+static vk::UniqueShaderModule create_module(vk::Device device, std::string const& spirv) {
+    vk::ShaderModuleCreateInfo info;
+    info.codeSize = spirv.size();
+    info.pCode = reinterpret_cast<uint32_t const*>(spirv.data());
+    return device.createShaderModuleUnique(info);
+}
+
+// Memory from allocate_device_memory, freed however the benchmark ends. Everything else a benchmark creates is held
+// in unique handles, so that a benchmark that throws does not leave objects behind for the device to be destroyed
+// with.
+class BenchmarkMemory {
+public:
+    explicit BenchmarkMemory(vk::Device device) : device(device) {}
+    ~BenchmarkMemory() {
+        free_device_memory(device, memory);
+    }
+
+    BenchmarkMemory(BenchmarkMemory const&) = delete;
+    BenchmarkMemory& operator=(BenchmarkMemory const&) = delete;
+
+    vk::Device device;
+    vk::DeviceMemory memory;
+};
+
+// Full screen triangles without blending or depth, drawn over and over into one large image
+static double measure_fill_rate(HeadlessContext& context, DeviceBenchmarkShaders const& shaders) {
+    vk::Device const device = context.device();
+    constexpr vk::Format format = vk::Format::eR8G8B8A8Unorm;
+    // Declared before the image, so the image is destroyed first
+    BenchmarkMemory memory(device);
+
+    vk::ImageCreateInfo image_info;
+    image_info.imageType = vk::ImageType::e2D;
+    image_info.extent = vk::Extent3D{ fill_size, fill_size, 1 };
+    image_info.mipLevels = 1;
+    image_info.arrayLayers = 1;
+    image_info.format = format;
+    image_info.tiling = vk::ImageTiling::eOptimal;
+    image_info.usage = vk::ImageUsageFlagBits::eColorAttachment;
+    image_info.samples = vk::SampleCountFlagBits::e1;
+    vk::UniqueImage const image = device.createImageUnique(image_info);
+    vk::MemoryRequirements const requirements = device.getImageMemoryRequirements(*image);
+    vk::MemoryAllocateInfo alloc_info;
+    alloc_info.allocationSize = requirements.size;
+    alloc_info.memoryTypeIndex = find_memory_type(context.physical_device(), requirements.memoryTypeBits,
+                                                  vk::MemoryPropertyFlagBits::eDeviceLocal);
+    memory.memory = allocate_device_memory(context.physical_device(), device, alloc_info);
+    device.bindImageMemory(*image, memory.memory, 0);
+
+    vk::ImageViewCreateInfo view_info;
+    view_info.image = *image;
+    view_info.viewType = vk::ImageViewType::e2D;
+    view_info.format = format;
+    view_info.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
+    view_info.subresourceRange.levelCount = 1;
+    view_info.subresourceRange.layerCount = 1;
+    vk::UniqueImageView const view = device.createImageViewUnique(view_info);
+
+    vk::AttachmentDescription attachment;
+    attachment.format = format;
+    attachment.samples = vk::SampleCountFlagBits::e1;
+    attachment.loadOp = vk::AttachmentLoadOp::eDontCare;
+    attachment.storeOp = vk::AttachmentStoreOp::eStore;
+    attachment.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
+    attachment.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+    attachment.initialLayout = vk::ImageLayout::eUndefined;
+    attachment.finalLayout = vk::ImageLayout::eColorAttachmentOptimal;
+    vk::AttachmentReference color_ref(0, vk::ImageLayout::eColorAttachmentOptimal);
+    vk::SubpassDescription subpass;
+    subpass.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
+    subpass.colorAttachmentCount = 1;
+    subpass.pColorAttachments = &color_ref;
+    vk::RenderPassCreateInfo render_pass_info;
+    render_pass_info.attachmentCount = 1;
+    render_pass_info.pAttachments = &attachment;
+    render_pass_info.subpassCount = 1;
+    render_pass_info.pSubpasses = &subpass;
+    vk::UniqueRenderPass const render_pass = device.createRenderPassUnique(render_pass_info);
+
+    vk::FramebufferCreateInfo framebuffer_info;
+    framebuffer_info.renderPass = *render_pass;
+    framebuffer_info.attachmentCount = 1;
+    framebuffer_info.pAttachments = &view.get();
+    framebuffer_info.width = fill_size;
+    framebuffer_info.height = fill_size;
+    framebuffer_info.layers = 1;
+    vk::UniqueFramebuffer const framebuffer = device.createFramebufferUnique(framebuffer_info);
+
+    vk::UniquePipelineLayout const layout = device.createPipelineLayoutUnique(vk::PipelineLayoutCreateInfo{});
+    vk::UniqueShaderModule vert_module = create_module(device, shaders.fill_vert);
+    vk::UniqueShaderModule frag_module = create_module(device, shaders.fill_frag);
+    std::array<vk::PipelineShaderStageCreateInfo, 2> stages;
+    stages[0].stage = vk::ShaderStageFlagBits::eVertex;
+    stages[0].module = *vert_module;
+    stages[0].pName = "main";
+    stages[1].stage = vk::ShaderStageFlagBits::eFragment;
+    stages[1].module = *frag_module;
+    stages[1].pName = "main";
+
+    vk::PipelineVertexInputStateCreateInfo vertex_input;
+    vk::PipelineInputAssemblyStateCreateInfo input_assembly;
+    input_assembly.topology = vk::PrimitiveTopology::eTriangleList;
+    vk::Viewport viewport(0.0f, 0.0f, float(fill_size), float(fill_size), 0.0f, 1.0f);
+    vk::Rect2D scissor(vk::Offset2D{ 0, 0 }, vk::Extent2D{ fill_size, fill_size });
+    vk::PipelineViewportStateCreateInfo viewport_state;
+    viewport_state.viewportCount = 1;
+    viewport_state.pViewports = &viewport;
+    viewport_state.scissorCount = 1;
+    viewport_state.pScissors = &scissor;
+    vk::PipelineRasterizationStateCreateInfo rasterization;
+    rasterization.polygonMode = vk::PolygonMode::eFill;
+    rasterization.cullMode = vk::CullModeFlagBits::eNone;
+    rasterization.lineWidth = 1.0f;
+    vk::PipelineMultisampleStateCreateInfo multisample;
+    multisample.rasterizationSamples = vk::SampleCountFlagBits::e1;
+    vk::PipelineColorBlendAttachmentState blend_attachment;
+    blend_attachment.colorWriteMask = vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG |
+                                      vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA;
+    vk::PipelineColorBlendStateCreateInfo blend;
+    blend.attachmentCount = 1;
+    blend.pAttachments = &blend_attachment;
+
+    vk::GraphicsPipelineCreateInfo pipeline_info;
+    pipeline_info.stageCount = stages.size();
+    pipeline_info.pStages = stages.data();
+    pipeline_info.pVertexInputState = &vertex_input;
+    pipeline_info.pInputAssemblyState = &input_assembly;
+    pipeline_info.pViewportState = &viewport_state;
+    pipeline_info.pRasterizationState = &rasterization;
+    pipeline_info.pMultisampleState = &multisample;
+    pipeline_info.pColorBlendState = &blend;
+    pipeline_info.layout = *layout;
+    pipeline_info.renderPass = *render_pass;
+    vk::UniquePipeline const pipeline(device.createGraphicsPipeline(nullptr, pipeline_info), device);
+    vert_module.reset();
+    frag_module.reset();
+
+    GpuTimer timer(context.physical_device(), device, 1);
+    auto const [draws, milliseconds] = calibrate(16, 1 << 12, [&](uint32_t draw_count) {
+        context.run([&](vk::CommandBuffer cmd) {
+            timer.reset(cmd);
+            timer.begin(cmd, 0);
+            vk::RenderPassBeginInfo begin_info;
+            begin_info.renderPass = *render_pass;
+            begin_info.framebuffer = *framebuffer;
+            begin_info.renderArea = scissor;
+            cmd.beginRenderPass(begin_info, vk::SubpassContents::eInline);
+            cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, *pipeline);
+            // Every instance covers the whole image again
+            cmd.draw(3, draw_count, 0, 0);
+            cmd.endRenderPass();
+            timer.end(cmd, 0);
+        });
+        return timer.read_milliseconds()[0];
+    });
+
+    return double(fill_size) * fill_size * draws / (milliseconds * 1e-3) / 1e9;
+}
+
+// Uploads from a staging buffer, like texture and mesh streaming does
+static double measure_transfer_rate(HeadlessContext& context) {
+    Buffer source(context.physical_device(), context.device(), transfer_size, vk::BufferUsageFlagBits::eTransferSrc,
+                  vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+    Buffer destination(context.physical_device(), context.device(), transfer_size,
+                       vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+    GpuTimer timer(context.physical_device(), context.device(), 1);
+    auto const [copies, milliseconds] = calibrate(1, 64, [&](uint32_t copy_count) {
+        context.run([&](vk::CommandBuffer cmd) {
+            timer.reset(cmd);
+            timer.begin(cmd, 0);
+            // Every copy writes the same destination, so each one waits for the copy before it
+            vk::MemoryBarrier barrier;
+            barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+            barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+            for (uint32_t i = 0; i < copy_count; ++i) {
+                if (i > 0) {
+                    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer, {},
+                                        barrier, nullptr, nullptr);
+                }
+                cmd.copyBuffer(source.handle(), destination.handle(), vk::BufferCopy(0, 0, transfer_size));
+            }
+            timer.end(cmd, 0);
+        });
+        return timer.read_milliseconds()[0];
+    });
+
+    return double(transfer_size) * copies / (milliseconds * 1e-3) / 1e9;
+}
+
+static double measure_compute_rate(HeadlessContext& context, DeviceBenchmarkShaders const& shaders) {
+    vk::Device const device = context.device();
+    uint32_t const invocations = compute_groups * compute_group_size;
+    Buffer results(context.physical_device(), device, invocations * 16, vk::BufferUsageFlagBits::eStorageBuffer,
+                   vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+    vk::DescriptorSetLayoutBinding binding;
+    binding.binding = 0;
+    binding.descriptorType = vk::DescriptorType::eStorageBuffer;
+    binding.descriptorCount = 1;
+    binding.stageFlags = vk::ShaderStageFlagBits::eCompute;
+    vk::DescriptorSetLayoutCreateInfo set_layout_info;
+    set_layout_info.bindingCount = 1;
+    set_layout_info.pBindings = &binding;
+    vk::UniqueDescriptorSetLayout const set_layout = device.createDescriptorSetLayoutUnique(set_layout_info);
+
+    vk::DescriptorPoolSize pool_size(vk::DescriptorType::eStorageBuffer, 1);
+    vk::DescriptorPoolCreateInfo pool_info;
+    pool_info.maxSets = 1;
+    pool_info.poolSizeCount = 1;
+    pool_info.pPoolSizes = &pool_size;
+    vk::UniqueDescriptorPool const pool = device.createDescriptorPoolUnique(pool_info);
+    vk::DescriptorSetAllocateInfo set_info;
+    set_info.descriptorPool = *pool;
+    set_info.descriptorSetCount = 1;
+    set_info.pSetLayouts = &set_layout.get();
+    vk::DescriptorSet const set = device.allocateDescriptorSets(set_info)[0];
+    vk::DescriptorBufferInfo buffer_info(results.handle(), 0, VK_WHOLE_SIZE);
+    vk::WriteDescriptorSet write;
+    write.dstSet = set;
+    write.dstBinding = 0;
+    write.descriptorCount = 1;
+    write.descriptorType = vk::DescriptorType::eStorageBuffer;
+    write.pBufferInfo = &buffer_info;
+    device.updateDescriptorSets(write, nullptr);
+
+    vk::PushConstantRange push_range(vk::ShaderStageFlagBits::eCompute, 0, sizeof(uint32_t));
+    vk::PipelineLayoutCreateInfo layout_info;
+    layout_info.setLayoutCount = 1;
+    layout_info.pSetLayouts = &set_layout.get();
+    layout_info.pushConstantRangeCount = 1;
+    layout_info.pPushConstantRanges = &push_range;
+    vk::UniquePipelineLayout const layout = device.createPipelineLayoutUnique(layout_info);
+
+    vk::UniqueShaderModule module = create_module(device, shaders.compute);
+    vk::ComputePipelineCreateInfo pipeline_info;
+    pipeline_info.stage.stage = vk::ShaderStageFlagBits::eCompute;
+    pipeline_info.stage.module = *module;
+    pipeline_info.stage.pName = "main";
+    pipeline_info.layout = *layout;
+    vk::UniquePipeline const pipeline(device.createComputePipeline(nullptr, pipeline_info), device);
+    module.reset();
+
+    GpuTimer timer(context.physical_device(), device, 1);
+    auto const [iterations, milliseconds] = calibrate(64, 1 << 16, [&](uint32_t iteration_count) {
+        context.run([&](vk::CommandBuffer cmd) {
+            timer.reset(cmd);
+            timer.begin(cmd, 0);
+            cmd.bindPipeline(vk::PipelineBindPoint::eCompute, *pipeline);
+            cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, *layout, 0, set, nullptr);
+            cmd.pushConstants(*layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(uint32_t), &iteration_count);
+            cmd.dispatch(compute_groups, 1, 1);
+            timer.end(cmd, 0);
+        });
+        return timer.read_milliseconds()[0];
+    });
+
+    return double(invocations) * iterations * flops_per_iteration / (milliseconds * 1e-3) / 1e9;
+}
+
+DeviceBenchmarkResult benchmark_device(DeviceUuid const& device_uuid, DeviceBenchmarkShaders const& shaders) {
+    HeadlessContext context(device_uuid);
+    DeviceBenchmarkResult result;
+    result.fill_rate = measure_fill_rate(context, shaders);
+    result.transfer_rate = measure_transfer_rate(context);
+    result.compute_rate = measure_compute_rate(context, shaders);
+    return result;
+}
+
+DeviceBenchmarkCache::DeviceBenchmarkCache(std::string path) : path(std::move(path)) {
+    std::ifstream file(this->path);
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        // UUID in hex, driver version, then the results
+        std::istringstream fields(line);
+        std::string uuid_hex;
+        Entry entry;
+        fields >> uuid_hex >> entry.driver_version >> entry.result.fill_rate >> entry.result.transfer_rate
+               >> entry.result.compute_rate;
+        if (!fields || uuid_hex.size() != entry.device_uuid.size() * 2) {
+            continue;
+        }
+        // Lines that are not two hex digits per byte are skipped like any other malformed line
+        bool valid = true;
+        for (size_t i = 0; i < entry.device_uuid.size() && valid; ++i) {
+            char const* const digits = uuid_hex.data() + i * 2;
+            auto const [end, error] = std::from_chars(digits, digits + 2, entry.device_uuid[i], 16);
+            valid = error == std::errc() && end == digits + 2;
+        }
+        if (valid) {
+            entries.push_back(entry);
+        }
+    }
+}
+
+std::optional<DeviceBenchmarkResult> DeviceBenchmarkCache::find(DeviceUuid const& device_uuid,
+                                                                uint32_t driver_version) const {
+    for (auto const& entry : entries) {
+        if (entry.device_uuid == device_uuid && entry.driver_version == driver_version) {
+            return entry.result;
+        }
+    }
+    return std::nullopt;
+}
+
+void DeviceBenchmarkCache::store(DeviceUuid const& device_uuid, uint32_t driver_version,
+                                 DeviceBenchmarkResult const& result) {
+    // A driver update replaces the results of the old driver
+    entries.erase(std::remove_if(entries.begin(), entries.end(), [&device_uuid](Entry const& entry) {
+        return entry.device_uuid == device_uuid;
+    }), entries.end());
+    entries.push_back(Entry{ device_uuid, driver_version, result });
+}
+
+void DeviceBenchmarkCache::save() const {
+    std::ofstream file(path);
+    if (!file) {
+        throw std::runtime_error("Failed to open " + path + " for writing");
+    }
+    file << "# device uuid, driver version, fill rate (Gpixel/s), transfer rate (GB/s), compute rate (GFLOP/s)\n";
+    for (auto const& entry : entries) {
+        for (uint8_t byte : entry.device_uuid) {
+            file << std::hex << std::setw(2) << std::setfill('0') << int(byte);
+        }
+        file << std::dec << std::setfill(' ') << " " << entry.driver_version << " " << entry.result.fill_rate << " "
+             << entry.result.transfer_rate << " " << entry.result.compute_rate << "\n";
+    }
+    if (!file) {
+        throw std::runtime_error("Failed to write " + path);
+    }
+}
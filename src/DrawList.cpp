@@ -0,0 +1,184 @@
+#include "DrawList.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+// Below this many draws, sorting on a single thread is faster than handing out work to the pool
+constexpr size_t parallel_sort_threshold = 8192;
+
+uint64_t make_sort_key(RenderPassType pass, uint32_t pipeline_id, uint32_t material_id, float depth) {
+    // The bit pattern of a non-negative float increases monotonically with its value, so it can be sorted as an integer
+    depth = std::max(depth, 0.0f);
+    uint32_t depth_bits;
+    std::memcpy(&depth_bits, &depth, sizeof(depth_bits));
+    if (pass == RenderPassType::Transparent) {
+        depth_bits = ~depth_bits;
+    }
+
+    return (static_cast<uint64_t>(pass) & 0xF) << 60
+         | (static_cast<uint64_t>(pipeline_id) & 0xFFF) << 48
+         | (static_cast<uint64_t>(material_id) & 0xFFFF) << 32
+         | depth_bits;
+}
+
+DrawStats& DrawStats::operator+=(DrawStats const& rhs) {
+    draws += rhs.draws;
+    pipeline_binds += rhs.pipeline_binds;
+    descriptor_binds += rhs.descriptor_binds;
+    vertex_buffer_binds += rhs.vertex_buffer_binds;
+    index_buffer_binds += rhs.index_buffer_binds;
+    push_constant_updates += rhs.push_constant_updates;
+    binds_elided += rhs.binds_elided;
+    return *this;
+}
+
+void DrawStats::report(std::ostream& out, size_t frames) const {
+    if (frames == 0) {
+        return;
+    }
+    out << "per frame: " << draws / frames << " draws, " 
+        << pipeline_binds / frames << " pipeline binds, "
+        << descriptor_binds / frames << " descriptor set binds, "
+        << vertex_buffer_binds / frames << " vertex buffer binds, "
+        << index_buffer_binds / frames << " index buffer binds, "
+        << push_constant_updates / frames << " push constant updates, "
+        << binds_elided / frames << " binds elided\n";
+}
+
+void DrawList::clear() {
+    draws.clear();
+    order.clear();
+}
+
+void DrawList::add(DrawCommand const& draw) {
+    draws.push_back(draw);
+}
+
+size_t DrawList::size() const {
+    return draws.size();
+}
+
+void DrawList::sort(ThreadPool& workers) {
+    size_t const count = draws.size();
+    order.resize(count);
+    scratch.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        order[i] = SortEntry{ draws[i].sort_key, static_cast<uint32_t>(i) };
+    }
+
+    bool const parallel = count >= parallel_sort_threshold;
+    // Must match the way ThreadPool::parallel_for splits up the list
+    size_t const chunks = parallel ? std::max<size_t>(1, std::min(workers.chunk_count(), count)) : 1;
+    histograms.resize(chunks);
+
+    auto for_each_chunk = [&](auto const& func) {
+        if (parallel) {
+            workers.parallel_for(count, func);
+        } else {
+            func(0, 0, count);
+        }
+    };
+
+    // LSD radix sort, 8 bits per pass
+    for (uint32_t shift = 0; shift < 64; shift += 8) {
+        for_each_chunk([&](size_t chunk, size_t begin, size_t end) {
+            auto& histogram = histograms[chunk];
+            histogram.fill(0);
+            for (size_t i = begin; i < end; ++i) {
+                ++histogram[(order[i].key >> shift) & 0xFF];
+            }
+        });
+
+        // Exclusive prefix sum over (bucket, chunk), so each chunk knows where to write each bucket.
+        // If all keys share the same byte this pass would not change the order, so skip it.
+        bool skip_pass = false;
+        uint32_t offset = 0;
+        for (size_t bucket = 0; bucket < 256; ++bucket) {
+            uint32_t const bucket_start = offset;
+            for (size_t chunk = 0; chunk < chunks; ++chunk) {
+                uint32_t const amount = histograms[chunk][bucket];
+                histograms[chunk][bucket] = offset;
+                offset += amount;
+            }
+            if (offset - bucket_start == count) {
+                skip_pass = true;
+                break;
+            }
+        }
+        if (skip_pass) {
+            continue;
+        }
+
+        for_each_chunk([&](size_t chunk, size_t begin, size_t end) {
+            auto& offsets = histograms[chunk];
+            for (size_t i = begin; i < end; ++i) {
+                scratch[offsets[(order[i].key >> shift) & 0xFF]++] = order[i];
+            }
+        });
+        order.swap(scratch);
+    }
+}
+
+void DrawList::record(vk::CommandBuffer cmd_buf, vk::PipelineLayout layout, DrawStats& stats) const {
+    vk::Pipeline bound_pipeline;
+    vk::DescriptorSet bound_set;
+    std::array<uint32_t, 2> bound_offsets = {};
+    vk::Buffer bound_vertex_buffer;
+    vk::Buffer bound_index_buffer;
+    DrawConstants pushed_constants;
+    bool constants_pushed = false;
+
+    for (auto const& entry : order) {
+        DrawCommand const& draw = draws[entry.index];
+
+        if (draw.pipeline != bound_pipeline) {
+            cmd_buf.bindPipeline(vk::PipelineBindPoint::eGraphics, draw.pipeline);
+            bound_pipeline = draw.pipeline;
+            ++stats.pipeline_binds;
+        } else {
+            ++stats.binds_elided;
+        }
+
+        if (draw.descriptor_set != bound_set || draw.dynamic_offsets != bound_offsets) {
+            cmd_buf.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, layout, 0, draw.descriptor_set, 
+                                       draw.dynamic_offsets);
+            bound_set = draw.descriptor_set;
+            bound_offsets = draw.dynamic_offsets;
+            ++stats.descriptor_binds;
+        } else {
+            ++stats.binds_elided;
+        }
+
+        // Vertex pulling pipelines have no vertex input at all
+        if (draw.vertex_buffer && draw.vertex_buffer != bound_vertex_buffer) {
+            vk::DeviceSize const offset = 0;
+            cmd_buf.bindVertexBuffers(0, draw.vertex_buffer, offset);
+            bound_vertex_buffer = draw.vertex_buffer;
+            ++stats.vertex_buffer_binds;
+        } else if (draw.vertex_buffer) {
+            ++stats.binds_elided;
+        }
+
+        // Push constants stay valid across pipeline binds, since every pipeline shares the same layout
+        if (!constants_pushed || std::memcmp(&draw.constants, &pushed_constants, sizeof(DrawConstants)) != 0) {
+            cmd_buf.pushConstants<DrawConstants>(layout, vk::ShaderStageFlagBits::eVertex, 0, draw.constants);
+            pushed_constants = draw.constants;
+            constants_pushed = true;
+            ++stats.push_constant_updates;
+        } else {
+            ++stats.binds_elided;
+        }
+
+        if (draw.index_buffer != bound_index_buffer) {
+            cmd_buf.bindIndexBuffer(draw.index_buffer, 0, vk::IndexType::eUint32);
+            bound_index_buffer = draw.index_buffer;
+            ++stats.index_buffer_binds;
+        } else {
+            ++stats.binds_elided;
+        }
+
+        cmd_buf.drawIndexed(draw.index_count, draw.instance_count, draw.first_index, draw.vertex_offset, draw.first_instance);
+        ++stats.draws;
+    }
+}
@@ -0,0 +1,342 @@
+#include "DynamicResolution.hpp"
+
+#include "MemoryBudget.hpp"
+#include "VkBuffer.hpp"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <iostream>
+
+// Weight of the newest measurement in the moving average
+constexpr double smoothing = 0.2;
+// Aim this far below the target, so ordinary frame to frame noise does not push frames over it
+constexpr double headroom = 0.9;
+// Leave the scale alone while the smoothed time is this close to the aim, so the resolution does not hunt around it
+constexpr double dead_band = 0.05;
+// Fraction of the way to the wanted scale taken per frame. Dropping is quick to avoid missed frames, recovering is
+// slow because measurements lag a few frames behind.
+constexpr float decrease_rate = 0.5f;
+constexpr float increase_rate = 0.1f;
+
+DynamicResolution::DynamicResolution(vk::PhysicalDevice physical_device, vk::Device device, vk::PipelineCache cache,
+                                     vk::Format format, vk::Extent2D extent, vk::SampleCountFlagBits samples,
+                                     vk::RenderPass present_pass, Shaders const& shaders, double target_milliseconds,
+                                     size_t slot_count)
+    : device(device), extent(extent), target_ms(target_milliseconds), timed(slot_count, false) {
+
+    timestamps_supported = physical_device.getProperties().limits.timestampComputeAndGraphics;
+    if (!timestamps_supported) {
+        std::cerr << "The device has no timestamps on graphics queues, the scene is always drawn at full resolution\n";
+    }
+    for (size_t i = 0; i < slot_count; ++i) {
+        timers.push_back(std::make_unique<GpuTimer>(physical_device, device, 1));
+    }
+
+    create_target(physical_device, format, samples);
+    create_upscale_pipeline(cache, present_pass, shaders);
+}
+
+DynamicResolution::~DynamicResolution() {
+    device.destroyPipeline(upscale_pipeline);
+    device.destroyPipelineLayout(upscale_layout);
+    device.destroyDescriptorPool(descriptor_pool);
+    device.destroyDescriptorSetLayout(descriptor_set_layout);
+    device.destroySampler(sampler);
+    device.destroyFramebuffer(framebuffer);
+    device.destroyRenderPass(render_pass);
+    multisample_target.reset();
+    device.destroyImageView(image_view);
+    device.destroyImage(image);
+    free_device_memory(device, image_memory);
+}
+
+void DynamicResolution::create_target(vk::PhysicalDevice physical_device, vk::Format format,
+                                      vk::SampleCountFlagBits samples) {
+    vk::ImageCreateInfo image_info;
+    image_info.imageType = vk::ImageType::e2D;
+    image_info.extent = vk::Extent3D{ extent.width, extent.height, 1 };
+    image_info.mipLevels = 1;
+    image_info.arrayLayers = 1;
+    image_info.format = format;
+    image_info.tiling = vk::ImageTiling::eOptimal;
+    image_info.initialLayout = vk::ImageLayout::eUndefined;
+    image_info.usage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eSampled;
+    image_info.samples = vk::SampleCountFlagBits::e1;
+    image_info.sharingMode = vk::SharingMode::eExclusive;
+    image = device.createImage(image_info);
+
+    vk::MemoryRequirements const requirements = device.getImageMemoryRequirements(image);
+    vk::MemoryAllocateInfo alloc_info;
+    alloc_info.allocationSize = requirements.size;
+    alloc_info.memoryTypeIndex = find_memory_type(physical_device, requirements.memoryTypeBits,
+                                                  vk::MemoryPropertyFlagBits::eDeviceLocal);
+    image_memory = allocate_device_memory(physical_device, device, alloc_info);
+    device.bindImageMemory(image, image_memory, 0);
+
+    vk::ImageViewCreateInfo view_info;
+    view_info.image = image;
+    view_info.viewType = vk::ImageViewType::e2D;
+    view_info.format = format;
+    view_info.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
+    view_info.subresourceRange.levelCount = 1;
+    view_info.subresourceRange.layerCount = 1;
+    image_view = device.createImageView(view_info);
+
+    // The previous frame's upscale has to be done reading before the target is cleared, and this frame's upscale
+    // has to wait for the scene to be written
+    std::array<vk::SubpassDependency, 2> dependencies;
+    dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[0].dstSubpass = 0;
+    dependencies[0].srcStageMask = vk::PipelineStageFlagBits::eFragmentShader;
+    dependencies[0].dstStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+    dependencies[0].dstAccessMask = vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite;
+    dependencies[1].srcSubpass = 0;
+    dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[1].srcStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+    dependencies[1].srcAccessMask = vk::AccessFlagBits::eColorAttachmentWrite;
+    dependencies[1].dstStageMask = vk::PipelineStageFlagBits::eFragmentShader;
+    dependencies[1].dstAccessMask = vk::AccessFlagBits::eShaderRead;
+    if (samples != vk::SampleCountFlagBits::e1) {
+        // Every frame draws into the same multisampled image, so the previous frame's writes have to be done too
+        dependencies[0].srcStageMask |= vk::PipelineStageFlagBits::eColorAttachmentOutput;
+        dependencies[0].srcAccessMask = vk::AccessFlagBits::eColorAttachmentWrite;
+    }
+
+    // The target is sampled by the upscale afterwards, so it is stored. Multisampled, only the resolved image is.
+    render_pass = create_color_render_pass(device, format, samples, vk::ImageLayout::eShaderReadOnlyOptimal,
+                                           dependencies);
+
+    std::vector<vk::ImageView> attachments;
+    if (samples != vk::SampleCountFlagBits::e1) {
+        multisample_target = std::make_unique<MultisampleTarget>(physical_device, device, format, extent, samples);
+        attachments.push_back(multisample_target->view());
+    }
+    attachments.push_back(image_view);
+    vk::FramebufferCreateInfo framebuffer_info;
+    framebuffer_info.renderPass = render_pass;
+    framebuffer_info.attachmentCount = attachments.size();
+    framebuffer_info.pAttachments = attachments.data();
+    framebuffer_info.width = extent.width;
+    framebuffer_info.height = extent.height;
+    framebuffer_info.layers = 1;
+    framebuffer = device.createFramebuffer(framebuffer_info);
+}
+
+void DynamicResolution::create_upscale_pipeline(vk::PipelineCache cache, vk::RenderPass present_pass,
+                                                Shaders const& shaders) {
+    // Bilinear filtering is the upscaler
+    vk::SamplerCreateInfo sampler_info;
+    sampler_info.magFilter = vk::Filter::eLinear;
+    sampler_info.minFilter = vk::Filter::eLinear;
+    sampler_info.mipmapMode = vk::SamplerMipmapMode::eNearest;
+    sampler_info.addressModeU = vk::SamplerAddressMode::eClampToEdge;
+    sampler_info.addressModeV = vk::SamplerAddressMode::eClampToEdge;
+    sampler_info.addressModeW = vk::SamplerAddressMode::eClampToEdge;
+    sampler = device.createSampler(sampler_info);
+
+    vk::DescriptorSetLayoutBinding binding;
+    binding.binding = 0;
+    binding.descriptorType = vk::DescriptorType::eCombinedImageSampler;
+    binding.descriptorCount = 1;
+    binding.stageFlags = vk::ShaderStageFlagBits::eFragment;
+    vk::DescriptorSetLayoutCreateInfo layout_info;
+    layout_info.bindingCount = 1;
+    layout_info.pBindings = &binding;
+    descriptor_set_layout = device.createDescriptorSetLayout(layout_info);
+
+    // The set never changes, so it gets a pool of its own instead of going through the per-frame allocator
+    vk::DescriptorPoolSize pool_size;
+    pool_size.type = vk::DescriptorType::eCombinedImageSampler;
+    pool_size.descriptorCount = 1;
+    vk::DescriptorPoolCreateInfo pool_info;
+    pool_info.maxSets = 1;
+    pool_info.poolSizeCount = 1;
+    pool_info.pPoolSizes = &pool_size;
+    descriptor_pool = device.createDescriptorPool(pool_info);
+
+    vk::DescriptorSetAllocateInfo alloc_info;
+    alloc_info.descriptorPool = descriptor_pool;
+    alloc_info.descriptorSetCount = 1;
+    alloc_info.pSetLayouts = &descriptor_set_layout;
+    descriptor_set = device.allocateDescriptorSets(alloc_info)[0];
+
+    vk::DescriptorImageInfo image_info(sampler, image_view, vk::ImageLayout::eShaderReadOnlyOptimal);
+    vk::WriteDescriptorSet write;
+    write.dstSet = descriptor_set;
+    write.dstBinding = 0;
+    write.descriptorCount = 1;
+    write.descriptorType = vk::DescriptorType::eCombinedImageSampler;
+    write.pImageInfo = &image_info;
+    device.updateDescriptorSets(write, nullptr);
+
+    vk::PushConstantRange push_range;
+    push_range.stageFlags = vk::ShaderStageFlagBits::eFragment;
+    push_range.offset = 0;
+    push_range.size = sizeof(glm::vec4);
+    vk::PipelineLayoutCreateInfo pipeline_layout_info;
+    pipeline_layout_info.setLayoutCount = 1;
+    pipeline_layout_info.pSetLayouts = &descriptor_set_layout;
+    pipeline_layout_info.pushConstantRangeCount = 1;
+    pipeline_layout_info.pPushConstantRanges = &push_range;
+    upscale_layout = device.createPipelineLayout(pipeline_layout_info);
+
+    vk::ShaderModuleCreateInfo module_info;
+    module_info.codeSize = shaders.upscale_vert.size();
+    module_info.pCode = reinterpret_cast<uint32_t const*>(shaders.upscale_vert.data());
+    vk::ShaderModule const vert_module = device.createShaderModule(module_info);
+    module_info.codeSize = shaders.upscale_frag.size();
+    module_info.pCode = reinterpret_cast<uint32_t const*>(shaders.upscale_frag.data());
+    vk::ShaderModule const frag_module = device.createShaderModule(module_info);
+
+    vk::PipelineShaderStageCreateInfo shader_stages[2];
+    shader_stages[0].stage = vk::ShaderStageFlagBits::eVertex;
+    shader_stages[0].module = vert_module;
+    shader_stages[0].pName = "main";
+    shader_stages[1].stage = vk::ShaderStageFlagBits::eFragment;
+    shader_stages[1].module = frag_module;
+    shader_stages[1].pName = "main";
+
+    // A single triangle generated from the vertex index
+    vk::PipelineVertexInputStateCreateInfo vertex_input_info;
+
+    vk::PipelineInputAssemblyStateCreateInfo input_assembly_info;
+    input_assembly_info.topology = vk::PrimitiveTopology::eTriangleList;
+
+    vk::Viewport viewport;
+    viewport.width = extent.width;
+    viewport.height = extent.height;
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+    vk::Rect2D scissor;
+    scissor.extent = extent;
+    vk::PipelineViewportStateCreateInfo viewport_info;
+    viewport_info.viewportCount = 1;
+    viewport_info.pViewports = &viewport;
+    viewport_info.scissorCount = 1;
+    viewport_info.pScissors = &scissor;
+
+    vk::PipelineRasterizationStateCreateInfo rasterization_info;
+    rasterization_info.polygonMode = vk::PolygonMode::eFill;
+    rasterization_info.lineWidth = 1.0f;
+    rasterization_info.cullMode = vk::CullModeFlagBits::eNone;
+
+    vk::PipelineMultisampleStateCreateInfo multisample_info;
+    multisample_info.rasterizationSamples = vk::SampleCountFlagBits::e1;
+
+    vk::PipelineColorBlendAttachmentState color_blend_attachment;
+    color_blend_attachment.colorWriteMask = vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG
+                                          | vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA;
+    vk::PipelineColorBlendStateCreateInfo color_blend_info;
+    color_blend_info.attachmentCount = 1;
+    color_blend_info.pAttachments = &color_blend_attachment;
+
+    vk::GraphicsPipelineCreateInfo pipeline_info;
+    pipeline_info.stageCount = 2;
+    pipeline_info.pStages = shader_stages;
+    pipeline_info.pVertexInputState = &vertex_input_info;
+    pipeline_info.pInputAssemblyState = &input_assembly_info;
+    pipeline_info.pViewportState = &viewport_info;
+    pipeline_info.pRasterizationState = &rasterization_info;
+    pipeline_info.pMultisampleState = &multisample_info;
+    pipeline_info.pColorBlendState = &color_blend_info;
+    pipeline_info.layout = upscale_layout;
+    pipeline_info.renderPass = present_pass;
+    pipeline_info.subpass = 0;
+
+    try {
+        upscale_pipeline = device.createGraphicsPipeline(cache, pipeline_info);
+    } catch (...) {
+        device.destroyShaderModule(vert_module);
+        device.destroyShaderModule(frag_module);
+        throw;
+    }
+    device.destroyShaderModule(vert_module);
+    device.destroyShaderModule(frag_module);
+}
+
+void DynamicResolution::update(size_t slot) {
+    if (timed[slot]) {
+        double const milliseconds = timers[slot]->read_milliseconds(0);
+        timed[slot] = false;
+        adjust(milliseconds);
+        stats.gpu_milliseconds_sum += milliseconds;
+        ++stats.timed_frames;
+    }
+    ++stats.frames;
+    stats.scale_sum += scale;
+    stats.lowest_scale = std::min(stats.lowest_scale, scale);
+}
+
+void DynamicResolution::adjust(double gpu_milliseconds) {
+    smoothed_ms = smoothed_ms < 0.0 ? gpu_milliseconds : smoothed_ms + (gpu_milliseconds - smoothed_ms) * smoothing;
+    double const ratio = target_ms * headroom / std::max(smoothed_ms, 1e-3);
+    if (std::abs(ratio - 1.0) < dead_band) {
+        return;
+    }
+    // Most of the GPU time scales with the pixel count, so with the square of the scale
+    float const wanted = scale * static_cast<float>(std::sqrt(ratio));
+    float const rate = wanted < scale ? decrease_rate : increase_rate;
+    scale = std::clamp(scale + (wanted - scale) * rate, min_scale, max_scale);
+}
+
+vk::Extent2D DynamicResolution::render_extent() const {
+    return vk::Extent2D{ std::max(1u, static_cast<uint32_t>(std::lround(extent.width * scale))),
+                         std::max(1u, static_cast<uint32_t>(std::lround(extent.height * scale))) };
+}
+
+vk::RenderPass DynamicResolution::scene_render_pass() const {
+    return render_pass;
+}
+
+vk::Framebuffer DynamicResolution::scene_framebuffer() const {
+    return framebuffer;
+}
+
+void DynamicResolution::begin_timing(vk::CommandBuffer cmd, size_t slot) {
+    if (!timestamps_supported) {
+        return;
+    }
+    timers[slot]->reset(cmd);
+    timers[slot]->begin(cmd, 0);
+}
+
+void DynamicResolution::end_timing(vk::CommandBuffer cmd, size_t slot) {
+    if (!timestamps_supported) {
+        return;
+    }
+    timers[slot]->end(cmd, 0);
+    timed[slot] = true;
+}
+
+void DynamicResolution::record_upscale(vk::CommandBuffer cmd) {
+    vk::Extent2D const rendered = render_extent();
+    glm::vec4 const uv_scale_max(float(rendered.width) / extent.width, float(rendered.height) / extent.height,
+                                 (rendered.width - 0.5f) / extent.width, (rendered.height - 0.5f) / extent.height);
+    cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, upscale_pipeline);
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, upscale_layout, 0, descriptor_set, nullptr);
+    cmd.pushConstants<glm::vec4>(upscale_layout, vk::ShaderStageFlagBits::eFragment, 0, uv_scale_max);
+    cmd.draw(3, 1, 0, 0);
+}
+
+DynamicResolution::Stats DynamicResolution::take_stats() {
+    Stats taken = stats;
+    taken.target_milliseconds = target_ms;
+    stats = Stats{};
+    return taken;
+}
+
+void DynamicResolution::Stats::report(std::ostream& out) const {
+    if (frames == 0) {
+        return;
+    }
+    out << "dynamic resolution: " << scale_sum / frames * 100.0 << "% average scale, " << lowest_scale * 100.0f
+        << "% lowest";
+    if (timed_frames > 0) {
+        out << ", " << gpu_milliseconds_sum / timed_frames << " ms scene GPU time (target " << target_milliseconds
+            << " ms)";
+    }
+    out << "\n";
+}
@@ -0,0 +1,151 @@
+#include "FrameCapture.hpp"
+
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+// Start of a capture file, followed by the header and the frames
+constexpr uint32_t capture_magic = 0x50414346; // "FCAP"
+constexpr uint32_t capture_version = 1;
+// Start of every frame, to notice when reading goes off the rails
+constexpr uint32_t frame_tag = 0x454d5246; // "FRME"
+
+template <typename T>
+static void write_value(std::ofstream& file, T const& value) {
+    file.write(reinterpret_cast<char const*>(&value), sizeof(T));
+}
+
+template <typename T>
+static T read_value(std::ifstream& file) {
+    T value;
+    file.read(reinterpret_cast<char*>(&value), sizeof(T));
+    return value;
+}
+
+// Write the runs of elements that differ from previous, and update previous to match. Everything is written when
+// previous is empty.
+template <typename T>
+static void write_changes(std::ofstream& file, T const* elements, uint32_t count, std::vector<T>& previous) {
+    auto const changed = [&](uint32_t i) {
+        return previous.empty() || std::memcmp(&elements[i], &previous[i], sizeof(T)) != 0;
+    };
+
+    std::vector<std::pair<uint32_t, uint32_t>> runs;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (!changed(i)) {
+            continue;
+        }
+        uint32_t const first = i;
+        while (i < count && changed(i)) {
+            ++i;
+        }
+        runs.emplace_back(first, i - first);
+    }
+
+    write_value(file, static_cast<uint32_t>(runs.size()));
+    for (auto const& [first, run_count] : runs) {
+        write_value(file, first);
+        write_value(file, run_count);
+        file.write(reinterpret_cast<char const*>(elements + first), sizeof(T) * run_count);
+    }
+    previous.assign(elements, elements + count);
+}
+
+template <typename T>
+static void read_changes(std::ifstream& file, std::string const& path, T* elements, uint32_t count) {
+    uint32_t const run_count = read_value<uint32_t>(file);
+    for (uint32_t run = 0; run < run_count && file; ++run) {
+        uint32_t const first = read_value<uint32_t>(file);
+        uint32_t const length = read_value<uint32_t>(file);
+        if (!file || first > count || length > count - first) {
+            throw std::runtime_error(path + " is corrupt, a frame changes elements past the end");
+        }
+        file.read(reinterpret_cast<char*>(elements + first), sizeof(T) * length);
+    }
+}
+
+static CaptureHeader read_header(std::ifstream& file, std::string const& path) {
+    if (read_value<uint32_t>(file) != capture_magic || read_value<uint32_t>(file) != capture_version) {
+        throw std::runtime_error(path + " is not a frame capture, or was written by another version");
+    }
+    CaptureHeader header;
+    header.width = read_value<uint32_t>(file);
+    header.height = read_value<uint32_t>(file);
+    header.instance_count = read_value<uint32_t>(file);
+    header.light_count = read_value<uint32_t>(file);
+    if (!file) {
+        throw std::runtime_error("Failed to read " + path);
+    }
+    return header;
+}
+
+CaptureHeader read_capture_header(std::string const& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Failed to open " + path);
+    }
+    return read_header(file, path);
+}
+
+CaptureWriter::CaptureWriter(std::string const& path, CaptureHeader const& header)
+    : path(path), file(path, std::ios::binary), header(header) {
+    if (!file) {
+        throw std::runtime_error("Failed to open " + path + " for writing");
+    }
+    write_value(file, capture_magic);
+    write_value(file, capture_version);
+    write_value(file, header.width);
+    write_value(file, header.height);
+    write_value(file, header.instance_count);
+    write_value(file, header.light_count);
+}
+
+void CaptureWriter::write_frame(float time, glm::mat4 const& view, glm::mat4 const& projection,
+                                glm::mat4 const* instances, PointLight const* lights) {
+    write_value(file, frame_tag);
+    write_value(file, time);
+    write_value(file, view);
+    write_value(file, projection);
+    write_changes(file, instances, header.instance_count, previous_instances);
+    write_changes(file, lights, header.light_count, previous_lights);
+    if (!file) {
+        throw std::runtime_error("Failed to write " + path);
+    }
+    ++frames;
+}
+
+size_t CaptureWriter::frame_count() const {
+    return frames;
+}
+
+CaptureReader::CaptureReader(std::string const& path) : path(path), file(path, std::ios::binary) {
+    if (!file) {
+        throw std::runtime_error("Failed to open " + path);
+    }
+    capture_header = read_header(file, path);
+}
+
+CaptureHeader const& CaptureReader::header() const {
+    return capture_header;
+}
+
+bool CaptureReader::read_frame(float& time, glm::mat4& view, glm::mat4& projection, glm::mat4* instances,
+                               PointLight* lights) {
+    uint32_t const tag = read_value<uint32_t>(file);
+    // Ending cleanly between two frames
+    if (file.eof() && file.gcount() == 0) {
+        return false;
+    }
+    if (!file || tag != frame_tag) {
+        throw std::runtime_error(path + " is corrupt, expected the start of a frame");
+    }
+    time = read_value<float>(file);
+    view = read_value<glm::mat4>(file);
+    projection = read_value<glm::mat4>(file);
+    read_changes(file, path, instances, capture_header.instance_count);
+    read_changes(file, path, lights, capture_header.light_count);
+    if (!file) {
+        throw std::runtime_error("Failed to read " + path + ", the last frame is truncated");
+    }
+    return true;
+}
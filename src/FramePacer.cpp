@@ -0,0 +1,96 @@
+#include "FramePacer.hpp"
+
+#include <algorithm>
+#include <thread>
+
+static double to_ms(FramePacer::clock::duration duration) {
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+FramePacer::FramePacer(double fps_limit, size_t frames_in_flight) : frames(frames_in_flight) {
+    if (fps_limit > 0.0) {
+        frame_period = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0 / fps_limit));
+    }
+}
+
+void FramePacer::wait_for_input_sample() {
+    if (frame_period == clock::duration::zero()) {
+        return;
+    }
+
+    clock::time_point const now = clock::now();
+    if (next_deadline == clock::time_point{}) {
+        next_deadline = now + frame_period;
+    }
+
+    clock::time_point const sample_time = next_deadline - work_estimate - safety_margin;
+    // Sleeping is not very accurate, so sleep most of the way and spin for the rest
+    constexpr auto spin_time = std::chrono::milliseconds(1);
+    if (sample_time - now > spin_time) {
+        std::this_thread::sleep_until(sample_time - spin_time);
+    }
+    while (clock::now() < sample_time) {
+        std::this_thread::yield();
+    }
+}
+
+void FramePacer::input_sampled(size_t frame_slot) {
+    frames[frame_slot].input = clock::now();
+}
+
+void FramePacer::presented(size_t frame_slot) {
+    clock::time_point const now = clock::now();
+    FrameTimes& frame = frames[frame_slot];
+    frame.in_flight = true;
+
+    clock::duration const latency = now - frame.input;
+    // Exponential moving average, recent frames weigh more
+    work_estimate = work_estimate == clock::duration::zero() ? latency : (work_estimate * 7 + latency) / 8;
+
+    stats.frames += 1;
+    stats.present_latency_total += to_ms(latency);
+    stats.present_latency_max = std::max(stats.present_latency_max, to_ms(latency));
+
+    if (frame_period != clock::duration::zero()) {
+        next_deadline += frame_period;
+        // If we missed the deadline, start over from now instead of trying to catch up with a burst of frames
+        if (next_deadline < now) {
+            next_deadline = now + frame_period;
+        }
+    }
+}
+
+void FramePacer::gpu_completed(size_t frame_slot) {
+    FrameTimes& frame = frames[frame_slot];
+    if (!frame.in_flight) {
+        return;
+    }
+    frame.in_flight = false;
+
+    // We only notice completion when waiting on the frame's fence, so this is an upper bound
+    double const latency = to_ms(clock::now() - frame.input);
+    stats.completed_frames += 1;
+    stats.gpu_latency_total += latency;
+    stats.gpu_latency_max = std::max(stats.gpu_latency_max, latency);
+}
+
+bool FramePacer::report(std::ostream& out) {
+    constexpr auto interval = std::chrono::seconds(3);
+    clock::time_point const now = clock::now();
+    if (now - stats.start < interval || stats.frames == 0) {
+        return false;
+    }
+
+    double const seconds = std::chrono::duration<double>(now - stats.start).count();
+    out << "fps: " << stats.frames / seconds
+        << " | input to present: " << stats.present_latency_total / stats.frames << " ms avg, "
+        << stats.present_latency_max << " ms max";
+    if (stats.completed_frames > 0) {
+        out << " | input to gpu done: <= " << stats.gpu_latency_total / stats.completed_frames << " ms avg, "
+            << stats.gpu_latency_max << " ms max";
+    }
+    out << "\n";
+
+    stats = Stats{};
+    return true;
+}
@@ -0,0 +1,199 @@
+#include "GeometryPool.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+
+GeometryPool::GeometryPool(vk::PhysicalDevice physical_device, vk::Device device, uint32_t vertex_stride,
+                           uint32_t vertex_capacity, uint32_t index_capacity, vk::BufferUsageFlags extra_vertex_usage)
+    : physical_device(physical_device), device(device), vertex_stride(vertex_stride),
+      vertex_ranges(vertex_capacity), index_ranges(index_capacity) {
+
+    vertices = Buffer(physical_device, device, vk::DeviceSize(vertex_capacity) * vertex_stride,
+                      vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eVertexBuffer | extra_vertex_usage,
+                      vk::MemoryPropertyFlagBits::eDeviceLocal);
+    indices = Buffer(physical_device, device, vk::DeviceSize(index_capacity) * sizeof(uint32_t),
+                     vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eIndexBuffer,
+                     vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+    if (extra_vertex_usage & vk::BufferUsageFlagBits::eShaderDeviceAddress) {
+        vertices_address = vertices.device_address();
+    }
+}
+
+MeshHandle GeometryPool::add_mesh(void const* vertex_data, uint32_t vertex_count, 
+                                  uint32_t const* index_data, uint32_t index_count) {
+    if (vertex_count == 0 || index_count == 0) {
+        throw std::invalid_argument("Meshes need at least one vertex and one index");
+    }
+
+    auto const vertex_offset = vertex_ranges.allocate(vertex_count);
+    if (!vertex_offset) {
+        throw std::runtime_error("Geometry pool is out of vertex space");
+    }
+    auto const first_index = index_ranges.allocate(index_count);
+    if (!first_index) {
+        vertex_ranges.free(*vertex_offset, vertex_count);
+        throw std::runtime_error("Geometry pool is out of index space");
+    }
+
+    MeshRange range;
+    range.vertex_offset = static_cast<int32_t>(*vertex_offset);
+    range.vertex_count = vertex_count;
+    range.first_index = static_cast<uint32_t>(*first_index);
+    range.index_count = index_count;
+
+    MeshHandle handle;
+    if (free_handles.empty()) {
+        handle = meshes.size();
+        meshes.push_back(range);
+    } else {
+        handle = free_handles.back();
+        free_handles.pop_back();
+        meshes[handle] = range;
+    }
+
+    // Queue the data for upload
+    size_t const vertex_bytes = size_t(vertex_count) * vertex_stride;
+    size_t const index_bytes = size_t(index_count) * sizeof(uint32_t);
+    PendingUpload upload;
+    upload.mesh = handle;
+    upload.vertex_data_offset = staging_data.size();
+    upload.index_data_offset = staging_data.size() + vertex_bytes;
+    staging_data.resize(staging_data.size() + vertex_bytes + index_bytes);
+    std::memcpy(staging_data.data() + upload.vertex_data_offset, vertex_data, vertex_bytes);
+    std::memcpy(staging_data.data() + upload.index_data_offset, index_data, index_bytes);
+    pending.push_back(upload);
+
+    return handle;
+}
+
+void GeometryPool::remove_mesh(MeshHandle mesh) {
+    assert(mesh < meshes.size() && meshes[mesh].index_count > 0 && "Invalid mesh handle");
+    MeshRange& range = meshes[mesh];
+    vertex_ranges.free(range.vertex_offset, range.vertex_count);
+    index_ranges.free(range.first_index, range.index_count);
+    range = MeshRange{};
+    free_handles.push_back(mesh);
+
+    // The space may be handed out again before the next flush, so the old data must not be uploaded into it
+    pending.erase(std::remove_if(pending.begin(), pending.end(), 
+                                 [mesh](PendingUpload const& upload) { return upload.mesh == mesh; }),
+                  pending.end());
+    // Staged data of the meshes still waiting is picked out by offset, the rest is only dropped once none are left
+    if (pending.empty()) {
+        staging_data.clear();
+    }
+}
+
+MeshRange const& GeometryPool::mesh(MeshHandle mesh) const {
+    assert(mesh < meshes.size() && meshes[mesh].index_count > 0 && "Invalid mesh handle");
+    return meshes[mesh];
+}
+
+void GeometryPool::flush(vk::CommandPool cmd_pool, vk::Queue queue) {
+    if (pending.empty()) {
+        staging_data.clear();
+        return;
+    }
+
+    vk::CommandBufferAllocateInfo cmdbuf_info;
+    cmdbuf_info.commandBufferCount = 1;
+    cmdbuf_info.level = vk::CommandBufferLevel::ePrimary;
+    cmdbuf_info.commandPool = cmd_pool;
+    vk::CommandBuffer cmd_buffer = device.allocateCommandBuffers(cmdbuf_info)[0];
+
+    vk::CommandBufferBeginInfo begin_info;
+    begin_info.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+    cmd_buffer.begin(begin_info);
+    Buffer const staging_buffer = record_uploads(cmd_buffer);
+    cmd_buffer.end();
+
+    vk::SubmitInfo submit_info;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &cmd_buffer;
+    queue.submit(submit_info, nullptr);
+    queue.waitIdle();
+
+    device.freeCommandBuffers(cmd_pool, cmd_buffer);
+}
+
+Buffer GeometryPool::record_uploads(vk::CommandBuffer cmd) {
+    if (pending.empty()) {
+        staging_data.clear();
+        return Buffer();
+    }
+
+    // Only the data of meshes that are still waiting is staged, meshes removed before their upload leave nothing
+    // behind
+    vk::DeviceSize staging_size = 0;
+    for (auto const& upload : pending) {
+        MeshRange const& range = meshes[upload.mesh];
+        staging_size += vk::DeviceSize(range.vertex_count) * vertex_stride
+                        + vk::DeviceSize(range.index_count) * sizeof(uint32_t);
+    }
+    Buffer staging_buffer(physical_device, device, staging_size, vk::BufferUsageFlagBits::eTransferSrc,
+                          vk::MemoryPropertyFlagBits::eHostCoherent | vk::MemoryPropertyFlagBits::eHostVisible);
+    uint8_t* const data_ptr = static_cast<uint8_t*>(device.mapMemory(staging_buffer.memory_handle(), 0, staging_size));
+
+    std::vector<vk::BufferCopy> vertex_copies;
+    std::vector<vk::BufferCopy> index_copies;
+    vertex_copies.reserve(pending.size());
+    index_copies.reserve(pending.size());
+    vk::DeviceSize staging_offset = 0;
+    for (auto const& upload : pending) {
+        MeshRange const& range = meshes[upload.mesh];
+        vk::DeviceSize const vertex_bytes = vk::DeviceSize(range.vertex_count) * vertex_stride;
+        vk::DeviceSize const index_bytes = vk::DeviceSize(range.index_count) * sizeof(uint32_t);
+        std::memcpy(data_ptr + staging_offset, staging_data.data() + upload.vertex_data_offset, vertex_bytes);
+        std::memcpy(data_ptr + staging_offset + vertex_bytes, staging_data.data() + upload.index_data_offset,
+                    index_bytes);
+        vertex_copies.emplace_back(staging_offset, vk::DeviceSize(range.vertex_offset) * vertex_stride, vertex_bytes);
+        index_copies.emplace_back(staging_offset + vertex_bytes, vk::DeviceSize(range.first_index) * sizeof(uint32_t),
+                                  index_bytes);
+        staging_offset += vertex_bytes + index_bytes;
+    }
+    device.unmapMemory(staging_buffer.memory_handle());
+
+    // One copy command per buffer, no matter how many meshes were added
+    cmd.copyBuffer(staging_buffer.handle(), vertices.handle(), vertex_copies);
+    cmd.copyBuffer(staging_buffer.handle(), indices.handle(), index_copies);
+    // Vertices are read as attributes, or as storage buffers through their address with vertex pulling
+    vk::MemoryBarrier barrier;
+    barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+    barrier.dstAccessMask = vk::AccessFlagBits::eVertexAttributeRead | vk::AccessFlagBits::eIndexRead
+                            | vk::AccessFlagBits::eShaderRead;
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                        vk::PipelineStageFlagBits::eVertexInput | vk::PipelineStageFlagBits::eVertexShader, {},
+                        barrier, nullptr, nullptr);
+
+    pending.clear();
+    staging_data.clear();
+    return staging_buffer;
+}
+
+bool GeometryPool::has_pending_uploads() const {
+    return !pending.empty();
+}
+
+vk::Buffer GeometryPool::vertex_buffer() {
+    return vertices.handle();
+}
+
+vk::Buffer GeometryPool::index_buffer() {
+    return indices.handle();
+}
+
+vk::DeviceAddress GeometryPool::vertex_address(MeshHandle mesh) const {
+    assert(vertices_address != 0 && "Pool was not created with device address support");
+    return vertices_address + vk::DeviceSize(meshes[mesh].vertex_offset) * vertex_stride;
+}
+
+uint32_t GeometryPool::vertices_used() const {
+    return vertex_ranges.used();
+}
+
+uint32_t GeometryPool::indices_used() const {
+    return index_ranges.used();
+}
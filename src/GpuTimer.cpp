@@ -0,0 +1,56 @@
+#include "GpuTimer.hpp"
+
+#include <stdexcept>
+
+GpuTimer::GpuTimer(vk::PhysicalDevice physical_device, vk::Device device, uint32_t range_count)
+    : device(device), range_count(range_count) {
+
+    timestamp_period = physical_device.getProperties().limits.timestampPeriod;
+
+    vk::QueryPoolCreateInfo info;
+    info.queryType = vk::QueryType::eTimestamp;
+    // One query for the start and one for the end of every range
+    info.queryCount = range_count * 2;
+    query_pool = device.createQueryPool(info);
+}
+
+GpuTimer::~GpuTimer() {
+    device.destroyQueryPool(query_pool);
+}
+
+void GpuTimer::reset(vk::CommandBuffer cmd_buf) {
+    cmd_buf.resetQueryPool(query_pool, 0, range_count * 2);
+}
+
+void GpuTimer::begin(vk::CommandBuffer cmd_buf, uint32_t range) {
+    cmd_buf.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, query_pool, range * 2);
+}
+
+void GpuTimer::end(vk::CommandBuffer cmd_buf, uint32_t range) {
+    cmd_buf.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, query_pool, range * 2 + 1);
+}
+
+std::vector<double> GpuTimer::read_milliseconds() {
+    std::vector<uint64_t> timestamps(range_count * 2);
+    vk::Result const result = device.getQueryPoolResults<uint64_t>(query_pool, 0, timestamps.size(), timestamps, 
+        sizeof(uint64_t), vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait);
+    if (result != vk::Result::eSuccess) {
+        throw std::runtime_error("Failed to read GPU timestamps");
+    }
+
+    std::vector<double> milliseconds(range_count);
+    for (uint32_t i = 0; i < range_count; ++i) {
+        milliseconds[i] = (timestamps[i * 2 + 1] - timestamps[i * 2]) * timestamp_period / 1e6;
+    }
+    return milliseconds;
+}
+
+double GpuTimer::read_milliseconds(uint32_t range) {
+    uint64_t timestamps[2];
+    vk::Result const result = device.getQueryPoolResults(query_pool, range * 2, 2, sizeof(timestamps), timestamps,
+        sizeof(uint64_t), vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait);
+    if (result != vk::Result::eSuccess) {
+        throw std::runtime_error("Failed to read GPU timestamps");
+    }
+    return (timestamps[1] - timestamps[0]) * timestamp_period / 1e6;
+}
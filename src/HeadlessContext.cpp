@@ -0,0 +1,152 @@
+#include "HeadlessContext.hpp"
+
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <vector>
+
+static std::optional<uint32_t> find_graphics_compute_family(vk::PhysicalDevice device) {
+    std::vector<vk::QueueFamilyProperties> const families = device.getQueueFamilyProperties();
+    for (uint32_t i = 0; i < families.size(); ++i) {
+        vk::QueueFlags const flags = families[i].queueFlags;
+        if ((flags & vk::QueueFlagBits::eGraphics) && (flags & vk::QueueFlagBits::eCompute)) {
+            return i;
+        }
+    }
+    return std::nullopt;
+}
+
+DeviceUuid physical_device_uuid(vk::PhysicalDevice device) {
+    vk::PhysicalDeviceProperties const properties = device.getProperties();
+    if (properties.apiVersion < VK_API_VERSION_1_1) {
+        return properties.pipelineCacheUUID;
+    }
+    auto const properties2 = device.getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceIDProperties>();
+    return properties2.get<vk::PhysicalDeviceIDProperties>().deviceUUID;
+}
+
+HeadlessContext::HeadlessContext() {
+    create_instance();
+
+    bool found_discrete = false;
+    for (auto device : instance.enumeratePhysicalDevices()) {
+        std::optional<uint32_t> const device_family = find_graphics_compute_family(device);
+        if (!device_family) {
+            continue;
+        }
+        bool const discrete = device.getProperties().deviceType == vk::PhysicalDeviceType::eDiscreteGpu;
+        if (!gpu || (discrete && !found_discrete)) {
+            gpu = device;
+            family = *device_family;
+            found_discrete = discrete;
+        }
+    }
+    if (!gpu) {
+        instance.destroy();
+        throw std::runtime_error("No physical device with a graphics and compute queue found");
+    }
+    std::cout << "Picked physical device: " << gpu.getProperties().deviceName << "\n";
+
+    create_device();
+}
+
+HeadlessContext::HeadlessContext(DeviceUuid const& device_uuid) {
+    create_instance();
+
+    for (auto device : instance.enumeratePhysicalDevices()) {
+        std::optional<uint32_t> const device_family = find_graphics_compute_family(device);
+        if (device_family && physical_device_uuid(device) == device_uuid) {
+            gpu = device;
+            family = *device_family;
+            break;
+        }
+    }
+    if (!gpu) {
+        instance.destroy();
+        throw std::runtime_error("Physical device not found, or it has no graphics and compute queue");
+    }
+
+    create_device();
+}
+
+void HeadlessContext::create_instance() {
+    vk::ApplicationInfo app_info;
+    app_info.pApplicationName = "Vulkan Testing App";
+    app_info.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
+    app_info.pEngineName = "No Engine";
+    app_info.engineVersion = VK_MAKE_VERSION(1, 0, 0);
+    app_info.apiVersion = VK_API_VERSION_1_2;
+
+    // No surface extensions and no validation, this is only used to measure
+    vk::InstanceCreateInfo instance_info;
+    instance_info.pApplicationInfo = &app_info;
+    instance = vk::createInstance(instance_info);
+}
+
+void HeadlessContext::create_device() {
+    float const priority = 1.0f;
+    vk::DeviceQueueCreateInfo queue_info;
+    queue_info.queueFamilyIndex = family;
+    queue_info.queueCount = 1;
+    queue_info.pQueuePriorities = &priority;
+
+    vk::DeviceCreateInfo device_info;
+    device_info.queueCreateInfoCount = 1;
+    device_info.pQueueCreateInfos = &queue_info;
+    logical_device = gpu.createDevice(device_info);
+    device_queue = logical_device.getQueue(family, 0);
+
+    vk::CommandPoolCreateInfo pool_info;
+    pool_info.queueFamilyIndex = family;
+    pool_info.flags = vk::CommandPoolCreateFlagBits::eTransient;
+    pool = logical_device.createCommandPool(pool_info);
+}
+
+HeadlessContext::~HeadlessContext() {
+    logical_device.waitIdle();
+    logical_device.destroyCommandPool(pool);
+    logical_device.destroy();
+    instance.destroy();
+}
+
+vk::PhysicalDevice HeadlessContext::physical_device() const {
+    return gpu;
+}
+
+vk::Device HeadlessContext::device() const {
+    return logical_device;
+}
+
+vk::Queue HeadlessContext::queue() const {
+    return device_queue;
+}
+
+uint32_t HeadlessContext::queue_family() const {
+    return family;
+}
+
+vk::CommandPool HeadlessContext::command_pool() const {
+    return pool;
+}
+
+void HeadlessContext::run(std::function<void(vk::CommandBuffer)> const& record) {
+    vk::CommandBufferAllocateInfo info;
+    info.level = vk::CommandBufferLevel::ePrimary;
+    info.commandBufferCount = 1;
+    info.commandPool = pool;
+    vk::CommandBuffer const cmd = logical_device.allocateCommandBuffers(info)[0];
+
+    vk::CommandBufferBeginInfo begin_info;
+    begin_info.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+    cmd.begin(begin_info);
+    record(cmd);
+    cmd.end();
+
+    vk::SubmitInfo submit_info;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &cmd;
+    device_queue.submit(submit_info, nullptr);
+    device_queue.waitIdle();
+
+    logical_device.freeCommandBuffers(pool, cmd);
+}
@@ -0,0 +1,333 @@
+#include "HostImageUpload.hpp"
+
+#include "MemoryBudget.hpp"
+#include "VkBuffer.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+constexpr vk::MemoryPropertyFlags unified_memory_properties = vk::MemoryPropertyFlagBits::eDeviceLocal |
+                                                              vk::MemoryPropertyFlagBits::eHostVisible |
+                                                              vk::MemoryPropertyFlagBits::eHostCoherent;
+
+static bool has_extension(std::vector<vk::ExtensionProperties> const& extensions, char const* name) {
+    return std::any_of(extensions.begin(), extensions.end(), [&](vk::ExtensionProperties const& extension) {
+        return std::strcmp(extension.extensionName, name) == 0;
+    });
+}
+
+static bool fits(vk::ImageFormatProperties const& properties, uint32_t width, uint32_t height, uint32_t layer_count) {
+    return width <= properties.maxExtent.width && height <= properties.maxExtent.height &&
+           layer_count <= properties.maxArrayLayers;
+}
+
+char const* to_string(ImageUploadPath path) {
+    switch (path) {
+    case ImageUploadPath::Staging:
+        return "staging buffer";
+    case ImageUploadPath::HostImageCopy:
+        return "host image copy";
+    case ImageUploadPath::LinearImage:
+        return "linear host visible image";
+    }
+    return "unknown";
+}
+
+HostImageCopyFeatures::HostImageCopyFeatures(vk::PhysicalDevice physical_device) {
+#ifdef VK_EXT_host_image_copy
+    // The instance is Vulkan 1.2, so what became core in 1.3 comes from extensions
+    extension_names = { VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME, VK_KHR_COPY_COMMANDS_2_EXTENSION_NAME,
+                        VK_KHR_FORMAT_FEATURE_FLAGS_2_EXTENSION_NAME };
+    std::vector<vk::ExtensionProperties> const available = physical_device.enumerateDeviceExtensionProperties();
+    bool const extensions_supported = std::all_of(extension_names.begin(), extension_names.end(), [&](char const* name) {
+        return has_extension(available, name);
+    });
+    if (!extensions_supported || physical_device.getProperties().apiVersion < VK_API_VERSION_1_1) {
+        return;
+    }
+
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_FEATURES_EXT;
+    VkPhysicalDeviceFeatures2 features2 = {};
+    features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features2.pNext = &features;
+    vkGetPhysicalDeviceFeatures2(static_cast<VkPhysicalDevice>(physical_device), &features2);
+    is_supported = features.hostImageCopy == VK_TRUE;
+    features.pNext = nullptr;
+#else
+    (void)physical_device;
+#endif
+}
+
+bool HostImageCopyFeatures::supported() const {
+    return is_supported;
+}
+
+void HostImageCopyFeatures::enable(std::vector<char const*>& extensions, vk::DeviceCreateInfo& info) {
+#ifdef VK_EXT_host_image_copy
+    if (!is_supported) {
+        return;
+    }
+    extensions.insert(extensions.end(), extension_names.begin(), extension_names.end());
+    features.pNext = const_cast<void*>(info.pNext);
+    info.pNext = &features;
+#else
+    (void)extensions;
+    (void)info;
+#endif
+}
+
+HostImageUploader::HostImageUploader(vk::PhysicalDevice physical_device, vk::Device device,
+                                     bool host_image_copy_enabled)
+    : physical_device(physical_device), device(device) {
+#ifdef VK_EXT_host_image_copy
+    if (host_image_copy_enabled) {
+        copy_memory_to_image = reinterpret_cast<PFN_vkCopyMemoryToImageEXT>(
+            device.getProcAddr("vkCopyMemoryToImageEXT"));
+        transition_image_layout = reinterpret_cast<PFN_vkTransitionImageLayoutEXT>(
+            device.getProcAddr("vkTransitionImageLayoutEXT"));
+
+        // Images are copied to in the layout they are sampled in, which the driver has to allow
+        VkPhysicalDeviceHostImageCopyPropertiesEXT properties = {};
+        properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_PROPERTIES_EXT;
+        VkPhysicalDeviceProperties2 properties2 = {};
+        properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        properties2.pNext = &properties;
+        vkGetPhysicalDeviceProperties2(static_cast<VkPhysicalDevice>(physical_device), &properties2);
+        std::vector<VkImageLayout> dst_layouts(properties.copyDstLayoutCount);
+        properties.pCopyDstLayouts = dst_layouts.data();
+        properties.copySrcLayoutCount = 0;
+        vkGetPhysicalDeviceProperties2(static_cast<VkPhysicalDevice>(physical_device), &properties2);
+        bool const sampled_layout_allowed = std::find(dst_layouts.begin(), dst_layouts.end(),
+                                                      VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) != dst_layouts.end();
+
+        host_image_copy = copy_memory_to_image && transition_image_layout && sampled_layout_allowed;
+    }
+#else
+    (void)host_image_copy_enabled;
+#endif
+
+    vk::PhysicalDeviceType const type = physical_device.getProperties().deviceType;
+    if (type == vk::PhysicalDeviceType::eIntegratedGpu || type == vk::PhysicalDeviceType::eCpu) {
+        vk::PhysicalDeviceMemoryProperties const memory = physical_device.getMemoryProperties();
+        for (uint32_t i = 0; i < memory.memoryTypeCount; ++i) {
+            if ((memory.memoryTypes[i].propertyFlags & unified_memory_properties) == unified_memory_properties) {
+                unified_memory = true;
+            }
+        }
+    }
+}
+
+ImageUploadPath HostImageUploader::choose_path(vk::Format format, uint32_t width, uint32_t height,
+                                               uint32_t layer_count) const {
+    if (host_image_copy_supports(format, width, height, layer_count)) {
+        return ImageUploadPath::HostImageCopy;
+    }
+    if (linear_image_supports(format, width, height, layer_count)) {
+        return ImageUploadPath::LinearImage;
+    }
+    return ImageUploadPath::Staging;
+}
+
+void HostImageUploader::create_image(ImageUploadPath path, vk::Format format, uint32_t width, uint32_t height,
+                                     std::vector<std::vector<uint8_t>> const& layers, vk::CommandPool pool,
+                                     vk::Queue queue, vk::Image& image, vk::DeviceMemory& memory) const {
+    switch (path) {
+    case ImageUploadPath::HostImageCopy:
+        copy_with_host_image_copy(format, width, height, layers, image, memory);
+        break;
+    case ImageUploadPath::LinearImage:
+        write_linear_image(format, width, height, layers, pool, queue, image, memory);
+        break;
+    case ImageUploadPath::Staging:
+        throw std::logic_error("Staging uploads are up to the caller");
+    }
+}
+
+bool HostImageUploader::host_image_copy_supports(vk::Format format, uint32_t width, uint32_t height,
+                                                 uint32_t layer_count) const {
+#ifdef VK_EXT_host_image_copy
+    if (!host_image_copy) {
+        return false;
+    }
+    VkPhysicalDeviceImageFormatInfo2 info = {};
+    info.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGE_FORMAT_INFO_2;
+    info.format = static_cast<VkFormat>(format);
+    info.type = VK_IMAGE_TYPE_2D;
+    info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    info.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT;
+    // Whether the image is laid out as well for the GPU as one written by transfers
+    VkHostImageCopyDevicePerformanceQueryEXT performance = {};
+    performance.sType = VK_STRUCTURE_TYPE_HOST_IMAGE_COPY_DEVICE_PERFORMANCE_QUERY_EXT;
+    VkImageFormatProperties2 properties = {};
+    properties.sType = VK_STRUCTURE_TYPE_IMAGE_FORMAT_PROPERTIES_2;
+    properties.pNext = &performance;
+    if (vkGetPhysicalDeviceImageFormatProperties2(static_cast<VkPhysicalDevice>(physical_device), &info,
+                                                  &properties) != VK_SUCCESS) {
+        return false;
+    }
+    // Sampling a texture every frame matters more than saving a copy once
+    return performance.optimalDeviceAccess == VK_TRUE &&
+           fits(vk::ImageFormatProperties(properties.imageFormatProperties), width, height, layer_count);
+#else
+    (void)format;
+    (void)width;
+    (void)height;
+    (void)layer_count;
+    return false;
+#endif
+}
+
+bool HostImageUploader::linear_image_supports(vk::Format format, uint32_t width, uint32_t height,
+                                              uint32_t layer_count) const {
+    if (!unified_memory) {
+        return false;
+    }
+    vk::FormatFeatureFlags const needed = vk::FormatFeatureFlagBits::eSampledImage |
+                                          vk::FormatFeatureFlagBits::eSampledImageFilterLinear;
+    if ((physical_device.getFormatProperties(format).linearTilingFeatures & needed) != needed) {
+        return false;
+    }
+    try {
+        vk::ImageFormatProperties const properties = physical_device.getImageFormatProperties(
+            format, vk::ImageType::e2D, vk::ImageTiling::eLinear, vk::ImageUsageFlagBits::eSampled);
+        return fits(properties, width, height, layer_count);
+    } catch (vk::FormatNotSupportedError const&) {
+        return false;
+    }
+}
+
+void HostImageUploader::copy_with_host_image_copy(vk::Format format, uint32_t width, uint32_t height,
+                                                  std::vector<std::vector<uint8_t>> const& layers, vk::Image& image,
+                                                  vk::DeviceMemory& memory) const {
+#ifdef VK_EXT_host_image_copy
+    uint32_t const layer_count = static_cast<uint32_t>(layers.size());
+    vk::ImageCreateInfo image_info;
+    image_info.imageType = vk::ImageType::e2D;
+    image_info.extent = vk::Extent3D{ width, height, 1 };
+    image_info.mipLevels = 1;
+    image_info.arrayLayers = layer_count;
+    image_info.format = format;
+    image_info.tiling = vk::ImageTiling::eOptimal;
+    image_info.initialLayout = vk::ImageLayout::eUndefined;
+    image_info.usage = vk::ImageUsageFlagBits::eSampled |
+                       static_cast<vk::ImageUsageFlagBits>(VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT);
+    image_info.samples = vk::SampleCountFlagBits::e1;
+    image = device.createImage(image_info);
+
+    vk::MemoryRequirements const requirements = device.getImageMemoryRequirements(image);
+    vk::MemoryAllocateInfo alloc_info;
+    alloc_info.allocationSize = requirements.size;
+    alloc_info.memoryTypeIndex = find_memory_type(physical_device, requirements.memoryTypeBits,
+                                                  vk::MemoryPropertyFlagBits::eDeviceLocal);
+    memory = allocate_device_memory(physical_device, device, alloc_info);
+    device.bindImageMemory(image, memory, 0);
+
+    // Nothing in the image is worth keeping, so it can go straight to the layout it is sampled in
+    VkHostImageLayoutTransitionInfoEXT transition = {};
+    transition.sType = VK_STRUCTURE_TYPE_HOST_IMAGE_LAYOUT_TRANSITION_INFO_EXT;
+    transition.image = static_cast<VkImage>(image);
+    transition.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    transition.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    transition.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, layer_count };
+    if (transition_image_layout(static_cast<VkDevice>(device), 1, &transition) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to transition the layout of an image from the host");
+    }
+
+    std::vector<VkMemoryToImageCopyEXT> regions(layer_count);
+    for (uint32_t layer = 0; layer < layer_count; ++layer) {
+        VkMemoryToImageCopyEXT& region = regions[layer];
+        region.sType = VK_STRUCTURE_TYPE_MEMORY_TO_IMAGE_COPY_EXT;
+        region.pHostPointer = layers[layer].data();
+        // Rows are tightly packed
+        region.memoryRowLength = 0;
+        region.memoryImageHeight = 0;
+        region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, layer, 1 };
+        region.imageOffset = { 0, 0, 0 };
+        region.imageExtent = { width, height, 1 };
+    }
+    VkCopyMemoryToImageInfoEXT copy = {};
+    copy.sType = VK_STRUCTURE_TYPE_COPY_MEMORY_TO_IMAGE_INFO_EXT;
+    copy.dstImage = static_cast<VkImage>(image);
+    copy.dstImageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    copy.regionCount = layer_count;
+    copy.pRegions = regions.data();
+    if (copy_memory_to_image(static_cast<VkDevice>(device), &copy) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to copy texels into an image from the host");
+    }
+#else
+    (void)format;
+    (void)width;
+    (void)height;
+    (void)layers;
+    (void)image;
+    (void)memory;
+    throw std::logic_error("Built without VK_EXT_host_image_copy");
+#endif
+}
+
+void HostImageUploader::write_linear_image(vk::Format format, uint32_t width, uint32_t height,
+                                           std::vector<std::vector<uint8_t>> const& layers, vk::CommandPool pool,
+                                           vk::Queue queue, vk::Image& image, vk::DeviceMemory& memory) const {
+    uint32_t const layer_count = static_cast<uint32_t>(layers.size());
+    vk::ImageCreateInfo image_info;
+    image_info.imageType = vk::ImageType::e2D;
+    image_info.extent = vk::Extent3D{ width, height, 1 };
+    image_info.mipLevels = 1;
+    image_info.arrayLayers = layer_count;
+    image_info.format = format;
+    image_info.tiling = vk::ImageTiling::eLinear;
+    // Keeps what we write through the mapping across the layout transition
+    image_info.initialLayout = vk::ImageLayout::ePreinitialized;
+    image_info.usage = vk::ImageUsageFlagBits::eSampled;
+    image_info.samples = vk::SampleCountFlagBits::e1;
+    image = device.createImage(image_info);
+
+    vk::MemoryRequirements const requirements = device.getImageMemoryRequirements(image);
+    vk::MemoryAllocateInfo alloc_info;
+    alloc_info.allocationSize = requirements.size;
+    alloc_info.memoryTypeIndex = find_memory_type(physical_device, requirements.memoryTypeBits,
+                                                  unified_memory_properties);
+    memory = allocate_device_memory(physical_device, device, alloc_info);
+    device.bindImageMemory(image, memory, 0);
+
+    // Rows of a linear image may be padded
+    uint8_t* const mapping = static_cast<uint8_t*>(device.mapMemory(memory, 0, VK_WHOLE_SIZE));
+    size_t const row_size = size_t(width) * 4;
+    for (uint32_t layer = 0; layer < layer_count; ++layer) {
+        vk::SubresourceLayout const layout = device.getImageSubresourceLayout(
+            image, vk::ImageSubresource{ vk::ImageAspectFlagBits::eColor, 0, layer });
+        for (uint32_t row = 0; row < height; ++row) {
+            std::memcpy(mapping + layout.offset + row * layout.rowPitch, layers[layer].data() + row * row_size,
+                        row_size);
+        }
+    }
+    device.unmapMemory(memory);
+
+    vk::CommandBufferAllocateInfo cmd_info;
+    cmd_info.level = vk::CommandBufferLevel::ePrimary;
+    cmd_info.commandPool = pool;
+    cmd_info.commandBufferCount = 1;
+    vk::CommandBuffer const cmd = device.allocateCommandBuffers(cmd_info)[0];
+    cmd.begin(vk::CommandBufferBeginInfo{ vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
+    vk::ImageMemoryBarrier barrier;
+    barrier.oldLayout = vk::ImageLayout::ePreinitialized;
+    barrier.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange = vk::ImageSubresourceRange{ vk::ImageAspectFlagBits::eColor, 0, 1, 0, layer_count };
+    barrier.srcAccessMask = vk::AccessFlagBits::eHostWrite;
+    barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eHost, vk::PipelineStageFlagBits::eFragmentShader, {}, nullptr,
+                        nullptr, barrier);
+    cmd.end();
+
+    vk::SubmitInfo submit_info;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &cmd;
+    queue.submit(submit_info, nullptr);
+    queue.waitIdle();
+    device.freeCommandBuffers(pool, cmd);
+}
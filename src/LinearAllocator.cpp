@@ -0,0 +1,44 @@
+#include "LinearAllocator.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+static std::byte* align_pointer(std::byte* pointer, size_t alignment) {
+    uintptr_t const address = reinterpret_cast<uintptr_t>(pointer);
+    return pointer + ((alignment - address % alignment) % alignment);
+}
+
+LinearAllocator::LinearAllocator(size_t capacity) : buffer(new std::byte[capacity]), buffer_size(capacity) {}
+
+void* LinearAllocator::allocate(size_t size, size_t alignment) {
+    std::byte* const start = align_pointer(buffer.get() + offset, alignment);
+    size_t const end = static_cast<size_t>(start - buffer.get()) + size;
+    if (end <= buffer_size) {
+        offset = end;
+        return start;
+    }
+
+    // With room to align the start
+    overflow.emplace_back(new std::byte[size + alignment]);
+    overflow_size += size + alignment;
+    return align_pointer(overflow.back().get(), alignment);
+}
+
+void LinearAllocator::reset() {
+    if (!overflow.empty()) {
+        // Everything has to fit next time, with some room to spare so it does not grow by a little every frame
+        buffer_size = std::max(buffer_size * 2, offset + overflow_size);
+        buffer.reset(new std::byte[buffer_size]);
+        overflow.clear();
+        overflow_size = 0;
+    }
+    offset = 0;
+}
+
+size_t LinearAllocator::capacity() const {
+    return buffer_size;
+}
+
+size_t LinearAllocator::used() const {
+    return offset + overflow_size;
+}
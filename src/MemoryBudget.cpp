@@ -0,0 +1,132 @@
+#include "MemoryBudget.hpp"
+
+#include <array>
+#include <ios>
+#include <mutex>
+#include <unordered_map>
+
+// Without VK_EXT_memory_budget there is no way to see what other processes use, so only plan on part of each heap
+constexpr vk::DeviceSize fallback_budget_percent = 80;
+
+struct Allocation {
+    uint32_t heap;
+    vk::DeviceSize size;
+};
+
+// Process wide, like the memory itself
+static std::mutex allocations_mutex;
+static std::unordered_map<VkDeviceMemory, Allocation> allocations;
+static std::array<vk::DeviceSize, VK_MAX_MEMORY_HEAPS> heap_usage{};
+static std::function<bool(uint32_t, vk::DeviceSize)> pressure_handler;
+
+MemoryBudget::MemoryBudget(vk::PhysicalDevice physical_device, bool extension_enabled)
+    : physical_device(physical_device), extension_enabled(extension_enabled) {}
+
+std::vector<MemoryBudget::Heap> MemoryBudget::query() const {
+    std::vector<Heap> heaps;
+    if (extension_enabled) {
+        auto const chain = physical_device.getMemoryProperties2<vk::PhysicalDeviceMemoryProperties2,
+                                                                vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+        auto const& properties = chain.get<vk::PhysicalDeviceMemoryProperties2>().memoryProperties;
+        auto const& budget = chain.get<vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+        for (uint32_t i = 0; i < properties.memoryHeapCount; ++i) {
+            Heap heap;
+            heap.size = properties.memoryHeaps[i].size;
+            heap.budget = budget.heapBudget[i];
+            heap.usage = budget.heapUsage[i];
+            heap.device_local = bool(properties.memoryHeaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal);
+            heaps.push_back(heap);
+        }
+    } else {
+        vk::PhysicalDeviceMemoryProperties const properties = physical_device.getMemoryProperties();
+        for (uint32_t i = 0; i < properties.memoryHeapCount; ++i) {
+            Heap heap;
+            heap.size = properties.memoryHeaps[i].size;
+            heap.budget = heap.size / 100 * fallback_budget_percent;
+            heap.usage = allocated_device_memory(i);
+            heap.device_local = bool(properties.memoryHeaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal);
+            heaps.push_back(heap);
+        }
+    }
+    return heaps;
+}
+
+MemoryBudget::Heap MemoryBudget::device_local() const {
+    Heap total;
+    total.device_local = true;
+    for (auto const& heap : query()) {
+        if (heap.device_local) {
+            total.size += heap.size;
+            total.budget += heap.budget;
+            total.usage += heap.usage;
+        }
+    }
+    return total;
+}
+
+void MemoryBudget::report(std::ostream& out) const {
+    auto const mib = [](vk::DeviceSize bytes) { return bytes / (1024.0 * 1024.0); };
+
+    std::vector<Heap> const heaps = query();
+    auto const precision = out.precision(1);
+    out << std::fixed;
+    out << "memory" << (extension_enabled ? "" : " (estimated)") << ":";
+    for (size_t i = 0; i < heaps.size(); ++i) {
+        out << (i == 0 ? " " : ", ") << "heap " << i << (heaps[i].device_local ? " (device local) " : " ")
+            << mib(heaps[i].usage) << " / " << mib(heaps[i].budget) << " MiB";
+    }
+    out << "\n";
+    out.unsetf(std::ios::fixed);
+    out.precision(precision);
+}
+
+vk::DeviceMemory allocate_device_memory(vk::PhysicalDevice physical_device, vk::Device device,
+                                        vk::MemoryAllocateInfo const& info) {
+    vk::PhysicalDeviceMemoryProperties const properties = physical_device.getMemoryProperties();
+    uint32_t const heap = properties.memoryTypes[info.memoryTypeIndex].heapIndex;
+
+    vk::DeviceMemory memory;
+    try {
+        memory = device.allocateMemory(info);
+    } catch (vk::OutOfDeviceMemoryError const&) {
+        std::function<bool(uint32_t, vk::DeviceSize)> handler;
+        {
+            std::lock_guard lock(allocations_mutex);
+            handler = pressure_handler;
+        }
+        // The handler frees memory itself, so the lock can't be held while it runs
+        if (!handler || !handler(heap, info.allocationSize)) {
+            throw;
+        }
+        memory = device.allocateMemory(info);
+    }
+
+    std::lock_guard lock(allocations_mutex);
+    allocations[static_cast<VkDeviceMemory>(memory)] = Allocation{ heap, info.allocationSize };
+    heap_usage[heap] += info.allocationSize;
+    return memory;
+}
+
+void free_device_memory(vk::Device device, vk::DeviceMemory memory) {
+    if (!memory) {
+        return;
+    }
+    device.freeMemory(memory);
+
+    std::lock_guard lock(allocations_mutex);
+    auto const it = allocations.find(static_cast<VkDeviceMemory>(memory));
+    if (it != allocations.end()) {
+        heap_usage[it->second.heap] -= it->second.size;
+        allocations.erase(it);
+    }
+}
+
+vk::DeviceSize allocated_device_memory(uint32_t heap) {
+    std::lock_guard lock(allocations_mutex);
+    return heap_usage[heap];
+}
+
+void set_memory_pressure_handler(std::function<bool(uint32_t heap, vk::DeviceSize size)> handler) {
+    std::lock_guard lock(allocations_mutex);
+    pressure_handler = std::move(handler);
+}
@@ -0,0 +1,187 @@
+#include "Multisampling.hpp"
+
+#include "MemoryBudget.hpp"
+#include "VkBuffer.hpp"
+
+#include <array>
+#include <optional>
+
+constexpr std::array<vk::SampleCountFlagBits, 7> sample_counts = {
+    vk::SampleCountFlagBits::e1, vk::SampleCountFlagBits::e2, vk::SampleCountFlagBits::e4,
+    vk::SampleCountFlagBits::e8, vk::SampleCountFlagBits::e16, vk::SampleCountFlagBits::e32,
+    vk::SampleCountFlagBits::e64
+};
+
+vk::SampleCountFlagBits choose_sample_count(vk::PhysicalDevice physical_device, uint32_t requested) {
+    vk::SampleCountFlags const supported = physical_device.getProperties().limits.framebufferColorSampleCounts;
+    vk::SampleCountFlagBits result = vk::SampleCountFlagBits::e1;
+    for (auto samples : sample_counts) {
+        if (static_cast<uint32_t>(samples) <= requested && (supported & samples)) {
+            result = samples;
+        }
+    }
+    return result;
+}
+
+// Memory that is only committed when the driver needs it, which a tiler does not for attachments that stay on chip
+static std::optional<uint32_t> find_lazily_allocated_memory_type(vk::PhysicalDevice physical_device,
+                                                                 uint32_t type_filter) {
+    vk::PhysicalDeviceMemoryProperties const properties = physical_device.getMemoryProperties();
+    for (uint32_t i = 0; i < properties.memoryTypeCount; ++i) {
+        if ((type_filter & (1 << i)) &&
+            (properties.memoryTypes[i].propertyFlags & vk::MemoryPropertyFlagBits::eLazilyAllocated)) {
+            return i;
+        }
+    }
+    return std::nullopt;
+}
+
+static vk::ImageCreateInfo transient_image_info(vk::Format format, vk::Extent2D extent,
+                                                vk::SampleCountFlagBits samples) {
+    vk::ImageCreateInfo info;
+    info.imageType = vk::ImageType::e2D;
+    info.extent = vk::Extent3D{ extent.width, extent.height, 1 };
+    info.mipLevels = 1;
+    info.arrayLayers = 1;
+    info.format = format;
+    info.tiling = vk::ImageTiling::eOptimal;
+    info.initialLayout = vk::ImageLayout::eUndefined;
+    // Only ever an attachment, so the driver is free to keep it out of memory
+    info.usage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransientAttachment;
+    info.samples = samples;
+    info.sharingMode = vk::SharingMode::eExclusive;
+    return info;
+}
+
+MultisampleTarget::MultisampleTarget(vk::PhysicalDevice physical_device, vk::Device device, vk::Format format,
+                                     vk::Extent2D extent, vk::SampleCountFlagBits samples)
+    : device(device), sample_count(samples) {
+    image = device.createImage(transient_image_info(format, extent, samples));
+
+    vk::MemoryRequirements const requirements = device.getImageMemoryRequirements(image);
+    std::optional<uint32_t> const lazy_type = find_lazily_allocated_memory_type(physical_device,
+                                                                                requirements.memoryTypeBits);
+    lazy = lazy_type.has_value();
+    memory_size = requirements.size;
+
+    vk::MemoryAllocateInfo alloc_info;
+    alloc_info.allocationSize = requirements.size;
+    alloc_info.memoryTypeIndex = lazy ? *lazy_type : find_memory_type(physical_device, requirements.memoryTypeBits,
+                                                                      vk::MemoryPropertyFlagBits::eDeviceLocal);
+    memory = allocate_device_memory(physical_device, device, alloc_info);
+    device.bindImageMemory(image, memory, 0);
+
+    vk::ImageViewCreateInfo view_info;
+    view_info.image = image;
+    view_info.viewType = vk::ImageViewType::e2D;
+    view_info.format = format;
+    view_info.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
+    view_info.subresourceRange.levelCount = 1;
+    view_info.subresourceRange.layerCount = 1;
+    image_view = device.createImageView(view_info);
+}
+
+MultisampleTarget::~MultisampleTarget() {
+    device.destroyImageView(image_view);
+    device.destroyImage(image);
+    free_device_memory(device, memory);
+}
+
+vk::ImageView MultisampleTarget::view() const {
+    return image_view;
+}
+
+vk::SampleCountFlagBits MultisampleTarget::samples() const {
+    return sample_count;
+}
+
+bool MultisampleTarget::lazily_allocated() const {
+    return lazy;
+}
+
+vk::DeviceSize MultisampleTarget::size() const {
+    return memory_size;
+}
+
+vk::DeviceSize MultisampleTarget::committed_size() const {
+    return lazy ? device.getMemoryCommitment(memory) : memory_size;
+}
+
+vk::RenderPass create_color_render_pass(vk::Device device, vk::Format format, vk::SampleCountFlagBits samples,
+                                        vk::ImageLayout final_layout,
+                                        vk::ArrayProxy<vk::SubpassDependency const> dependencies) {
+    bool const multisampled = samples != vk::SampleCountFlagBits::e1;
+
+    std::array<vk::AttachmentDescription, 2> attachments;
+    // Drawn to. Multisampled, it is only needed until it is resolved.
+    attachments[0].format = format;
+    attachments[0].samples = samples;
+    attachments[0].loadOp = vk::AttachmentLoadOp::eClear;
+    attachments[0].storeOp = multisampled ? vk::AttachmentStoreOp::eDontCare : vk::AttachmentStoreOp::eStore;
+    attachments[0].stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
+    attachments[0].stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+    attachments[0].initialLayout = vk::ImageLayout::eUndefined;
+    attachments[0].finalLayout = multisampled ? vk::ImageLayout::eColorAttachmentOptimal : final_layout;
+    // Resolve target. The resolve writes every pixel of the render area, so there is nothing to load.
+    attachments[1].format = format;
+    attachments[1].samples = vk::SampleCountFlagBits::e1;
+    attachments[1].loadOp = vk::AttachmentLoadOp::eDontCare;
+    attachments[1].storeOp = vk::AttachmentStoreOp::eStore;
+    attachments[1].stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
+    attachments[1].stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+    attachments[1].initialLayout = vk::ImageLayout::eUndefined;
+    attachments[1].finalLayout = final_layout;
+
+    vk::AttachmentReference const color_ref(0, vk::ImageLayout::eColorAttachmentOptimal);
+    vk::AttachmentReference const resolve_ref(1, vk::ImageLayout::eColorAttachmentOptimal);
+    vk::SubpassDescription subpass;
+    subpass.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
+    subpass.colorAttachmentCount = 1;
+    subpass.pColorAttachments = &color_ref;
+    // Resolved at the end of the subpass, while the samples are still on chip
+    subpass.pResolveAttachments = multisampled ? &resolve_ref : nullptr;
+
+    vk::RenderPassCreateInfo render_pass_info;
+    render_pass_info.attachmentCount = multisampled ? 2 : 1;
+    render_pass_info.pAttachments = attachments.data();
+    render_pass_info.subpassCount = 1;
+    render_pass_info.pSubpasses = &subpass;
+    render_pass_info.dependencyCount = dependencies.size();
+    render_pass_info.pDependencies = dependencies.data();
+    return device.createRenderPass(render_pass_info);
+}
+
+void report_multisampling(std::ostream& out, vk::PhysicalDevice physical_device, vk::Device device,
+                          vk::Format format, vk::Extent2D extent) {
+    auto const mib = [](vk::DeviceSize bytes) { return bytes / (1024.0 * 1024.0); };
+    vk::SampleCountFlags const supported = physical_device.getProperties().limits.framebufferColorSampleCounts;
+
+    auto const precision = out.precision(1);
+    out << std::fixed;
+    out << "Multisampling at " << extent.width << "x" << extent.height << ":\n";
+    double resolved_mib = 0.0;
+    for (auto samples : sample_counts) {
+        if (!(supported & samples)) {
+            continue;
+        }
+        vk::Image const image = device.createImage(transient_image_info(format, extent, samples));
+        vk::MemoryRequirements const requirements = device.getImageMemoryRequirements(image);
+        bool const lazy = find_lazily_allocated_memory_type(physical_device, requirements.memoryTypeBits).has_value();
+        device.destroyImage(image);
+
+        uint32_t const count = static_cast<uint32_t>(samples);
+        if (count == 1) {
+            // Without multisampling the target itself is stored, which is also what a resolve writes
+            resolved_mib = mib(requirements.size);
+            out << "  1x: " << resolved_mib << " MiB target, " << resolved_mib << " MiB written per frame\n";
+            continue;
+        }
+        // Storing the samples writes all of them, and a separate resolve reads them back before writing the result
+        double const stored_mib = resolved_mib * (2 * count + 1);
+        out << "  " << count << "x: " << mib(requirements.size) << " MiB target"
+            << (lazy ? " (lazily allocated, may never be committed)" : "") << ", " << resolved_mib
+            << " MiB written per frame resolved on chip, " << stored_mib << " MiB if stored and resolved afterwards\n";
+    }
+    out.unsetf(std::ios::fixed);
+    out.precision(precision);
+}
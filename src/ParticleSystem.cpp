@@ -0,0 +1,467 @@
+#include "ParticleSystem.hpp"
+
+#include "GpuTimer.hpp"
+#include "HeadlessContext.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <numeric>
+#include <vector>
+
+struct GpuParticle {
+    glm::vec4 position_life;
+    glm::vec4 velocity_lifetime;
+    glm::vec4 color;
+};
+
+// Same layout as the Counters block in the shaders. The indirect arguments are written by the GPU.
+struct ParticleCounters {
+    int32_t dead_count;
+    uint32_t alive_count[2];
+    uint32_t capacity;
+    glm::uvec4 simulate_dispatch;
+    glm::uvec4 draw;
+};
+
+static_assert(sizeof(GpuParticle) == 48 && sizeof(ParticleCounters) == 48, "Particle layout does not match the shaders");
+constexpr vk::DeviceSize simulate_dispatch_offset = offsetof(ParticleCounters, simulate_dispatch);
+constexpr vk::DeviceSize draw_offset = offsetof(ParticleCounters, draw);
+
+// Push constants of the passes, see the shaders
+struct EmitConstants {
+    glm::vec4 position_spread;
+    glm::vec4 velocity_lifetime;
+    glm::vec4 color;
+    uint32_t count;
+    uint32_t seed;
+    uint32_t current;
+};
+
+struct StepConstants {
+    uint32_t mode;
+    uint32_t current;
+};
+
+struct SimulationConstants {
+    glm::vec4 gravity_dt;
+    uint32_t current;
+};
+
+struct KeyConstants {
+    glm::mat4 view;
+    uint32_t current;
+};
+
+struct SortConstants {
+    uint32_t k;
+    uint32_t j;
+    uint32_t local_steps;
+};
+
+struct CameraConstants {
+    glm::mat4 view_projection;
+    glm::vec4 right_size;
+    glm::vec4 up;
+};
+
+// Every compute pass fits in the push constant size every device supports
+constexpr uint32_t compute_constants_size = 128;
+static_assert(sizeof(EmitConstants) <= compute_constants_size && sizeof(KeyConstants) <= compute_constants_size,
+              "Particle push constants are too large");
+
+// Must match local_size_x in the shaders
+constexpr uint32_t particle_group_size = 64;
+constexpr uint32_t sort_group_size = 256;
+// Entries a sort workgroup handles in shared memory
+constexpr uint32_t sort_block_size = sort_group_size * 2;
+
+static glm::vec3 const gravity(0.0f, 0.0f, -9.81f);
+
+static uint32_t round_up_to_power_of_two(uint32_t value) {
+    uint32_t result = 1;
+    while (result < value) {
+        result *= 2;
+    }
+    return result;
+}
+
+// Makes the writes of the previous pass visible to everything reading particle data afterwards
+static void particle_barrier(vk::CommandBuffer cmd) {
+    vk::MemoryBarrier barrier;
+    barrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+    barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite
+                          | vk::AccessFlagBits::eIndirectCommandRead;
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                        vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eDrawIndirect
+                        | vk::PipelineStageFlagBits::eVertexShader,
+                        {}, barrier, nullptr, nullptr);
+}
+
+ParticleSystem::ParticleSystem(vk::PhysicalDevice physical_device, vk::Device device, vk::PipelineCache cache,
+                               Shaders const& shaders, uint32_t capacity, vk::CommandPool cmd_pool, vk::Queue queue)
+    : device(device), cache(cache), particle_capacity(round_up_to_power_of_two(std::max(capacity, sort_block_size))) {
+
+    vk::BufferUsageFlags const storage = vk::BufferUsageFlagBits::eStorageBuffer;
+    vk::BufferUsageFlags const uploaded = storage | vk::BufferUsageFlagBits::eTransferDst;
+    vk::MemoryPropertyFlags const device_local = vk::MemoryPropertyFlagBits::eDeviceLocal;
+    particles = Buffer(physical_device, device, particle_capacity * sizeof(GpuParticle), storage, device_local);
+    dead_list = Buffer(physical_device, device, particle_capacity * sizeof(uint32_t), uploaded, device_local);
+    alive_lists = Buffer(physical_device, device, 2 * particle_capacity * sizeof(uint32_t), storage, device_local);
+    counters = Buffer(physical_device, device, sizeof(ParticleCounters),
+                      uploaded | vk::BufferUsageFlagBits::eIndirectBuffer, device_local);
+    sort_entries = Buffer(physical_device, device, particle_capacity * sizeof(glm::uvec2), storage, device_local);
+
+    // Every particle starts out dead
+    {
+        vk::MemoryPropertyFlags const host_visible = vk::MemoryPropertyFlagBits::eHostVisible
+                                                   | vk::MemoryPropertyFlagBits::eHostCoherent;
+        vk::DeviceSize const dead_list_size = particle_capacity * sizeof(uint32_t);
+        Buffer staging(physical_device, device, dead_list_size, vk::BufferUsageFlagBits::eTransferSrc, host_visible);
+        uint32_t* const indices = static_cast<uint32_t*>(device.mapMemory(staging.memory_handle(), 0, VK_WHOLE_SIZE));
+        std::iota(indices, indices + particle_capacity, 0u);
+        device.unmapMemory(staging.memory_handle());
+        copy_buffers(staging, dead_list, dead_list_size, cmd_pool, queue);
+
+        ParticleCounters initial{};
+        initial.dead_count = particle_capacity;
+        initial.capacity = particle_capacity;
+        Buffer counter_staging(physical_device, device, sizeof(initial), vk::BufferUsageFlagBits::eTransferSrc,
+                               host_visible);
+        void* const data = device.mapMemory(counter_staging.memory_handle(), 0, VK_WHOLE_SIZE);
+        std::memcpy(data, &initial, sizeof(initial));
+        device.unmapMemory(counter_staging.memory_handle());
+        copy_buffers(counter_staging, counters, sizeof(initial), cmd_pool, queue);
+    }
+
+    std::array<vk::DescriptorSetLayoutBinding, 5> bindings;
+    for (uint32_t i = 0; i < bindings.size(); ++i) {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = vk::DescriptorType::eStorageBuffer;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = vk::ShaderStageFlagBits::eCompute | vk::ShaderStageFlagBits::eVertex;
+    }
+    vk::DescriptorSetLayoutCreateInfo layout_info;
+    layout_info.bindingCount = bindings.size();
+    layout_info.pBindings = bindings.data();
+    descriptor_set_layout = device.createDescriptorSetLayout(layout_info);
+
+    // The set never changes, so it gets a pool of its own instead of going through the per-frame allocator
+    vk::DescriptorPoolSize pool_size;
+    pool_size.type = vk::DescriptorType::eStorageBuffer;
+    pool_size.descriptorCount = bindings.size();
+    vk::DescriptorPoolCreateInfo pool_info;
+    pool_info.maxSets = 1;
+    pool_info.poolSizeCount = 1;
+    pool_info.pPoolSizes = &pool_size;
+    descriptor_pool = device.createDescriptorPool(pool_info);
+
+    vk::DescriptorSetAllocateInfo alloc_info;
+    alloc_info.descriptorPool = descriptor_pool;
+    alloc_info.descriptorSetCount = 1;
+    alloc_info.pSetLayouts = &descriptor_set_layout;
+    descriptor_set = device.allocateDescriptorSets(alloc_info)[0];
+
+    std::array<vk::DescriptorBufferInfo, 5> const buffer_infos = {
+        vk::DescriptorBufferInfo(particles.handle(), 0, VK_WHOLE_SIZE),
+        vk::DescriptorBufferInfo(dead_list.handle(), 0, VK_WHOLE_SIZE),
+        vk::DescriptorBufferInfo(alive_lists.handle(), 0, VK_WHOLE_SIZE),
+        vk::DescriptorBufferInfo(counters.handle(), 0, VK_WHOLE_SIZE),
+        vk::DescriptorBufferInfo(sort_entries.handle(), 0, VK_WHOLE_SIZE)
+    };
+    std::array<vk::WriteDescriptorSet, 5> writes;
+    for (uint32_t i = 0; i < writes.size(); ++i) {
+        writes[i].dstSet = descriptor_set;
+        writes[i].dstBinding = i;
+        writes[i].descriptorCount = 1;
+        writes[i].descriptorType = vk::DescriptorType::eStorageBuffer;
+        writes[i].pBufferInfo = &buffer_infos[i];
+    }
+    device.updateDescriptorSets(writes, nullptr);
+
+    vk::PushConstantRange push_range;
+    push_range.stageFlags = vk::ShaderStageFlagBits::eCompute;
+    push_range.offset = 0;
+    push_range.size = compute_constants_size;
+    vk::PipelineLayoutCreateInfo pipeline_layout_info;
+    pipeline_layout_info.setLayoutCount = 1;
+    pipeline_layout_info.pSetLayouts = &descriptor_set_layout;
+    pipeline_layout_info.pushConstantRangeCount = 1;
+    pipeline_layout_info.pPushConstantRanges = &push_range;
+    compute_layout = device.createPipelineLayout(pipeline_layout_info);
+
+    emit_pipeline = create_compute_pipeline(shaders.emit);
+    counters_pipeline = create_compute_pipeline(shaders.counters);
+    simulate_pipeline = create_compute_pipeline(shaders.simulate);
+    sort_keys_pipeline = create_compute_pipeline(shaders.sort_keys);
+    sort_pipeline = create_compute_pipeline(shaders.sort);
+}
+
+ParticleSystem::~ParticleSystem() {
+    device.destroyPipeline(render_pipeline);
+    device.destroyPipelineLayout(render_layout);
+    device.destroyPipeline(sort_pipeline);
+    device.destroyPipeline(sort_keys_pipeline);
+    device.destroyPipeline(simulate_pipeline);
+    device.destroyPipeline(counters_pipeline);
+    device.destroyPipeline(emit_pipeline);
+    device.destroyPipelineLayout(compute_layout);
+    device.destroyDescriptorPool(descriptor_pool);
+    device.destroyDescriptorSetLayout(descriptor_set_layout);
+}
+
+vk::Pipeline ParticleSystem::create_compute_pipeline(std::string const& spirv) {
+    vk::ShaderModuleCreateInfo module_info;
+    module_info.codeSize = spirv.size();
+    module_info.pCode = reinterpret_cast<uint32_t const*>(spirv.data());
+    vk::ShaderModule const module = device.createShaderModule(module_info);
+
+    vk::ComputePipelineCreateInfo pipeline_info;
+    pipeline_info.stage.stage = vk::ShaderStageFlagBits::eCompute;
+    pipeline_info.stage.module = module;
+    pipeline_info.stage.pName = "main";
+    pipeline_info.layout = compute_layout;
+    vk::Pipeline pipeline;
+    try {
+        pipeline = device.createComputePipeline(cache, pipeline_info);
+    } catch (...) {
+        device.destroyShaderModule(module);
+        throw;
+    }
+    device.destroyShaderModule(module);
+    return pipeline;
+}
+
+void ParticleSystem::create_render_pipeline(vk::RenderPass render_pass, vk::SampleCountFlagBits samples,
+                                            std::string const& vert_spirv, std::string const& frag_spirv) {
+    vk::PushConstantRange push_range;
+    push_range.stageFlags = vk::ShaderStageFlagBits::eVertex;
+    push_range.offset = 0;
+    push_range.size = sizeof(CameraConstants);
+    vk::PipelineLayoutCreateInfo pipeline_layout_info;
+    pipeline_layout_info.setLayoutCount = 1;
+    pipeline_layout_info.pSetLayouts = &descriptor_set_layout;
+    pipeline_layout_info.pushConstantRangeCount = 1;
+    pipeline_layout_info.pPushConstantRanges = &push_range;
+    render_layout = device.createPipelineLayout(pipeline_layout_info);
+
+    vk::ShaderModuleCreateInfo module_info;
+    module_info.codeSize = vert_spirv.size();
+    module_info.pCode = reinterpret_cast<uint32_t const*>(vert_spirv.data());
+    vk::ShaderModule const vert_module = device.createShaderModule(module_info);
+    module_info.codeSize = frag_spirv.size();
+    module_info.pCode = reinterpret_cast<uint32_t const*>(frag_spirv.data());
+    vk::ShaderModule const frag_module = device.createShaderModule(module_info);
+
+    vk::PipelineShaderStageCreateInfo shader_stages[2];
+    shader_stages[0].stage = vk::ShaderStageFlagBits::eVertex;
+    shader_stages[0].module = vert_module;
+    shader_stages[0].pName = "main";
+    shader_stages[1].stage = vk::ShaderStageFlagBits::eFragment;
+    shader_stages[1].module = frag_module;
+    shader_stages[1].pName = "main";
+
+    // Quads are generated from the vertex and instance index
+    vk::PipelineVertexInputStateCreateInfo vertex_input_info;
+
+    vk::PipelineInputAssemblyStateCreateInfo input_assembly_info;
+    input_assembly_info.topology = vk::PrimitiveTopology::eTriangleList;
+
+    // Drawn in the scene pass, which sets the viewport and scissor
+    vk::PipelineViewportStateCreateInfo viewport_info;
+    viewport_info.viewportCount = 1;
+    viewport_info.scissorCount = 1;
+    vk::DynamicState const dynamic_states[] = { vk::DynamicState::eViewport, vk::DynamicState::eScissor };
+    vk::PipelineDynamicStateCreateInfo dynamic_info;
+    dynamic_info.dynamicStateCount = 2;
+    dynamic_info.pDynamicStates = dynamic_states;
+
+    vk::PipelineRasterizationStateCreateInfo rasterization_info;
+    rasterization_info.polygonMode = vk::PolygonMode::eFill;
+    rasterization_info.lineWidth = 1.0f;
+    rasterization_info.cullMode = vk::CullModeFlagBits::eNone;
+
+    vk::PipelineMultisampleStateCreateInfo multisample_info;
+    multisample_info.rasterizationSamples = samples;
+
+    // Back to front, so regular alpha blending composes correctly
+    vk::PipelineColorBlendAttachmentState color_blend_attachment;
+    color_blend_attachment.colorWriteMask = vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG
+                                          | vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA;
+    color_blend_attachment.blendEnable = true;
+    color_blend_attachment.srcColorBlendFactor = vk::BlendFactor::eSrcAlpha;
+    color_blend_attachment.dstColorBlendFactor = vk::BlendFactor::eOneMinusSrcAlpha;
+    color_blend_attachment.colorBlendOp = vk::BlendOp::eAdd;
+    color_blend_attachment.srcAlphaBlendFactor = vk::BlendFactor::eOne;
+    color_blend_attachment.dstAlphaBlendFactor = vk::BlendFactor::eOneMinusSrcAlpha;
+    color_blend_attachment.alphaBlendOp = vk::BlendOp::eAdd;
+    vk::PipelineColorBlendStateCreateInfo color_blend_info;
+    color_blend_info.attachmentCount = 1;
+    color_blend_info.pAttachments = &color_blend_attachment;
+
+    vk::GraphicsPipelineCreateInfo pipeline_info;
+    pipeline_info.stageCount = 2;
+    pipeline_info.pStages = shader_stages;
+    pipeline_info.pVertexInputState = &vertex_input_info;
+    pipeline_info.pInputAssemblyState = &input_assembly_info;
+    pipeline_info.pViewportState = &viewport_info;
+    pipeline_info.pRasterizationState = &rasterization_info;
+    pipeline_info.pMultisampleState = &multisample_info;
+    pipeline_info.pColorBlendState = &color_blend_info;
+    pipeline_info.pDynamicState = &dynamic_info;
+    pipeline_info.layout = render_layout;
+    pipeline_info.renderPass = render_pass;
+    pipeline_info.subpass = 0;
+
+    try {
+        render_pipeline = device.createGraphicsPipeline(cache, pipeline_info);
+    } catch (...) {
+        device.destroyShaderModule(vert_module);
+        device.destroyShaderModule(frag_module);
+        throw;
+    }
+    device.destroyShaderModule(vert_module);
+    device.destroyShaderModule(frag_module);
+}
+
+void ParticleSystem::record_simulation(vk::CommandBuffer cmd, float dt, uint32_t emit_count,
+                                       ParticleEmitter const& emitter) {
+    // The previous step's draw and sort are done with the buffers before anything is changed
+    vk::MemoryBarrier barrier;
+    barrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+    barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite;
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eDrawIndirect
+                        | vk::PipelineStageFlagBits::eVertexShader,
+                        vk::PipelineStageFlagBits::eComputeShader, {}, barrier, nullptr, nullptr);
+
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, compute_layout, 0, descriptor_set, nullptr);
+
+    emit_count = std::min(emit_count, particle_capacity);
+    if (emit_count > 0) {
+        EmitConstants constants;
+        constants.position_spread = glm::vec4(emitter.position, emitter.spread);
+        constants.velocity_lifetime = glm::vec4(emitter.velocity, emitter.lifetime);
+        constants.color = emitter.color;
+        constants.count = emit_count;
+        constants.seed = seed++;
+        constants.current = current;
+        cmd.bindPipeline(vk::PipelineBindPoint::eCompute, emit_pipeline);
+        cmd.pushConstants(compute_layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(constants), &constants);
+        cmd.dispatch((emit_count + particle_group_size - 1) / particle_group_size, 1, 1);
+        particle_barrier(cmd);
+    }
+
+    StepConstants step{ 0, current };
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, counters_pipeline);
+    cmd.pushConstants(compute_layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(step), &step);
+    cmd.dispatch(1, 1, 1);
+    particle_barrier(cmd);
+
+    SimulationConstants simulation;
+    simulation.gravity_dt = glm::vec4(gravity, dt);
+    simulation.current = current;
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, simulate_pipeline);
+    cmd.pushConstants(compute_layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(simulation), &simulation);
+    cmd.dispatchIndirect(counters.handle(), simulate_dispatch_offset);
+    particle_barrier(cmd);
+
+    // Survivors are in the other list now
+    current = 1 - current;
+    step = StepConstants{ 1, current };
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, counters_pipeline);
+    cmd.pushConstants(compute_layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(step), &step);
+    cmd.dispatch(1, 1, 1);
+    particle_barrier(cmd);
+}
+
+void ParticleSystem::record_sort(vk::CommandBuffer cmd, glm::mat4 const& view) {
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, compute_layout, 0, descriptor_set, nullptr);
+
+    KeyConstants keys;
+    keys.view = view;
+    keys.current = current;
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, sort_keys_pipeline);
+    cmd.pushConstants(compute_layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(keys), &keys);
+    cmd.dispatch(particle_capacity / particle_group_size, 1, 1);
+    particle_barrier(cmd);
+
+    // The amount of alive particles is only known on the GPU, so the whole padded buffer is sorted. Steps comparing
+    // entries within a block are batched into one shared memory dispatch.
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, sort_pipeline);
+    uint32_t const group_count = particle_capacity / sort_block_size;
+    for (uint32_t k = 2; k <= particle_capacity; k *= 2) {
+        uint32_t j = k / 2;
+        for (; j >= sort_block_size; j /= 2) {
+            SortConstants const step{ k, j, 0 };
+            cmd.pushConstants(compute_layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(step), &step);
+            cmd.dispatch(group_count, 1, 1);
+            particle_barrier(cmd);
+        }
+        SortConstants const step{ k, j, 1 };
+        cmd.pushConstants(compute_layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(step), &step);
+        cmd.dispatch(group_count, 1, 1);
+        particle_barrier(cmd);
+    }
+}
+
+void ParticleSystem::record_draw(vk::CommandBuffer cmd, glm::mat4 const& view, glm::mat4 const& projection,
+                                 float size) {
+    CameraConstants camera;
+    camera.view_projection = projection * view;
+    // The rows of the view rotation are the camera axes in world space
+    camera.right_size = glm::vec4(view[0][0], view[1][0], view[2][0], size * 0.5f);
+    camera.up = glm::vec4(view[0][1], view[1][1], view[2][1], 0.0f);
+
+    cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, render_pipeline);
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, render_layout, 0, descriptor_set, nullptr);
+    cmd.pushConstants(render_layout, vk::ShaderStageFlagBits::eVertex, 0, sizeof(camera), &camera);
+    cmd.drawIndirect(counters.handle(), draw_offset, 1, sizeof(vk::DrawIndirectCommand));
+}
+
+uint32_t ParticleSystem::capacity() const {
+    return particle_capacity;
+}
+
+void benchmark_particles(ParticleSystem::Shaders const& shaders, size_t particle_count) {
+    constexpr uint32_t steps = 20;
+
+    HeadlessContext context;
+    ParticleSystem particles(context.physical_device(), context.device(), nullptr, shaders, particle_count,
+                             context.command_pool(), context.queue());
+
+    // Fill every slot with particles that outlive the benchmark, so each step simulates and sorts all of them
+    ParticleEmitter emitter;
+    emitter.lifetime = 1e6f;
+    context.run([&](vk::CommandBuffer cmd) {
+        particles.record_simulation(cmd, 0.0f, particles.capacity(), emitter);
+    });
+
+    glm::mat4 const view = glm::lookAt(glm::vec3(2, 2, 2), glm::vec3(0, 0, 0), glm::vec3(0, 0, 1));
+    GpuTimer timer(context.physical_device(), context.device(), 2);
+    double simulation_ms = 0.0;
+    double sort_ms = 0.0;
+    for (uint32_t i = 0; i < steps; ++i) {
+        context.run([&](vk::CommandBuffer cmd) {
+            timer.reset(cmd);
+            timer.begin(cmd, 0);
+            particles.record_simulation(cmd, 1.0f / 60.0f, 0, emitter);
+            timer.end(cmd, 0);
+            timer.begin(cmd, 1);
+            particles.record_sort(cmd, view);
+            timer.end(cmd, 1);
+        });
+        std::vector<double> const milliseconds = timer.read_milliseconds();
+        simulation_ms += milliseconds[0] / steps;
+        sort_ms += milliseconds[1] / steps;
+    }
+
+    double const millions = particles.capacity() / 1e6;
+    std::cout << "Particle benchmark: " << particles.capacity() << " particles, " << steps << " steps\n"
+              << "  simulation: " << simulation_ms << " ms per step (" << simulation_ms / millions
+              << " ms per million particles)\n"
+              << "  sort:       " << sort_ms << " ms per step (" << sort_ms / millions
+              << " ms per million particles)\n";
+}
@@ -0,0 +1,315 @@
+#include "PipelineLibrary.hpp"
+#include "Profiler.hpp"
+#include "ThreadPool.hpp"
+
+#include <array>
+#include <cassert>
+#include <iostream>
+
+uint64_t PipelineKey::pack() const {
+    uint32_t const cull = static_cast<uint32_t>(cull_mode);
+    uint32_t polygon = static_cast<uint32_t>(polygon_mode);
+    // The one extension mode goes after the core ones, instead of aliasing one of them
+    if (polygon_mode == vk::PolygonMode::eFillRectangleNV) {
+        polygon = 3;
+    }
+    uint32_t const primitive = static_cast<uint32_t>(topology);
+    assert(cull <= 0x3 && polygon <= 0x3 && primitive <= 0xF && static_cast<uint32_t>(blend_mode) <= 0x3 &&
+           shader_features < (1u << shader_feature_count) && "Pipeline state does not fit in its key");
+
+    uint64_t bits = 0;
+    bits |= static_cast<uint64_t>(cull);
+    bits |= static_cast<uint64_t>(polygon) << 2;
+    bits |= static_cast<uint64_t>(primitive) << 4;
+    bits |= static_cast<uint64_t>(blend_mode) << 8;
+    bits |= static_cast<uint64_t>(vertex_layout) << 10;
+    bits |= static_cast<uint64_t>(shader_features) << 18;
+    return bits;
+}
+
+PipelineKey PipelineKey::generic() const {
+    PipelineKey key;
+    key.vertex_layout = vertex_layout;
+    key.topology = topology;
+    return key;
+}
+
+PipelineLibrary::PipelineLibrary(CreateInfo info, Shaders shaders, ThreadPool& workers)
+    : info(std::move(info)), workers(workers), shaders(std::make_shared<Shaders const>(std::move(shaders))) {}
+
+PipelineLibrary::~PipelineLibrary() {
+    {
+        std::unique_lock lock(jobs_mutex);
+        jobs_cv.wait(lock, [this] { return jobs_in_flight == 0; });
+    }
+
+    for (auto const& [packed, entry] : pipelines) {
+        if (entry.pipeline) {
+            info.device.destroyPipeline(entry.pipeline);
+        }
+    }
+    for (auto pipeline : retired) {
+        info.device.destroyPipeline(pipeline);
+    }
+}
+
+vk::Pipeline PipelineLibrary::get(PipelineKey const& key) {
+    uint64_t const packed = key.pack();
+    PipelineKey const generic = key.generic();
+
+    // Fast path, only takes a shared lock
+    {
+        std::shared_lock lock(mutex);
+        auto it = pipelines.find(packed);
+        if (it != pipelines.end()) {
+            if (it->second.pipeline) {
+                return it->second.pipeline;
+            }
+            // Still compiling
+            auto generic_it = pipelines.find(generic.pack());
+            if (generic_it != pipelines.end() && generic_it->second.pipeline) {
+                return generic_it->second.pipeline;
+            }
+        }
+    }
+
+    // Unknown key, or one whose generic pipeline is missing as well. Both are left to the workers.
+    std::unique_lock lock(mutex);
+    vk::Pipeline const fallback = request(generic);
+    if (packed == generic.pack()) {
+        return fallback;
+    }
+    vk::Pipeline const pipeline = request(key);
+    return pipeline ? pipeline : fallback;
+}
+
+void PipelineLibrary::prewarm(PipelineKey const& key) {
+    get_blocking(key.generic());
+    std::unique_lock lock(mutex);
+    request(key);
+}
+
+vk::Pipeline PipelineLibrary::get_compiled(PipelineKey const& key) {
+    return get_blocking(key);
+}
+
+void PipelineLibrary::reload_shaders(Shaders new_shaders) {
+    std::unique_lock lock(mutex);
+    if (new_shaders.vert_spirv.empty()) {
+        new_shaders.vert_spirv = shaders->vert_spirv;
+    }
+    if (new_shaders.frag_spirv.empty()) {
+        new_shaders.frag_spirv = shaders->frag_spirv;
+    }
+    if (new_shaders.pull_vert_spirv.empty()) {
+        new_shaders.pull_vert_spirv = shaders->pull_vert_spirv;
+    }
+    shaders = std::make_shared<Shaders const>(std::move(new_shaders));
+    ++generation;
+    for (auto const& [packed, entry] : pipelines) {
+        queue_compile(entry.key, shaders, generation);
+    }
+}
+
+std::vector<vk::Pipeline> PipelineLibrary::take_retired() {
+    std::unique_lock lock(mutex);
+    std::vector<vk::Pipeline> result;
+    result.swap(retired);
+    return result;
+}
+
+vk::Pipeline PipelineLibrary::get_blocking(PipelineKey const& key) {
+    std::shared_ptr<Shaders const> current_shaders;
+    uint64_t current_generation;
+    {
+        std::shared_lock lock(mutex);
+        auto it = pipelines.find(key.pack());
+        if (it != pipelines.end() && it->second.pipeline) {
+            return it->second.pipeline;
+        }
+        current_shaders = shaders;
+        current_generation = generation;
+    }
+
+    return store(key, build(key, *current_shaders), current_generation);
+}
+
+vk::Pipeline PipelineLibrary::request(PipelineKey const& key) {
+    auto [it, inserted] = pipelines.try_emplace(key.pack());
+    if (inserted) {
+        it->second.key = key;
+        queue_compile(key, shaders, generation);
+    }
+    return it->second.pipeline;
+}
+
+void PipelineLibrary::queue_compile(PipelineKey const& key, std::shared_ptr<Shaders const> job_shaders, uint64_t job_generation) {
+    {
+        std::lock_guard lock(jobs_mutex);
+        ++jobs_in_flight;
+    }
+
+    workers.submit([this, key, job_shaders = std::move(job_shaders), job_generation] {
+        PROFILE_ZONE("Compile pipeline");
+        try {
+            store(key, build(key, *job_shaders), job_generation);
+        } catch (vk::SystemError const& e) {
+            std::cerr << "Failed to compile pipeline permutation " << key.pack() << ": " << e.what() << "\n";
+        }
+
+        std::lock_guard lock(jobs_mutex);
+        if (--jobs_in_flight == 0) {
+            jobs_cv.notify_all();
+        }
+    });
+}
+
+vk::Pipeline PipelineLibrary::store(PipelineKey const& key, vk::Pipeline pipeline, uint64_t pipeline_generation) {
+    std::unique_lock lock(mutex);
+    Entry& entry = pipelines[key.pack()];
+    entry.key = key;
+
+    if (entry.pipeline && entry.generation >= pipeline_generation) {
+        // Somebody else was faster, or a compile with newer shaders already finished
+        info.device.destroyPipeline(pipeline);
+        return entry.pipeline;
+    }
+
+    // The old version may still be in use by command buffers that are in flight
+    if (entry.pipeline) {
+        retired.push_back(entry.pipeline);
+    }
+    entry.pipeline = pipeline;
+    entry.generation = pipeline_generation;
+    return pipeline;
+}
+
+vk::Pipeline PipelineLibrary::build(PipelineKey const& key, Shaders const& stage_shaders) const {
+    VertexInputLayout const& layout = info.vertex_layouts[key.vertex_layout];
+    std::string const& vert_spirv = layout.vertex_pulling ? stage_shaders.pull_vert_spirv : stage_shaders.vert_spirv;
+
+    vk::ShaderModuleCreateInfo module_info;
+    module_info.codeSize = vert_spirv.size();
+    module_info.pCode = reinterpret_cast<uint32_t const*>(vert_spirv.data());
+    vk::ShaderModule vert_module = info.device.createShaderModule(module_info);
+    module_info.codeSize = stage_shaders.frag_spirv.size();
+    module_info.pCode = reinterpret_cast<uint32_t const*>(stage_shaders.frag_spirv.data());
+    vk::ShaderModule frag_module = info.device.createShaderModule(module_info);
+
+    // Every feature bit becomes a boolean specialization constant with the same index. Stages simply ignore the
+    // constants they do not declare.
+    std::array<vk::SpecializationMapEntry, shader_feature_count> spec_entries;
+    std::array<vk::Bool32, shader_feature_count> spec_values;
+    for (uint32_t i = 0; i < shader_feature_count; ++i) {
+        spec_entries[i].constantID = i;
+        spec_entries[i].offset = i * sizeof(vk::Bool32);
+        spec_entries[i].size = sizeof(vk::Bool32);
+        spec_values[i] = (key.shader_features >> i) & 1;
+    }
+    vk::SpecializationInfo spec_info;
+    spec_info.mapEntryCount = spec_entries.size();
+    spec_info.pMapEntries = spec_entries.data();
+    spec_info.dataSize = sizeof(spec_values);
+    spec_info.pData = spec_values.data();
+
+    vk::PipelineShaderStageCreateInfo shader_stages[2];
+    shader_stages[0].stage = vk::ShaderStageFlagBits::eVertex;
+    shader_stages[0].module = vert_module;
+    shader_stages[0].pName = "main";
+    shader_stages[0].pSpecializationInfo = &spec_info;
+    shader_stages[1].stage = vk::ShaderStageFlagBits::eFragment;
+    shader_stages[1].module = frag_module;
+    shader_stages[1].pName = "main";
+    shader_stages[1].pSpecializationInfo = &spec_info;
+
+    vk::PipelineVertexInputStateCreateInfo vertex_input_info;
+    vertex_input_info.vertexBindingDescriptionCount = layout.bindings.size();
+    vertex_input_info.pVertexBindingDescriptions = layout.bindings.data();
+    vertex_input_info.vertexAttributeDescriptionCount = layout.attributes.size();
+    vertex_input_info.pVertexAttributeDescriptions = layout.attributes.data();
+
+    vk::PipelineInputAssemblyStateCreateInfo input_assembly_info;
+    input_assembly_info.topology = key.topology;
+    input_assembly_info.primitiveRestartEnable = false;
+
+    // Viewport and scissor are set per render pass, the scene may be drawn at less than the swapchain resolution
+    vk::PipelineViewportStateCreateInfo viewport_info;
+    viewport_info.viewportCount = 1;
+    viewport_info.scissorCount = 1;
+    vk::DynamicState const dynamic_states[] = { vk::DynamicState::eViewport, vk::DynamicState::eScissor };
+    vk::PipelineDynamicStateCreateInfo dynamic_info;
+    dynamic_info.dynamicStateCount = 2;
+    dynamic_info.pDynamicStates = dynamic_states;
+
+    vk::PipelineRasterizationStateCreateInfo rasterization_info;
+    rasterization_info.depthClampEnable = false;
+    rasterization_info.rasterizerDiscardEnable = false;
+    rasterization_info.polygonMode = key.polygon_mode;
+    rasterization_info.lineWidth = 1.0f;
+    rasterization_info.cullMode = key.cull_mode;
+    rasterization_info.frontFace = vk::FrontFace::eCounterClockwise;
+    rasterization_info.depthBiasEnable = false;
+
+    vk::PipelineMultisampleStateCreateInfo multisample_info;
+    multisample_info.sampleShadingEnable = false;
+    multisample_info.rasterizationSamples = info.samples;
+
+    vk::PipelineColorBlendAttachmentState color_blend_attachment;
+    color_blend_attachment.colorWriteMask = vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG 
+                                          | vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA;
+    switch (key.blend_mode) {
+        case BlendMode::Opaque:
+            color_blend_attachment.blendEnable = false;
+            break;
+        case BlendMode::Alpha:
+            color_blend_attachment.blendEnable = true;
+            color_blend_attachment.srcColorBlendFactor = vk::BlendFactor::eSrcAlpha;
+            color_blend_attachment.dstColorBlendFactor = vk::BlendFactor::eOneMinusSrcAlpha;
+            color_blend_attachment.colorBlendOp = vk::BlendOp::eAdd;
+            color_blend_attachment.srcAlphaBlendFactor = vk::BlendFactor::eOne;
+            color_blend_attachment.dstAlphaBlendFactor = vk::BlendFactor::eOneMinusSrcAlpha;
+            color_blend_attachment.alphaBlendOp = vk::BlendOp::eAdd;
+            break;
+        case BlendMode::Additive:
+            color_blend_attachment.blendEnable = true;
+            color_blend_attachment.srcColorBlendFactor = vk::BlendFactor::eSrcAlpha;
+            color_blend_attachment.dstColorBlendFactor = vk::BlendFactor::eOne;
+            color_blend_attachment.colorBlendOp = vk::BlendOp::eAdd;
+            color_blend_attachment.srcAlphaBlendFactor = vk::BlendFactor::eZero;
+            color_blend_attachment.dstAlphaBlendFactor = vk::BlendFactor::eOne;
+            color_blend_attachment.alphaBlendOp = vk::BlendOp::eAdd;
+            break;
+    }
+
+    vk::PipelineColorBlendStateCreateInfo color_blend_info;
+    color_blend_info.logicOpEnable = false;
+    color_blend_info.attachmentCount = 1;
+    color_blend_info.pAttachments = &color_blend_attachment;
+
+    vk::GraphicsPipelineCreateInfo pipeline_info;
+    pipeline_info.stageCount = 2;
+    pipeline_info.pStages = shader_stages;
+    pipeline_info.pVertexInputState = &vertex_input_info;
+    pipeline_info.pInputAssemblyState = &input_assembly_info;
+    pipeline_info.pViewportState = &viewport_info;
+    pipeline_info.pRasterizationState = &rasterization_info;
+    pipeline_info.pMultisampleState = &multisample_info;
+    pipeline_info.pColorBlendState = &color_blend_info;
+    pipeline_info.pDynamicState = &dynamic_info;
+    pipeline_info.layout = info.layout;
+    pipeline_info.renderPass = info.render_pass;
+    pipeline_info.subpass = 0;
+
+    vk::Pipeline pipeline;
+    try {
+        pipeline = info.device.createGraphicsPipeline(info.cache, pipeline_info);
+    } catch (...) {
+        info.device.destroyShaderModule(vert_module);
+        info.device.destroyShaderModule(frag_module);
+        throw;
+    }
+
+    info.device.destroyShaderModule(vert_module);
+    info.device.destroyShaderModule(frag_module);
+    return pipeline;
+}
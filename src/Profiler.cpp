@@ -0,0 +1,334 @@
+#include "Profiler.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+
+struct ProfileEvent {
+    char const* name;
+    int64_t start;
+    int64_t end;
+};
+
+// Events of one thread. The owning thread pushes and profiler_collect drains, so the ring only needs the two
+// indices to be atomic.
+class ProfileTrack {
+public:
+    static constexpr size_t capacity = 1 << 16;
+
+    ProfileTrack(uint32_t id, std::string name) : id(id), name(std::move(name)), events(capacity) {}
+
+    void push(ProfileEvent const& event) {
+        size_t const write = head.load(std::memory_order_relaxed);
+        if (write - tail.load(std::memory_order_acquire) == capacity) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        events[write % capacity] = event;
+        head.store(write + 1, std::memory_order_release);
+    }
+
+    template <typename Func>
+    void drain(Func&& func) {
+        size_t const read = tail.load(std::memory_order_relaxed);
+        size_t const write = head.load(std::memory_order_acquire);
+        for (size_t i = read; i != write; ++i) {
+            func(events[i % capacity]);
+        }
+        tail.store(write, std::memory_order_release);
+    }
+
+    uint32_t const id;
+    // Guarded by the registry mutex
+    std::string name;
+    std::atomic<size_t> dropped{ 0 };
+
+private:
+    std::vector<ProfileEvent> events;
+    // Producer and consumer each write one of these, keep them on separate cache lines
+    alignas(64) std::atomic<size_t> head{ 0 };
+    alignas(64) std::atomic<size_t> tail{ 0 };
+};
+
+struct CollectedEvent {
+    ProfileEvent event;
+    uint32_t track;
+};
+
+// Tracks are never destroyed, threads that have exited may still have events waiting to be collected
+static std::mutex registry_mutex;
+static std::vector<std::unique_ptr<ProfileTrack>> tracks;
+static thread_local ProfileTrack* thread_track = nullptr;
+
+static std::atomic<bool> capturing{ false };
+// Only touched by the thread calling profiler_collect
+static std::vector<CollectedEvent> collected;
+
+int64_t profiler_now() {
+    static auto const epoch = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+ProfileTrack* profiler_add_track(std::string name) {
+    std::lock_guard lock(registry_mutex);
+    tracks.push_back(std::make_unique<ProfileTrack>(static_cast<uint32_t>(tracks.size()), std::move(name)));
+    return tracks.back().get();
+}
+
+static ProfileTrack* current_thread_track() {
+    if (!thread_track) {
+        thread_track = profiler_add_track("");
+        std::lock_guard lock(registry_mutex);
+        thread_track->name = "Thread " + std::to_string(thread_track->id);
+    }
+    return thread_track;
+}
+
+void profiler_set_thread_name(std::string name) {
+    ProfileTrack* const track = current_thread_track();
+    std::lock_guard lock(registry_mutex);
+    track->name = std::move(name);
+}
+
+void profiler_record(ProfileTrack* track, char const* name, int64_t start, int64_t end) {
+    track->push(ProfileEvent{ name, start, end });
+}
+
+static void drain_tracks(bool keep) {
+    std::lock_guard lock(registry_mutex);
+    for (auto const& track : tracks) {
+        track->drain([keep, id = track->id](ProfileEvent const& event) {
+            if (keep) {
+                collected.push_back(CollectedEvent{ event, id });
+            }
+        });
+    }
+}
+
+void profiler_start_capture() {
+    // Whatever was recorded before belongs to no capture
+    drain_tracks(false);
+    collected.clear();
+    capturing.store(true, std::memory_order_relaxed);
+}
+
+void profiler_stop_capture() {
+    capturing.store(false, std::memory_order_relaxed);
+}
+
+bool profiler_capturing() {
+    return capturing.load(std::memory_order_relaxed);
+}
+
+void profiler_collect() {
+    drain_tracks(true);
+}
+
+static void write_json_string(std::ostream& out, std::string const& value) {
+    out << '"';
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int(c) << std::dec << std::setfill(' ');
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+void profiler_write_chrome_trace(std::string const& path) {
+    profiler_collect();
+    std::ofstream file(path);
+    if (!file) {
+        throw std::runtime_error("Failed to open " + path + " for writing");
+    }
+
+    // Timestamps are in microseconds
+    file << std::fixed << std::setprecision(3) << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    size_t dropped = 0;
+    {
+        std::lock_guard lock(registry_mutex);
+        for (auto const& track : tracks) {
+            file << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << track->id << ",\"args\":{\"name\":";
+            write_json_string(file, track->name);
+            file << "}},\n";
+            dropped += track->dropped.exchange(0);
+        }
+    }
+    for (size_t i = 0; i < collected.size(); ++i) {
+        ProfileEvent const& event = collected[i].event;
+        file << "{\"ph\":\"X\",\"name\":";
+        write_json_string(file, event.name);
+        file << ",\"pid\":1,\"tid\":" << collected[i].track << ",\"ts\":" << event.start / 1000.0
+             << ",\"dur\":" << (event.end - event.start) / 1000.0 << "}" << (i + 1 < collected.size() ? ",\n" : "\n");
+    }
+    file << "]}\n";
+
+    if (!file) {
+        throw std::runtime_error("Failed to write " + path);
+    }
+    if (dropped > 0) {
+        std::cerr << "Profiler ring buffers overflowed, " << dropped << " zones are missing from the trace\n";
+    }
+    collected.clear();
+}
+
+ProfileZone::ProfileZone(char const* name) : name(name), start(profiler_capturing() ? profiler_now() : -1) {}
+
+ProfileZone::~ProfileZone() {
+    if (start >= 0) {
+        current_thread_track()->push(ProfileEvent{ name, start, profiler_now() });
+    }
+}
+
+GpuProfiler::GpuProfiler(vk::PhysicalDevice physical_device, vk::Device device, uint32_t queue_family,
+                         size_t slot_count, vk::DispatchLoaderDynamic const* dispatcher, vk::CommandPool cmd_pool,
+                         vk::Queue queue)
+    : device(device), dispatcher(dispatcher), slots(slot_count) {
+
+    uint32_t const valid_bits = physical_device.getQueueFamilyProperties()[queue_family].timestampValidBits;
+    timestamps_supported = valid_bits > 0;
+    timestamp_period = physical_device.getProperties().limits.timestampPeriod;
+    if (valid_bits < 64) {
+        timestamp_mask = (uint64_t(1) << valid_bits) - 1;
+    }
+    if (!timestamps_supported) {
+        std::cerr << "The graphics queue has no timestamps, GPU zones are only labelled\n";
+        return;
+    }
+
+    // One query for the start and one for the end of every zone
+    vk::QueryPoolCreateInfo pool_info;
+    pool_info.queryType = vk::QueryType::eTimestamp;
+    pool_info.queryCount = max_zones * 2;
+    for (auto& slot : slots) {
+        slot.query_pool = device.createQueryPool(pool_info);
+    }
+    track = profiler_add_track("GPU");
+
+    // The timestamp lands somewhere between submitting and the queue going idle, which is close enough to line the
+    // clocks up for a trace
+    vk::CommandBufferAllocateInfo cmd_info;
+    cmd_info.level = vk::CommandBufferLevel::ePrimary;
+    cmd_info.commandBufferCount = 1;
+    cmd_info.commandPool = cmd_pool;
+    vk::CommandBuffer const cmd = device.allocateCommandBuffers(cmd_info)[0];
+    vk::CommandBufferBeginInfo begin_info;
+    begin_info.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+    cmd.begin(begin_info);
+    cmd.resetQueryPool(slots[0].query_pool, 0, 1);
+    cmd.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, slots[0].query_pool, 0);
+    cmd.end();
+
+    vk::SubmitInfo submit_info;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &cmd;
+    int64_t const submitted = profiler_now();
+    queue.submit(submit_info, nullptr);
+    queue.waitIdle();
+    int64_t const finished = profiler_now();
+    device.freeCommandBuffers(cmd_pool, cmd);
+
+    uint64_t timestamp = 0;
+    vk::Result const result = device.getQueryPoolResults(slots[0].query_pool, 0, 1, sizeof(timestamp), &timestamp,
+        sizeof(uint64_t), vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait);
+    if (result != vk::Result::eSuccess) {
+        throw std::runtime_error("Failed to read GPU timestamps");
+    }
+    clock_offset = (submitted + finished) / 2 - to_cpu_time(timestamp);
+}
+
+GpuProfiler::~GpuProfiler() {
+    for (auto const& slot : slots) {
+        device.destroyQueryPool(slot.query_pool);
+    }
+}
+
+void GpuProfiler::begin_frame(vk::CommandBuffer cmd, size_t slot) {
+    current = &slots[slot];
+    open_zones.clear();
+    if (!timestamps_supported) {
+        return;
+    }
+
+    read_back(*current);
+    cmd.resetQueryPool(current->query_pool, 0, max_zones * 2);
+}
+
+void GpuProfiler::collect() {
+    if (!timestamps_supported) {
+        return;
+    }
+    for (auto& slot : slots) {
+        read_back(slot);
+    }
+}
+
+void GpuProfiler::read_back(Slot& slot) {
+    if (slot.zones.empty()) {
+        return;
+    }
+    std::array<uint64_t, max_zones * 2> timestamps;
+    uint32_t const query_count = static_cast<uint32_t>(slot.zones.size() * 2);
+    vk::Result const result = device.getQueryPoolResults(slot.query_pool, 0, query_count,
+        query_count * sizeof(uint64_t), timestamps.data(), sizeof(uint64_t), vk::QueryResultFlagBits::e64);
+    // Not ready only happens if the slot was never submitted, then there is nothing to report
+    if (result == vk::Result::eSuccess) {
+        for (auto const& zone : slot.zones) {
+            profiler_record(track, zone.name, to_cpu_time(timestamps[zone.query]),
+                            to_cpu_time(timestamps[zone.query + 1]));
+        }
+    }
+    slot.zones.clear();
+}
+
+void GpuProfiler::begin_zone(vk::CommandBuffer cmd, char const* name) {
+    if (dispatcher) {
+        vk::DebugUtilsLabelEXT label;
+        label.pLabelName = name;
+        cmd.beginDebugUtilsLabelEXT(label, *dispatcher);
+    }
+
+    int32_t query = -1;
+    if (timestamps_supported && profiler_capturing() && current->zones.size() < max_zones) {
+        query = static_cast<int32_t>(current->zones.size() * 2);
+        current->zones.push_back(Zone{ name, static_cast<uint32_t>(query) });
+        cmd.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, current->query_pool, query);
+    }
+    open_zones.push_back(query);
+}
+
+void GpuProfiler::end_zone(vk::CommandBuffer cmd) {
+    int32_t const query = open_zones.back();
+    open_zones.pop_back();
+    if (query >= 0) {
+        cmd.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, current->query_pool, query + 1);
+    }
+    if (dispatcher) {
+        cmd.endDebugUtilsLabelEXT(*dispatcher);
+    }
+}
+
+int64_t GpuProfiler::to_cpu_time(uint64_t timestamp) const {
+    return static_cast<int64_t>((timestamp & timestamp_mask) * timestamp_period) + clock_offset;
+}
+
+GpuZone::GpuZone(GpuProfiler* profiler, vk::CommandBuffer cmd, char const* name) : profiler(profiler), cmd(cmd) {
+    if (profiler) {
+        profiler->begin_zone(cmd, name);
+    }
+}
+
+GpuZone::~GpuZone() {
+    if (profiler) {
+        profiler->end_zone(cmd);
+    }
+}
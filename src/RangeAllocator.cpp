@@ -0,0 +1,82 @@
+#include "RangeAllocator.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+
+RangeAllocator::RangeAllocator(uint64_t capacity) : total(capacity) {
+    if (capacity > 0) {
+        free_ranges.emplace(0, capacity);
+    }
+}
+
+std::optional<uint64_t> RangeAllocator::allocate(uint64_t size) {
+    if (size == 0) {
+        return std::nullopt;
+    }
+
+    // Best fit, to keep large free ranges around for large allocations
+    auto best = free_ranges.end();
+    for (auto it = free_ranges.begin(); it != free_ranges.end(); ++it) {
+        if (it->second >= size && (best == free_ranges.end() || it->second < best->second)) {
+            best = it;
+            if (it->second == size) {
+                break;
+            }
+        }
+    }
+    if (best == free_ranges.end()) {
+        return std::nullopt;
+    }
+
+    uint64_t const offset = best->first;
+    uint64_t const remaining = best->second - size;
+    free_ranges.erase(best);
+    if (remaining > 0) {
+        free_ranges.emplace(offset + size, remaining);
+    }
+
+    in_use += size;
+    return offset;
+}
+
+void RangeAllocator::free(uint64_t offset, uint64_t size) {
+    assert(offset + size <= total && "Range is out of bounds");
+    in_use -= size;
+
+    auto next = free_ranges.lower_bound(offset);
+    assert((next == free_ranges.end() || offset + size <= next->first) && "Range overlaps a free range");
+
+    // Merge with the free range right after this one
+    if (next != free_ranges.end() && next->first == offset + size) {
+        size += next->second;
+        next = free_ranges.erase(next);
+    }
+
+    // Merge with the free range right before this one
+    if (next != free_ranges.begin()) {
+        auto const prev = std::prev(next);
+        if (prev->first + prev->second == offset) {
+            prev->second += size;
+            return;
+        }
+    }
+
+    free_ranges.emplace_hint(next, offset, size);
+}
+
+uint64_t RangeAllocator::capacity() const {
+    return total;
+}
+
+uint64_t RangeAllocator::used() const {
+    return in_use;
+}
+
+uint64_t RangeAllocator::largest_free_range() const {
+    uint64_t largest = 0;
+    for (auto const& [offset, size] : free_ranges) {
+        largest = std::max(largest, size);
+    }
+    return largest;
+}
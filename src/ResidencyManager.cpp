@@ -0,0 +1,140 @@
+#include "ResidencyManager.hpp"
+
+#include <algorithm>
+#include <numeric>
+
+void ResidencyManager::Stats::report(std::ostream& out, char const* name) const {
+    out << name << " residency: " << promotions << " promotions, " << demotions << " demotions, "
+        << evictions << " evictions, " << bytes_streamed / 1024 << " KiB streamed in\n";
+}
+
+ResourceId ResidencyManager::add(std::vector<vk::DeviceSize> level_sizes, uint32_t initial_level, SetLevel set_level) {
+    Resource resource;
+    resource.level_sizes = std::move(level_sizes);
+    resource.level = initial_level;
+    resource.set_level = std::move(set_level);
+    resident += resource.level_sizes[initial_level];
+    resources.push_back(std::move(resource));
+    return resources.size() - 1;
+}
+
+void ResidencyManager::touch(ResourceId resource, uint64_t value) {
+    resources[resource].last_used = value;
+}
+
+uint32_t ResidencyManager::level(ResourceId resource) const {
+    return resources[resource].level;
+}
+
+vk::DeviceSize ResidencyManager::resident_size() const {
+    return resident;
+}
+
+void ResidencyManager::update(uint64_t value, vk::DeviceSize budget) {
+    // Demote down to this, and only promote while staying under it, so levels don't flip back and forth at the edge
+    vk::DeviceSize const low_mark = budget - budget / 8;
+    std::vector<ResourceId> const order = lru_order();
+
+    changing_levels = true;
+    if (resident > budget) {
+        // Resources not used in this frame go straight to their lowest level
+        for (ResourceId id : order) {
+            Resource& resource = resources[id];
+            if (resident <= low_mark || resource.last_used == value) {
+                break;
+            }
+            change_level(resource, resource.level_sizes.size() - 1);
+        }
+        // If that was not enough, everything else loses detail one level at a time. Resources in use are only
+        // evicted as a last resort.
+        for (bool const evict : { false, true }) {
+            bool demoted = true;
+            while (resident > low_mark && demoted) {
+                demoted = false;
+                for (ResourceId id : order) {
+                    Resource& resource = resources[id];
+                    if (resident <= low_mark) {
+                        break;
+                    }
+                    uint32_t const next = resource.level + 1;
+                    if (next < resource.level_sizes.size() && (evict || resource.level_sizes[next] > 0)) {
+                        change_level(resource, next);
+                        demoted = true;
+                    }
+                }
+            }
+        }
+    } else {
+        // Most recently used first
+        for (auto it = order.rbegin(); it != order.rend(); ++it) {
+            Resource& resource = resources[*it];
+            if (resource.last_used != value) {
+                break;
+            }
+            if (resource.level == 0) {
+                continue;
+            }
+            vk::DeviceSize const growth = resource.level_sizes[resource.level - 1] - resource.level_sizes[resource.level];
+            if (resident + growth <= low_mark) {
+                change_level(resource, resource.level - 1);
+            }
+        }
+    }
+    changing_levels = false;
+}
+
+vk::DeviceSize ResidencyManager::evict_unused(uint64_t submitted, vk::DeviceSize size) {
+    if (changing_levels) {
+        return 0;
+    }
+
+    changing_levels = true;
+    vk::DeviceSize const before = resident;
+    for (ResourceId id : lru_order()) {
+        Resource& resource = resources[id];
+        // Every later resource was used even more recently
+        if (before - resident >= size || resource.last_used > submitted) {
+            break;
+        }
+        change_level(resource, resource.level_sizes.size() - 1);
+    }
+    changing_levels = false;
+
+    return before - resident;
+}
+
+ResidencyManager::Stats ResidencyManager::take_stats() {
+    Stats const taken = stats;
+    stats = Stats{};
+    return taken;
+}
+
+std::vector<ResourceId> ResidencyManager::lru_order() const {
+    std::vector<ResourceId> order(resources.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [this](ResourceId lhs, ResourceId rhs) {
+        return resources[lhs].last_used < resources[rhs].last_used;
+    });
+    return order;
+}
+
+void ResidencyManager::change_level(Resource& resource, uint32_t level) {
+    if (level == resource.level) {
+        return;
+    }
+
+    vk::DeviceSize const old_size = resource.level_sizes[resource.level];
+    vk::DeviceSize const new_size = resource.level_sizes[level];
+    if (level < resource.level) {
+        ++stats.promotions;
+        stats.bytes_streamed += new_size;
+    } else if (new_size == 0) {
+        ++stats.evictions;
+    } else {
+        ++stats.demotions;
+    }
+
+    resource.level = level;
+    resident = resident - old_size + new_size;
+    resource.set_level(level, resource.last_used);
+}
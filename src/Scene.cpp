@@ -0,0 +1,411 @@
+#include "Scene.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define SCENE_USE_SSE 1
+#include <immintrin.h>
+#endif
+
+void Scene::reserve(size_t count) {
+    for (auto* array : { &pos_x, &pos_y, &pos_z, &rot_x, &rot_y, &rot_z, &rot_w, &scale_x, &scale_y, &scale_z }) {
+        array->reserve(count);
+    }
+    parents.reserve(count);
+    dirty.reserve(count);
+    local.reserve(count);
+    world.reserve(count);
+    dirty_nodes.reserve(count);
+}
+
+size_t Scene::size() const {
+    return parents.size();
+}
+
+uint32_t Scene::add_node(uint32_t parent, glm::vec3 const& position, glm::quat const& rotation, glm::vec3 const& scale) {
+    uint32_t const node = parents.size();
+    // Parents must be added before their children, otherwise a single forward pass is not enough to update the hierarchy
+    assert((parent == no_parent || parent < node) && "Parent node does not exist");
+
+    pos_x.push_back(position.x);
+    pos_y.push_back(position.y);
+    pos_z.push_back(position.z);
+    rot_x.push_back(rotation.x);
+    rot_y.push_back(rotation.y);
+    rot_z.push_back(rotation.z);
+    rot_w.push_back(rotation.w);
+    scale_x.push_back(scale.x);
+    scale_y.push_back(scale.y);
+    scale_z.push_back(scale.z);
+    parents.push_back(parent);
+    dirty.push_back(1);
+    local.emplace_back(1.0f);
+    world.emplace_back(1.0f);
+
+    return node;
+}
+
+void Scene::set_position(uint32_t node, glm::vec3 const& position) {
+    pos_x[node] = position.x;
+    pos_y[node] = position.y;
+    pos_z[node] = position.z;
+    dirty[node] = 1;
+}
+
+void Scene::set_rotation(uint32_t node, glm::quat const& rotation) {
+    rot_x[node] = rotation.x;
+    rot_y[node] = rotation.y;
+    rot_z[node] = rotation.z;
+    rot_w[node] = rotation.w;
+    dirty[node] = 1;
+}
+
+void Scene::set_scale(uint32_t node, glm::vec3 const& scale) {
+    scale_x[node] = scale.x;
+    scale_y[node] = scale.y;
+    scale_z[node] = scale.z;
+    dirty[node] = 1;
+}
+
+size_t Scene::update_transforms() {
+    // Gather the nodes that need an update. Since parents always come before their children, a dirty parent
+    // has already been seen by the time we reach the child.
+    dirty_nodes.clear();
+    for (uint32_t i = 0; i < parents.size(); ++i) {
+        uint32_t const parent = parents[i];
+        if (parent != no_parent && dirty[parent]) {
+            dirty[i] = 1;
+        }
+        if (dirty[i]) {
+            dirty_nodes.push_back(i);
+        }
+    }
+
+    if (dirty_nodes.empty()) {
+        return 0;
+    }
+
+    compute_local_matrices();
+    compute_world_matrices();
+
+    for (uint32_t node : dirty_nodes) {
+        dirty[node] = 0;
+    }
+    return dirty_nodes.size();
+}
+
+void Scene::write_instances(glm::mat4* dest) const {
+    stream_matrices(dest, world.data(), world.size());
+}
+
+void Scene::copy_instances(glm::mat4* dest) const {
+    std::memcpy(dest, world.data(), world.size() * sizeof(glm::mat4));
+}
+
+glm::mat4 const* Scene::world_matrices() const {
+    return world.data();
+}
+
+#if SCENE_USE_SSE
+
+static inline __m128 madd(__m128 a, __m128 b, __m128 c) {
+#if defined(__FMA__)
+    return _mm_fmadd_ps(a, b, c);
+#else
+    return _mm_add_ps(_mm_mul_ps(a, b), c);
+#endif
+}
+
+// Takes one column of four nodes in SoA form (one lane per node), transposes it and stores the column in each node
+static inline void store_column(glm::mat4* matrices, uint32_t const* nodes, int column,
+                                __m128 x, __m128 y, __m128 z, __m128 w) {
+    _MM_TRANSPOSE4_PS(x, y, z, w);
+    _mm_storeu_ps(&matrices[nodes[0]][column].x, x);
+    _mm_storeu_ps(&matrices[nodes[1]][column].x, y);
+    _mm_storeu_ps(&matrices[nodes[2]][column].x, z);
+    _mm_storeu_ps(&matrices[nodes[3]][column].x, w);
+}
+
+#endif
+
+#if SCENE_USE_SSE && defined(__AVX2__)
+
+// Translation * rotation * scale for eight nodes at once. Node data is gathered straight from the SoA arrays.
+static inline void local_matrices_x8(float const* const* arrays, uint32_t const* nodes, glm::mat4* out) {
+    __m256i const indices = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(nodes));
+    auto load = [indices](float const* base) { return _mm256_i32gather_ps(base, indices, 4); };
+
+    __m256 const px = load(arrays[0]), py = load(arrays[1]), pz = load(arrays[2]);
+    __m256 const x = load(arrays[3]), y = load(arrays[4]), z = load(arrays[5]), w = load(arrays[6]);
+    __m256 const sx = load(arrays[7]), sy = load(arrays[8]), sz = load(arrays[9]);
+
+    __m256 const one = _mm256_set1_ps(1.0f);
+    __m256 const x2 = _mm256_add_ps(x, x), y2 = _mm256_add_ps(y, y), z2 = _mm256_add_ps(z, z);
+    __m256 const xx = _mm256_mul_ps(x, x2), yy = _mm256_mul_ps(y, y2), zz = _mm256_mul_ps(z, z2);
+    __m256 const xy = _mm256_mul_ps(x, y2), xz = _mm256_mul_ps(x, z2), yz = _mm256_mul_ps(y, z2);
+    __m256 const wx = _mm256_mul_ps(w, x2), wy = _mm256_mul_ps(w, y2), wz = _mm256_mul_ps(w, z2);
+
+    __m256 const c[4][4] = {
+        { _mm256_mul_ps(_mm256_sub_ps(one, _mm256_add_ps(yy, zz)), sx), _mm256_mul_ps(_mm256_add_ps(xy, wz), sx),
+          _mm256_mul_ps(_mm256_sub_ps(xz, wy), sx), _mm256_setzero_ps() },
+        { _mm256_mul_ps(_mm256_sub_ps(xy, wz), sy), _mm256_mul_ps(_mm256_sub_ps(one, _mm256_add_ps(xx, zz)), sy),
+          _mm256_mul_ps(_mm256_add_ps(yz, wx), sy), _mm256_setzero_ps() },
+        { _mm256_mul_ps(_mm256_add_ps(xz, wy), sz), _mm256_mul_ps(_mm256_sub_ps(yz, wx), sz),
+          _mm256_mul_ps(_mm256_sub_ps(one, _mm256_add_ps(xx, yy)), sz), _mm256_setzero_ps() },
+        { px, py, pz, one }
+    };
+
+    // Split into two groups of four and transpose those with SSE
+    for (int column = 0; column < 4; ++column) {
+        store_column(out, nodes, column,
+                     _mm256_castps256_ps128(c[column][0]), _mm256_castps256_ps128(c[column][1]),
+                     _mm256_castps256_ps128(c[column][2]), _mm256_castps256_ps128(c[column][3]));
+        store_column(out, nodes + 4, column,
+                     _mm256_extractf128_ps(c[column][0], 1), _mm256_extractf128_ps(c[column][1], 1),
+                     _mm256_extractf128_ps(c[column][2], 1), _mm256_extractf128_ps(c[column][3], 1));
+    }
+}
+
+#elif SCENE_USE_SSE
+
+static inline void local_matrices_x4(float const* const* arrays, uint32_t const* nodes, glm::mat4* out) {
+    auto load = [nodes](float const* base) {
+        return _mm_set_ps(base[nodes[3]], base[nodes[2]], base[nodes[1]], base[nodes[0]]);
+    };
+
+    __m128 const px = load(arrays[0]), py = load(arrays[1]), pz = load(arrays[2]);
+    __m128 const x = load(arrays[3]), y = load(arrays[4]), z = load(arrays[5]), w = load(arrays[6]);
+    __m128 const sx = load(arrays[7]), sy = load(arrays[8]), sz = load(arrays[9]);
+
+    __m128 const one = _mm_set1_ps(1.0f);
+    __m128 const zero = _mm_setzero_ps();
+    __m128 const x2 = _mm_add_ps(x, x), y2 = _mm_add_ps(y, y), z2 = _mm_add_ps(z, z);
+    __m128 const xx = _mm_mul_ps(x, x2), yy = _mm_mul_ps(y, y2), zz = _mm_mul_ps(z, z2);
+    __m128 const xy = _mm_mul_ps(x, y2), xz = _mm_mul_ps(x, z2), yz = _mm_mul_ps(y, z2);
+    __m128 const wx = _mm_mul_ps(w, x2), wy = _mm_mul_ps(w, y2), wz = _mm_mul_ps(w, z2);
+
+    store_column(out, nodes, 0, _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(yy, zz)), sx),
+                 _mm_mul_ps(_mm_add_ps(xy, wz), sx), _mm_mul_ps(_mm_sub_ps(xz, wy), sx), zero);
+    store_column(out, nodes, 1, _mm_mul_ps(_mm_sub_ps(xy, wz), sy),
+                 _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, zz)), sy), _mm_mul_ps(_mm_add_ps(yz, wx), sy), zero);
+    store_column(out, nodes, 2, _mm_mul_ps(_mm_add_ps(xz, wy), sz), _mm_mul_ps(_mm_sub_ps(yz, wx), sz),
+                 _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, yy)), sz), zero);
+    store_column(out, nodes, 3, px, py, pz, one);
+}
+
+#endif
+
+void Scene::compute_local_matrices() {
+    size_t const count = dirty_nodes.size();
+    size_t i = 0;
+
+#if SCENE_USE_SSE
+    float const* arrays[] = {
+        pos_x.data(), pos_y.data(), pos_z.data(),
+        rot_x.data(), rot_y.data(), rot_z.data(), rot_w.data(),
+        scale_x.data(), scale_y.data(), scale_z.data()
+    };
+#if defined(__AVX2__)
+    for (; i + 8 <= count; i += 8) {
+        local_matrices_x8(arrays, &dirty_nodes[i], local.data());
+    }
+#else
+    for (; i + 4 <= count; i += 4) {
+        local_matrices_x4(arrays, &dirty_nodes[i], local.data());
+    }
+#endif
+#endif
+
+    // Remaining nodes that do not fill up a full SIMD batch
+    for (; i < count; ++i) {
+        uint32_t const node = dirty_nodes[i];
+        float const x = rot_x[node], y = rot_y[node], z = rot_z[node], w = rot_w[node];
+        float const xx = 2 * x * x, yy = 2 * y * y, zz = 2 * z * z;
+        float const xy = 2 * x * y, xz = 2 * x * z, yz = 2 * y * z;
+        float const wx = 2 * w * x, wy = 2 * w * y, wz = 2 * w * z;
+
+        glm::mat4& m = local[node];
+        m[0] = glm::vec4(1 - (yy + zz), xy + wz, xz - wy, 0) * scale_x[node];
+        m[1] = glm::vec4(xy - wz, 1 - (xx + zz), yz + wx, 0) * scale_y[node];
+        m[2] = glm::vec4(xz + wy, yz - wx, 1 - (xx + yy), 0) * scale_z[node];
+        m[3] = glm::vec4(pos_x[node], pos_y[node], pos_z[node], 1);
+    }
+}
+
+void Scene::compute_world_matrices() {
+    // This part is inherently sequential: a child needs the final world matrix of its parent
+    for (uint32_t node : dirty_nodes) {
+        uint32_t const parent = parents[node];
+        if (parent == no_parent) {
+            world[node] = local[node];
+            continue;
+        }
+
+#if SCENE_USE_SSE
+        float const* a = &world[parent][0].x;
+        float const* b = &local[node][0].x;
+        float* out = &world[node][0].x;
+
+        __m128 const a0 = _mm_loadu_ps(a + 0);
+        __m128 const a1 = _mm_loadu_ps(a + 4);
+        __m128 const a2 = _mm_loadu_ps(a + 8);
+        __m128 const a3 = _mm_loadu_ps(a + 12);
+        for (int column = 0; column < 4; ++column) {
+            float const* col = b + column * 4;
+            __m128 result = _mm_mul_ps(a0, _mm_set1_ps(col[0]));
+            result = madd(a1, _mm_set1_ps(col[1]), result);
+            result = madd(a2, _mm_set1_ps(col[2]), result);
+            result = madd(a3, _mm_set1_ps(col[3]), result);
+            _mm_storeu_ps(out + column * 4, result);
+        }
+#else
+        world[node] = world[parent] * local[node];
+#endif
+    }
+}
+
+void stream_matrices(glm::mat4* dest, glm::mat4 const* src, size_t count) {
+#if SCENE_USE_SSE
+    // Streaming stores require 16 byte alignment. Mapped memory always satisfies this, but a plain pointer might not.
+    if (reinterpret_cast<uintptr_t>(dest) % 16 == 0) {
+        float* out = &dest[0][0].x;
+        for (size_t i = 0; i < count; ++i) {
+            float const* in = &src[i][0].x;
+            _mm_stream_ps(out + 0, _mm_loadu_ps(in + 0));
+            _mm_stream_ps(out + 4, _mm_loadu_ps(in + 4));
+            _mm_stream_ps(out + 8, _mm_loadu_ps(in + 8));
+            _mm_stream_ps(out + 12, _mm_loadu_ps(in + 12));
+            out += 16;
+        }
+        // Make sure the non-temporal stores are visible before anyone submits work reading this memory
+        _mm_sfence();
+        return;
+    }
+#endif
+    std::memcpy(dest, src, count * sizeof(glm::mat4));
+}
+
+// Build a hierarchy with one root for every 8 nodes, and give each root a rotation based on time
+static void fill_benchmark_scene(Scene& scene, size_t node_count) {
+    scene.reserve(node_count);
+    uint32_t root = Scene::no_parent;
+    for (size_t i = 0; i < node_count; ++i) {
+        float const f = static_cast<float>(i);
+        glm::vec3 const position(std::fmod(f, 97.0f), std::fmod(f * 0.37f, 13.0f), std::fmod(f * 0.11f, 7.0f));
+        glm::quat const rotation = glm::angleAxis(f * 0.01f, glm::normalize(glm::vec3(1, f, 2)));
+        if (i % 8 == 0) {
+            root = scene.add_node(Scene::no_parent, position, rotation, glm::vec3(1.0f));
+        } else {
+            scene.add_node(root, position, rotation, glm::vec3(0.5f));
+        }
+    }
+}
+
+void benchmark_scene_transforms(size_t node_count) {
+    using clock = std::chrono::steady_clock;
+    constexpr size_t iterations = 50;
+
+    // Both paths write their results into the same kind of instance array. Note that this is regular heap memory,
+    // so the benefit of the non-temporal stores on write-combined memory does not show up here.
+    std::vector<glm::mat4> instances(node_count);
+
+    // Naive path: a glm matrix per object, stored in AoS form
+    std::vector<glm::vec3> positions(node_count);
+    std::vector<glm::quat> rotations(node_count);
+    std::vector<glm::vec3> scales(node_count);
+    std::vector<uint32_t> parents(node_count);
+    std::vector<glm::mat4> naive_world(node_count);
+    {
+        uint32_t root = Scene::no_parent;
+        for (size_t i = 0; i < node_count; ++i) {
+            float const f = static_cast<float>(i);
+            positions[i] = glm::vec3(std::fmod(f, 97.0f), std::fmod(f * 0.37f, 13.0f), std::fmod(f * 0.11f, 7.0f));
+            rotations[i] = glm::angleAxis(f * 0.01f, glm::normalize(glm::vec3(1, f, 2)));
+            scales[i] = glm::vec3(i % 8 == 0 ? 1.0f : 0.5f);
+            if (i % 8 == 0) {
+                root = i;
+                parents[i] = Scene::no_parent;
+            } else {
+                parents[i] = root;
+            }
+        }
+    }
+
+    auto const naive_start = clock::now();
+    for (size_t iteration = 0; iteration < iterations; ++iteration) {
+        glm::quat const spin = glm::angleAxis(iteration * 0.01f, glm::vec3(0, 0, 1));
+        for (size_t i = 0; i < node_count; i += 8) {
+            rotations[i] = spin;
+        }
+        for (size_t i = 0; i < node_count; ++i) {
+            glm::mat4 const local = glm::translate(glm::mat4(1.0f), positions[i]) * glm::mat4_cast(rotations[i]) *
+                                    glm::scale(glm::mat4(1.0f), scales[i]);
+            naive_world[i] = parents[i] == Scene::no_parent ? local : naive_world[parents[i]] * local;
+            instances[i] = naive_world[i];
+        }
+    }
+    auto const naive_end = clock::now();
+
+    Scene scene;
+    fill_benchmark_scene(scene, node_count);
+    scene.update_transforms();
+
+    // SoA path with every root animated, so the entire hierarchy is dirty
+    auto const soa_start = clock::now();
+    for (size_t iteration = 0; iteration < iterations; ++iteration) {
+        glm::quat const spin = glm::angleAxis(iteration * 0.01f, glm::vec3(0, 0, 1));
+        for (size_t i = 0; i < node_count; i += 8) {
+            scene.set_rotation(i, spin);
+        }
+        scene.update_transforms();
+        scene.write_instances(instances.data());
+    }
+    auto const soa_end = clock::now();
+
+    // Both paths ran the same animation, so their final matrices should match
+    float max_error = 0.0f;
+    for (size_t i = 0; i < node_count; ++i) {
+        for (int c = 0; c < 4; ++c) {
+            glm::vec4 const diff = glm::abs(naive_world[i][c] - instances[i][c]);
+            max_error = std::max({ max_error, diff.x, diff.y, diff.z, diff.w });
+        }
+    }
+
+    // SoA path where only 1 in 10 roots moves
+    auto const sparse_start = clock::now();
+    for (size_t iteration = 0; iteration < iterations; ++iteration) {
+        glm::quat const spin = glm::angleAxis(iteration * 0.01f, glm::vec3(0, 0, 1));
+        for (size_t i = 0; i < node_count; i += 80) {
+            scene.set_rotation(i, spin);
+        }
+        scene.update_transforms();
+        scene.write_instances(instances.data());
+    }
+    auto const sparse_end = clock::now();
+
+    auto to_ms = [](auto duration) {
+        return std::chrono::duration<double, std::milli>(duration).count() / iterations;
+    };
+
+#if SCENE_USE_SSE && defined(__AVX2__)
+    char const* simd_path = "AVX2";
+#elif SCENE_USE_SSE
+    char const* simd_path = "SSE";
+#else
+    char const* simd_path = "scalar";
+#endif
+
+    std::cout << "Transform update for " << node_count << " nodes (" << simd_path << ", average of "
+              << iterations << " iterations)\n";
+    std::cout << "  glm per object:    " << to_ms(naive_end - naive_start) << " ms\n";
+    std::cout << "  SoA, all dirty:    " << to_ms(soa_end - soa_start) << " ms\n";
+    std::cout << "  SoA, 10% dirty:    " << to_ms(sparse_end - sparse_start) << " ms\n";
+    std::cout << "  max difference:    " << max_error << "\n";
+}
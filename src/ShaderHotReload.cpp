@@ -0,0 +1,130 @@
+#include "ShaderHotReload.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+static std::string read_spirv(std::string const& path) {
+    std::ifstream file(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+static std::string directory_of(std::string const& path) {
+    size_t const slash = path.find_last_of('/');
+    return slash == std::string::npos ? "." : path.substr(0, slash);
+}
+
+static std::string file_name_of(std::string const& path) {
+    size_t const slash = path.find_last_of('/');
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+ShaderHotReload::ShaderHotReload(std::vector<ShaderFile> files, ShadersChanged on_change)
+    : files(std::move(files)), on_change(std::move(on_change)) {
+    thread = std::thread([this] { watch_loop(); });
+}
+
+ShaderHotReload::~ShaderHotReload() {
+    running = false;
+    thread.join();
+}
+
+bool ShaderHotReload::compile(ShaderFile const& shader) {
+    // The compiler can be overridden, for example to use glslangValidator
+    char const* compiler = std::getenv("GLSLC");
+    std::string const command = std::string(compiler ? compiler : "glslc") + " " + shader.options + " \""
+                                + shader.glsl_path + "\" -o \"" + shader.spirv_path + "\"";
+    std::cout << "Recompiling " << shader.glsl_path << "\n";
+    // The compiler prints its own diagnostics
+    return std::system(command.c_str()) == 0;
+}
+
+#ifdef __linux__
+
+void ShaderHotReload::watch_loop() {
+    int const fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        std::cerr << "Shader hot reload disabled: inotify_init1 failed\n";
+        return;
+    }
+
+    // Editors often save by writing a temporary file and renaming it, so watch the directories instead of the files.
+    // Watching a directory twice hands out its existing watch again.
+    std::vector<int> watches;
+    std::vector<std::string> names;
+    for (auto const& file : files) {
+        int const watch = inotify_add_watch(fd, directory_of(file.glsl_path).c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+        if (watch < 0) {
+            std::cerr << "Shader hot reload disabled: cannot watch shader directory\n";
+            close(fd);
+            return;
+        }
+        watches.push_back(watch);
+        names.push_back(file_name_of(file.glsl_path));
+    }
+
+    alignas(inotify_event) char buffer[4096];
+    std::vector<bool> changed(files.size(), false);
+    while (running) {
+        pollfd poll_info{ fd, POLLIN, 0 };
+        // Time out regularly so we notice when we have to stop
+        int const ready = poll(&poll_info, 1, 100);
+        if (ready > 0) {
+            ssize_t length;
+            while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+                for (char* ptr = buffer; ptr < buffer + length; ) {
+                    inotify_event const* event = reinterpret_cast<inotify_event const*>(ptr);
+                    if (event->len > 0) {
+                        for (size_t i = 0; i < files.size(); ++i) {
+                            if (event->wd == watches[i] && names[i] == event->name) {
+                                changed[i] = true;
+                            }
+                        }
+                    }
+                    ptr += sizeof(inotify_event) + event->len;
+                }
+            }
+            // Saving a file tends to produce a burst of events, wait for it to settle before compiling
+            continue;
+        }
+
+        if (std::find(changed.begin(), changed.end(), true) == changed.end()) {
+            continue;
+        }
+
+        bool success = true;
+        for (size_t i = 0; i < files.size(); ++i) {
+            if (changed[i]) {
+                success &= compile(files[i]);
+            }
+        }
+        changed.assign(files.size(), false);
+
+        // Keep the old shaders around if the new ones do not compile
+        if (success) {
+            std::vector<std::string> spirv;
+            for (auto const& file : files) {
+                spirv.push_back(read_spirv(file.spirv_path));
+            }
+            on_change(std::move(spirv));
+        }
+    }
+
+    close(fd);
+}
+
+#else
+
+void ShaderHotReload::watch_loop() {
+    std::cerr << "Shader hot reload is only supported on Linux\n";
+}
+
+#endif
@@ -0,0 +1,424 @@
+#include "Skinning.hpp"
+
+#include "Scene.hpp"
+#include "ThreadPool.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define SKINNING_USE_SSE 1
+#include <immintrin.h>
+#endif
+
+// Layout of VertexFormat::Standard, which the compute shader reads and writes
+constexpr vk::DeviceSize standard_vertex_stride = 48;
+
+// Must match local_size_x in data/skinning.comp
+constexpr uint32_t skinning_group_size = 64;
+
+// Below this many characters, palettes are evaluated on the calling thread
+constexpr size_t parallel_palette_threshold = 32;
+
+// Push constants of data/skinning.comp
+struct SkinningConstants {
+    uint32_t vertex_count;
+    uint32_t joint_count;
+    // Index of the slot's first palette matrix and first output vertex
+    uint32_t first_palette;
+    uint32_t first_vertex;
+};
+
+SkinWeights make_skin_weights(glm::uvec4 const& joints, glm::vec4 const& weights) {
+    float const sum = weights.x + weights.y + weights.z + weights.w;
+    assert(sum > 0.0f && "A vertex needs at least one joint");
+
+    std::array<uint32_t, 4> quantized;
+    uint32_t total = 0;
+    for (int i = 0; i < 4; ++i) {
+        assert(joints[i] < SkeletalAnimation::max_joints);
+        quantized[i] = static_cast<uint32_t>(std::lround(weights[i] / sum * 255.0f));
+        total += quantized[i];
+    }
+    // Rounding may be off by a little, which goes to the largest weight
+    size_t const largest = std::max_element(quantized.begin(), quantized.end()) - quantized.begin();
+    quantized[largest] = quantized[largest] + 255 - total;
+
+    SkinWeights result;
+    result.joints = joints.x | joints.y << 8 | joints.z << 16 | joints.w << 24;
+    result.weights = quantized[0] | quantized[1] << 8 | quantized[2] << 16 | quantized[3] << 24;
+    return result;
+}
+
+uint32_t SkeletalAnimation::add_joint(uint32_t parent, glm::vec3 const& position) {
+    uint32_t const joint = parents.size();
+    assert((parent == no_parent || parent < joint) && "Parent joint does not exist");
+    if (joint >= max_joints) {
+        throw std::runtime_error("Skeletons are limited to 256 joints");
+    }
+
+    parents.push_back(parent);
+    pos_x.push_back(position.x);
+    pos_y.push_back(position.y);
+    pos_z.push_back(position.z);
+    // Joints are unrotated in the bind pose, so the bind pose is just the sum of the offsets
+    glm::mat4 const parent_bind = parent == no_parent ? glm::mat4(1.0f) : glm::inverse(inverse_bind[parent]);
+    inverse_bind.push_back(glm::inverse(glm::translate(parent_bind, position)));
+    return joint;
+}
+
+size_t SkeletalAnimation::joint_count() const {
+    return parents.size();
+}
+
+void SkeletalAnimation::set_clip(size_t keys, float duration) {
+    assert(keys > 0 && duration > 0.0f);
+    key_count = keys;
+    clip_duration = duration;
+    size_t const count = keys * joint_count();
+    rot_x.assign(count, 0.0f);
+    rot_y.assign(count, 0.0f);
+    rot_z.assign(count, 0.0f);
+    rot_w.assign(count, 1.0f);
+}
+
+void SkeletalAnimation::set_rotation(size_t key, uint32_t joint, glm::quat const& rotation) {
+    size_t const index = key * joint_count() + joint;
+    rot_x[index] = rotation.x;
+    rot_y[index] = rotation.y;
+    rot_z[index] = rotation.z;
+    rot_w[index] = rotation.w;
+}
+
+float SkeletalAnimation::duration() const {
+    return clip_duration;
+}
+
+#if SKINNING_USE_SSE
+
+static inline __m128 madd(__m128 a, __m128 b, __m128 c) {
+#if defined(__FMA__)
+    return _mm_fmadd_ps(a, b, c);
+#else
+    return _mm_add_ps(_mm_mul_ps(a, b), c);
+#endif
+}
+
+// Normalized lerp between the rotations of keys a and b for four consecutive joints, turned into translation *
+// rotation matrices. Joint data is loaded straight from the SoA arrays.
+static inline void local_matrices_x4(float const* const* a, float const* const* b, float const* const* position,
+                                     __m128 t, glm::mat4* out) {
+    __m128 ax = _mm_loadu_ps(a[0]), ay = _mm_loadu_ps(a[1]), az = _mm_loadu_ps(a[2]), aw = _mm_loadu_ps(a[3]);
+    __m128 bx = _mm_loadu_ps(b[0]), by = _mm_loadu_ps(b[1]), bz = _mm_loadu_ps(b[2]), bw = _mm_loadu_ps(b[3]);
+
+    // Take the short way around: flip b when it is in the other hemisphere
+    __m128 const dot = madd(ax, bx, madd(ay, by, madd(az, bz, _mm_mul_ps(aw, bw))));
+    __m128 const sign = _mm_and_ps(dot, _mm_set1_ps(-0.0f));
+    bx = _mm_xor_ps(bx, sign);
+    by = _mm_xor_ps(by, sign);
+    bz = _mm_xor_ps(bz, sign);
+    bw = _mm_xor_ps(bw, sign);
+
+    __m128 x = madd(_mm_sub_ps(bx, ax), t, ax), y = madd(_mm_sub_ps(by, ay), t, ay);
+    __m128 z = madd(_mm_sub_ps(bz, az), t, az), w = madd(_mm_sub_ps(bw, aw), t, aw);
+    __m128 const one = _mm_set1_ps(1.0f);
+    __m128 const length = _mm_sqrt_ps(madd(x, x, madd(y, y, madd(z, z, _mm_mul_ps(w, w)))));
+    __m128 const inverse_length = _mm_div_ps(one, length);
+    x = _mm_mul_ps(x, inverse_length);
+    y = _mm_mul_ps(y, inverse_length);
+    z = _mm_mul_ps(z, inverse_length);
+    w = _mm_mul_ps(w, inverse_length);
+
+    __m128 const zero = _mm_setzero_ps();
+    __m128 const x2 = _mm_add_ps(x, x), y2 = _mm_add_ps(y, y), z2 = _mm_add_ps(z, z);
+    __m128 const xx = _mm_mul_ps(x, x2), yy = _mm_mul_ps(y, y2), zz = _mm_mul_ps(z, z2);
+    __m128 const xy = _mm_mul_ps(x, y2), xz = _mm_mul_ps(x, z2), yz = _mm_mul_ps(y, z2);
+    __m128 const wx = _mm_mul_ps(w, x2), wy = _mm_mul_ps(w, y2), wz = _mm_mul_ps(w, z2);
+
+    // One lane per joint, transposed into the columns of four consecutive matrices
+    __m128 c[4][4] = {
+        { _mm_sub_ps(one, _mm_add_ps(yy, zz)), _mm_add_ps(xy, wz), _mm_sub_ps(xz, wy), zero },
+        { _mm_sub_ps(xy, wz), _mm_sub_ps(one, _mm_add_ps(xx, zz)), _mm_add_ps(yz, wx), zero },
+        { _mm_add_ps(xz, wy), _mm_sub_ps(yz, wx), _mm_sub_ps(one, _mm_add_ps(xx, yy)), zero },
+        { _mm_loadu_ps(position[0]), _mm_loadu_ps(position[1]), _mm_loadu_ps(position[2]), one }
+    };
+    for (int column = 0; column < 4; ++column) {
+        _MM_TRANSPOSE4_PS(c[column][0], c[column][1], c[column][2], c[column][3]);
+        for (int joint = 0; joint < 4; ++joint) {
+            _mm_storeu_ps(&out[joint][column].x, c[column][joint]);
+        }
+    }
+}
+
+#endif
+
+// out = a * b. out may be b, but not a.
+static inline void multiply(glm::mat4 const& a, glm::mat4 const& b, glm::mat4& out) {
+#if SKINNING_USE_SSE
+    __m128 const a0 = _mm_loadu_ps(&a[0].x);
+    __m128 const a1 = _mm_loadu_ps(&a[1].x);
+    __m128 const a2 = _mm_loadu_ps(&a[2].x);
+    __m128 const a3 = _mm_loadu_ps(&a[3].x);
+    for (int column = 0; column < 4; ++column) {
+        float const* col = &b[column].x;
+        __m128 result = _mm_mul_ps(a0, _mm_set1_ps(col[0]));
+        result = madd(a1, _mm_set1_ps(col[1]), result);
+        result = madd(a2, _mm_set1_ps(col[2]), result);
+        result = madd(a3, _mm_set1_ps(col[3]), result);
+        _mm_storeu_ps(&out[column].x, result);
+    }
+#else
+    out = a * b;
+#endif
+}
+
+void SkeletalAnimation::evaluate(float time, glm::mat4* scratch, glm::mat4* palette) const {
+    size_t const count = joint_count();
+    float const key_position = std::fmod(std::fmod(time, clip_duration) + clip_duration, clip_duration)
+                             / clip_duration * key_count;
+    size_t const key_a = std::min(static_cast<size_t>(key_position), key_count - 1);
+    size_t const key_b = (key_a + 1) % key_count;
+    float const t = key_position - key_a;
+    size_t const a = key_a * count;
+    size_t const b = key_b * count;
+
+    // Local matrices first, the rotation blended between the two keys and the translation from the bind pose
+    size_t joint = 0;
+#if SKINNING_USE_SSE
+    __m128 const t4 = _mm_set1_ps(t);
+    for (; joint + 4 <= count; joint += 4) {
+        float const* const rotation_a[] = { &rot_x[a + joint], &rot_y[a + joint], &rot_z[a + joint], &rot_w[a + joint] };
+        float const* const rotation_b[] = { &rot_x[b + joint], &rot_y[b + joint], &rot_z[b + joint], &rot_w[b + joint] };
+        float const* const position[] = { &pos_x[joint], &pos_y[joint], &pos_z[joint] };
+        local_matrices_x4(rotation_a, rotation_b, position, t4, scratch + joint);
+    }
+#endif
+    // Remaining joints that do not fill up a full SIMD batch
+    for (; joint < count; ++joint) {
+        glm::quat const qa(rot_w[a + joint], rot_x[a + joint], rot_y[a + joint], rot_z[a + joint]);
+        glm::quat qb(rot_w[b + joint], rot_x[b + joint], rot_y[b + joint], rot_z[b + joint]);
+        if (glm::dot(qa, qb) < 0.0f) {
+            qb = -qb;
+        }
+        glm::quat const q = glm::normalize(qa + (qb - qa) * t);
+        scratch[joint] = glm::mat4_cast(q);
+        scratch[joint][3] = glm::vec4(pos_x[joint], pos_y[joint], pos_z[joint], 1.0f);
+    }
+
+    // Then the hierarchy in place, a parent's local matrix has already turned into its model matrix
+    for (joint = 0; joint < count; ++joint) {
+        uint32_t const parent = parents[joint];
+        if (parent != no_parent) {
+            multiply(scratch[parent], scratch[joint], scratch[joint]);
+        }
+        multiply(scratch[joint], inverse_bind[joint], palette[joint]);
+    }
+}
+
+// Device local buffer with the given contents
+static Buffer upload_buffer(vk::PhysicalDevice physical_device, vk::Device device, void const* data,
+                            vk::DeviceSize size, vk::BufferUsageFlags usage, vk::CommandPool cmd_pool,
+                            vk::Queue queue) {
+    Buffer staging(physical_device, device, size, vk::BufferUsageFlagBits::eTransferSrc,
+                   vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+    void* const mapping = device.mapMemory(staging.memory_handle(), 0, VK_WHOLE_SIZE);
+    std::memcpy(mapping, data, size);
+    device.unmapMemory(staging.memory_handle());
+
+    Buffer buffer(physical_device, device, size, usage | vk::BufferUsageFlagBits::eTransferDst,
+                  vk::MemoryPropertyFlagBits::eDeviceLocal);
+    copy_buffers(staging, buffer, size, cmd_pool, queue);
+    return buffer;
+}
+
+SkinnedCharacters::SkinnedCharacters(vk::PhysicalDevice physical_device, vk::Device device, vk::PipelineCache cache,
+                                     std::string const& spirv, Mesh const& mesh, SkeletalAnimation animation,
+                                     uint32_t character_count, uint32_t slot_count,
+                                     vk::BufferUsageFlags extra_output_usage, vk::CommandPool cmd_pool,
+                                     vk::Queue queue)
+    : device(device), animation(std::move(animation)), characters(character_count), slots(slot_count),
+      vertex_count(mesh.vertex_count), indices(mesh.index_count) {
+    size_t const joint_count = this->animation.joint_count();
+    vk::BufferUsageFlags const storage = vk::BufferUsageFlagBits::eStorageBuffer;
+    bind_vertices = upload_buffer(physical_device, device, mesh.vertices, vertex_count * standard_vertex_stride,
+                                  storage, cmd_pool, queue);
+    weights = upload_buffer(physical_device, device, mesh.weights, vertex_count * sizeof(SkinWeights), storage,
+                            cmd_pool, queue);
+    index_data = upload_buffer(physical_device, device, mesh.indices, indices * sizeof(uint32_t),
+                               vk::BufferUsageFlagBits::eIndexBuffer, cmd_pool, queue);
+
+    // Palettes are written by the CPU every frame, and stay mapped
+    palettes = Buffer(physical_device, device, vk::DeviceSize(slots) * characters * joint_count * sizeof(glm::mat4),
+                      storage, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+    palette_mapping = static_cast<glm::mat4*>(device.mapMemory(palettes.memory_handle(), 0, VK_WHOLE_SIZE));
+
+    output = Buffer(physical_device, device, vk::DeviceSize(slots) * characters * vertex_count * standard_vertex_stride,
+                    storage | vk::BufferUsageFlagBits::eVertexBuffer | extra_output_usage,
+                    vk::MemoryPropertyFlagBits::eDeviceLocal);
+    if (extra_output_usage & vk::BufferUsageFlagBits::eShaderDeviceAddress) {
+        output_address = output.device_address();
+    }
+
+    std::array<vk::DescriptorSetLayoutBinding, 4> bindings;
+    for (uint32_t i = 0; i < bindings.size(); ++i) {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = vk::DescriptorType::eStorageBuffer;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = vk::ShaderStageFlagBits::eCompute;
+    }
+    vk::DescriptorSetLayoutCreateInfo layout_info;
+    layout_info.bindingCount = bindings.size();
+    layout_info.pBindings = bindings.data();
+    descriptor_set_layout = device.createDescriptorSetLayout(layout_info);
+
+    // The set never changes, so it gets a pool of its own instead of going through the per-frame allocator
+    vk::DescriptorPoolSize pool_size;
+    pool_size.type = vk::DescriptorType::eStorageBuffer;
+    pool_size.descriptorCount = bindings.size();
+    vk::DescriptorPoolCreateInfo pool_info;
+    pool_info.maxSets = 1;
+    pool_info.poolSizeCount = 1;
+    pool_info.pPoolSizes = &pool_size;
+    descriptor_pool = device.createDescriptorPool(pool_info);
+
+    vk::DescriptorSetAllocateInfo alloc_info;
+    alloc_info.descriptorPool = descriptor_pool;
+    alloc_info.descriptorSetCount = 1;
+    alloc_info.pSetLayouts = &descriptor_set_layout;
+    descriptor_set = device.allocateDescriptorSets(alloc_info)[0];
+
+    std::array<vk::DescriptorBufferInfo, 4> const buffer_infos = {
+        vk::DescriptorBufferInfo(bind_vertices.handle(), 0, VK_WHOLE_SIZE),
+        vk::DescriptorBufferInfo(weights.handle(), 0, VK_WHOLE_SIZE),
+        vk::DescriptorBufferInfo(palettes.handle(), 0, VK_WHOLE_SIZE),
+        vk::DescriptorBufferInfo(output.handle(), 0, VK_WHOLE_SIZE)
+    };
+    std::array<vk::WriteDescriptorSet, 4> writes;
+    for (uint32_t i = 0; i < writes.size(); ++i) {
+        writes[i].dstSet = descriptor_set;
+        writes[i].dstBinding = i;
+        writes[i].descriptorCount = 1;
+        writes[i].descriptorType = vk::DescriptorType::eStorageBuffer;
+        writes[i].pBufferInfo = &buffer_infos[i];
+    }
+    device.updateDescriptorSets(writes, nullptr);
+
+    vk::PushConstantRange push_range;
+    push_range.stageFlags = vk::ShaderStageFlagBits::eCompute;
+    push_range.offset = 0;
+    push_range.size = sizeof(SkinningConstants);
+    vk::PipelineLayoutCreateInfo pipeline_layout_info;
+    pipeline_layout_info.setLayoutCount = 1;
+    pipeline_layout_info.pSetLayouts = &descriptor_set_layout;
+    pipeline_layout_info.pushConstantRangeCount = 1;
+    pipeline_layout_info.pPushConstantRanges = &push_range;
+    pipeline_layout = device.createPipelineLayout(pipeline_layout_info);
+
+    vk::ShaderModuleCreateInfo module_info;
+    module_info.codeSize = spirv.size();
+    module_info.pCode = reinterpret_cast<uint32_t const*>(spirv.data());
+    vk::ShaderModule const module = device.createShaderModule(module_info);
+
+    vk::ComputePipelineCreateInfo compute_info;
+    compute_info.stage.stage = vk::ShaderStageFlagBits::eCompute;
+    compute_info.stage.module = module;
+    compute_info.stage.pName = "main";
+    compute_info.layout = pipeline_layout;
+    try {
+        pipeline = device.createComputePipeline(cache, compute_info);
+    } catch (...) {
+        device.destroyShaderModule(module);
+        throw;
+    }
+    device.destroyShaderModule(module);
+}
+
+SkinnedCharacters::~SkinnedCharacters() {
+    device.destroyPipeline(pipeline);
+    device.destroyPipelineLayout(pipeline_layout);
+    device.destroyDescriptorPool(descriptor_pool);
+    device.destroyDescriptorSetLayout(descriptor_set_layout);
+    device.unmapMemory(palettes.memory_handle());
+}
+
+void SkinnedCharacters::evaluate_characters(uint32_t slot, float time, size_t chunk, size_t begin, size_t end) {
+    size_t const joint_count = animation.joint_count();
+    glm::mat4* const local = &scratch[chunk * joint_count * 2];
+    glm::mat4* const palette = local + joint_count;
+    // Characters are spread evenly over the clip, so they do not all move in lockstep
+    float const phase_step = animation.duration() * 0.618034f;
+    for (size_t character = begin; character < end; ++character) {
+        animation.evaluate(time + character * phase_step, local, palette);
+        stream_matrices(palette_mapping + (size_t(slot) * characters + character) * joint_count, palette, joint_count);
+    }
+}
+
+void SkinnedCharacters::update_palettes(uint32_t slot, float time, ThreadPool& workers) {
+    bool const parallel = characters >= parallel_palette_threshold;
+    // Only grows on the first call
+    size_t const chunks = parallel ? workers.chunk_count() : 1;
+    if (scratch.size() < chunks * animation.joint_count() * 2) {
+        scratch.resize(chunks * animation.joint_count() * 2);
+    }
+
+    if (!parallel) {
+        evaluate_characters(slot, time, 0, 0, characters);
+        return;
+    }
+    workers.parallel_for(characters, [this, slot, time](size_t chunk, size_t begin, size_t end) {
+        evaluate_characters(slot, time, chunk, begin, end);
+    });
+}
+
+void SkinnedCharacters::record_skinning(vk::CommandBuffer cmd, uint32_t slot) {
+    SkinningConstants constants;
+    constants.vertex_count = vertex_count;
+    constants.joint_count = static_cast<uint32_t>(animation.joint_count());
+    constants.first_palette = slot * characters * constants.joint_count;
+    constants.first_vertex = slot * characters * vertex_count;
+
+    // A single dispatch for every character, one row of workgroups each
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipeline_layout, 0, descriptor_set, nullptr);
+    cmd.pushConstants(pipeline_layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(constants), &constants);
+    cmd.dispatch((vertex_count + skinning_group_size - 1) / skinning_group_size, characters, 1);
+
+    // Read as vertex input, or through device addresses with vertex pulling
+    vk::MemoryBarrier barrier;
+    barrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+    barrier.dstAccessMask = vk::AccessFlagBits::eVertexAttributeRead | vk::AccessFlagBits::eShaderRead;
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                        vk::PipelineStageFlagBits::eVertexInput | vk::PipelineStageFlagBits::eVertexShader,
+                        {}, barrier, nullptr, nullptr);
+}
+
+uint32_t SkinnedCharacters::character_count() const {
+    return characters;
+}
+
+vk::Buffer SkinnedCharacters::output_buffer() {
+    return output.handle();
+}
+
+vk::Buffer SkinnedCharacters::index_buffer() {
+    return index_data.handle();
+}
+
+uint32_t SkinnedCharacters::index_count() const {
+    return indices;
+}
+
+int32_t SkinnedCharacters::vertex_offset(uint32_t slot, uint32_t character) const {
+    return static_cast<int32_t>((slot * characters + character) * vertex_count);
+}
+
+vk::DeviceAddress SkinnedCharacters::vertex_address(uint32_t slot, uint32_t character) const {
+    return output_address + vk::DeviceSize(vertex_offset(slot, character)) * standard_vertex_stride;
+}
@@ -0,0 +1,285 @@
+#include "TexturePacker.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <numeric>
+#include <stdexcept>
+
+// Start of an atlas file, followed by the layout and the pixels of every layer
+constexpr uint32_t atlas_magic = 0x534c5441; // "ATLS"
+constexpr uint32_t atlas_version = 1;
+
+static uint32_t align_up(uint32_t size, uint32_t alignment) {
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+SkylinePacker::SkylinePacker(uint32_t width, uint32_t height) : width(width), height(height) {
+    skyline.push_back(Segment{ 0, 0, width });
+}
+
+std::optional<uint32_t> SkylinePacker::fit(size_t index, uint32_t rect_width, uint32_t rect_height) const {
+    if (skyline[index].x + rect_width > width) {
+        return std::nullopt;
+    }
+    // The rectangle has to sit on top of every segment it spans
+    uint32_t y = 0;
+    uint32_t remaining = rect_width;
+    for (size_t i = index; remaining > 0; ++i) {
+        y = std::max(y, skyline[i].y);
+        if (y + rect_height > height) {
+            return std::nullopt;
+        }
+        remaining -= std::min(remaining, skyline[i].width);
+    }
+    return y;
+}
+
+std::optional<std::array<uint32_t, 2>> SkylinePacker::insert(uint32_t rect_width, uint32_t rect_height) {
+    size_t best_index = skyline.size();
+    uint32_t best_top = height + 1;
+    uint32_t best_y = 0;
+    for (size_t i = 0; i < skyline.size(); ++i) {
+        std::optional<uint32_t> const y = fit(i, rect_width, rect_height);
+        // Lowest top edge wins, then the leftmost spot
+        if (y && *y + rect_height < best_top) {
+            best_index = i;
+            best_top = *y + rect_height;
+            best_y = *y;
+        }
+    }
+    if (best_index == skyline.size()) {
+        return std::nullopt;
+    }
+
+    uint32_t const x = skyline[best_index].x;
+    skyline.insert(skyline.begin() + best_index, Segment{ x, best_top, rect_width });
+
+    // Cut the segments now covered by the rectangle
+    for (size_t i = best_index + 1; i < skyline.size();) {
+        uint32_t const end = x + rect_width;
+        if (skyline[i].x >= end) {
+            break;
+        }
+        uint32_t const overlap = end - skyline[i].x;
+        if (overlap >= skyline[i].width) {
+            skyline.erase(skyline.begin() + i);
+            continue;
+        }
+        skyline[i].x += overlap;
+        skyline[i].width -= overlap;
+        break;
+    }
+
+    // Neighbours at the same height become one segment
+    for (size_t i = 0; i + 1 < skyline.size();) {
+        if (skyline[i].y == skyline[i + 1].y) {
+            skyline[i].width += skyline[i + 1].width;
+            skyline.erase(skyline.begin() + i + 1);
+        } else {
+            ++i;
+        }
+    }
+
+    return std::array<uint32_t, 2>{ x, best_y };
+}
+
+uint32_t atlas_alignment(uint32_t mip_levels) {
+    return 1u << (std::max(mip_levels, 1u) - 1);
+}
+
+uint32_t choose_atlas_page_size(std::vector<TextureImage> const& images, uint32_t mip_levels,
+                                uint32_t min_page_size, uint32_t max_page_size) {
+    uint32_t const alignment = atlas_alignment(mip_levels);
+    uint32_t largest = 0;
+    for (auto const& image : images) {
+        largest = std::max({ largest, align_up(image.width + 2 * alignment, alignment),
+                             align_up(image.height + 2 * alignment, alignment) });
+    }
+
+    uint32_t page_size = 1;
+    while (page_size < std::max(largest, min_page_size)) {
+        page_size *= 2;
+    }
+    if (page_size > max_page_size) {
+        throw std::invalid_argument("Texture is too large for an atlas page");
+    }
+    return page_size;
+}
+
+AtlasLayout pack_textures(std::vector<std::array<uint32_t, 2>> const& sizes, uint32_t page_size, uint32_t mip_levels) {
+    AtlasLayout layout;
+    layout.page_size = page_size;
+    // One texel of padding in the smallest level
+    uint32_t const alignment = atlas_alignment(mip_levels);
+    layout.padding = alignment;
+    layout.entries.resize(sizes.size());
+
+    // Tallest first, which keeps the skyline flat
+    std::vector<size_t> order(sizes.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&sizes](size_t lhs, size_t rhs) {
+        return sizes[lhs][1] != sizes[rhs][1] ? sizes[lhs][1] > sizes[rhs][1] : sizes[lhs][0] > sizes[rhs][0];
+    });
+
+    std::vector<SkylinePacker> pages;
+    for (size_t index : order) {
+        uint32_t const width = sizes[index][0];
+        uint32_t const height = sizes[index][1];
+        uint32_t const padded_width = align_up(width + 2 * layout.padding, alignment);
+        uint32_t const padded_height = align_up(height + 2 * layout.padding, alignment);
+        if (width == 0 || height == 0 || padded_width > page_size || padded_height > page_size) {
+            throw std::invalid_argument("Texture " + std::to_string(index) + " does not fit in an atlas page");
+        }
+
+        std::optional<std::array<uint32_t, 2>> position;
+        uint32_t layer = 0;
+        for (; layer < pages.size(); ++layer) {
+            position = pages[layer].insert(padded_width, padded_height);
+            if (position) {
+                break;
+            }
+        }
+        // Nothing fits in the existing layers, start a new one
+        if (!position) {
+            pages.emplace_back(page_size, page_size);
+            position = pages.back().insert(padded_width, padded_height);
+        }
+
+        AtlasEntry& entry = layout.entries[index];
+        entry.layer = layer;
+        entry.x = (*position)[0] + layout.padding;
+        entry.y = (*position)[1] + layout.padding;
+        entry.width = width;
+        entry.height = height;
+        float const texel = 1.0f / page_size;
+        entry.uv_rect = { entry.x * texel, entry.y * texel, width * texel, height * texel };
+    }
+    layout.layer_count = pages.size();
+    return layout;
+}
+
+Atlas build_atlas(std::vector<TextureImage> const& images, uint32_t page_size, uint32_t mip_levels) {
+    std::vector<std::array<uint32_t, 2>> sizes;
+    for (auto const& image : images) {
+        sizes.push_back({ image.width, image.height });
+    }
+
+    Atlas atlas;
+    atlas.layout = pack_textures(sizes, page_size, mip_levels);
+    atlas.layers.assign(atlas.layout.layer_count, std::vector<uint8_t>(size_t(page_size) * page_size * 4, 0));
+
+    uint32_t const padding = atlas.layout.padding;
+    for (size_t i = 0; i < images.size(); ++i) {
+        TextureImage const& image = images[i];
+        AtlasEntry const& entry = atlas.layout.entries[i];
+        std::vector<uint8_t>& layer = atlas.layers[entry.layer];
+        // The padding repeats the nearest edge texel, like clamp to edge addressing would
+        for (uint32_t y = entry.y - padding; y < entry.y + entry.height + padding; ++y) {
+            uint32_t const source_y = std::min(std::max(y, entry.y) - entry.y, image.height - 1);
+            for (uint32_t x = entry.x - padding; x < entry.x + entry.width + padding; ++x) {
+                uint32_t const source_x = std::min(std::max(x, entry.x) - entry.x, image.width - 1);
+                std::copy_n(&image.pixels[(size_t(source_y) * image.width + source_x) * 4], 4,
+                            &layer[(size_t(y) * page_size + x) * 4]);
+            }
+        }
+    }
+    return atlas;
+}
+
+template <typename T>
+static void write_value(std::ofstream& file, T const& value) {
+    file.write(reinterpret_cast<char const*>(&value), sizeof(T));
+}
+
+template <typename T>
+static T read_value(std::ifstream& file) {
+    T value;
+    file.read(reinterpret_cast<char*>(&value), sizeof(T));
+    return value;
+}
+
+void save_atlas(std::string const& path, Atlas const& atlas) {
+    std::ofstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Failed to open " + path + " for writing");
+    }
+
+    AtlasLayout const& layout = atlas.layout;
+    write_value(file, atlas_magic);
+    write_value(file, atlas_version);
+    write_value(file, layout.page_size);
+    write_value(file, layout.layer_count);
+    write_value(file, layout.padding);
+    write_value(file, static_cast<uint32_t>(layout.entries.size()));
+    for (auto const& entry : layout.entries) {
+        write_value(file, entry.layer);
+        write_value(file, entry.x);
+        write_value(file, entry.y);
+        write_value(file, entry.width);
+        write_value(file, entry.height);
+        write_value(file, entry.uv_rect);
+    }
+    for (auto const& layer : atlas.layers) {
+        file.write(reinterpret_cast<char const*>(layer.data()), layer.size());
+    }
+
+    if (!file) {
+        throw std::runtime_error("Failed to write " + path);
+    }
+}
+
+Atlas load_atlas(std::string const& path, uint32_t max_page_size, uint32_t max_layers) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Failed to open " + path);
+    }
+    if (read_value<uint32_t>(file) != atlas_magic || read_value<uint32_t>(file) != atlas_version) {
+        throw std::runtime_error(path + " is not a texture atlas, or was written by another version");
+    }
+
+    Atlas atlas;
+    AtlasLayout& layout = atlas.layout;
+    layout.page_size = read_value<uint32_t>(file);
+    layout.layer_count = read_value<uint32_t>(file);
+    layout.padding = read_value<uint32_t>(file);
+    uint32_t const entry_count = read_value<uint32_t>(file);
+    if (!file) {
+        throw std::runtime_error("Failed to read " + path);
+    }
+    if (layout.page_size > max_page_size || layout.layer_count > max_layers) {
+        throw std::runtime_error("Texture atlas " + path + " is too large for this device");
+    }
+    // The counts come from the file, so check that it holds that much before allocating for it
+    constexpr uint64_t entry_size = 5 * sizeof(uint32_t) + sizeof(std::array<float, 4>);
+    uint64_t const layer_size = uint64_t(layout.page_size) * layout.page_size * 4;
+    std::streamoff const header_end = file.tellg();
+    file.seekg(0, std::ios::end);
+    uint64_t const remaining = static_cast<uint64_t>(file.tellg() - header_end);
+    file.seekg(header_end);
+    if (entry_count * entry_size + layout.layer_count * layer_size != remaining) {
+        throw std::runtime_error(path + " is corrupt, its size does not match its header");
+    }
+
+    layout.entries.resize(entry_count);
+    for (auto& entry : layout.entries) {
+        entry.layer = read_value<uint32_t>(file);
+        entry.x = read_value<uint32_t>(file);
+        entry.y = read_value<uint32_t>(file);
+        entry.width = read_value<uint32_t>(file);
+        entry.height = read_value<uint32_t>(file);
+        entry.uv_rect = read_value<std::array<float, 4>>(file);
+        if (entry.layer >= layout.layer_count) {
+            throw std::runtime_error(path + " is corrupt, a texture is on layer " + std::to_string(entry.layer) +
+                                     " of " + std::to_string(layout.layer_count));
+        }
+    }
+    atlas.layers.assign(layout.layer_count, std::vector<uint8_t>(layer_size));
+    for (auto& layer : atlas.layers) {
+        file.read(reinterpret_cast<char*>(layer.data()), layer.size());
+    }
+
+    if (!file) {
+        throw std::runtime_error("Failed to read " + path);
+    }
+    return atlas;
+}
@@ -0,0 +1,100 @@
+#include "ThreadPool.hpp"
+#include "Profiler.hpp"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t thread_count) {
+    threads.reserve(thread_count);
+    for (size_t i = 0; i < thread_count; ++i) {
+        threads.emplace_back([this] { worker_loop(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    cv.notify_all();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+size_t ThreadPool::size() const {
+    return threads.size();
+}
+
+void ThreadPool::submit(std::function<void()> job) {
+    {
+        std::lock_guard lock(mutex);
+        jobs.push(std::move(job));
+    }
+    cv.notify_one();
+}
+
+size_t ThreadPool::chunk_count() const {
+    return threads.size() + 1;
+}
+
+size_t ThreadPool::run_parallel(size_t count, void const* context, ChunkFunction function) {
+    size_t const chunks = std::max<size_t>(1, std::min(chunk_count(), count));
+    if (chunks == 1) {
+        function(context, 0, 0, count);
+        return 1;
+    }
+
+    std::lock_guard parallel_lock(parallel_mutex);
+    std::unique_lock lock(mutex);
+    task.context = context;
+    task.function = function;
+    task.count = count;
+    task.chunk_size = (count + chunks - 1) / chunks;
+    task.chunks = chunks;
+    task.next_chunk = 0;
+    task.unfinished = chunks;
+    cv.notify_all();
+
+    // The calling thread takes chunks as well, so the task finishes even while every worker is busy with a job
+    run_chunks(lock);
+    task_done_cv.wait(lock, [this] { return task.unfinished == 0; });
+    task = ParallelTask{};
+    return chunks;
+}
+
+void ThreadPool::run_chunks(std::unique_lock<std::mutex>& lock) {
+    while (task.next_chunk < task.chunks) {
+        size_t const chunk = task.next_chunk++;
+        size_t const begin = std::min(task.count, chunk * task.chunk_size);
+        size_t const end = std::min(task.count, begin + task.chunk_size);
+        void const* const context = task.context;
+        ChunkFunction const function = task.function;
+        lock.unlock();
+        function(context, chunk, begin, end);
+        lock.lock();
+        if (--task.unfinished == 0) {
+            task_done_cv.notify_one();
+        }
+    }
+}
+
+void ThreadPool::worker_loop() {
+    profiler_set_thread_name("Worker");
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock lock(mutex);
+            cv.wait(lock, [this] { return stopping || !jobs.empty() || task.next_chunk < task.chunks; });
+            if (task.next_chunk < task.chunks) {
+                run_chunks(lock);
+                continue;
+            }
+            if (stopping && jobs.empty()) {
+                return;
+            }
+            job = std::move(jobs.front());
+            jobs.pop();
+        }
+        job();
+    }
+}
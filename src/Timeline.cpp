@@ -0,0 +1,191 @@
+#include "Timeline.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+TimelineSemaphoreFeatures::TimelineSemaphoreFeatures(vk::PhysicalDevice physical_device) {
+    uint32_t const api_version = physical_device.getProperties().apiVersion;
+    core = api_version >= VK_API_VERSION_1_2;
+    if (!core) {
+        // Querying the feature takes Vulkan 1.1
+        if (api_version < VK_API_VERSION_1_1) {
+            return;
+        }
+        std::vector<vk::ExtensionProperties> const available = physical_device.enumerateDeviceExtensionProperties();
+        bool const has_extension = std::any_of(available.begin(), available.end(), [](auto const& extension) {
+            return std::strcmp(extension.extensionName, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME) == 0;
+        });
+        if (!has_extension) {
+            return;
+        }
+    }
+
+    auto const supported = physical_device.getFeatures2<vk::PhysicalDeviceFeatures2,
+                                                        vk::PhysicalDeviceTimelineSemaphoreFeatures>();
+    is_supported = supported.get<vk::PhysicalDeviceTimelineSemaphoreFeatures>().timelineSemaphore;
+}
+
+bool TimelineSemaphoreFeatures::supported() const {
+    return is_supported;
+}
+
+void TimelineSemaphoreFeatures::enable(std::vector<char const*>& extensions, vk::DeviceCreateInfo& info) {
+    if (!is_supported) {
+        return;
+    }
+    if (!core) {
+        extensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+    }
+    features.timelineSemaphore = true;
+    features.pNext = const_cast<void*>(info.pNext);
+    info.pNext = &features;
+}
+
+TimelineFunctions TimelineSemaphoreFeatures::load(vk::Device device) const {
+    TimelineFunctions functions;
+    functions.wait_semaphores = reinterpret_cast<PFN_vkWaitSemaphores>(
+        device.getProcAddr(core ? "vkWaitSemaphores" : "vkWaitSemaphoresKHR"));
+    functions.get_semaphore_counter_value = reinterpret_cast<PFN_vkGetSemaphoreCounterValue>(
+        device.getProcAddr(core ? "vkGetSemaphoreCounterValue" : "vkGetSemaphoreCounterValueKHR"));
+    if (!functions.wait_semaphores || !functions.get_semaphore_counter_value) {
+        throw std::runtime_error("Failed to load the timeline semaphore functions");
+    }
+    return functions;
+}
+
+SubmitBatch::SubmitBatch(vk::ArrayProxy<vk::CommandBuffer const> command_buffers)
+    : command_buffers(command_buffers.data()), command_buffer_count(command_buffers.size()) {}
+
+SubmitBatch& SubmitBatch::wait(vk::Semaphore semaphore, vk::PipelineStageFlags stage) {
+    if (wait_count == max_semaphores) {
+        throw std::runtime_error("Too many semaphores to wait for in one batch");
+    }
+    wait_semaphores[wait_count] = semaphore;
+    wait_values[wait_count] = 0;
+    wait_stages[wait_count] = stage;
+    ++wait_count;
+    return *this;
+}
+
+SubmitBatch& SubmitBatch::wait(QueueTimeline const& timeline, uint64_t value, vk::PipelineStageFlags stage) {
+    wait(timeline.semaphore(), stage);
+    wait_values[wait_count - 1] = value;
+    return *this;
+}
+
+SubmitBatch& SubmitBatch::signal(vk::Semaphore semaphore) {
+    if (signal_count == max_semaphores) {
+        throw std::runtime_error("Too many semaphores to signal in one batch");
+    }
+    signal_semaphores[signal_count++] = semaphore;
+    return *this;
+}
+
+QueueTimeline::QueueTimeline(vk::Device device, vk::Queue queue, TimelineFunctions functions)
+    : device(device), device_queue(queue), functions(functions) {
+    vk::SemaphoreTypeCreateInfo type_info;
+    type_info.semaphoreType = vk::SemaphoreType::eTimeline;
+    type_info.initialValue = 0;
+    vk::SemaphoreCreateInfo info;
+    info.pNext = &type_info;
+    timeline = device.createSemaphore(info);
+}
+
+QueueTimeline::~QueueTimeline() {
+    device.destroySemaphore(timeline);
+}
+
+vk::Queue QueueTimeline::queue() const {
+    return device_queue;
+}
+
+vk::Semaphore QueueTimeline::semaphore() const {
+    return timeline;
+}
+
+uint64_t QueueTimeline::next_value() const {
+    return submitted + 1;
+}
+
+uint64_t QueueTimeline::last_submitted() const {
+    return submitted;
+}
+
+uint64_t QueueTimeline::completed() {
+    uint64_t value = 0;
+    VkResult const result = functions.get_semaphore_counter_value(static_cast<VkDevice>(device),
+                                                                  static_cast<VkSemaphore>(timeline), &value);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("Failed to read a timeline semaphore: " + vk::to_string(vk::Result(result)));
+    }
+    known_completed = std::max(known_completed, value);
+    return known_completed;
+}
+
+bool QueueTimeline::reached(uint64_t value) {
+    return value <= known_completed || value <= completed();
+}
+
+void QueueTimeline::wait(uint64_t value) {
+    if (value <= known_completed) {
+        return;
+    }
+    VkSemaphore const semaphore = static_cast<VkSemaphore>(timeline);
+    VkSemaphoreWaitInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    info.semaphoreCount = 1;
+    info.pSemaphores = &semaphore;
+    info.pValues = &value;
+    VkResult const result = functions.wait_semaphores(static_cast<VkDevice>(device), &info,
+                                                      std::numeric_limits<uint64_t>::max());
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("Failed to wait for a timeline semaphore: " + vk::to_string(vk::Result(result)));
+    }
+    known_completed = std::max(known_completed, value);
+}
+
+uint64_t QueueTimeline::submit(vk::ArrayProxy<SubmitBatch const> batches) {
+    if (batches.empty() || batches.size() > max_batches) {
+        throw std::runtime_error("A submission takes 1 to " + std::to_string(max_batches) + " batches");
+    }
+    uint64_t const value = submitted + 1;
+
+    // Every signal needs a value, binary semaphores ignore theirs
+    std::array<uint64_t, SubmitBatch::max_semaphores + 1> signal_values = {};
+    // The last batch signals the timeline after its own semaphores
+    std::array<vk::Semaphore, SubmitBatch::max_semaphores + 1> last_signals;
+    std::array<vk::TimelineSemaphoreSubmitInfo, max_batches> timeline_infos;
+    std::array<vk::SubmitInfo, max_batches> infos;
+    for (uint32_t i = 0; i < batches.size(); ++i) {
+        SubmitBatch const& batch = batches.data()[i];
+        vk::TimelineSemaphoreSubmitInfo& timeline_info = timeline_infos[i];
+        vk::SubmitInfo& info = infos[i];
+        info.pNext = &timeline_info;
+        info.commandBufferCount = batch.command_buffer_count;
+        info.pCommandBuffers = batch.command_buffers;
+        info.waitSemaphoreCount = batch.wait_count;
+        info.pWaitSemaphores = batch.wait_semaphores.data();
+        info.pWaitDstStageMask = batch.wait_stages.data();
+        timeline_info.waitSemaphoreValueCount = batch.wait_count;
+        timeline_info.pWaitSemaphoreValues = batch.wait_values.data();
+
+        info.signalSemaphoreCount = batch.signal_count;
+        info.pSignalSemaphores = batch.signal_semaphores.data();
+        if (i + 1 == batches.size()) {
+            std::copy_n(batch.signal_semaphores.begin(), batch.signal_count, last_signals.begin());
+            last_signals[batch.signal_count] = timeline;
+            signal_values[batch.signal_count] = value;
+            info.signalSemaphoreCount = batch.signal_count + 1;
+            info.pSignalSemaphores = last_signals.data();
+        }
+        timeline_info.signalSemaphoreValueCount = info.signalSemaphoreCount;
+        timeline_info.pSignalSemaphoreValues = signal_values.data();
+    }
+
+    device_queue.submit(vk::ArrayProxy<vk::SubmitInfo const>(batches.size(), infos.data()), nullptr);
+    submitted = value;
+    return value;
+}
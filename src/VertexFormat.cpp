@@ -0,0 +1,20 @@
+#include "VertexFormat.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+static uint32_t pack_unorm(float value, float max) {
+    return static_cast<uint32_t>(std::round(std::clamp(value, 0.0f, 1.0f) * max));
+}
+
+CompactVertex make_compact_vertex(glm::vec3 const& pos, glm::vec3 const& color, glm::vec2 const& tex_coords) {
+    CompactVertex vertex;
+    vertex.pos[0] = pos.x;
+    vertex.pos[1] = pos.y;
+    vertex.pos[2] = pos.z;
+    // Same bit layout as unpackUnorm4x8 and unpackUnorm2x16 expect
+    vertex.color = pack_unorm(color.r, 255.0f) | pack_unorm(color.g, 255.0f) << 8 | pack_unorm(color.b, 255.0f) << 16
+                 | 255u << 24;
+    vertex.tex_coords = pack_unorm(tex_coords.x, 65535.0f) | pack_unorm(tex_coords.y, 65535.0f) << 16;
+    return vertex;
+}
@@ -0,0 +1,552 @@
+#include "VirtualTexture.hpp"
+
+#include "MemoryBudget.hpp"
+#include "Profiler.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+
+constexpr vk::DeviceSize tile_bytes = vk::DeviceSize(VirtualTexture::tile_size) * VirtualTexture::tile_size * 4;
+constexpr vk::Format atlas_format = vk::Format::eR8G8B8A8Srgb;
+// Slot x and y, mip level of the page in the slot, and 255 once the page table is filled in
+constexpr vk::Format page_table_format = vk::Format::eR8G8B8A8Uint;
+
+// A feedback slice holds the number of pages requested, a bit per page that is set once the page was requested, and
+// the list of requested pages. Must match PageRequests in shader.frag.
+static uint32_t feedback_seen_words() {
+    return (VirtualTexture::page_count() + 31) / 32;
+}
+
+static vk::DeviceSize feedback_list_offset() {
+    return (1 + feedback_seen_words()) * sizeof(uint32_t);
+}
+
+static vk::DeviceSize align_up(vk::DeviceSize size, vk::DeviceSize alignment) {
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+static uint32_t hash_block(uint32_t x, uint32_t y) {
+    uint32_t hash = x * 0x8da6b343u ^ y * 0xd8163841u;
+    hash ^= hash >> 13;
+    hash *= 0x5bd1e995u;
+    hash ^= hash >> 15;
+    return hash;
+}
+
+void procedural_page_source(uint32_t mip, int32_t x, int32_t y, uint32_t width, uint32_t height, uint8_t* rgba) {
+    int32_t const level_size = VirtualTexture::virtual_size >> mip;
+    for (uint32_t row = 0; row < height; ++row) {
+        uint32_t const level_y = std::clamp(y + int32_t(row), 0, level_size - 1);
+        for (uint32_t column = 0; column < width; ++column) {
+            uint32_t const level_x = std::clamp(x + int32_t(column), 0, level_size - 1);
+            // Blocks and checkers are sized in full resolution texels, so every level shows the same picture
+            uint32_t const full_x = level_x << mip;
+            uint32_t const full_y = level_y << mip;
+            uint32_t const hash = hash_block(full_x / 1024, full_y / 1024);
+            // Checkers smaller than a texel average out
+            float shade = mip < 5 ? (((full_x >> 5) ^ (full_y >> 5)) & 1 ? 1.0f : 0.7f) : 0.85f;
+            if (level_x % VirtualTexture::page_size == 0 || level_y % VirtualTexture::page_size == 0) {
+                shade *= 0.25f;
+            }
+            uint8_t* const texel = rgba + (size_t(row) * width + column) * 4;
+            texel[0] = static_cast<uint8_t>((96 + (hash & 0x9F)) * shade);
+            texel[1] = static_cast<uint8_t>((96 + ((hash >> 8) & 0x9F)) * shade);
+            texel[2] = static_cast<uint8_t>((96 + ((hash >> 16) & 0x9F)) * shade);
+            texel[3] = 255;
+        }
+    }
+}
+
+PageCache::PageCache(uint32_t slot_count) : slots(slot_count) {
+    // Hand out low slots first
+    for (uint32_t slot = slot_count; slot-- > 0;) {
+        free_slots.push_back(slot);
+    }
+}
+
+std::optional<uint32_t> PageCache::find(uint32_t page) const {
+    auto const it = page_slots.find(page);
+    if (it == page_slots.end()) {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+void PageCache::touch(uint32_t slot, uint64_t frame) {
+    Slot& entry = slots[slot];
+    entry.last_used = std::max(entry.last_used, frame);
+    if (!entry.pinned) {
+        lru.splice(lru.end(), lru, entry.lru_position);
+    }
+}
+
+std::optional<PageCache::Allocation> PageCache::allocate(uint32_t page, uint64_t frame) {
+    Allocation allocation{ 0, no_page };
+    if (!free_slots.empty()) {
+        allocation.slot = free_slots.back();
+        free_slots.pop_back();
+    } else {
+        // Everything used this frame is still needed
+        if (lru.empty() || slots[lru.front()].last_used >= frame) {
+            return std::nullopt;
+        }
+        allocation.slot = lru.front();
+        lru.pop_front();
+        allocation.evicted = slots[allocation.slot].page;
+        page_slots.erase(allocation.evicted);
+    }
+
+    Slot& entry = slots[allocation.slot];
+    entry.page = page;
+    entry.last_used = frame;
+    entry.pinned = true;
+    page_slots[page] = allocation.slot;
+    return allocation;
+}
+
+void PageCache::unpin(uint32_t slot) {
+    Slot& entry = slots[slot];
+    if (entry.pinned) {
+        entry.pinned = false;
+        entry.lru_position = lru.insert(lru.end(), slot);
+    }
+}
+
+uint32_t PageCache::page(uint32_t slot) const {
+    return slots[slot].page;
+}
+
+size_t PageCache::size() const {
+    return page_slots.size();
+}
+
+void VirtualTexture::Stats::report(std::ostream& out, size_t frames) const {
+    if (frames == 0) {
+        return;
+    }
+    out << "virtual texture per frame: " << pages_requested / frames << " pages requested, "
+        << pages_uploaded / frames << " uploaded, " << pages_evicted / frames << " evicted, "
+        << resident_pages << " pages resident (" << resident_size / 1024 << " KiB)\n";
+}
+
+uint32_t VirtualTexture::page_id(uint32_t mip, uint32_t x, uint32_t y) {
+    // Every level has a quarter of the pages of the one before it
+    uint32_t const level_offset = ((1u << (2 * mip_count)) - (1u << (2 * (mip_count - mip)))) / 3;
+    return level_offset + y * (pages_per_side >> mip) + x;
+}
+
+uint32_t VirtualTexture::page_count() {
+    return page_id(mip_count, 0, 0);
+}
+
+// Mip level and position of a page within its level
+static std::array<uint32_t, 3> page_coords(uint32_t page) {
+    uint32_t mip = 0;
+    while (VirtualTexture::page_id(mip + 1, 0, 0) <= page) {
+        ++mip;
+    }
+    uint32_t const index = page - VirtualTexture::page_id(mip, 0, 0);
+    uint32_t const pages = VirtualTexture::pages_per_side >> mip;
+    return { mip, index % pages, index / pages };
+}
+
+static void create_image(vk::PhysicalDevice physical_device, vk::Device device, uint32_t size, uint32_t levels,
+                         vk::Format format, vk::Image& image, vk::DeviceMemory& memory) {
+    vk::ImageCreateInfo image_info;
+    image_info.imageType = vk::ImageType::e2D;
+    image_info.extent = vk::Extent3D{ size, size, 1 };
+    image_info.mipLevels = levels;
+    image_info.arrayLayers = 1;
+    image_info.format = format;
+    image_info.tiling = vk::ImageTiling::eOptimal;
+    image_info.initialLayout = vk::ImageLayout::eUndefined;
+    image_info.usage = vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled;
+    image_info.samples = vk::SampleCountFlagBits::e1;
+    image_info.sharingMode = vk::SharingMode::eExclusive;
+    image = device.createImage(image_info);
+
+    vk::MemoryRequirements const requirements = device.getImageMemoryRequirements(image);
+    vk::MemoryAllocateInfo alloc_info;
+    alloc_info.allocationSize = requirements.size;
+    alloc_info.memoryTypeIndex = find_memory_type(physical_device, requirements.memoryTypeBits,
+                                                  vk::MemoryPropertyFlagBits::eDeviceLocal);
+    memory = allocate_device_memory(physical_device, device, alloc_info);
+    device.bindImageMemory(image, memory, 0);
+}
+
+static vk::ImageView create_view(vk::Device device, vk::Image image, vk::Format format, uint32_t levels) {
+    vk::ImageViewCreateInfo info;
+    info.image = image;
+    info.viewType = vk::ImageViewType::e2D;
+    info.format = format;
+    info.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
+    info.subresourceRange.levelCount = levels;
+    info.subresourceRange.layerCount = 1;
+    return device.createImageView(info);
+}
+
+static vk::ImageMemoryBarrier layout_barrier(vk::Image image, uint32_t levels, vk::ImageLayout old_layout,
+                                             vk::ImageLayout new_layout, vk::AccessFlags src_access,
+                                             vk::AccessFlags dst_access) {
+    vk::ImageMemoryBarrier barrier;
+    barrier.oldLayout = old_layout;
+    barrier.newLayout = new_layout;
+    barrier.srcAccessMask = src_access;
+    barrier.dstAccessMask = dst_access;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
+    barrier.subresourceRange.levelCount = levels;
+    barrier.subresourceRange.layerCount = 1;
+    return barrier;
+}
+
+VirtualTexture::VirtualTexture(vk::PhysicalDevice physical_device, vk::Device device, ThreadPool& workers,
+                               PageSource source, uint32_t atlas_tiles, size_t slice_count, vk::CommandPool cmd_pool,
+                               vk::Queue queue)
+    : device(device), workers(workers), source(std::move(source)), atlas_tiles(atlas_tiles),
+      cache(atlas_tiles * atlas_tiles), page_states(page_count(), PageState::Absent), page_table(page_count() * 4) {
+
+    vk::PhysicalDeviceLimits const limits = physical_device.getProperties().limits;
+    // Slot coordinates have to fit in the page table's 8 bit channels
+    if (atlas_tiles == 0 || atlas_tiles > 256 || atlas_tiles * tile_size > limits.maxImageDimension2D) {
+        throw std::invalid_argument("Unsupported virtual texture atlas size");
+    }
+
+    feedback_stride = align_up(feedback_list_offset() + page_count() * sizeof(uint32_t),
+                               limits.minStorageBufferOffsetAlignment);
+    feedback = Buffer(physical_device, device, feedback_stride * slice_count, vk::BufferUsageFlagBits::eStorageBuffer,
+                      vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+    feedback_mapping = static_cast<uint8_t*>(device.mapMemory(feedback.memory_handle(), 0, VK_WHOLE_SIZE));
+    std::memset(feedback_mapping, 0, feedback_stride * slice_count);
+
+    staging_stride = align_up(page_table.size() + max_uploads_per_update * tile_bytes,
+                              std::max<vk::DeviceSize>(limits.optimalBufferCopyOffsetAlignment, 16));
+    staging = Buffer(physical_device, device, staging_stride * slice_count, vk::BufferUsageFlagBits::eTransferSrc,
+                     vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+    staging_mapping = static_cast<uint8_t*>(device.mapMemory(staging.memory_handle(), 0, VK_WHOLE_SIZE));
+
+    create_image(physical_device, device, atlas_tiles * tile_size, 1, atlas_format, atlas_image, atlas_memory);
+    atlas_view = create_view(device, atlas_image, atlas_format, 1);
+    create_image(physical_device, device, pages_per_side, mip_count, page_table_format, page_table_image,
+                 page_table_memory);
+    page_table_view = create_view(device, page_table_image, page_table_format, mip_count);
+
+    // The borders make clamping unnecessary inside the atlas, and the atlas has no mip levels of its own
+    vk::SamplerCreateInfo sampler_info;
+    sampler_info.magFilter = vk::Filter::eLinear;
+    sampler_info.minFilter = vk::Filter::eLinear;
+    sampler_info.mipmapMode = vk::SamplerMipmapMode::eNearest;
+    sampler_info.addressModeU = vk::SamplerAddressMode::eClampToEdge;
+    sampler_info.addressModeV = vk::SamplerAddressMode::eClampToEdge;
+    sampler_info.addressModeW = vk::SamplerAddressMode::eClampToEdge;
+    sampler_info.maxLod = 0.0f;
+    atlas_sampler = device.createSampler(sampler_info);
+    // Integer textures can only be read without filtering
+    sampler_info.magFilter = vk::Filter::eNearest;
+    sampler_info.minFilter = vk::Filter::eNearest;
+    sampler_info.maxLod = float(mip_count);
+    page_table_sampler = device.createSampler(sampler_info);
+
+    std::array<vk::DescriptorSetLayoutBinding, 3> bindings;
+    bindings[0].descriptorType = vk::DescriptorType::eCombinedImageSampler;
+    bindings[1].descriptorType = vk::DescriptorType::eCombinedImageSampler;
+    bindings[2].descriptorType = vk::DescriptorType::eStorageBuffer;
+    for (uint32_t i = 0; i < bindings.size(); ++i) {
+        bindings[i].binding = i;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = vk::ShaderStageFlagBits::eFragment;
+    }
+    vk::DescriptorSetLayoutCreateInfo layout_info;
+    layout_info.bindingCount = bindings.size();
+    layout_info.pBindings = bindings.data();
+    descriptor_set_layout = device.createDescriptorSetLayout(layout_info);
+
+    // The single page of the last level is the fallback for everything, it never leaves the atlas
+    uint32_t const root = page_id(mip_count - 1, 0, 0);
+    uint32_t const root_slot = cache.allocate(root, 0)->slot;
+    page_states[root] = PageState::Resident;
+    stats.resident_pages = 1;
+    rebuild_page_table();
+
+    vk::CommandBufferAllocateInfo cmd_info;
+    cmd_info.level = vk::CommandBufferLevel::ePrimary;
+    cmd_info.commandBufferCount = 1;
+    cmd_info.commandPool = cmd_pool;
+    vk::CommandBuffer const cmd = device.allocateCommandBuffers(cmd_info)[0];
+    vk::CommandBufferBeginInfo begin_info;
+    begin_info.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+    cmd.begin(begin_info);
+
+    std::array<vk::ImageMemoryBarrier, 2> const initial_barriers = {
+        layout_barrier(atlas_image, 1, vk::ImageLayout::eUndefined, vk::ImageLayout::eShaderReadOnlyOptimal, {}, {}),
+        layout_barrier(page_table_image, mip_count, vk::ImageLayout::eUndefined,
+                       vk::ImageLayout::eShaderReadOnlyOptimal, {}, {})
+    };
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eFragmentShader, {},
+                        nullptr, nullptr, initial_barriers);
+    LinearAllocator upload_memory(4096);
+    LoadedPage const root_page{ root, root_slot, load_page(root) };
+    record_uploads(cmd, 0, &root_page, 1, true, upload_memory);
+    page_table_dirty = false;
+
+    cmd.end();
+    vk::SubmitInfo submit_info;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &cmd;
+    queue.submit(submit_info, nullptr);
+    queue.waitIdle();
+    device.freeCommandBuffers(cmd_pool, cmd);
+}
+
+VirtualTexture::~VirtualTexture() {
+    // Loads still running write into this object
+    {
+        std::unique_lock lock(loaded_mutex);
+        loaded_cv.wait(lock, [this] { return loads_in_flight == 0; });
+    }
+    device.destroyDescriptorSetLayout(descriptor_set_layout);
+    device.destroySampler(atlas_sampler);
+    device.destroySampler(page_table_sampler);
+    device.destroyImageView(atlas_view);
+    device.destroyImage(atlas_image);
+    free_device_memory(device, atlas_memory);
+    device.destroyImageView(page_table_view);
+    device.destroyImage(page_table_image);
+    free_device_memory(device, page_table_memory);
+    device.unmapMemory(feedback.memory_handle());
+    device.unmapMemory(staging.memory_handle());
+}
+
+vk::DescriptorSetLayout VirtualTexture::set_layout() const {
+    return descriptor_set_layout;
+}
+
+DescriptorSetContents VirtualTexture::descriptors(size_t slice) {
+    DescriptorSetContents contents;
+    contents.image(0, vk::DescriptorType::eCombinedImageSampler, page_table_sampler, page_table_view,
+                   vk::ImageLayout::eShaderReadOnlyOptimal);
+    contents.image(1, vk::DescriptorType::eCombinedImageSampler, atlas_sampler, atlas_view,
+                   vk::ImageLayout::eShaderReadOnlyOptimal);
+    contents.buffer(2, vk::DescriptorType::eStorageBuffer, feedback.handle(), slice * feedback_stride,
+                    feedback_stride);
+    return contents;
+}
+
+void VirtualTexture::update(vk::CommandBuffer cmd, size_t slice, uint64_t frame, LinearAllocator& frame_memory) {
+    PROFILE_ZONE("Update virtual texture");
+    // Every page the shader asked for in the previous frame drawn with this slice. The shader appends each page
+    // once, so the list never holds more than every page.
+    uint8_t* const slice_feedback = feedback_mapping + slice * feedback_stride;
+    uint32_t const request_count = std::min(*reinterpret_cast<uint32_t const*>(slice_feedback), page_count());
+    uint32_t const* const requests = reinterpret_cast<uint32_t const*>(slice_feedback + feedback_list_offset());
+    LinearVector<uint32_t> missing(frame_memory);
+    for (uint32_t i = 0; i < request_count; ++i) {
+        if (requests[i] < page_count()) {
+            ++stats.pages_requested;
+            request_page(requests[i], frame, missing);
+        }
+    }
+    // Clearing the count and the bits is enough to start the list over
+    std::memset(slice_feedback, 0, feedback_list_offset());
+
+    // Coarse levels come last in the page order. Loading them first gives every page a close fallback soon.
+    std::sort(missing.begin(), missing.end(), std::greater<uint32_t>());
+    missing.erase(std::unique(missing.begin(), missing.end()), missing.end());
+    for (uint32_t page : missing) {
+        if (!start_load(page, frame)) {
+            break;
+        }
+    }
+
+    LinearVector<LoadedPage> pages(frame_memory);
+    {
+        std::lock_guard lock(loaded_mutex);
+        size_t const count = std::min<size_t>(loaded_pages.size(), max_uploads_per_update);
+        std::move(loaded_pages.begin(), loaded_pages.begin() + count, std::back_inserter(pages));
+        loaded_pages.erase(loaded_pages.begin(), loaded_pages.begin() + count);
+    }
+    for (auto const& page : pages) {
+        page_states[page.page] = PageState::Resident;
+        cache.unpin(page.slot);
+        cache.touch(page.slot, frame);
+        ++stats.pages_uploaded;
+        ++stats.resident_pages;
+        page_table_dirty = true;
+    }
+
+    if (page_table_dirty) {
+        rebuild_page_table();
+    }
+    if (page_table_dirty || !pages.empty()) {
+        record_uploads(cmd, slice, pages.data(), pages.size(), page_table_dirty, frame_memory);
+    }
+    page_table_dirty = false;
+}
+
+void VirtualTexture::record_feedback_barrier(vk::CommandBuffer cmd, size_t slice) {
+    vk::BufferMemoryBarrier barrier;
+    barrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+    barrier.dstAccessMask = vk::AccessFlagBits::eHostRead;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = feedback.handle();
+    barrier.offset = slice * feedback_stride;
+    barrier.size = feedback_stride;
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eFragmentShader, vk::PipelineStageFlagBits::eHost, {},
+                        nullptr, barrier, nullptr);
+}
+
+VirtualTexture::Stats VirtualTexture::take_stats() {
+    Stats taken = stats;
+    taken.resident_size = taken.resident_pages * tile_bytes;
+    stats = Stats{};
+    stats.resident_pages = taken.resident_pages;
+    return taken;
+}
+
+std::vector<uint8_t> VirtualTexture::load_page(uint32_t page) const {
+    PROFILE_ZONE("Load page");
+    std::array<uint32_t, 3> const coords = page_coords(page);
+    std::vector<uint8_t> texels(tile_bytes);
+    // The border comes from the neighbouring pages
+    source(coords[0], int32_t(coords[1] * page_size) - int32_t(page_border),
+           int32_t(coords[2] * page_size) - int32_t(page_border), tile_size, tile_size, texels.data());
+    return texels;
+}
+
+void VirtualTexture::request_page(uint32_t page, uint64_t frame, LinearVector<uint32_t>& missing) {
+    std::array<uint32_t, 3> coords = page_coords(page);
+    while (true) {
+        uint32_t const id = page_id(coords[0], coords[1], coords[2]);
+        // Ancestors are the fallback while a page loads, or after it is evicted, so they are kept as well
+        if (page_states[id] == PageState::Resident) {
+            cache.touch(*cache.find(id), frame);
+        } else if (page_states[id] == PageState::Absent) {
+            missing.push_back(id);
+        }
+        if (coords[0] == mip_count - 1) {
+            break;
+        }
+        coords = { coords[0] + 1, coords[1] / 2, coords[2] / 2 };
+    }
+}
+
+bool VirtualTexture::start_load(uint32_t page, uint64_t frame) {
+    std::optional<PageCache::Allocation> const allocation = cache.allocate(page, frame);
+    if (!allocation) {
+        return false;
+    }
+    if (allocation->evicted != PageCache::no_page) {
+        // Frames in flight may still sample the old page, but they finish before the copy into the slot runs
+        page_states[allocation->evicted] = PageState::Absent;
+        ++stats.pages_evicted;
+        --stats.resident_pages;
+        page_table_dirty = true;
+    }
+    page_states[page] = PageState::Loading;
+
+    {
+        std::lock_guard lock(loaded_mutex);
+        ++loads_in_flight;
+    }
+    uint32_t const slot = allocation->slot;
+    workers.submit([this, page, slot] {
+        std::vector<uint8_t> texels = load_page(page);
+        std::lock_guard lock(loaded_mutex);
+        loaded_pages.push_back(LoadedPage{ page, slot, std::move(texels) });
+        --loads_in_flight;
+        loaded_cv.notify_all();
+    });
+    return true;
+}
+
+void VirtualTexture::rebuild_page_table() {
+    // Coarsest level first, so pages that are not resident can copy the entry of their parent
+    for (uint32_t mip = mip_count; mip-- > 0;) {
+        uint32_t const pages = pages_per_side >> mip;
+        for (uint32_t y = 0; y < pages; ++y) {
+            for (uint32_t x = 0; x < pages; ++x) {
+                uint8_t* const entry = &page_table[size_t(page_id(mip, x, y)) * 4];
+                if (page_states[page_id(mip, x, y)] == PageState::Resident) {
+                    uint32_t const slot = *cache.find(page_id(mip, x, y));
+                    entry[0] = static_cast<uint8_t>(slot % atlas_tiles);
+                    entry[1] = static_cast<uint8_t>(slot / atlas_tiles);
+                    entry[2] = static_cast<uint8_t>(mip);
+                    entry[3] = 255;
+                } else {
+                    std::memcpy(entry, &page_table[size_t(page_id(mip + 1, x / 2, y / 2)) * 4], 4);
+                }
+            }
+        }
+    }
+}
+
+void VirtualTexture::record_uploads(vk::CommandBuffer cmd, size_t slice, LoadedPage const* pages, size_t upload_count,
+                                    bool table, LinearAllocator& frame_memory) {
+    vk::DeviceSize const slice_offset = slice * staging_stride;
+    uint8_t* const base = staging_mapping + slice_offset;
+
+    LinearVector<vk::BufferImageCopy> page_copies(frame_memory);
+    page_copies.reserve(upload_count);
+    for (size_t i = 0; i < upload_count; ++i) {
+        vk::DeviceSize const offset = page_table.size() + i * tile_bytes;
+        std::memcpy(base + offset, pages[i].texels.data(), tile_bytes);
+
+        vk::BufferImageCopy copy;
+        copy.bufferOffset = slice_offset + offset;
+        copy.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+        copy.imageSubresource.layerCount = 1;
+        copy.imageOffset = vk::Offset3D{ int32_t(pages[i].slot % atlas_tiles * tile_size),
+                                         int32_t(pages[i].slot / atlas_tiles * tile_size), 0 };
+        copy.imageExtent = vk::Extent3D{ tile_size, tile_size, 1 };
+        page_copies.push_back(copy);
+    }
+
+    LinearVector<vk::BufferImageCopy> table_copies(frame_memory);
+    if (table) {
+        std::memcpy(base, page_table.data(), page_table.size());
+        for (uint32_t mip = 0; mip < mip_count; ++mip) {
+            vk::BufferImageCopy copy;
+            copy.bufferOffset = slice_offset + page_id(mip, 0, 0) * 4;
+            copy.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+            copy.imageSubresource.mipLevel = mip;
+            copy.imageSubresource.layerCount = 1;
+            copy.imageExtent = vk::Extent3D{ pages_per_side >> mip, pages_per_side >> mip, 1 };
+            table_copies.push_back(copy);
+        }
+    }
+
+    // Earlier frames are done sampling before anything is overwritten
+    LinearVector<vk::ImageMemoryBarrier> barriers(frame_memory);
+    if (!page_copies.empty()) {
+        barriers.push_back(layout_barrier(atlas_image, 1, vk::ImageLayout::eShaderReadOnlyOptimal,
+                                          vk::ImageLayout::eTransferDstOptimal, vk::AccessFlagBits::eShaderRead,
+                                          vk::AccessFlagBits::eTransferWrite));
+    }
+    if (!table_copies.empty()) {
+        barriers.push_back(layout_barrier(page_table_image, mip_count, vk::ImageLayout::eShaderReadOnlyOptimal,
+                                          vk::ImageLayout::eTransferDstOptimal, vk::AccessFlagBits::eShaderRead,
+                                          vk::AccessFlagBits::eTransferWrite));
+    }
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eFragmentShader, vk::PipelineStageFlagBits::eTransfer, {},
+                        nullptr, nullptr, barriers);
+
+    if (!page_copies.empty()) {
+        cmd.copyBufferToImage(staging.handle(), atlas_image, vk::ImageLayout::eTransferDstOptimal, page_copies);
+    }
+    if (!table_copies.empty()) {
+        cmd.copyBufferToImage(staging.handle(), page_table_image, vk::ImageLayout::eTransferDstOptimal, table_copies);
+    }
+
+    for (auto& barrier : barriers) {
+        std::swap(barrier.oldLayout, barrier.newLayout);
+        std::swap(barrier.srcAccessMask, barrier.dstAccessMask);
+    }
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eFragmentShader, {},
+                        nullptr, nullptr, barriers);
+}
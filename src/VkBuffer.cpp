@@ -1,5 +1,9 @@
 #include "VkBuffer.hpp"
 
+#include "MemoryBudget.hpp"
+
+#include <stdexcept>
+
 uint32_t find_memory_type(vk::PhysicalDevice physical_device, uint32_t type_filter, vk::MemoryPropertyFlags properties) {
     // Get available memory types
     vk::PhysicalDeviceMemoryProperties const device_properties = physical_device.getMemoryProperties();
@@ -7,13 +11,12 @@ uint32_t find_memory_type(vk::PhysicalDevice physical_device, uint32_t type_filt
     for (uint32_t i = 0; i < device_properties.memoryTypeCount; ++i) {
         // If the filter matches the memory type, return the index of the memory type
         if (type_filter & (1 << i) && 
-            (device_properties.memoryTypes[i].propertyFlags & properties)) { // Also check if memory properties match
+            (device_properties.memoryTypes[i].propertyFlags & properties) == properties) { // Also check if all memory properties match
             return i;
         }
     }
 
-    assert(false && "Failed to find suitable memory type\n");
-    return -1;
+    throw std::runtime_error("Failed to find suitable memory type");
 }
 
 Buffer::Buffer(vk::PhysicalDevice physical_device, vk::Device device, vk::DeviceSize size, 
@@ -31,12 +34,20 @@ Buffer::Buffer(vk::PhysicalDevice physical_device, vk::Device device, vk::Device
     vk::MemoryAllocateInfo alloc_info;
     alloc_info.allocationSize = requirements.size;
     alloc_info.memoryTypeIndex = find_memory_type(physical_device, requirements.memoryTypeBits, properties);
+    // Buffers used through device addresses need memory that supports it
+    vk::MemoryAllocateFlagsInfo flags_info;
+    if (usage & vk::BufferUsageFlagBits::eShaderDeviceAddress) {
+        flags_info.flags = vk::MemoryAllocateFlagBits::eDeviceAddress;
+        alloc_info.pNext = &flags_info;
+    }
 
-    memory = device.allocateMemory(alloc_info);
+    memory = allocate_device_memory(physical_device, device, alloc_info);
     device.bindBufferMemory(buffer, memory, 0);
 }
 
 Buffer::Buffer(Buffer&& rhs) {
+    physical_device = rhs.physical_device;
+    device = rhs.device;
     buffer = rhs.buffer;
     memory = rhs.memory;
 
@@ -47,6 +58,8 @@ Buffer::Buffer(Buffer&& rhs) {
 Buffer& Buffer::operator=(Buffer&& rhs) {
     if (this != &rhs) {
         destroy();
+        physical_device = rhs.physical_device;
+        device = rhs.device;
         buffer = rhs.buffer;
         memory = rhs.memory;
 
@@ -68,13 +81,21 @@ vk::DeviceMemory Buffer::memory_handle() {
     return memory;
 }
 
+vk::DeviceAddress Buffer::device_address() {
+    vk::BufferDeviceAddressInfo info;
+    info.buffer = buffer;
+    return device.getBufferAddress(info);
+}
+
 void Buffer::destroy() {
     if (buffer) {
         device.destroyBuffer(buffer);
+        buffer = nullptr;
     }
 
     if (memory) {
-        device.freeMemory(memory);
+        free_device_memory(device, memory);
+        memory = nullptr;
     }
 }
 
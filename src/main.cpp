@@ -3,19 +3,59 @@
 
 #include <stb/stb_image.h>
 
-#define GLM_FORCE_DEFAULT_ALIGNED_GENTYPES
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
 #undef max
 #undef min
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <limits>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <random>
+#include <string>
+#include <thread>
 #include <vector>
 
+#include "AllocationCounter.hpp"
+#include "AppConfig.hpp"
+#include "AsyncFileReader.hpp"
+#include "ClusteredLighting.hpp"
+#include "DescriptorAllocator.hpp"
+#include "DeviceBenchmark.hpp"
+#include "DrawList.hpp"
+#include "DynamicResolution.hpp"
+#include "FrameCapture.hpp"
+#include "FramePacer.hpp"
+#include "GeometryPool.hpp"
+#include "GpuTimer.hpp"
+#include "HeadlessContext.hpp"
+#include "HostImageUpload.hpp"
+#include "LinearAllocator.hpp"
+#include "MemoryBudget.hpp"
+#include "Multisampling.hpp"
+#include "ParticleSystem.hpp"
+#include "PipelineLibrary.hpp"
+#include "Profiler.hpp"
+#include "ResidencyManager.hpp"
+#include "Scene.hpp"
+#include "ShaderHotReload.hpp"
+#include "Skinning.hpp"
+#include "TexturePacker.hpp"
+#include "ThreadPool.hpp"
+#include "Timeline.hpp"
+#include "TripleBuffer.hpp"
+#include "VertexFormat.hpp"
+#include "VirtualTexture.hpp"
 #include "VkBuffer.hpp"
 
 struct Vertex {
@@ -58,33 +98,310 @@ struct Vertex {
     }
 };
 
+// The vertex pulling shader decodes VertexFormat::Standard with this layout
+static_assert(sizeof(Vertex) == 48 && offsetof(Vertex, color) == 16 && offsetof(Vertex, tex_coords) == 32,
+              "Vertex layout does not match data/shader_pull.vert");
+
+// Vertex attributes from binding 0. Per-instance data comes from the object storage buffer.
+static VertexInputLayout standard_vertex_layout() {
+    VertexInputLayout layout;
+    layout.bindings = { Vertex::input_binding_description() };
+
+    auto const vertex_attributes = Vertex::attribute_descriptions();
+    layout.attributes.assign(vertex_attributes.begin(), vertex_attributes.end());
+
+    return layout;
+}
+
+// No vertex input at all, vertices are fetched by the vertex shader
+static VertexInputLayout pulled_vertex_layout() {
+    VertexInputLayout layout;
+    layout.vertex_pulling = true;
+    return layout;
+}
+
+// Indices into the vertex layouts of the pipeline library
+constexpr uint8_t vertex_layout_standard = 0;
+constexpr uint8_t vertex_layout_pulled = 1;
+
 struct Matrices {
-    glm::mat4 model;
     glm::mat4 view;
     glm::mat4 projection;
 };
 
-constexpr std::array<Vertex, 4> vertices = {
+// Everything the renderer needs from the simulation to draw one frame. Once published, a snapshot is never modified
+// until the render thread hands it back.
+struct SceneSnapshot {
+    uint64_t frame = 0;
+    Matrices matrices;
+    std::vector<glm::mat4> instances;
+    std::vector<PointLight> lights;
+    // Seconds since the simulation started
+    float time = 0.0f;
+};
+
+constexpr std::array<Vertex, 4> quad_vertices = {
     Vertex{{-0.5f, -0.5f, 0.0f}, {1.0f, 0.0f, 0.0f}, {1.0f, 0.0f}},
     Vertex{{0.5f, -0.5f, 0.0f}, {0.0f, 1.0f, 0.0f}, {0.0f, 0.0f}},
     Vertex{{0.5f, 0.5f, 0.0f}, {0.0f, 0.0f, 1.0f}, {0.0f, 1.0f}},
     Vertex{{-0.5f, 0.5f, 0.0f}, {1.0f, 1.0f, 1.0f}, {1.0f, 1.0f}}
 };
 
-constexpr std::array<uint32_t, 6> indices = {
+constexpr std::array<uint32_t, 6> quad_indices = {
     0, 1, 2, 2, 3, 0
 };
 
-constexpr size_t max_frames_in_flight = 2;
+// Center vertex followed by the corners
+constexpr std::array<Vertex, 7> hexagon_vertices = {
+    Vertex{{0.0f, 0.0f, 0.0f}, {1.0f, 1.0f, 1.0f}, {0.5f, 0.5f}},
+    Vertex{{0.5f, 0.0f, 0.0f}, {1.0f, 0.0f, 0.0f}, {1.0f, 0.5f}},
+    Vertex{{0.25f, 0.433f, 0.0f}, {1.0f, 1.0f, 0.0f}, {0.75f, 0.067f}},
+    Vertex{{-0.25f, 0.433f, 0.0f}, {0.0f, 1.0f, 0.0f}, {0.25f, 0.067f}},
+    Vertex{{-0.5f, 0.0f, 0.0f}, {0.0f, 1.0f, 1.0f}, {0.0f, 0.5f}},
+    Vertex{{-0.25f, -0.433f, 0.0f}, {0.0f, 0.0f, 1.0f}, {0.25f, 0.933f}},
+    Vertex{{0.25f, -0.433f, 0.0f}, {1.0f, 0.0f, 1.0f}, {0.75f, 0.933f}}
+};
+
+constexpr std::array<uint32_t, 18> hexagon_indices = {
+    0, 1, 2, 0, 2, 3, 0, 3, 4, 0, 4, 5, 0, 5, 6, 0, 6, 1
+};
+
+static vk::DeviceSize align_up(vk::DeviceSize size, vk::DeviceSize alignment) {
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+// Square grid of triangles covering [-1, 1] on the XY plane
+static void make_grid_mesh(uint32_t size, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices) {
+    vertices.clear();
+    indices.clear();
+    for (uint32_t y = 0; y <= size; ++y) {
+        for (uint32_t x = 0; x <= size; ++x) {
+            glm::vec2 const uv(float(x) / size, float(y) / size);
+            vertices.push_back(Vertex{ glm::vec3(uv * 2.0f - 1.0f, 0.0f), glm::vec3(uv, 1.0f), uv });
+        }
+    }
+    for (uint32_t y = 0; y < size; ++y) {
+        for (uint32_t x = 0; x < size; ++x) {
+            uint32_t const corner = y * (size + 1) + x;
+            indices.insert(indices.end(), { corner, corner + 1, corner + size + 2, corner + size + 2, corner + size + 1, corner });
+        }
+    }
+}
+
+// Characters are ribbons lying on the scene, a chain of joints one unit apart that wriggles along its length
+constexpr uint32_t character_joints = 8;
+// Rows of vertices along each joint's segment
+constexpr uint32_t character_rows_per_joint = 4;
+constexpr float character_scale = 0.02f;
+
+// Ribbon along +X in the XY plane, every row of vertices blended between the two joints it is between. The clip
+// sends a wave down the joint chain, bending the ribbon within its plane.
+static SkeletalAnimation make_character(std::vector<Vertex>& vertices, std::vector<SkinWeights>& weights,
+                                        std::vector<uint32_t>& indices) {
+    SkeletalAnimation animation;
+    uint32_t joint = SkeletalAnimation::no_parent;
+    for (uint32_t i = 0; i < character_joints; ++i) {
+        joint = animation.add_joint(joint, glm::vec3(i == 0 ? 0.0f : 1.0f, 0.0f, 0.0f));
+    }
+
+    constexpr size_t key_count = 16;
+    animation.set_clip(key_count, 1.5f);
+    for (size_t key = 0; key < key_count; ++key) {
+        float const phase = glm::radians(360.0f) * key / key_count;
+        for (uint32_t i = 0; i < character_joints; ++i) {
+            float const angle = 0.4f * std::sin(phase - i * 0.8f);
+            animation.set_rotation(key, i, glm::angleAxis(angle, glm::vec3(0.0f, 0.0f, 1.0f)));
+        }
+    }
+
+    vertices.clear();
+    weights.clear();
+    indices.clear();
+    uint32_t const rows = character_joints * character_rows_per_joint + 1;
+    for (uint32_t row = 0; row < rows; ++row) {
+        float const x = float(row) / character_rows_per_joint;
+        uint32_t const first = std::min(row / character_rows_per_joint, character_joints - 1);
+        uint32_t const second = std::min(first + 1, character_joints - 1);
+        float const blend = first == second ? 0.0f : x - first;
+        SkinWeights const row_weights = make_skin_weights(glm::uvec4(first, second, 0, 0), 
+                                                          glm::vec4(1.0f - blend, blend, 0.0f, 0.0f));
+        float const u = x / character_joints;
+        for (float v : { 0.0f, 1.0f }) {
+            vertices.push_back(Vertex{ glm::vec3(x, (v - 0.5f) * 0.6f, 0.0f), glm::vec3(1.0f - u, u, 0.5f), 
+                                       glm::vec2(u, v) });
+            weights.push_back(row_weights);
+        }
+        if (row + 1 < rows) {
+            uint32_t const corner = row * 2;
+            indices.insert(indices.end(), { corner, corner + 2, corner + 3, corner + 3, corner + 1, corner });
+        }
+    }
+    return animation;
+}
+
+// Characters scattered over the scene grid, slightly above it, facing random directions
+static std::vector<glm::mat4> make_character_transforms(size_t count) {
+    std::mt19937 rng(4321);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    std::vector<glm::mat4> transforms(count);
+    for (auto& transform : transforms) {
+        glm::vec3 const position(unit(rng) * 1.6f - 0.8f, unit(rng) * 1.6f - 0.8f, 0.01f);
+        transform = glm::translate(glm::mat4(1.0f), position);
+        transform = glm::rotate(transform, unit(rng) * glm::radians(360.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+        transform = glm::scale(transform, glm::vec3(character_scale));
+    }
+    return transforms;
+}
+
+// Halve an RGBA8 image with a 2x2 box filter. Odd sizes drop the last row or column.
+static std::vector<uint8_t> downsample_rgba8(std::vector<uint8_t> const& pixels, uint32_t& width, uint32_t& height) {
+    uint32_t const half_width = std::max(1u, width / 2);
+    uint32_t const half_height = std::max(1u, height / 2);
+    std::vector<uint8_t> half(size_t(half_width) * half_height * 4);
+    for (uint32_t y = 0; y < half_height; ++y) {
+        for (uint32_t x = 0; x < half_width; ++x) {
+            uint32_t const x0 = std::min(x * 2, width - 1), x1 = std::min(x * 2 + 1, width - 1);
+            uint32_t const y0 = std::min(y * 2, height - 1), y1 = std::min(y * 2 + 1, height - 1);
+            for (uint32_t c = 0; c < 4; ++c) {
+                uint32_t const sum = pixels[(size_t(y0) * width + x0) * 4 + c] + pixels[(size_t(y0) * width + x1) * 4 + c] +
+                                     pixels[(size_t(y1) * width + x0) * 4 + c] + pixels[(size_t(y1) * width + x1) * 4 + c];
+                half[(size_t(y) * half_width + x) * 4 + c] = uint8_t((sum + 2) / 4);
+            }
+        }
+    }
+    width = half_width;
+    height = half_height;
+    return half;
+}
+
+// Decode an image file read into memory, path is only for the error message
+static TextureImage decode_texture_image(std::string const& path, std::string const& file) {
+    int width, height, channels;
+    unsigned char* pixels = stbi_load_from_memory(reinterpret_cast<stbi_uc const*>(file.data()),
+                                                  static_cast<int>(file.size()), &width, &height, &channels,
+                                                  STBI_rgb_alpha);
+    if (!pixels) {
+        throw std::runtime_error("Failed to load image " + path);
+    }
+
+    TextureImage image;
+    image.width = width;
+    image.height = height;
+    image.pixels.assign(pixels, pixels + size_t(width) * height * 4);
+    stbi_image_free(pixels);
+    return image;
+}
+
+// Two-colour checkerboard with cells of cell_size texels
+static TextureImage make_checker_texture(uint32_t size, uint32_t cell_size, std::array<uint8_t, 4> a, 
+                                         std::array<uint8_t, 4> b) {
+    TextureImage image;
+    image.width = size;
+    image.height = size;
+    image.pixels.resize(size_t(size) * size * 4);
+    for (uint32_t y = 0; y < size; ++y) {
+        for (uint32_t x = 0; x < size; ++x) {
+            std::array<uint8_t, 4> const& color = ((x / cell_size + y / cell_size) % 2) ? a : b;
+            std::copy_n(color.data(), 4, &image.pixels[(size_t(y) * size + x) * 4]);
+        }
+    }
+    return image;
+}
+
+// Horizontal gradient from a to b
+static TextureImage make_gradient_texture(uint32_t width, uint32_t height, glm::vec4 a, glm::vec4 b) {
+    TextureImage image;
+    image.width = width;
+    image.height = height;
+    image.pixels.resize(size_t(width) * height * 4);
+    for (uint32_t x = 0; x < width; ++x) {
+        glm::vec4 const color = glm::mix(a, b, float(x) / std::max(width - 1, 1u)) * 255.0f + 0.5f;
+        for (uint32_t y = 0; y < height; ++y) {
+            for (uint32_t c = 0; c < 4; ++c) {
+                image.pixels[(size_t(y) * width + x) * 4 + c] = uint8_t(color[c]);
+            }
+        }
+    }
+    return image;
+}
+
+// Where a texture of the atlas is, as read by the vertex shaders
+struct GpuAtlasRect {
+    // Offset in xy, scale in zw
+    glm::vec4 uv_rect;
+    uint32_t layer;
+};
+
+static_assert(sizeof(GpuAtlasRect) == 32, "GpuAtlasRect does not match the TextureRects block in the shaders");
+
+// Space in the shared vertex and index buffers, in vertices and indices
+constexpr uint32_t geometry_pool_vertices = 1 << 16;
+constexpr uint32_t geometry_pool_indices = 1 << 18;
+
+// Detail levels the texture can be demoted to, each half the size of the previous one
+constexpr uint32_t texture_detail_levels = 4;
+// Smallest atlas layer, so small textures still share a layer
+constexpr uint32_t atlas_min_page_size = 256;
+// Offline packing does not know the device, so it stays within what every device supports
+constexpr uint32_t atlas_max_page_size = 4096;
+// Slots along each side of the virtual texture's page atlas, 256 pages or 18 MiB
+constexpr uint32_t virtual_texture_atlas_tiles = 16;
+
+// The scene is a grid of quads, each with a few smaller quads orbiting around it
+constexpr size_t scene_grid_size = 64;
+constexpr size_t scene_children_per_node = 4;
+
+constexpr float camera_near = 0.1f;
+constexpr float camera_far = 100.0f;
+
+// Lights scattered over the scene grid. The radius shrinks with the amount of lights, so about the same amount of
+// them reaches any point.
+static std::vector<PointLight> make_lights(size_t count) {
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    float const radius = std::clamp(1.5f / std::sqrt(float(std::max<size_t>(count, 1))), 0.05f, 0.5f);
+
+    std::vector<PointLight> lights(count);
+    for (auto& light : lights) {
+        light.position = glm::vec3(unit(rng) * 2.0f - 1.0f, unit(rng) * 2.0f - 1.0f, 0.05f + unit(rng) * 0.2f);
+        light.radius = radius;
+        light.color = glm::vec3(unit(rng), unit(rng), unit(rng));
+        light.intensity = 2.0f;
+    }
+    return lights;
+}
+
+constexpr char const* pipeline_cache_file = "pipeline_cache.bin";
+constexpr char const* device_benchmark_file = "device_benchmarks.txt";
 
 static std::string read_file(std::string_view fname) {
-    std::ifstream file(fname.data(), std::ios::binary);
-    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    std::ifstream file(fname.data(), std::ios::binary | std::ios::ate);
+    if (!file) {
+        return {};
+    }
+    // One read of the whole file instead of copying it a character at a time
+    std::string contents(static_cast<size_t>(file.tellg()), '\0');
+    file.seekg(0);
+    file.read(contents.data(), contents.size());
+    contents.resize(static_cast<size_t>(file.gcount()));
+    return contents;
 }
 
-static GLFWwindow* init_glfw(size_t w, size_t h, const char* title) {
+static ParticleSystem::Shaders read_particle_shaders() {
+    ParticleSystem::Shaders shaders;
+    shaders.emit = read_file("shaders/particle_emit.comp.spv");
+    shaders.counters = read_file("shaders/particle_counters.comp.spv");
+    shaders.simulate = read_file("shaders/particle_simulate.comp.spv");
+    shaders.sort_keys = read_file("shaders/particle_sort_keys.comp.spv");
+    shaders.sort = read_file("shaders/particle_sort.comp.spv");
+    return shaders;
+}
+
+static GLFWwindow* init_glfw(size_t w, size_t h, const char* title, bool visible) {
     glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
     glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+    glfwWindowHint(GLFW_VISIBLE, visible ? GLFW_TRUE : GLFW_FALSE);
     GLFWwindow* window = glfwCreateWindow(w, h, title, nullptr, nullptr);
     return window;
 }
@@ -187,11 +504,30 @@ static vk::SurfaceFormatKHR choose_swap_surface_format(std::vector<vk::SurfaceFo
     return formats[0];
 }
 
-static vk::PresentModeKHR choose_swap_present_mode(std::vector<vk::PresentModeKHR> const& present_modes) {
-    // Prefer Mailbox mode (can be used for triple buffering)
-    for (auto const& mode : present_modes) {
-        if (mode == vk::PresentModeKHR::eMailbox) {
-            return mode;
+static vk::PresentModeKHR choose_swap_present_mode(std::vector<vk::PresentModeKHR> const& present_modes, 
+                                                   PresentModePolicy policy) {
+    // Modes to try for each policy, in order of preference
+    std::vector<vk::PresentModeKHR> preferred;
+    switch (policy) {
+        case PresentModePolicy::Fifo:
+            break;
+        case PresentModePolicy::FifoRelaxed:
+            preferred = { vk::PresentModeKHR::eFifoRelaxed };
+            break;
+        case PresentModePolicy::Mailbox:
+            // Mailbox can be used for triple buffering
+            preferred = { vk::PresentModeKHR::eMailbox };
+            break;
+        case PresentModePolicy::Immediate:
+            preferred = { vk::PresentModeKHR::eImmediate, vk::PresentModeKHR::eMailbox };
+            break;
+    }
+
+    for (auto const& wanted : preferred) {
+        for (auto const& mode : present_modes) {
+            if (mode == wanted) {
+                return mode;
+            }
         }
     }
 
@@ -214,6 +550,15 @@ static vk::Extent2D choose_swap_extent(vk::SurfaceCapabilitiesKHR const& capabil
     return actual_extent;
 }
 
+static bool has_device_extension(vk::PhysicalDevice device, char const* name) {
+    for (auto const& properties : device.enumerateDeviceExtensionProperties()) {
+        if (std::strcmp(properties.extensionName, name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
 static int physical_device_score(vk::PhysicalDevice device, vk::SurfaceKHR surface) {
     vk::PhysicalDeviceProperties properties = device.getProperties();
     vk::PhysicalDeviceFeatures features = device.getFeatures();
@@ -242,20 +587,16 @@ static int physical_device_score(vk::PhysicalDevice device, vk::SurfaceKHR surfa
 
     // Check for required extensions
     ExtensionsInfo required_extensions = get_required_device_extensions();
-    std::vector<vk::ExtensionProperties> device_extensions = device.enumerateDeviceExtensionProperties();
     for (auto const& extension : required_extensions.names) {
-        bool found = false;
-        // Check if requested extension is available
-        for (auto const& properties : device_extensions) {
-            if (std::strcmp(properties.extensionName, extension)) {
-                found = true;
-            }
-        }
         // These extensions are required for the appication to work
-        if (!found) {
+        if (!has_device_extension(device, extension)) {
             return 0;
         }
     }
+    // Frames and the resources they use are tracked with timeline semaphores
+    if (!TimelineSemaphoreFeatures(device).supported()) {
+        return 0;
+    }
 
     // Check swapchain capabilities
     SwapChainSupportDetails swapchain_details = get_swapchain_support_details(device, surface);
@@ -267,9 +608,80 @@ static int physical_device_score(vk::PhysicalDevice device, vk::SurfaceKHR surfa
     return score;
 }
 
+// Device by its index in enumeration order, or the first one with name in its device name
+static vk::PhysicalDevice find_requested_device(std::vector<vk::PhysicalDevice> const& devices,
+                                                std::string const& name) {
+    if (!name.empty() && std::all_of(name.begin(), name.end(), [](char c) { return c >= '0' && c <= '9'; })) {
+        size_t const index = std::stoul(name);
+        if (index >= devices.size()) {
+            throw std::runtime_error("There is no physical device " + name);
+        }
+        return devices[index];
+    }
+    for (auto device : devices) {
+        if (std::string_view(device.getProperties().deviceName).find(name) != std::string_view::npos) {
+            return device;
+        }
+    }
+    throw std::runtime_error("No physical device matches " + name);
+}
+
+// Benchmarks every candidate that has no results for its current driver yet, or all of them if rerun is set, and
+// returns the one with the best score
+static vk::PhysicalDevice fastest_device(std::vector<vk::PhysicalDevice> const& candidates, bool rerun) {
+    DeviceBenchmarkShaders shaders;
+    shaders.fill_vert = read_file("shaders/bench_fill.vert.spv");
+    shaders.fill_frag = read_file("shaders/bench_fill.frag.spv");
+    shaders.compute = read_file("shaders/bench_compute.comp.spv");
+
+    DeviceBenchmarkCache cache(device_benchmark_file);
+    bool cache_changed = false;
+    vk::PhysicalDevice best = candidates[0];
+    double best_score = -1.0;
+    std::cout << "Device benchmarks (fill Gpixel/s, transfer GB/s, compute GFLOP/s):\n";
+    for (auto device : candidates) {
+        vk::PhysicalDeviceProperties const properties = device.getProperties();
+        DeviceUuid const uuid = physical_device_uuid(device);
+        std::optional<DeviceBenchmarkResult> result;
+        if (!rerun) {
+            result = cache.find(uuid, properties.driverVersion);
+        }
+        bool const cached = result.has_value();
+        if (!cached) {
+            try {
+                result = benchmark_device(uuid, shaders);
+                cache.store(uuid, properties.driverVersion, *result);
+                cache_changed = true;
+            } catch (std::exception const& e) {
+                // Not cached, so it gets another chance next launch
+                std::cerr << "Failed to benchmark " << properties.deviceName << ": " << e.what() << "\n";
+                result = DeviceBenchmarkResult{};
+            }
+        }
+
+        double const score = result->score();
+        std::cout << "  " << properties.deviceName << ": fill " << result->fill_rate << ", transfer "
+                  << result->transfer_rate << ", compute " << result->compute_rate << ", score " << score
+                  << (cached ? " (cached)" : "") << "\n";
+        if (score > best_score) {
+            best_score = score;
+            best = device;
+        }
+    }
+
+    if (cache_changed) {
+        try {
+            cache.save();
+        } catch (std::exception const& e) {
+            std::cerr << e.what() << "\n";
+        }
+    }
+    return best;
+}
+
 static void create_image(vk::PhysicalDevice physical_device, vk::Device device, size_t width, size_t height, vk::Format format,
                   vk::ImageTiling tiling, vk::ImageUsageFlags usage, vk::MemoryPropertyFlags properties, 
-                  vk::Image& image, vk::DeviceMemory& image_memory) {
+                  vk::Image& image, vk::DeviceMemory& image_memory, uint32_t array_layers = 1) {
 
     vk::ImageCreateInfo image_info;
     image_info.imageType = vk::ImageType::e2D;
@@ -277,7 +689,7 @@ static void create_image(vk::PhysicalDevice physical_device, vk::Device device,
     image_info.extent.height = height;
     image_info.extent.depth = 1;
     image_info.mipLevels = 1;
-    image_info.arrayLayers = 1;
+    image_info.arrayLayers = array_layers;
 
     image_info.format = format;
     image_info.tiling = tiling;
@@ -292,7 +704,7 @@ static void create_image(vk::PhysicalDevice physical_device, vk::Device device,
     vk::MemoryAllocateInfo alloc_info;
     alloc_info.allocationSize = mem_requirements.size;
     alloc_info.memoryTypeIndex = find_memory_type(physical_device, mem_requirements.memoryTypeBits, properties);
-    image_memory = device.allocateMemory(alloc_info);
+    image_memory = allocate_device_memory(physical_device, device, alloc_info);
     device.bindImageMemory(image, image_memory, 0);
 }
 
@@ -325,7 +737,8 @@ static void end_single_time_command_buffer(vk::Device device, vk::CommandBuffer
 }
 
 static void transition_image_layout(vk::Device device, vk::CommandBuffer cmd_buf, vk::Image image, 
-                                    vk::Format format, vk::ImageLayout old_layout, vk::ImageLayout new_layout) {
+                                    vk::Format format, vk::ImageLayout old_layout, vk::ImageLayout new_layout,
+                                    uint32_t layer_count = 1) {
     
     vk::ImageMemoryBarrier barrier;
     barrier.oldLayout = old_layout;
@@ -338,7 +751,7 @@ static void transition_image_layout(vk::Device device, vk::CommandBuffer cmd_buf
     barrier.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
     barrier.subresourceRange.baseArrayLayer = 0;
     barrier.subresourceRange.baseMipLevel = 0;
-    barrier.subresourceRange.layerCount = 1;
+    barrier.subresourceRange.layerCount = layer_count;
     barrier.subresourceRange.levelCount = 1;
 
     vk::PipelineStageFlags src_stage;
@@ -364,8 +777,9 @@ static void transition_image_layout(vk::Device device, vk::CommandBuffer cmd_buf
     cmd_buf.pipelineBarrier(src_stage, dst_stage, vk::DependencyFlagBits::eByRegion, nullptr, nullptr, barrier);
 }
 
+// With more than one layer, the layers follow each other in the buffer
 static void copy_buffer_to_image(vk::Device device, vk::CommandBuffer cmd_buf, Buffer& buf, vk::Image image,
-                                 vk::ImageLayout image_layout, size_t width, size_t height) {
+                                 vk::ImageLayout image_layout, size_t width, size_t height, uint32_t layer_count = 1) {
     vk::BufferImageCopy copy_region;
     copy_region.bufferOffset = 0;
     // Values of 0 means tightly packed here
@@ -374,7 +788,7 @@ static void copy_buffer_to_image(vk::Device device, vk::CommandBuffer cmd_buf, B
 
     copy_region.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
     copy_region.imageSubresource.baseArrayLayer = 0;
-    copy_region.imageSubresource.layerCount = 1;
+    copy_region.imageSubresource.layerCount = layer_count;
     copy_region.imageSubresource.mipLevel = 0;
     
     copy_region.imageOffset = vk::Offset3D{0, 0, 0};
@@ -383,14 +797,15 @@ static void copy_buffer_to_image(vk::Device device, vk::CommandBuffer cmd_buf, B
     cmd_buf.copyBufferToImage(buf.handle(), image, image_layout, copy_region);
 }
 
-static vk::ImageView create_image_view(vk::Device device, vk::Image image, vk::Format format) {
+static vk::ImageView create_image_view(vk::Device device, vk::Image image, vk::Format format,
+                                       vk::ImageViewType type = vk::ImageViewType::e2D, uint32_t layer_count = 1) {
     vk::ImageViewCreateInfo info;
     info.format = format;
     info.image = image;
-    info.viewType = vk::ImageViewType::e2D;
+    info.viewType = type;
     info.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
     info.subresourceRange.baseArrayLayer = 0;
-    info.subresourceRange.layerCount = 1;
+    info.subresourceRange.layerCount = layer_count;
     info.subresourceRange.baseMipLevel = 0;
     info.subresourceRange.levelCount = 1;
 
@@ -399,8 +814,10 @@ static vk::ImageView create_image_view(vk::Device device, vk::Image image, vk::F
 
 class VulkanApp {
 public:
-    VulkanApp(size_t width, size_t height, const char* title) : window_w(width), window_h(height) {
-        window = init_glfw(width, height, title);
+    VulkanApp(size_t width, size_t height, const char* title, AppConfig const& config) 
+        : window_w(width), window_h(height), config(config), pacer(config.fps_limit, config.frames_in_flight) {
+        // Replays only need a swapchain to draw to
+        window = init_glfw(width, height, title, config.replay_file.empty());
         get_available_instance_extensions();
         create_instance();
         // Create dispatcher for dynamically dispatching some functions
@@ -414,50 +831,95 @@ public:
         create_image_views();
         create_render_pass();
         create_descriptor_set_layout();
-        create_graphics_pipeline();
-        create_framebuffers();
+        create_pipeline_cache();
         create_command_pools();
+        create_gpu_profiler();
+        create_lighting();
+        create_virtual_texture();
+        create_pipeline_layout();
+        create_pipeline_library();
+        create_framebuffers();
+        create_dynamic_resolution();
+        create_particles();
         create_texture_image();
-        create_texture_image_view();
         create_texture_sampler();
-        create_vertex_buffer();
-        create_index_buffer();
-        create_uniform_buffers();
-        create_descriptor_pool();
-        create_descriptor_sets();
+        create_geometry_pool();
+        create_scene();
+        create_characters();
+        create_frame_data_buffers();
+        descriptor_allocator = std::make_unique<DescriptorAllocator>(device, config.frames_in_flight);
+        for (size_t i = 0; i < config.frames_in_flight; ++i) {
+            frame_allocators.push_back(std::make_unique<LinearAllocator>(frame_allocator_capacity));
+        }
+        // When an allocation fails, make room by dropping texture detail. Frames in flight may still sample the
+        // dropped levels, so wait for them before the levels are destroyed.
+        set_memory_pressure_handler([this](uint32_t, vk::DeviceSize size) {
+            if (texture_residency.evict_unused(graphics_timeline->last_submitted(), size) == 0) {
+                return false;
+            }
+            wait_for_retired_resources();
+            return true;
+        });
         create_command_buffers();
         create_sync_objects();
+        if (config.shader_hot_reload) {
+            start_shader_hot_reload();
+        }
     }
 
     ~VulkanApp() {
+        // Stop the shader watcher first, it might still be reloading shaders
+        shader_hot_reload.reset();
+        set_memory_pressure_handler(nullptr);
+        // This waits for background compiles to finish
+        pipeline_library.reset();
+        for (auto const& retired : retired_resources) {
+            retired.destroy();
+        }
+        save_pipeline_cache();
+        device.destroyPipelineCache(pipeline_cache);
+
         device.destroySampler(texture_sampler);
+        device.destroySampler(nearest_sampler);
         device.destroyImageView(texture_image_view);
         device.destroyImage(texture_image);
-        device.freeMemory(texture_image_memory);
-        device.destroyDescriptorPool(descriptor_pool);
-        for (auto& uniform_buf : uniform_buffers) {
-            uniform_buf.destroy();
-        }
+        free_device_memory(device, texture_image_memory);
+        texture_rects.destroy();
+        descriptor_allocator.reset();
+        device.unmapMemory(view_buffer.memory_handle());
+        view_buffer.destroy();
+        device.unmapMemory(object_buffer.memory_handle());
+        object_buffer.destroy();
         device.destroyDescriptorSetLayout(descriptor_set_layout);
-        index_buffer.destroy();
-        vertex_buffer.destroy();
-        for (auto& sync_set : sync_objects) {
-            device.destroySemaphore(sync_set.image_available);
-            device.destroySemaphore(sync_set.render_finished);
-            device.destroyFence(sync_set.frame_fence);
+        gpu_profiler.reset();
+        lighting.reset();
+        virtual_texture.reset();
+        particles.reset();
+        characters.reset();
+        dynamic_resolution.reset();
+        compact_geometry.reset();
+        geometry.reset();
+        for (auto& semaphores : swapchain_semaphores) {
+            device.destroySemaphore(semaphores.image_available);
+            device.destroySemaphore(semaphores.render_finished);
         }
+        graphics_timeline.reset();
 
         device.destroyCommandPool(command_pool);
         device.destroyCommandPool(transient_pool);
         for (auto const& framebuf : swapchain_framebuffers) {
             device.destroyFramebuffer(framebuf);
         }
+        for (auto const& framebuf : msaa_framebuffers) {
+            device.destroyFramebuffer(framebuf);
+        }
+        msaa_target.reset();
 
         for (auto const& img_view : swapchain_image_views) {
             device.destroyImageView(img_view);
         }
-        device.destroyPipeline(graphics_pipeline);
         device.destroyRenderPass(render_pass);
+        device.destroyRenderPass(msaa_render_pass);
         device.destroyPipelineLayout(pipeline_layout);
         device.destroySwapchainKHR(swapchain);
         device.destroy();
@@ -469,17 +931,122 @@ public:
     }
 
     void run() {
+        if (config.bench_vertex_pulling) {
+            benchmark_vertex_pulling();
+            return;
+        }
+        if (config.bench_lights) {
+            benchmark_lights();
+            return;
+        }
+        if (!config.replay_file.empty()) {
+            replay();
+            return;
+        }
+        if (!config.capture_file.empty()) {
+            try {
+                capture = std::make_unique<CaptureWriter>(config.capture_file, capture_header());
+            } catch (std::runtime_error const& e) {
+                std::cerr << e.what() << "\n";
+                return;
+            }
+        }
+
+        // Simulate the first frame on this thread, so the renderer always has a snapshot to draw
+        simulate(snapshots.write_buffer());
+        snapshots.write_buffer().frame = ++published_frame;
+        snapshots.publish();
+        snapshots.acquire();
+        consumed_frame = published_frame;
+
+        profiler_set_thread_name("Main");
+        if (!config.profile_file.empty()) {
+            if (profiler_compiled) {
+                profiler_start_capture();
+            } else {
+                std::cerr << "Built without VK_PLAYGROUND_PROFILER, nothing to profile\n";
+            }
+        }
+
+        simulation_running = true;
+        simulation_thread = std::thread([this] { simulation_loop(); });
+
         while(!glfwWindowShouldClose(window)) {
-            static float last_frame_time = glfwGetTime();
-            float frame_time = glfwGetTime();
-            float delta_time = frame_time - last_frame_time;
-            if (std::fmod(frame_time, 3.0f) < 0.01f) {
-                std::cout << 1.0f / delta_time << "\n";
+            {
+                PROFILE_ZONE("Frame");
+                // Wait for the GPU before sampling input, so that any time spent blocking on the GPU does not end up
+                // between sampling input and presenting.
+                wait_for_frame_slot();
+                collect_retired_pipelines();
+                destroy_retired_resources();
+                descriptor_allocator->begin_frame(current_frame);
+                frame_allocators[current_frame]->reset();
+                pacer.wait_for_input_sample();
+                {
+                    PROFILE_ZONE("Poll events");
+                    glfwPollEvents();
+                }
+                pacer.input_sampled(current_frame);
+                // Pick up the newest snapshot. If the simulation fell behind we simply draw the previous one again
+                // instead of waiting for it.
+                if (snapshots.acquire()) {
+                    {
+                        std::lock_guard lock(simulation_mutex);
+                        consumed_frame = snapshots.read_buffer().frame;
+                    }
+                    // Let the simulation start on the next frame while we render this one
+                    simulation_cv.notify_one();
+                }
+                uint64_t const allocations_before = thread_allocation_count();
+                render_frame(snapshots.read_buffer());
+                frame_heap_allocations += thread_allocation_count() - allocations_before;
+                if (capture) {
+                    capture_frame(snapshots.read_buffer());
+                }
+                pacer.presented(current_frame);
+                update_residency();
+                ++draw_stats_frames;
+                if (pacer.report(std::cout)) {
+                    draw_stats.report(std::cout, draw_stats_frames);
+                    descriptor_allocator->take_stats().report(std::cout, draw_stats_frames);
+                    memory_budget->report(std::cout);
+                    texture_residency.take_stats().report(std::cout, "texture");
+                    if (use_virtual_texture()) {
+                        virtual_texture->take_stats().report(std::cout, draw_stats_frames);
+                    }
+                    if (dynamic_resolution) {
+                        dynamic_resolution->take_stats().report(std::cout);
+                    }
+                    if (msaa_target) {
+                        std::cout << "Multisample target: " << msaa_target->committed_size() / (1024 * 1024) << " of "
+                                  << msaa_target->size() / (1024 * 1024) << " MiB committed\n";
+                    }
+                    mesh_residency.take_stats().report(std::cout, "mesh");
+                    if (allocation_counting_compiled) {
+                        std::cout << "render_frame heap allocations: "
+                                  << static_cast<double>(frame_heap_allocations) / draw_stats_frames << " per frame\n";
+                        frame_heap_allocations = 0;
+                    }
+                    draw_stats = DrawStats{};
+                    draw_stats_frames = 0;
+                }
+                current_frame = (current_frame + 1) % config.frames_in_flight;
+                ++frame_number;
             }
-            glfwPollEvents();
-            render_frame();
-            current_frame = (current_frame + 1) % max_frames_in_flight;
-            last_frame_time = frame_time;
+            // After the frame zone closed, so that the trace holds the last frame
+            if (profiler_capturing()) {
+                finish_profile();
+            }
+        }
+
+        {
+            std::lock_guard lock(simulation_mutex);
+            simulation_running = false;
+        }
+        simulation_cv.notify_one();
+        simulation_thread.join();
+        if (capture) {
+            std::cout << "Captured " << capture->frame_count() << " frames to " << config.capture_file << "\n";
         }
         
         // Wait until everything is done before starting to deallocate stuff
@@ -490,6 +1057,9 @@ private:
     size_t window_w, window_h;
     GLFWwindow* window;
 
+    AppConfig config;
+    FramePacer pacer;
+
     std::vector<vk::ExtensionProperties> extensions;
     vk::Instance instance;
     vk::DispatchLoaderDynamic dynamic_dispatcher;
@@ -497,6 +1067,10 @@ private:
 
     vk::PhysicalDevice physical_device;
     vk::Device device;
+    // Buffer device addresses are available, so vertices can be pulled in the vertex shader
+    bool vertex_pulling_supported = false;
+    // Needed for the virtual texture feedback written by the fragment shader
+    bool fragment_stores_supported = false;
     vk::Queue graphics_queue;
     vk::Queue present_queue;
 
@@ -511,38 +1085,153 @@ private:
     vk::DescriptorSetLayout descriptor_set_layout;
     vk::PipelineLayout pipeline_layout;
     vk::RenderPass render_pass;
-    vk::Pipeline graphics_pipeline;
+    // Samples per pixel the scene is drawn with
+    vk::SampleCountFlagBits scene_samples = vk::SampleCountFlagBits::e1;
+    // Draws the scene into a MultisampleTarget and resolves it into the swapchain image, null without multisampling
+    vk::RenderPass msaa_render_pass;
+    vk::PipelineCache pipeline_cache;
+
+    // Background threads for work like pipeline compilation
+    ThreadPool workers{ std::max(1u, std::thread::hardware_concurrency() / 2) };
+    // Asset reads, in the background so a stream of them does not hold up frames
+    AsyncFileReader file_reader{ workers };
+    std::unique_ptr<PipelineLibrary> pipeline_library;
+    // Permutations of the graphics pipeline used to draw the scene, alternating in a checkerboard pattern
+    std::array<PipelineKey, 2> scene_pipeline_keys;
+
+    std::unique_ptr<ShaderHotReload> shader_hot_reload;
+    // Objects that were replaced while frames in flight may still use them, like pipelines replaced by a hot reload
+    // or texture levels that were streamed out
+    struct RetiredResource {
+        std::function<void()> destroy;
+        // Value of the last submission to the graphics queue that could have used the resource
+        uint64_t last_used;
+    };
+    std::vector<RetiredResource> retired_resources;
 
     std::vector<vk::Framebuffer> swapchain_framebuffers;
+    // Shared by every swapchain image, only needed when multisampling without dynamic resolution
+    std::unique_ptr<MultisampleTarget> msaa_target;
+    std::vector<vk::Framebuffer> msaa_framebuffers;
 
     vk::CommandPool command_pool;
     vk::CommandPool transient_pool;
     std::vector<vk::CommandBuffer> command_buffers;
+    // With dynamic resolution the upscale into the swapchain image is submitted separately, so only it waits for the
+    // image to be acquired and the scene's GPU time does not include that wait
+    std::vector<vk::CommandBuffer> upscale_command_buffers;
 
-    size_t current_frame = 0;
+    // Rebuilt and re-recorded every frame
+    DrawList draw_list;
+    DrawStats draw_stats;
+    size_t draw_stats_frames = 0;
 
-    // Synchronization
-    struct SyncObjects {
+    size_t current_frame = 0;
+    // Total amount of frames rendered
+    uint64_t frame_number = 0;
+
+    // Every submission to the graphics queue advances its timeline by one, a frame signals one value
+    std::unique_ptr<QueueTimeline> graphics_timeline;
+    // Value of the newest frame in each frame slot, and of the newest frame drawn to each swapchain image
+    std::vector<uint64_t> frame_slot_values;
+    std::vector<uint64_t> swapchain_image_values;
+    // Acquiring and presenting swapchain images only works with binary semaphores, one pair per frame slot
+    struct SwapchainSemaphores {
         vk::Semaphore image_available;
         vk::Semaphore render_finished;
-        vk::Fence frame_fence;
     };
+    std::vector<SwapchainSemaphores> swapchain_semaphores;
 
-    std::vector<SyncObjects> sync_objects;
-    std::vector<vk::Fence> images_in_flight;
-
-    Buffer vertex_buffer;
-    Buffer index_buffer;
+    // Vertices and indices of every mesh
+    std::unique_ptr<GeometryPool> geometry;
+    // Meshes used by the scene, alternating per row of the grid. Empty while a mesh is evicted.
+    std::array<std::optional<MeshHandle>, 2> scene_meshes;
+    // With vertex pulling, the hexagon is drawn from compact vertices by the same pipelines as the quad
+    std::unique_ptr<GeometryPool> compact_geometry;
+    MeshHandle compact_hexagon;
 
     vk::Image texture_image;
     vk::DeviceMemory texture_image_memory;
     vk::ImageView texture_image_view;
+    // Every texture of the scene, packed into the layers of one array texture. The full resolution layers are kept
+    // in host memory so any detail level can be streamed in again.
+    Atlas texture_atlas;
+    // UV remap table of the atlas, one GpuAtlasRect per texture
+    Buffer texture_rects;
     vk::Sampler texture_sampler;
-
-    std::vector<Buffer> uniform_buffers;
-
-    vk::DescriptorPool descriptor_pool;
-    std::vector<vk::DescriptorSet> descriptor_sets;
+    // Used by the second material, to give it a different look
+    vk::Sampler nearest_sampler;
+    std::unique_ptr<HostImageUploader> image_uploader;
+    // How the texture was last uploaded, reported when it changes
+    std::optional<ImageUploadPath> texture_upload_path;
+
+    std::unique_ptr<MemoryBudget> memory_budget;
+    // Textures are demoted to lower detail when device memory runs low, meshes are evicted when the geometry pool
+    // fills up. Both are streamed back in once they are drawn again and there is room.
+    ResidencyManager texture_residency;
+    ResidencyManager mesh_residency;
+    ResourceId texture_resource = 0;
+    std::array<ResourceId, 2> scene_mesh_resources;
+
+    // The scene is only touched by the simulation thread once it is running
+    Scene scene;
+
+    // Per-view matrices and per-object world matrices, with one slice per swapchain image. Both buffers stay 
+    // mapped for the lifetime of the application, and slices are selected with dynamic offsets.
+    Buffer view_buffer;
+    Buffer object_buffer;
+    uint8_t* view_mapping = nullptr;
+    uint8_t* object_mapping = nullptr;
+    vk::DeviceSize view_stride = 0;
+    vk::DeviceSize object_stride = 0;
+
+    // Descriptor sets are allocated every frame, and freed once the frame is done
+    std::unique_ptr<DescriptorAllocator> descriptor_allocator;
+    // Host memory for lists that only live while a frame is recorded, one per frame in flight. Reset together with
+    // the descriptor allocator, once the frame's fence signalled.
+    static constexpr size_t frame_allocator_capacity = 64 * 1024;
+    std::vector<std::unique_ptr<LinearAllocator>> frame_allocators;
+    // Heap allocations made by render_frame since the last report, should stay at 0 once everything is warmed up
+    uint64_t frame_heap_allocations = 0;
+
+    // Records the inputs of every drawn frame with --capture
+    std::unique_ptr<CaptureWriter> capture;
+
+    std::unique_ptr<ClusteredLighting> lighting;
+    // Where the lights are at the start, the simulation moves them around these
+    std::vector<PointLight> base_lights;
+
+    std::unique_ptr<VirtualTexture> virtual_texture;
+
+    // Null when the scene is drawn at the full swapchain resolution
+    std::unique_ptr<DynamicResolution> dynamic_resolution;
+
+    // Null if the profiler is compiled out
+    std::unique_ptr<GpuProfiler> gpu_profiler;
+
+    // Null when running without characters
+    std::unique_ptr<SkinnedCharacters> characters;
+    // World matrix of every character, written to the object buffer after the scene's
+    std::vector<glm::mat4> character_transforms;
+
+    // Null when running without particles
+    std::unique_ptr<ParticleSystem> particles;
+    ParticleEmitter particle_emitter;
+    // Snapshot time the particles were last advanced to
+    float particle_time = 0.0f;
+    // Fraction of a particle left over from the previous frame's emission
+    float particle_emit_carry = 0.0f;
+
+    // The simulation produces frame N + 1 while the render thread draws frame N
+    TripleBuffer<SceneSnapshot> snapshots;
+    std::thread simulation_thread;
+    // Only used to put the simulation thread to sleep when it is a frame ahead, snapshots themselves are handed over
+    // without locking.
+    std::mutex simulation_mutex;
+    std::condition_variable simulation_cv;
+    bool simulation_running = false;
+    uint64_t published_frame = 0;
+    uint64_t consumed_frame = 0;
 
     void get_available_instance_extensions() {
         extensions = vk::enumerateInstanceExtensionProperties();
@@ -559,7 +1248,7 @@ private:
             bool found = false;
             // Check if requested layer is available
             for (auto const& properties : available_layers) {
-                if (std::strcmp(properties.layerName, layer)) {
+                if (std::strcmp(properties.layerName, layer) == 0) {
                     found = true;
                 }
             }
@@ -625,23 +1314,32 @@ private:
 
     void pick_physical_device() {
         std::vector<vk::PhysicalDevice> devices = instance.enumeratePhysicalDevices();
-        int max_score = 0;
-        for (auto device : devices) {
-            // Find 'best' physical device
-            int score = physical_device_score(device, surface);
-            if (score > max_score) {
-                max_score = score;
-                physical_device = device;
+        if (!config.device.empty()) {
+            physical_device = find_requested_device(devices, config.device);
+            if (physical_device_score(physical_device, surface) == 0) {
+                throw std::runtime_error(std::string(physical_device.getProperties().deviceName) +
+                                         " cannot run this application");
+            }
+        } else {
+            std::vector<vk::PhysicalDevice> candidates;
+            for (auto device : devices) {
+                if (physical_device_score(device, surface) > 0) {
+                    candidates.push_back(device);
+                }
+            }
+            if (candidates.empty()) {
+                throw std::runtime_error("No physical device found");
+            }
+            // Only measure when there is a choice to make
+            if (candidates.size() == 1 && !config.benchmark_devices) {
+                physical_device = candidates[0];
+            } else {
+                physical_device = fastest_device(candidates, config.benchmark_devices);
             }
         }
 
         vk::PhysicalDeviceProperties properties = physical_device.getProperties();
         std::cout << "Picked physical device: " << properties.deviceName << "\n";
-
-        if (!physical_device) {
-            std::cerr << "No physical device found\n";
-            return;
-        }
     }
 
     void create_logical_device() {
@@ -664,15 +1362,46 @@ private:
         // Enumerate features we want enabled. We leave this at the default for now
         vk::PhysicalDeviceFeatures features;
         features.samplerAnisotropy = true;
+        fragment_stores_supported = physical_device.getFeatures().fragmentStoresAndAtomics;
+        features.fragmentStoresAndAtomics = fragment_stores_supported;
+        if (config.virtual_texture && !fragment_stores_supported) {
+            std::cerr << "Fragment shader stores are not supported, the virtual texture is turned off\n";
+        }
 
         // Create the actual device
         vk::DeviceCreateInfo device_info;
         device_info.pQueueCreateInfos = queue_infos.data();
         device_info.queueCreateInfoCount = queue_infos.size();
         device_info.pEnabledFeatures = &features;
+
+        // Buffer device addresses are core in Vulkan 1.2, but still optional
+        vk::PhysicalDeviceBufferDeviceAddressFeatures address_features;
+        if (physical_device.getProperties().apiVersion >= VK_API_VERSION_1_2) {
+            auto const supported = physical_device.getFeatures2<vk::PhysicalDeviceFeatures2, 
+                                                                vk::PhysicalDeviceBufferDeviceAddressFeatures>();
+            vertex_pulling_supported = supported.get<vk::PhysicalDeviceBufferDeviceAddressFeatures>().bufferDeviceAddress;
+        }
+        if (vertex_pulling_supported) {
+            address_features.bufferDeviceAddress = true;
+            device_info.pNext = &address_features;
+        } else if (config.vertex_pulling || config.bench_vertex_pulling) {
+            std::cerr << "Buffer device addresses are not supported, using fixed-function vertex input\n";
+        }
         
         // List required extensions and enable them
         ExtensionsInfo required_extensions = get_required_device_extensions();
+        // Lets the driver report how much memory we may use, otherwise the budget is estimated
+        bool const memory_budget_supported = physical_device.getProperties().apiVersion >= VK_API_VERSION_1_1 && 
+                                             has_device_extension(physical_device, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+        if (memory_budget_supported) {
+            required_extensions.names.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+        }
+        // Lets textures be written from the CPU without staging buffers
+        HostImageCopyFeatures host_image_copy(physical_device);
+        host_image_copy.enable(required_extensions.names, device_info);
+        // Checked when the device was picked
+        TimelineSemaphoreFeatures timeline_features(physical_device);
+        timeline_features.enable(required_extensions.names, device_info);
         device_info.ppEnabledExtensionNames = required_extensions.names.data();
         device_info.enabledExtensionCount = required_extensions.names.size();
         
@@ -681,13 +1410,17 @@ private:
         // Find the graphics queue. The second parameter is the index of the queue
         graphics_queue = device.getQueue(indices.graphics_family.value(), 0);
         present_queue = device.getQueue(indices.present_family.value(), 0);
+        graphics_timeline = std::make_unique<QueueTimeline>(device, graphics_queue, timeline_features.load(device));
+
+        memory_budget = std::make_unique<MemoryBudget>(physical_device, memory_budget_supported);
+        image_uploader = std::make_unique<HostImageUploader>(physical_device, device, host_image_copy.supported());
     }
 
     void create_swapchain() {
         SwapChainSupportDetails swap_chain_support = get_swapchain_support_details(physical_device, surface);
 
         vk::SurfaceFormatKHR surface_format = choose_swap_surface_format(swap_chain_support.formats);
-        vk::PresentModeKHR present_mode = choose_swap_present_mode(swap_chain_support.present_modes);
+        vk::PresentModeKHR present_mode = choose_swap_present_mode(swap_chain_support.present_modes, config.present_mode);
         vk::Extent2D extent = choose_swap_extent(swap_chain_support.capabilities, window_w, window_h);
 
         // + 1 because we want to avoid the driver stalling if we do not have enough images
@@ -759,13 +1492,6 @@ private:
         }
     }
 
-    vk::ShaderModule create_shader_module(std::string const& code) {
-        vk::ShaderModuleCreateInfo info;
-        info.codeSize = code.size();
-        info.pCode = reinterpret_cast<uint32_t const*>(code.data());
-        return device.createShaderModule(info);
-    }
-
     void create_render_pass() {
         vk::AttachmentDescription color_attachment;
         color_attachment.format = swapchain_format;
@@ -807,6 +1533,25 @@ private:
         render_pass_info.pDependencies = &dependency;
 
         render_pass = device.createRenderPass(render_pass_info);
+
+        if (config.msaa_samples > 1) {
+            scene_samples = choose_sample_count(physical_device, config.msaa_samples);
+            if (static_cast<uint32_t>(scene_samples) != config.msaa_samples) {
+                std::cerr << config.msaa_samples << "x multisampling is not supported, using "
+                          << static_cast<uint32_t>(scene_samples) << "x\n";
+            }
+        }
+        if (scene_samples != vk::SampleCountFlagBits::e1) {
+            // Every frame draws into the same multisampled image, so the previous frame's writes have to be done
+            dependency.srcAccessMask = vk::AccessFlagBits::eColorAttachmentWrite;
+            msaa_render_pass = create_color_render_pass(device, swapchain_format, scene_samples,
+                                                        vk::ImageLayout::ePresentSrcKHR, dependency);
+        }
+    }
+
+    // Render pass the scene pipelines are made for. Compatible with the dynamic resolution scene pass.
+    vk::RenderPass scene_pipeline_pass() const {
+        return msaa_render_pass ? msaa_render_pass : render_pass;
     }
 
     void create_descriptor_set_layout() {
@@ -814,7 +1559,8 @@ private:
         ubo_binding.binding = 0;
         // There is only one UBO for this binding (so it's not a UBO array basically)
         ubo_binding.descriptorCount = 1;
-        ubo_binding.descriptorType = vk::DescriptorType::eUniformBuffer;
+        // Dynamic, so the same set can point at the slice of any frame
+        ubo_binding.descriptorType = vk::DescriptorType::eUniformBufferDynamic;
         // UBO is only visible in the vertex shader
         ubo_binding.stageFlags = vk::ShaderStageFlagBits::eVertex;
 
@@ -825,137 +1571,196 @@ private:
         sampler_binding.pImmutableSamplers = nullptr;
         sampler_binding.stageFlags = vk::ShaderStageFlagBits::eFragment;
 
-        vk::DescriptorSetLayoutBinding bindings[] = { ubo_binding, sampler_binding };
+        vk::DescriptorSetLayoutBinding objects_binding;
+        objects_binding.binding = 2;
+        objects_binding.descriptorCount = 1;
+        objects_binding.descriptorType = vk::DescriptorType::eStorageBufferDynamic;
+        objects_binding.stageFlags = vk::ShaderStageFlagBits::eVertex;
+
+        // Where each texture is in the atlas
+        vk::DescriptorSetLayoutBinding texture_rects_binding;
+        texture_rects_binding.binding = 3;
+        texture_rects_binding.descriptorCount = 1;
+        texture_rects_binding.descriptorType = vk::DescriptorType::eStorageBuffer;
+        texture_rects_binding.stageFlags = vk::ShaderStageFlagBits::eVertex;
+
+        vk::DescriptorSetLayoutBinding bindings[] = { ubo_binding, sampler_binding, objects_binding, texture_rects_binding };
 
         vk::DescriptorSetLayoutCreateInfo info;
-        info.bindingCount = 2;
+        info.bindingCount = 4;
         info.pBindings = bindings;
 
         descriptor_set_layout = device.createDescriptorSetLayout(info);
     }
 
-    void create_graphics_pipeline() {
-        std::string vert_shader_code = read_file("shaders/shader.vert.spv");
-        std::string frag_shader_code = read_file("shaders/shader.frag.spv");
+    void create_pipeline_cache() {
+        // Start from the cache of the previous run if there is one. The driver ignores the data if it was created
+        // by a different device or driver version.
+        std::string const cache_data = read_file(pipeline_cache_file);
+
+        vk::PipelineCacheCreateInfo info;
+        info.initialDataSize = cache_data.size();
+        info.pInitialData = cache_data.data();
+        pipeline_cache = device.createPipelineCache(info);
+    }
+
+    void save_pipeline_cache() {
+        std::vector<uint8_t> const cache_data = device.getPipelineCacheData(pipeline_cache);
+        std::ofstream file(pipeline_cache_file, std::ios::binary);
+        file.write(reinterpret_cast<char const*>(cache_data.data()), cache_data.size());
+    }
 
-        vk::ShaderModule vert_module = create_shader_module(vert_shader_code);
-        vk::ShaderModule frag_module = create_shader_module(frag_shader_code);
+    void create_pipeline_layout() {
+        // The pipeline layout specifies uniforms
+        vk::PipelineLayoutCreateInfo pipeline_layout_info;
+        // Set 1 holds the lights and set 2 the virtual texture, both are bound once per frame
+        vk::DescriptorSetLayout const set_layouts[] = { descriptor_set_layout, lighting->set_layout(),
+                                                        virtual_texture->set_layout() };
+        pipeline_layout_info.setLayoutCount = 3;
+        pipeline_layout_info.pSetLayouts = set_layouts;
+        // Small per-draw data goes through push constants
+        vk::PushConstantRange draw_constants_range;
+        draw_constants_range.stageFlags = vk::ShaderStageFlagBits::eVertex;
+        draw_constants_range.offset = 0;
+        draw_constants_range.size = sizeof(DrawConstants);
+        pipeline_layout_info.pushConstantRangeCount = 1;
+        pipeline_layout_info.pPushConstantRanges = &draw_constants_range;
+        pipeline_layout = device.createPipelineLayout(pipeline_layout_info);
+    }
 
-        // For each shader stage, we need a vk::PipelineShaderStage
-        vk::PipelineShaderStageCreateInfo vert_info;
-        vert_info.stage = vk::ShaderStageFlagBits::eVertex;
-        vert_info.module = vert_module;
-        // Specify entry point for shader
-        vert_info.pName = "main";
+    void create_lighting() {
+        // The benchmark goes up to 10000 lights
+        uint32_t const max_lights = config.bench_lights ? 10000 : std::max<uint32_t>(config.light_count, 1);
+        lighting = std::make_unique<ClusteredLighting>(physical_device, device, pipeline_cache, 
+                                                       read_file("shaders/cluster_lights.comp.spv"), max_lights, 
+                                                       swapchain_images.size());
+        base_lights = make_lights(config.light_count);
+    }
 
-        vk::PipelineShaderStageCreateInfo frag_info;
-        frag_info.stage = vk::ShaderStageFlagBits::eFragment;
-        frag_info.module = frag_module;
-        frag_info.pName = "main";
+    // The shaders always declare the virtual texture, so it exists even when it is not used, with room for only the
+    // coarsest page
+    void create_virtual_texture() {
+        uint32_t const atlas_tiles = use_virtual_texture() ? virtual_texture_atlas_tiles : 1;
+        virtual_texture = std::make_unique<VirtualTexture>(physical_device, device, workers, procedural_page_source,
+                                                           atlas_tiles, swapchain_images.size(), transient_pool,
+                                                           graphics_queue);
+    }
 
-        vk::PipelineShaderStageCreateInfo shader_stages[] = { vert_info, frag_info };
+    bool use_virtual_texture() const {
+        return config.virtual_texture && fragment_stores_supported;
+    }
 
-        // Similar to OpenGL vao objects
-        vk::PipelineVertexInputStateCreateInfo vertex_input_info;
-        
-        auto const binding_info = Vertex::input_binding_description();
-        auto const attribute_info = Vertex::attribute_descriptions();
-
-        vertex_input_info.vertexBindingDescriptionCount = 1;
-        vertex_input_info.pVertexBindingDescriptions = &binding_info;
-        vertex_input_info.vertexAttributeDescriptionCount = attribute_info.size();
-        vertex_input_info.pVertexAttributeDescriptions = attribute_info.data();
-
-        vk::PipelineInputAssemblyStateCreateInfo input_assembly_info;
-        input_assembly_info.topology = vk::PrimitiveTopology::eTriangleList;
-        input_assembly_info.primitiveRestartEnable = false;
-
-        // Define viewport and scissor region
-        vk::Viewport viewport;
-        viewport.x = 0.0f;
-        viewport.y = 0.0f;
-        viewport.width = swapchain_extent.width;
-        viewport.height = swapchain_extent.height;
-        viewport.minDepth = 0.0f;
-        viewport.maxDepth = 0.0f;
-        vk::Rect2D scissor;
-        scissor.offset = vk::Offset2D{};
-        scissor.extent = swapchain_extent;
-
-        vk::PipelineViewportStateCreateInfo viewport_info;
-        viewport_info.viewportCount = 1;
-        viewport_info.pViewports = &viewport;
-        viewport_info.scissorCount = 1;
-        viewport_info.pScissors = &scissor;
-
-        // Rasterizer create info
-        vk::PipelineRasterizationStateCreateInfo rasterization_info;
-        rasterization_info.depthClampEnable = false;
-        rasterization_info.rasterizerDiscardEnable = false;
-        rasterization_info.polygonMode = vk::PolygonMode::eFill;
-        rasterization_info.lineWidth = 1.0f;
-        rasterization_info.cullMode = vk::CullModeFlagBits::eBack;
-        rasterization_info.frontFace = vk::FrontFace::eCounterClockwise;
-        // This setting can be useful for shadow mapping. Requires additional values to be set.
-        rasterization_info.depthBiasEnable = false;
-
-        // Setup multisample state
-        vk::PipelineMultisampleStateCreateInfo multisample_info;
-        multisample_info.sampleShadingEnable = false;
-        multisample_info.rasterizationSamples = vk::SampleCountFlagBits::e1;
-        // If we were to enable multisampling, we'd need to set a few more settings here
-
-        // Do not enable depth testing for now
-
-        // Setup color blending mode
-        vk::PipelineColorBlendAttachmentState color_blend_attachment;
-        color_blend_attachment.colorWriteMask = vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG 
-                                        | vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA;
-        color_blend_attachment.blendEnable = false;
-        // Since we disable blending, we can leave the other settings at the default
-
-        vk::PipelineColorBlendStateCreateInfo color_blend_info;
-        color_blend_info.logicOpEnable = false;
-        color_blend_info.attachmentCount = 1;
-        color_blend_info.pAttachments = &color_blend_attachment;
-
-        // Set dynamic state
-        vk::DynamicState dynamic_states[] = {
-            vk::DynamicState::eViewport
+    void create_pipeline_library() {
+        PipelineLibrary::CreateInfo info;
+        info.device = device;
+        info.cache = pipeline_cache;
+        info.layout = pipeline_layout;
+        info.render_pass = scene_pipeline_pass();
+        info.samples = scene_samples;
+        info.vertex_layouts = { standard_vertex_layout(), pulled_vertex_layout() };
+
+        PipelineLibrary::Shaders shaders;
+        shaders.vert_spirv = read_file("shaders/shader.vert.spv");
+        shaders.frag_spirv = read_file(scene_frag_shader().spirv_path);
+        if (vertex_pulling_supported) {
+            shaders.pull_vert_spirv = read_file("shaders/shader_pull.vert.spv");
+        }
+
+        pipeline_library = std::make_unique<PipelineLibrary>(std::move(info), std::move(shaders), workers);
+
+        // These permutations are compiled in the background, the generic pipeline is used until they are done
+        scene_pipeline_keys[0].shader_features = shader_feature_alpha_cutout;
+        scene_pipeline_keys[1].shader_features = shader_feature_alpha_cutout | shader_feature_vertex_color;
+        if (config.light_count > 0) {
+            for (auto& key : scene_pipeline_keys) {
+                key.shader_features |= shader_feature_lighting | shader_feature_clustered_lights;
+            }
+        }
+        if (use_virtual_texture()) {
+            for (auto& key : scene_pipeline_keys) {
+                key.shader_features |= shader_feature_virtual_texture;
+            }
+        }
+        if (use_vertex_pulling()) {
+            for (auto& key : scene_pipeline_keys) {
+                key.vertex_layout = vertex_layout_pulled;
+            }
+        }
+        // Only the generic pipelines are compiled here, so the frame never waits for one
+        for (auto const& key : scene_pipeline_keys) {
+            pipeline_library->prewarm(key);
+        }
+    }
+
+    bool use_vertex_pulling() const {
+        return config.vertex_pulling && vertex_pulling_supported;
+    }
+
+    // Only the variant compiled with VIRTUAL_TEXTURE_FEEDBACK writes to a storage buffer, which takes
+    // fragmentStoresAndAtomics
+    ShaderHotReload::ShaderFile scene_frag_shader() const {
+        std::string const glsl_path = config.shader_source_dir + "/shader.frag";
+        if (use_virtual_texture()) {
+            return { glsl_path, "shaders/shader_feedback.frag.spv", "-DVIRTUAL_TEXTURE_FEEDBACK" };
+        }
+        return { glsl_path, "shaders/shader.frag.spv", "" };
+    }
+
+    void start_shader_hot_reload() {
+        std::string const& source_dir = config.shader_source_dir;
+        // In the order of PipelineLibrary::Shaders
+        std::vector<ShaderHotReload::ShaderFile> files = {
+            ShaderHotReload::ShaderFile{ source_dir + "/shader.vert", "shaders/shader.vert.spv", "" },
+            scene_frag_shader()
         };
+        if (vertex_pulling_supported) {
+            files.push_back(
+                ShaderHotReload::ShaderFile{ source_dir + "/shader_pull.vert", "shaders/shader_pull.vert.spv", "" });
+        }
+        shader_hot_reload = std::make_unique<ShaderHotReload>(std::move(files), [this](std::vector<std::string> spirv) {
+            // Without vertex pulling its shader is not watched, left empty it keeps its current code
+            spirv.resize(3);
+            pipeline_library->reload_shaders(
+                PipelineLibrary::Shaders{ std::move(spirv[0]), std::move(spirv[1]), std::move(spirv[2]) });
+        });
+    }
 
-        vk::PipelineDynamicStateCreateInfo dynamic_state_info;
-        dynamic_state_info.dynamicStateCount = 1;
-        dynamic_state_info.pDynamicStates = dynamic_states;
+    // Take ownership of pipelines replaced by a shader reload. Frames that are still in flight may use them, so they
+    // are only destroyed once every frame submitted so far is done.
+    void collect_retired_pipelines() {
+        for (auto pipeline : pipeline_library->take_retired()) {
+            retire_resource(graphics_timeline->last_submitted(), [this, pipeline] {
+                device.destroyPipeline(pipeline);
+            });
+        }
+    }
 
-        // The pipeline layout specifies uniforms
-        vk::PipelineLayoutCreateInfo pipeline_layout_info;
-        pipeline_layout_info.setLayoutCount = 1;
-        pipeline_layout_info.pSetLayouts = &descriptor_set_layout;
-        pipeline_layout = device.createPipelineLayout(pipeline_layout_info);
+    // Destroy a resource once the graphics timeline reaches last_used
+    void retire_resource(uint64_t last_used, std::function<void()> destroy) {
+        retired_resources.push_back(RetiredResource{ std::move(destroy), last_used });
+    }
 
-        // Create the actual graphics pipeline
-        vk::GraphicsPipelineCreateInfo pipeline_info;
-        pipeline_info.stageCount = 2;
-        pipeline_info.pStages = shader_stages;
-        pipeline_info.pVertexInputState = &vertex_input_info;
-        pipeline_info.pInputAssemblyState = &input_assembly_info;
-        pipeline_info.pViewportState = &viewport_info;
-        pipeline_info.pRasterizationState = &rasterization_info;
-        pipeline_info.pMultisampleState = &multisample_info;
-        pipeline_info.pColorBlendState = &color_blend_info;
-        pipeline_info.pDynamicState = nullptr; // Disable dynamic state for now
-        // Setup layout and render pass
-        pipeline_info.layout = pipeline_layout;
-        pipeline_info.renderPass = render_pass;
-        pipeline_info.subpass = 0;
-
-        graphics_pipeline = device.createGraphicsPipeline(nullptr, pipeline_info);
-
-        // Just like with OpenGL shaders, we're allowed to destroy the modules when 
-        // we have finished linking them together
-        device.destroyShaderModule(vert_module);
-        device.destroyShaderModule(frag_module);
+    // Wait until every retired resource that submitted work used is unused, and destroy them
+    void wait_for_retired_resources() {
+        uint64_t newest = 0;
+        for (auto const& retired : retired_resources) {
+            if (retired.last_used <= graphics_timeline->last_submitted()) {
+                newest = std::max(newest, retired.last_used);
+            }
+        }
+        graphics_timeline->wait(newest);
+        destroy_retired_resources();
+    }
+
+    void destroy_retired_resources() {
+        for (auto it = retired_resources.begin(); it != retired_resources.end(); ) {
+            if (graphics_timeline->reached(it->last_used)) {
+                it->destroy();
+                it = retired_resources.erase(it);
+            } else {
+                ++it;
+            }
+        }
     }
 
     void create_framebuffers() {
@@ -976,6 +1781,54 @@ private:
 
             swapchain_framebuffers[i] = device.createFramebuffer(framebuffer_info);
         }
+
+        if (!msaa_render_pass) {
+            return;
+        }
+        report_multisampling(std::cout, physical_device, device, swapchain_format, swapchain_extent);
+        // Dynamic resolution resolves into its own target instead
+        if (use_dynamic_resolution()) {
+            return;
+        }
+        msaa_target = std::make_unique<MultisampleTarget>(physical_device, device, swapchain_format,
+                                                          swapchain_extent, scene_samples);
+        msaa_framebuffers.resize(swapchain_image_views.size());
+        for (size_t i = 0; i < msaa_framebuffers.size(); ++i) {
+            std::array<vk::ImageView, 2> const attachments = { msaa_target->view(), swapchain_image_views[i] };
+            vk::FramebufferCreateInfo framebuffer_info;
+            framebuffer_info.renderPass = msaa_render_pass;
+            framebuffer_info.attachmentCount = attachments.size();
+            framebuffer_info.pAttachments = attachments.data();
+            framebuffer_info.width = swapchain_extent.width;
+            framebuffer_info.height = swapchain_extent.height;
+            framebuffer_info.layers = 1;
+            msaa_framebuffers[i] = device.createFramebuffer(framebuffer_info);
+        }
+    }
+
+    bool use_dynamic_resolution() const {
+        // Benchmarks draw straight to the swapchain. Replays do too, the scale follows the GPU time so frames would
+        // differ between runs.
+        return config.dynamic_resolution_ms && !config.bench_lights && !config.bench_vertex_pulling &&
+               config.replay_file.empty();
+    }
+
+    void create_dynamic_resolution() {
+        if (!use_dynamic_resolution()) {
+            return;
+        }
+        DynamicResolution::Shaders shaders;
+        shaders.upscale_vert = read_file("shaders/upscale.vert.spv");
+        shaders.upscale_frag = read_file("shaders/upscale.frag.spv");
+        dynamic_resolution = std::make_unique<DynamicResolution>(physical_device, device, pipeline_cache,
+                                                                 swapchain_format, swapchain_extent, scene_samples,
+                                                                 render_pass, shaders, *config.dynamic_resolution_ms,
+                                                                 swapchain_images.size());
+    }
+
+    // Size the scene is drawn at this frame
+    vk::Extent2D scene_extent() const {
+        return dynamic_resolution ? dynamic_resolution->render_extent() : swapchain_extent;
     }
 
     void create_command_pools() {
@@ -983,53 +1836,161 @@ private:
         vk::CommandPoolCreateInfo info;
         info.queueFamilyIndex = queue_families.graphics_family.value();
 
+        // Command buffers are re-recorded individually when the pipeline changes
+        info.flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer;
         command_pool = device.createCommandPool(info);
 
         info.flags = vk::CommandPoolCreateFlagBits::eTransient;
         transient_pool = device.createCommandPool(info);
     }
 
+    void create_gpu_profiler() {
+        if (!profiler_compiled) {
+            return;
+        }
+        // Labels go through the debug utils extension, which is always enabled for the debug messenger
+        uint32_t const graphics_family = find_queue_families(physical_device, surface).graphics_family.value();
+        gpu_profiler = std::make_unique<GpuProfiler>(physical_device, device, graphics_family, swapchain_images.size(),
+                                                     &dynamic_dispatcher, transient_pool, graphics_queue);
+    }
+
+    void create_particles() {
+        if (config.particle_count == 0) {
+            return;
+        }
+        particles = std::make_unique<ParticleSystem>(physical_device, device, pipeline_cache, read_particle_shaders(),
+                                                     config.particle_count, transient_pool, graphics_queue);
+        particles->create_render_pipeline(scene_pipeline_pass(), scene_samples,
+                                          read_file("shaders/particle.vert.spv"),
+                                          read_file("shaders/particle.frag.spv"));
+    }
+
     void create_texture_image() {
-        int width, height, channels;
-        unsigned char* pixels = stbi_load("textures/pengu.png", &width, &height, &channels, STBI_rgb_alpha);
+        vk::PhysicalDeviceLimits const limits = physical_device.getProperties().limits;
+        if (config.atlas_file.empty()) {
+            // Pack at startup. Padding keeps the textures apart at every detail level.
+            std::vector<TextureImage> images;
+            std::string const pengu_path = "textures/pengu.png";
+            images.push_back(decode_texture_image(pengu_path, read_files(file_reader, { pengu_path })[0]));
+            images.push_back(make_checker_texture(64, 8, { 230, 230, 230, 255 }, { 40, 40, 40, 255 }));
+            images.push_back(make_gradient_texture(128, 32, glm::vec4(0.9f, 0.2f, 0.1f, 1.0f), 
+                                                   glm::vec4(0.1f, 0.3f, 0.9f, 1.0f)));
+            uint32_t const page_size = choose_atlas_page_size(images, texture_detail_levels, atlas_min_page_size,
+                                                              limits.maxImageDimension2D);
+            texture_atlas = build_atlas(images, page_size, texture_detail_levels);
+        } else {
+            texture_atlas = load_atlas(config.atlas_file, limits.maxImageDimension2D, limits.maxImageArrayLayers);
+        }
+        AtlasLayout const& layout = texture_atlas.layout;
+        if (layout.entries.empty()) {
+            throw std::runtime_error("Texture atlas has no textures");
+        }
+        std::cout << "Texture atlas: " << layout.entries.size() << " textures in " << layout.layer_count 
+                  << " layers of " << layout.page_size << "x" << layout.page_size << "\n";
+
+        std::vector<GpuAtlasRect> rects;
+        for (auto const& entry : layout.entries) {
+            rects.push_back(GpuAtlasRect{ glm::vec4(entry.uv_rect[0], entry.uv_rect[1], entry.uv_rect[2], entry.uv_rect[3]), 
+                                          entry.layer });
+        }
+        vk::DeviceSize const rects_size = rects.size() * sizeof(GpuAtlasRect);
+        Buffer staging_buffer(physical_device, device, rects_size, vk::BufferUsageFlagBits::eTransferSrc, 
+                              vk::MemoryPropertyFlagBits::eHostCoherent | vk::MemoryPropertyFlagBits::eHostVisible);
+        void* data_ptr = device.mapMemory(staging_buffer.memory_handle(), 0, rects_size);
+        std::memcpy(data_ptr, rects.data(), rects_size);
+        device.unmapMemory(staging_buffer.memory_handle());
+        texture_rects = Buffer(physical_device, device, rects_size, 
+                               vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst,
+                               vk::MemoryPropertyFlagBits::eDeviceLocal);
+        copy_buffers(staging_buffer, texture_rects, rects_size, transient_pool, graphics_queue);
+
+        upload_texture_level(0);
+
+        // Every layer shrinks with the level
+        std::vector<vk::DeviceSize> level_sizes;
+        for (uint32_t level = 0; level < texture_detail_levels; ++level) {
+            vk::DeviceSize const page_size = std::max(1u, layout.page_size >> level);
+            level_sizes.push_back(page_size * page_size * 4 * layout.layer_count);
+        }
+        texture_resource = texture_residency.add(std::move(level_sizes), 0, [this](uint32_t level, uint64_t last_used) {
+            // Frames in flight may still sample the current level
+            retire_resource(last_used, [this, image = texture_image, memory = texture_image_memory, 
+                                        view = texture_image_view] {
+                device.destroyImageView(view);
+                device.destroyImage(image);
+                free_device_memory(device, memory);
+            });
+            upload_texture_level(level);
+        });
+    }
 
-        if (!pixels) {
-            std::cerr << "Failed to load image\n";
+    // Create the texture at a detail level from the full resolution pixels. Level n is 2^n times smaller.
+    // Every layer of the atlas is downsampled separately. The atlas padding keeps textures from bleeding into each
+    // other at every level.
+    void upload_texture_level(uint32_t level) {
+        uint32_t const layer_count = texture_atlas.layout.layer_count;
+        uint32_t width = texture_atlas.layout.page_size;
+        uint32_t height = texture_atlas.layout.page_size;
+        std::vector<std::vector<uint8_t>> level_layers(level == 0 ? 0 : layer_count);
+        for (uint32_t i = 0; i < level; ++i) {
+            for (uint32_t layer = 0; layer < layer_count; ++layer) {
+                uint32_t layer_width = width, layer_height = height;
+                level_layers[layer] = downsample_rgba8(i == 0 ? texture_atlas.layers[layer] : level_layers[layer],
+                                                       layer_width, layer_height);
+            }
+            width = std::max(1u, width / 2);
+            height = std::max(1u, height / 2);
+        }
+        std::vector<std::vector<uint8_t>> const& layers = level == 0 ? texture_atlas.layers : level_layers;
+
+        // Straight from host memory into the image where the device allows it
+        ImageUploadPath const path = image_uploader->choose_path(vk::Format::eR8G8B8A8Srgb, width, height,
+                                                                 layer_count);
+        if (texture_upload_path != path) {
+            std::cout << "Texture upload: " << to_string(path) << "\n";
+            texture_upload_path = path;
+        }
+        if (path != ImageUploadPath::Staging) {
+            image_uploader->create_image(path, vk::Format::eR8G8B8A8Srgb, width, height, layers, transient_pool,
+                                         graphics_queue, texture_image, texture_image_memory);
+            texture_image_view = create_image_view(device, texture_image, vk::Format::eR8G8B8A8Srgb,
+                                                   vk::ImageViewType::e2DArray, layer_count);
             return;
         }
 
-        vk::DeviceSize const image_size = width * height * 4;
+        vk::DeviceSize const layer_size = vk::DeviceSize(width) * height * 4;
+        vk::DeviceSize const image_size = layer_size * layer_count;
 
         Buffer staging_buffer(physical_device, device, image_size, vk::BufferUsageFlagBits::eTransferSrc, 
                               vk::MemoryPropertyFlagBits::eHostCoherent | vk::MemoryPropertyFlagBits::eHostVisible);
 
-        void* data_ptr = device.mapMemory(staging_buffer.memory_handle(), 0, image_size);
-        std::memcpy(data_ptr, pixels, image_size);
+        uint8_t* data_ptr = static_cast<uint8_t*>(device.mapMemory(staging_buffer.memory_handle(), 0, image_size));
+        for (uint32_t layer = 0; layer < layer_count; ++layer) {
+            std::memcpy(data_ptr + layer * layer_size, layers[layer].data(), layer_size);
+        }
         device.unmapMemory(staging_buffer.memory_handle());
-        // We no longer need the pixel data here
-        stbi_image_free(pixels);
 
         // Create the image
         create_image(physical_device, device, width, height, vk::Format::eR8G8B8A8Srgb, vk::ImageTiling::eOptimal, 
                      vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled, 
-                     vk::MemoryPropertyFlagBits::eDeviceLocal, texture_image, texture_image_memory);
+                     vk::MemoryPropertyFlagBits::eDeviceLocal, texture_image, texture_image_memory, layer_count);
         
         vk::CommandBuffer cmd_buf = begin_single_time_command_buffer(device, transient_pool);
 
         // Transition image layout from Undefined to TransferDstOptimal
         transition_image_layout(device, cmd_buf, texture_image, vk::Format::eR8G8B8A8Srgb, 
-                                vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal);
+                                vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal, layer_count);
         // Copy data to image
         copy_buffer_to_image(device, cmd_buf, staging_buffer, texture_image, 
-                             vk::ImageLayout::eTransferDstOptimal, width, height);
+                             vk::ImageLayout::eTransferDstOptimal, width, height, layer_count);
         // Transition one more time so we can start sampling the image
         transition_image_layout(device, cmd_buf, texture_image, vk::Format::eR8G8B8A8Srgb,
-                                vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal);
+                                vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal, 
+                                layer_count);
         end_single_time_command_buffer(device, cmd_buf, transient_pool, graphics_queue);
-    }
 
-    void create_texture_image_view() {
-        texture_image_view = create_image_view(device, texture_image, vk::Format::eR8G8B8A8Srgb);
+        texture_image_view = create_image_view(device, texture_image, vk::Format::eR8G8B8A8Srgb, 
+                                               vk::ImageViewType::e2DArray, layer_count);
     }
 
     void create_texture_sampler() {
@@ -1052,115 +2013,176 @@ private:
         info.maxLod = 0.0f;
 
         texture_sampler = device.createSampler(info);
-    }
 
-    void create_vertex_buffer() {
-        vk::DeviceSize buffer_size = vertices.size() * sizeof(Vertex);
-        // Create staging buffer for transfer
-        Buffer staging_buffer(physical_device, device, buffer_size, vk::BufferUsageFlagBits::eTransferSrc, 
-                              vk::MemoryPropertyFlagBits::eHostCoherent | vk::MemoryPropertyFlagBits::eHostVisible);
-        // Copy data to staging buffer
-        void* data_ptr;
-        data_ptr = device.mapMemory(staging_buffer.memory_handle(), 0, buffer_size);
-        std::memcpy(data_ptr, &vertices[0], buffer_size);
-        device.unmapMemory(staging_buffer.memory_handle());
-
-        // Create vertex buffer in device local memory and copy contents
-        vertex_buffer = Buffer(physical_device, device, buffer_size, 
-                               vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eVertexBuffer, 
-                               vk::MemoryPropertyFlagBits::eDeviceLocal);
-        // Do the copy
-        copy_buffers(staging_buffer, vertex_buffer, buffer_size, transient_pool, graphics_queue);
-        // Temporary staging buffer is destroyed by the Buffer destructor
+        info.magFilter = vk::Filter::eNearest;
+        info.minFilter = vk::Filter::eNearest;
+        info.anisotropyEnable = false;
+        nearest_sampler = device.createSampler(info);
     }
 
-    void create_index_buffer() {
-         vk::DeviceSize buffer_size = indices.size() * sizeof(uint32_t);
-        // Create staging buffer for transfer
-        Buffer staging_buffer(physical_device, device, buffer_size, vk::BufferUsageFlagBits::eTransferSrc, 
-                              vk::MemoryPropertyFlagBits::eHostCoherent | vk::MemoryPropertyFlagBits::eHostVisible);
-        // Copy data to staging buffer
-        void* data_ptr;
-        data_ptr = device.mapMemory(staging_buffer.memory_handle(), 0, buffer_size);
-        std::memcpy(data_ptr, &indices[0], buffer_size);
-        device.unmapMemory(staging_buffer.memory_handle());
-
-        // Create index buffer in device local memory and copy contents
-        index_buffer = Buffer(physical_device, device, buffer_size, 
-                              vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eIndexBuffer, 
-                              vk::MemoryPropertyFlagBits::eDeviceLocal);
-        // Do the copy
-        copy_buffers(staging_buffer, index_buffer, buffer_size, transient_pool, graphics_queue);
-        // Temporary staging buffer is destroyed by the Buffer destructor
+    // Vertex buffer usage needed to read vertices through device addresses
+    vk::BufferUsageFlags pulled_vertex_usage() const {
+        if (!vertex_pulling_supported) {
+            return {};
+        }
+        return vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress;
     }
 
-    void create_uniform_buffers() {
-        uniform_buffers.resize(swapchain_image_views.size());
+    void create_geometry_pool() {
+        geometry = std::make_unique<GeometryPool>(physical_device, device, sizeof(Vertex), 
+                                                  geometry_pool_vertices, geometry_pool_indices, pulled_vertex_usage());
+        add_scene_mesh(0);
+        add_scene_mesh(1);
+        // Upload all meshes at once
+        geometry->flush(transient_pool, graphics_queue);
+
+        for (size_t i = 0; i < scene_meshes.size(); ++i) {
+            MeshRange const& mesh = geometry->mesh(*scene_meshes[i]);
+            vk::DeviceSize const size = mesh.vertex_count * sizeof(Vertex) + mesh.index_count * sizeof(uint32_t);
+            scene_mesh_resources[i] = mesh_residency.add({ size, 0 }, 0, [this, i](uint32_t level, uint64_t last_used) {
+                if (level == 0) {
+                    // Uploaded by the next frame's command buffer, before it draws the mesh
+                    add_scene_mesh(i);
+                } else {
+                    // Frames in flight may still draw the mesh, so its space is released later
+                    MeshHandle const mesh = *scene_meshes[i];
+                    scene_meshes[i].reset();
+                    retire_resource(last_used, [this, mesh] { geometry->remove_mesh(mesh); });
+                }
+            });
+        }
 
-        vk::DeviceSize size = sizeof(Matrices);
-        for (auto& uniform_buffer : uniform_buffers) {
-            uniform_buffer = Buffer(physical_device, device, size, vk::BufferUsageFlagBits::eUniformBuffer, 
-                                    vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);                        
+        if (use_vertex_pulling()) {
+            std::vector<CompactVertex> compact_vertices;
+            for (auto const& vertex : hexagon_vertices) {
+                compact_vertices.push_back(make_compact_vertex(vertex.pos, vertex.color, vertex.tex_coords));
+            }
+            compact_geometry = std::make_unique<GeometryPool>(physical_device, device, sizeof(CompactVertex),
+                                                              compact_vertices.size(), hexagon_indices.size(), 
+                                                              pulled_vertex_usage());
+            compact_hexagon = compact_geometry->add_mesh(compact_vertices.data(), compact_vertices.size(),
+                                                         hexagon_indices.data(), hexagon_indices.size());
+            compact_geometry->flush(transient_pool, graphics_queue);
         }
     }
 
-    void create_descriptor_pool() {
-        vk::DescriptorPoolSize sizes[2];
-        sizes[0].type = vk::DescriptorType::eUniformBuffer;
-        sizes[0].descriptorCount = swapchain_images.size();
-
-        sizes[1].type = vk::DescriptorType::eCombinedImageSampler;
-        sizes[1].descriptorCount = swapchain_images.size();
-
-        vk::DescriptorPoolCreateInfo info;
-        info.poolSizeCount = 2;
-        info.pPoolSizes = sizes;
-        info.maxSets = swapchain_images.size();
-
-        descriptor_pool = device.createDescriptorPool(info);
+    // Queue the geometry of a scene mesh for upload, with the next flush of the pool or the next frame
+    void add_scene_mesh(size_t index) {
+        if (index == 0) {
+            scene_meshes[0] = geometry->add_mesh(quad_vertices.data(), quad_vertices.size(), 
+                                                 quad_indices.data(), quad_indices.size());
+        } else {
+            scene_meshes[1] = geometry->add_mesh(hexagon_vertices.data(), hexagon_vertices.size(), 
+                                                 hexagon_indices.data(), hexagon_indices.size());
+        }
     }
 
-    void create_descriptor_sets() {
-        // Allocate descriptor sets
-        std::vector<vk::DescriptorSetLayout> layouts(swapchain_images.size(), descriptor_set_layout);
-        vk::DescriptorSetAllocateInfo alloc_info;
-        alloc_info.descriptorPool = descriptor_pool;
-        alloc_info.descriptorSetCount = swapchain_images.size();
-        alloc_info.pSetLayouts = layouts.data();
-        descriptor_sets = device.allocateDescriptorSets(alloc_info);
+    void create_characters() {
+        if (config.character_count == 0) {
+            return;
+        }
+        std::vector<Vertex> vertices;
+        std::vector<SkinWeights> weights;
+        std::vector<uint32_t> indices;
+        SkeletalAnimation animation = make_character(vertices, weights, indices);
+
+        SkinnedCharacters::Mesh mesh;
+        mesh.vertices = vertices.data();
+        mesh.weights = weights.data();
+        mesh.vertex_count = vertices.size();
+        mesh.indices = indices.data();
+        mesh.index_count = indices.size();
+        // Skinned vertices are pulled like any other standard vertices
+        vk::BufferUsageFlags const output_usage = use_vertex_pulling() ? pulled_vertex_usage() : vk::BufferUsageFlags{};
+        characters = std::make_unique<SkinnedCharacters>(physical_device, device, pipeline_cache, 
+                                                         read_file("shaders/skinning.comp.spv"), mesh, 
+                                                         std::move(animation), config.character_count, 
+                                                         swapchain_images.size(), output_usage, transient_pool, 
+                                                         graphics_queue);
+        character_transforms = make_character_transforms(config.character_count);
+    }
 
-        // Configure descriptor sets
-        for (size_t i = 0; i < descriptor_sets.size(); ++i) {
-            vk::DescriptorBufferInfo buffer_info;
-            buffer_info.buffer = uniform_buffers[i].handle();
-            buffer_info.offset = 0;
-            buffer_info.range = sizeof(Matrices);
+    // World matrices in the object buffer, the characters come after the scene
+    size_t object_count() const {
+        return scene.size() + character_transforms.size();
+    }
 
-            vk::DescriptorImageInfo image_info;
-            image_info.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
-            image_info.imageView = texture_image_view;
-            image_info.sampler = texture_sampler;
+    // Keep textures and meshes within what is left of the device local budget. Changes take effect from the next
+    // frame on.
+    void update_residency() {
+        // Replaced objects still count as used until they are destroyed, which would make the budget look tighter 
+        // than it is
+        if (!retired_resources.empty()) {
+            return;
+        }
 
-            // We update a descriptor set using a vk::WriteDescriptorSet struct
-            std::array<vk::WriteDescriptorSet, 2> write_infos;
-            write_infos[0].dstSet = descriptor_sets[i];
-            write_infos[0].pBufferInfo = &buffer_info;
-            write_infos[0].dstBinding = 0;
-            // Not an array
-            write_infos[0].dstArrayElement = 0;
-            write_infos[0].descriptorType = vk::DescriptorType::eUniformBuffer;
-            write_infos[0].descriptorCount = 1;
+        MemoryBudget::Heap const heap = memory_budget->device_local();
+        vk::DeviceSize limit = heap.budget;
+        if (config.memory_budget_mib > 0) {
+            limit = std::min(limit, vk::DeviceSize(config.memory_budget_mib) * 1024 * 1024);
+        }
+        // Everything that is not streamed has to fit in as well. The geometry pool is allocated up front, it counts
+        // with the meshes it holds, so that meshes and textures share the rest of the budget.
+        vk::DeviceSize const pool_size = vk::DeviceSize(geometry_pool_vertices) * sizeof(Vertex) + 
+                                         vk::DeviceSize(geometry_pool_indices) * sizeof(uint32_t);
+        vk::DeviceSize const streamed = texture_residency.resident_size() + pool_size;
+        vk::DeviceSize const other = heap.usage - std::min(heap.usage, streamed);
+        vk::DeviceSize const available = limit > other ? limit - other : 0;
+        // Called right after a frame was submitted, so its value is the last one
+        uint64_t const frame_value = graphics_timeline->last_submitted();
+        // Meshes are small next to the textures drawn on them, they get their share first
+        mesh_residency.update(frame_value, std::min(available, pool_size));
+        texture_residency.update(frame_value, available - std::min(available, mesh_residency.resident_size()));
+    }
 
-            write_infos[1].dstSet = descriptor_sets[i];
-            write_infos[1].pImageInfo = &image_info;
-            write_infos[1].dstBinding = 1;
+    void create_scene() {
+        scene.reserve(scene_grid_size * scene_grid_size * (1 + scene_children_per_node));
+
+        // Spread the grid over [-1, 1] on the XY plane
+        float const cell_size = 2.0f / scene_grid_size;
+        for (size_t y = 0; y < scene_grid_size; ++y) {
+            for (size_t x = 0; x < scene_grid_size; ++x) {
+                glm::vec3 const position(-1.0f + (x + 0.5f) * cell_size, -1.0f + (y + 0.5f) * cell_size, 0.0f);
+                uint32_t const parent = scene.add_node(Scene::no_parent, position, glm::quat(1, 0, 0, 0), 
+                                                       glm::vec3(cell_size * 0.5f));
+                // Children are positioned relative to their parent
+                for (size_t i = 0; i < scene_children_per_node; ++i) {
+                    float const angle = glm::radians(360.0f) * i / scene_children_per_node;
+                    glm::vec3 const offset(std::cos(angle) * 0.75f, std::sin(angle) * 0.75f, 0.0f);
+                    scene.add_node(parent, offset, glm::quat(1, 0, 0, 0), glm::vec3(0.25f));
+                }
+            }
+        }
+    }
 
-            write_infos[1].dstArrayElement = 0;
-            write_infos[1].descriptorType = vk::DescriptorType::eCombinedImageSampler;
-            write_infos[1].descriptorCount = 1;
+    void create_frame_data_buffers() {
+        vk::PhysicalDeviceLimits const limits = physical_device.getProperties().limits;
+        size_t const image_count = swapchain_images.size();
+
+        view_stride = align_up(sizeof(Matrices), limits.minUniformBufferOffsetAlignment);
+        view_buffer = Buffer(physical_device, device, view_stride * image_count, vk::BufferUsageFlagBits::eUniformBuffer,
+                             vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+        view_mapping = static_cast<uint8_t*>(device.mapMemory(view_buffer.memory_handle(), 0, VK_WHOLE_SIZE));
+
+        // Streaming stores need every slice to be at least 16 byte aligned
+        object_stride = align_up(object_count() * sizeof(glm::mat4), 
+                                 std::max<vk::DeviceSize>(limits.minStorageBufferOffsetAlignment, 64));
+        object_buffer = Buffer(physical_device, device, object_stride * image_count, vk::BufferUsageFlagBits::eStorageBuffer,
+                               vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+        object_mapping = static_cast<uint8_t*>(device.mapMemory(object_buffer.memory_handle(), 0, VK_WHOLE_SIZE));
+    }
 
-            device.updateDescriptorSets(write_infos, nullptr);
-        }
+    // Contents of the descriptor set of a material. Buffer descriptors cover a single frame, the dynamic offsets 
+    // pick the frame when binding.
+    DescriptorSetContents material_descriptors(size_t material) {
+        DescriptorSetContents contents;
+        contents.buffer(0, vk::DescriptorType::eUniformBufferDynamic, view_buffer.handle(), 0, sizeof(Matrices));
+        contents.image(1, vk::DescriptorType::eCombinedImageSampler, material == 0 ? texture_sampler : nearest_sampler, 
+                       texture_image_view, vk::ImageLayout::eShaderReadOnlyOptimal);
+        contents.buffer(2, vk::DescriptorType::eStorageBufferDynamic, object_buffer.handle(), 0, 
+                        object_count() * sizeof(glm::mat4));
+        contents.buffer(3, vk::DescriptorType::eStorageBuffer, texture_rects.handle(), 0, VK_WHOLE_SIZE);
+        return contents;
     }
 
     void create_command_buffers() {
@@ -1170,129 +2192,502 @@ private:
         info.level = vk::CommandBufferLevel::ePrimary;
         info.commandBufferCount = swapchain_framebuffers.size();
 
+        // These are recorded every frame, right before submitting them
         command_buffers = device.allocateCommandBuffers(info);
+        if (dynamic_resolution) {
+            upscale_command_buffers = device.allocateCommandBuffers(info);
+        }
+    }
+
+    void build_draw_list(size_t image_index, SceneSnapshot const& snapshot) {
+        PROFILE_ZONE("Build draw list");
+        draw_list.clear();
+
+        // Look up the pipelines once, the library hands out the generic pipeline while a permutation is compiling
+        vk::Pipeline const pipelines[] = {
+            pipeline_library->get(scene_pipeline_keys[0]),
+            pipeline_library->get(scene_pipeline_keys[1])
+        };
+
+        DescriptorSetContents const materials[] = { material_descriptors(0), material_descriptors(1) };
+
+        // The whole scene is visible, so everything it draws is in use until the frame's submission is done. With
+        // vertex pulling, the hexagon comes from the compact pool, which is not managed.
+        uint64_t const frame_value = graphics_timeline->next_value();
+        texture_residency.touch(texture_resource, frame_value);
+        mesh_residency.touch(scene_mesh_resources[0], frame_value);
+        if (!use_vertex_pulling()) {
+            mesh_residency.touch(scene_mesh_resources[1], frame_value);
+        }
+
+        // One draw per grid cell, drawing the node and its children as instances
+        size_t const stride = 1 + scene_children_per_node;
+        for (size_t cell = 0; cell < scene_grid_size * scene_grid_size; ++cell) {
+            size_t const first_node = cell * stride;
+            uint32_t const pipeline_id = (cell % scene_grid_size + cell / scene_grid_size) % 2;
+            size_t const mesh_index = (cell / scene_grid_size) % 2;
+            uint32_t const material = cell % 2;
+            // Evicted meshes are skipped until they are streamed back in, and so are pipelines that are not compiled
+            // at all yet
+            bool const compact_mesh = use_vertex_pulling() && mesh_index == 1;
+            if ((!compact_mesh && !scene_meshes[mesh_index]) || !pipelines[pipeline_id]) {
+                continue;
+            }
+
+            // Distance to the camera along the view direction
+            glm::vec4 const position = snapshot.instances[first_node][3];
+            float const depth = -(snapshot.matrices.view * position).z;
+
+            DrawCommand draw;
+            draw.sort_key = make_sort_key(RenderPassType::Opaque, pipeline_id, material, depth);
+            draw.pipeline = pipelines[pipeline_id];
+            // Only the first draw of each material in a frame allocates and writes a set
+            draw.descriptor_set = descriptor_allocator->get(descriptor_set_layout, materials[material]);
+            draw.dynamic_offsets = frame_offsets(image_index);
+            draw.constants.first_object = first_node;
+            // Every texture is in the same atlas, so switching textures does not split the batch
+            draw.constants.texture_index = cell % texture_atlas.layout.entries.size();
+            if (use_vertex_pulling()) {
+                // Quads use standard vertices and hexagons compact ones, the shader decodes either
+                GeometryPool& pool = mesh_index == 0 ? *geometry : *compact_geometry;
+                MeshHandle const handle = mesh_index == 0 ? *scene_meshes[0] : compact_hexagon;
+                MeshRange const& mesh = pool.mesh(handle);
+                draw.constants.vertices = pool.vertex_address(handle);
+                draw.constants.vertex_format = mesh_index == 0 ? VertexFormat::Standard : VertexFormat::Compact;
+                draw.index_buffer = pool.index_buffer();
+                draw.index_count = mesh.index_count;
+                draw.first_index = mesh.first_index;
+            } else {
+                // Every mesh lives in the same buffers, so these are only bound once
+                MeshRange const& mesh = geometry->mesh(*scene_meshes[mesh_index]);
+                draw.vertex_buffer = geometry->vertex_buffer();
+                draw.index_buffer = geometry->index_buffer();
+                draw.index_count = mesh.index_count;
+                draw.first_index = mesh.first_index;
+                draw.vertex_offset = mesh.vertex_offset;
+            }
+            draw.instance_count = stride;
+            draw_list.add(draw);
+        }
+
+        if (characters && pipelines[0]) {
+            add_character_draws(image_index, snapshot, pipelines[0],
+                                descriptor_allocator->get(descriptor_set_layout, materials[0]));
+        }
 
-        // Record commands to the command buffers
-        for (size_t i = 0; i < command_buffers.size(); ++i) {
-            vk::CommandBuffer cmd_buffer = command_buffers[i];
-            // We're going to leave these values at their defaults
-            vk::CommandBufferBeginInfo begin_info;
-            // Start command buffer
-            cmd_buffer.begin(begin_info);
-            // Start render pass
+        draw_list.sort(workers);
+    }
+
+    // One draw per character, reading the vertices skinned for this swapchain image
+    void add_character_draws(size_t image_index, SceneSnapshot const& snapshot, vk::Pipeline pipeline, 
+                             vk::DescriptorSet descriptor_set) {
+        uint32_t const slot = static_cast<uint32_t>(image_index);
+        for (uint32_t character = 0; character < characters->character_count(); ++character) {
+            float const depth = -(snapshot.matrices.view * character_transforms[character][3]).z;
+
+            DrawCommand draw;
+            draw.sort_key = make_sort_key(RenderPassType::Opaque, 0, 0, depth);
+            draw.pipeline = pipeline;
+            draw.descriptor_set = descriptor_set;
+            draw.dynamic_offsets = frame_offsets(image_index);
+            draw.constants.first_object = static_cast<uint32_t>(scene.size() + character);
+            draw.constants.texture_index = character % texture_atlas.layout.entries.size();
+            if (use_vertex_pulling()) {
+                draw.constants.vertices = characters->vertex_address(slot, character);
+                draw.constants.vertex_format = VertexFormat::Standard;
+            } else {
+                draw.vertex_buffer = characters->output_buffer();
+                draw.vertex_offset = characters->vertex_offset(slot, character);
+            }
+            draw.index_buffer = characters->index_buffer();
+            draw.index_count = characters->index_count();
+            draw_list.add(draw);
+        }
+    }
+
+    void record_command_buffer(size_t i, SceneSnapshot const& snapshot) {
+        PROFILE_ZONE("Record commands");
+        vk::CommandBuffer cmd_buffer = command_buffers[i];
+        // We're going to leave these values at their defaults
+        vk::CommandBufferBeginInfo begin_info;
+        // Start command buffer
+        cmd_buffer.begin(begin_info);
+        if (gpu_profiler) {
+            gpu_profiler->begin_frame(cmd_buffer, i);
+        }
+        if (dynamic_resolution) {
+            dynamic_resolution->begin_timing(cmd_buffer, i);
+        }
+        // Meshes streamed back in since the last frame, which the draws of this one read
+        if (geometry->has_pending_uploads()) {
+            PROFILE_GPU_ZONE(gpu_profiler.get(), cmd_buffer, "Geometry upload");
+            auto const staging = std::make_shared<Buffer>(geometry->record_uploads(cmd_buffer));
+            retire_resource(graphics_timeline->next_value(), [staging] { staging->destroy(); });
+        }
+        // Lights are binned into clusters before the render pass starts
+        vk::DescriptorSet const lighting_set = descriptor_allocator->get(lighting->set_layout(), lighting->descriptors());
+        if (config.light_count > 0) {
+            PROFILE_GPU_ZONE(gpu_profiler.get(), cmd_buffer, "Light binning");
+            lighting->record_binning(cmd_buffer, lighting_set, i);
+        }
+        if (particles) {
+            PROFILE_GPU_ZONE(gpu_profiler.get(), cmd_buffer, "Particle update");
+            record_particle_update(cmd_buffer, snapshot);
+        }
+        // Skinned once, read by every pass drawing the characters
+        if (characters) {
+            PROFILE_GPU_ZONE(gpu_profiler.get(), cmd_buffer, "Skinning");
+            characters->record_skinning(cmd_buffer, i);
+        }
+        // Pages that finished loading since this image was last drawn
+        if (use_virtual_texture()) {
+            PROFILE_GPU_ZONE(gpu_profiler.get(), cmd_buffer, "Virtual texture upload");
+            virtual_texture->update(cmd_buffer, i, frame_number, *frame_allocators[current_frame]);
+        }
+        {
+            PROFILE_GPU_ZONE(gpu_profiler.get(), cmd_buffer, "Scene pass");
+            begin_scene_pass(cmd_buffer, i, lighting_set);
+            // Draw everything, binding only the state that changes between draws
+            draw_list.record(cmd_buffer, pipeline_layout, draw_stats);
+            // Blended particles go on top of the opaque scene. They bind their own set 0, so they come last.
+            if (particles) {
+                particles->record_draw(cmd_buffer, snapshot.matrices.view, snapshot.matrices.projection, 0.05f);
+            }
+            cmd_buffer.endRenderPass();
+        }
+        if (use_virtual_texture()) {
+            virtual_texture->record_feedback_barrier(cmd_buffer, i);
+        }
+        if (dynamic_resolution) {
+            dynamic_resolution->end_timing(cmd_buffer, i);
+        }
+        // End command buffer
+        cmd_buffer.end();
+
+        if (dynamic_resolution) {
+            record_upscale_command_buffer(i);
+        }
+    }
+
+    // Stretch the scene over the swapchain image
+    void record_upscale_command_buffer(size_t i) {
+        vk::CommandBuffer cmd_buffer = upscale_command_buffers[i];
+        cmd_buffer.begin(vk::CommandBufferBeginInfo{});
+        {
+            PROFILE_GPU_ZONE(gpu_profiler.get(), cmd_buffer, "Upscale");
             vk::RenderPassBeginInfo render_pass_info;
             render_pass_info.renderPass = render_pass;
             render_pass_info.framebuffer = swapchain_framebuffers[i];
             render_pass_info.renderArea.offset = vk::Offset2D{0, 0};
             render_pass_info.renderArea.extent = swapchain_extent;
-            // Specify clear color
             vk::ClearValue clear_color = vk::ClearColorValue(std::array<float, 4>{{0.0f, 0.0f, 0.0f, 1.0f}});
             render_pass_info.clearValueCount = 1;
             render_pass_info.pClearValues = &clear_color;
-            // Render pass started
             cmd_buffer.beginRenderPass(render_pass_info, vk::SubpassContents::eInline);
-            // Bind the graphics pipeline
-            cmd_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, graphics_pipeline);
-            // Bind the vertex and index buffer
-            vk::DeviceSize offset = 0;
-            cmd_buffer.bindVertexBuffers(0, vertex_buffer.handle(), offset);
-            cmd_buffer.bindIndexBuffer(index_buffer.handle(), 0, vk::IndexType::eUint32);
-            // Bind descriptor set
-            cmd_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipeline_layout, 0, descriptor_sets[i], nullptr);
-            // Do the drawcall
-            cmd_buffer.drawIndexed(indices.size(), 1, 0, 0, 0);
-            // End command buffer
+            dynamic_resolution->record_upscale(cmd_buffer);
             cmd_buffer.endRenderPass();
-            cmd_buffer.end();
         }
+        cmd_buffer.end();
+    }
+
+    // Advance the particles to the snapshot's time, emitting enough to keep the pool about full
+    void record_particle_update(vk::CommandBuffer cmd_buffer, SceneSnapshot const& snapshot) {
+        float const dt = std::max(snapshot.time - particle_time, 0.0f);
+        particle_time = snapshot.time;
+        particle_emit_carry += dt * particles->capacity() / particle_emitter.lifetime;
+        uint32_t const emit_count = static_cast<uint32_t>(particle_emit_carry);
+        particle_emit_carry -= emit_count;
+
+        particles->record_simulation(cmd_buffer, dt, emit_count, particle_emitter);
+        particles->record_sort(cmd_buffer, snapshot.matrices.view);
+    }
+
+    // Start the render pass on a swapchain image, multisampled or not, or on the dynamic resolution target, with the
+    // lights and virtual texture feedback of the image's slice bound
+    void begin_scene_pass(vk::CommandBuffer cmd_buffer, size_t image_index, vk::DescriptorSet lighting_set) {
+        vk::Extent2D const extent = scene_extent();
+        vk::RenderPassBeginInfo render_pass_info;
+        if (dynamic_resolution) {
+            render_pass_info.renderPass = dynamic_resolution->scene_render_pass();
+            render_pass_info.framebuffer = dynamic_resolution->scene_framebuffer();
+        } else if (msaa_target) {
+            render_pass_info.renderPass = msaa_render_pass;
+            render_pass_info.framebuffer = msaa_framebuffers[image_index];
+        } else {
+            render_pass_info.renderPass = render_pass;
+            render_pass_info.framebuffer = swapchain_framebuffers[image_index];
+        }
+        render_pass_info.renderArea.offset = vk::Offset2D{0, 0};
+        render_pass_info.renderArea.extent = extent;
+        // Specify clear color
+        vk::ClearValue clear_color = vk::ClearColorValue(std::array<float, 4>{{0.0f, 0.0f, 0.0f, 1.0f}});
+        render_pass_info.clearValueCount = 1;
+        render_pass_info.pClearValues = &clear_color;
+        // Render pass started
+        cmd_buffer.beginRenderPass(render_pass_info, vk::SubpassContents::eInline);
+        cmd_buffer.setViewport(0, vk::Viewport(0.0f, 0.0f, float(extent.width), float(extent.height), 0.0f, 1.0f));
+        cmd_buffer.setScissor(0, render_pass_info.renderArea);
+        cmd_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipeline_layout, 1, lighting_set, 
+                                      lighting->dynamic_offsets(image_index));
+        vk::DescriptorSet const virtual_texture_set =
+            descriptor_allocator->get(virtual_texture->set_layout(), virtual_texture->descriptors(image_index));
+        cmd_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipeline_layout, 2, virtual_texture_set,
+                                      nullptr);
     }
 
     void create_sync_objects() {
         vk::SemaphoreCreateInfo info;
-        vk::FenceCreateInfo fence_info;
-        fence_info.flags = vk::FenceCreateFlagBits::eSignaled;
-        sync_objects.resize(max_frames_in_flight);
-        for (auto& sync_set : sync_objects) {
-            sync_set.image_available = device.createSemaphore(info);
-            sync_set.render_finished = device.createSemaphore(info);
-            sync_set.frame_fence = device.createFence(fence_info);
+        swapchain_semaphores.resize(config.frames_in_flight);
+        for (auto& semaphores : swapchain_semaphores) {
+            semaphores.image_available = device.createSemaphore(info);
+            semaphores.render_finished = device.createSemaphore(info);
         }
 
-        images_in_flight.resize(swapchain_images.size(), nullptr);
+        // The timeline starts at 0, which counts as done
+        frame_slot_values.resize(config.frames_in_flight, 0);
+        swapchain_image_values.resize(swapchain_images.size(), 0);
     }
 
-    void update_uniform_buffer(size_t image_index) {
+    void simulate(SceneSnapshot& snapshot) {
+        PROFILE_ZONE("Simulate");
         static const float start_time = (float)glfwGetTime();
 
         float const current_time = (float)glfwGetTime();
         float const time = current_time - start_time;
+        snapshot.time = time;
+
+        // Only the grid nodes are animated, their children follow along through the hierarchy
+        glm::quat const rotation = glm::angleAxis(time * glm::radians(90.0f), glm::vec3(0, 0, 1));
+        size_t const stride = 1 + scene_children_per_node;
+        for (size_t node = 0; node < scene.size(); node += stride) {
+            scene.set_rotation(node, rotation);
+        }
+        scene.update_transforms();
 
-        Matrices matrices;
-        matrices.model = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f), glm::vec3(0, 0, 1));
-        matrices.view = glm::lookAt(glm::vec3(2, 2, 2), glm::vec3(0, 0, 0), glm::vec3(0, 0, 1));
-        matrices.projection = glm::perspective(glm::radians(45.0f), (float)window_w / (float)window_h, 0.1f, 100.0f);
+        snapshot.instances.resize(scene.size());
+        scene.copy_instances(snapshot.instances.data());
+
+        snapshot.matrices.view = glm::lookAt(glm::vec3(2, 2, 2), glm::vec3(0, 0, 0), glm::vec3(0, 0, 1));
+        snapshot.matrices.projection = glm::perspective(glm::radians(45.0f), (float)window_w / (float)window_h, 
+                                                        camera_near, camera_far);
         // GLM was made for OpenGL, so we have to flip the Y axis
-        matrices.projection[1][1] *= -1;
+        snapshot.matrices.projection[1][1] *= -1;
+
+        // Every light circles around its starting point
+        snapshot.lights = base_lights;
+        for (size_t i = 0; i < snapshot.lights.size(); ++i) {
+            float const angle = time + float(i);
+            snapshot.lights[i].position += glm::vec3(std::cos(angle), std::sin(angle), 0.0f) * 0.1f;
+        }
+    }
+
+    void simulation_loop() {
+        profiler_set_thread_name("Simulation");
+        while (true) {
+            {
+                // Stay at most one frame ahead of the renderer, anything more would only add latency
+                std::unique_lock lock(simulation_mutex);
+                simulation_cv.wait(lock, [this] { return !simulation_running || consumed_frame == published_frame; });
+                if (!simulation_running) {
+                    return;
+                }
+            }
 
-        // Note that this is not a good way to copy data to uniform buffers
-        void* data_ptr = device.mapMemory(uniform_buffers[image_index].memory_handle(), 0, sizeof(Matrices));
-        std::memcpy(data_ptr, &matrices, sizeof(Matrices));
-        device.unmapMemory(uniform_buffers[image_index].memory_handle());
+            SceneSnapshot& snapshot = snapshots.write_buffer();
+            simulate(snapshot);
+            {
+                std::lock_guard lock(simulation_mutex);
+                snapshot.frame = ++published_frame;
+            }
+            snapshots.publish();
+        }
     }
 
-    void render_frame() {
-        // Wait for an available spot in the in-flight frames array
-        device.waitForFences(sync_objects[current_frame].frame_fence, true, std::numeric_limits<std::uint64_t>::max());
+    CaptureHeader capture_header() const {
+        CaptureHeader header;
+        header.width = static_cast<uint32_t>(window_w);
+        header.height = static_cast<uint32_t>(window_h);
+        header.instance_count = static_cast<uint32_t>(scene.size());
+        header.light_count = static_cast<uint32_t>(base_lights.size());
+        return header;
+    }
 
+    void capture_frame(SceneSnapshot const& snapshot) {
+        PROFILE_ZONE("Capture frame");
+        try {
+            capture->write_frame(snapshot.time, snapshot.matrices.view, snapshot.matrices.projection,
+                                 snapshot.instances.data(), snapshot.lights.data());
+        } catch (std::runtime_error const& e) {
+            std::cerr << e.what() << ", stopping the capture\n";
+            capture.reset();
+        }
+    }
 
+    // Draw the frames of a capture one after another, as fast as the GPU allows. The snapshots come from the file
+    // instead of the simulation, and no input is sampled, so every run draws exactly the same frames.
+    void replay() {
+        std::unique_ptr<CaptureReader> reader;
+        try {
+            reader = std::make_unique<CaptureReader>(config.replay_file);
+        } catch (std::runtime_error const& e) {
+            std::cerr << e.what() << "\n";
+            return;
+        }
+        CaptureHeader const expected = capture_header();
+        CaptureHeader const& header = reader->header();
+        if (header.instance_count != expected.instance_count || header.light_count != expected.light_count) {
+            std::cerr << config.replay_file << " was captured with " << header.instance_count << " instances and "
+                      << header.light_count << " lights, this scene has " << expected.instance_count << " and "
+                      << expected.light_count << "\n";
+            return;
+        }
+
+        SceneSnapshot snapshot;
+        snapshot.instances.resize(header.instance_count);
+        snapshot.lights.resize(header.light_count);
+        std::vector<double> frame_milliseconds;
+        auto const start = std::chrono::steady_clock::now();
+        auto frame_start = start;
+        while (true) {
+            PROFILE_ZONE("Frame");
+            wait_for_frame_slot();
+            collect_retired_pipelines();
+            destroy_retired_resources();
+            descriptor_allocator->begin_frame(current_frame);
+            frame_allocators[current_frame]->reset();
+            try {
+                if (!reader->read_frame(snapshot.time, snapshot.matrices.view, snapshot.matrices.projection,
+                                        snapshot.instances.data(), snapshot.lights.data())) {
+                    break;
+                }
+            } catch (std::runtime_error const& e) {
+                std::cerr << e.what() << "\n";
+                break;
+            }
+            snapshot.frame = frame_number + 1;
+            render_frame(snapshot);
+            update_residency();
+            current_frame = (current_frame + 1) % config.frames_in_flight;
+            ++frame_number;
+
+            auto const now = std::chrono::steady_clock::now();
+            frame_milliseconds.push_back(std::chrono::duration<double, std::milli>(now - frame_start).count());
+            frame_start = now;
+        }
+        device.waitIdle();
+        double const seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (frame_milliseconds.empty()) {
+            std::cout << config.replay_file << " holds no frames\n";
+            return;
+        }
+        std::sort(frame_milliseconds.begin(), frame_milliseconds.end());
+        auto const percentile = [&](double p) {
+            return frame_milliseconds[static_cast<size_t>(p * (frame_milliseconds.size() - 1))];
+        };
+        std::cout << "Replayed " << frame_milliseconds.size() << " frames of " << config.replay_file << " at "
+                  << header.width << "x" << header.height << " in " << seconds << " s\n"
+                  << "  frame time: mean " << seconds * 1000.0 / frame_milliseconds.size() << " ms, median "
+                  << percentile(0.5) << " ms, 99th percentile " << percentile(0.99) << " ms, max "
+                  << frame_milliseconds.back() << " ms\n";
+        draw_stats.report(std::cout, frame_milliseconds.size());
+    }
+
+    // Collect the frame's profiler events, and write the trace once enough frames were captured
+    void finish_profile() {
+        profiler_collect();
+        if (frame_number < config.profile_frames) {
+            return;
+        }
+        // The GPU zones of the frames still in flight are only read back once their slot is reused, wait for them
+        graphics_timeline->wait(graphics_timeline->last_submitted());
+        if (gpu_profiler) {
+            gpu_profiler->collect();
+            profiler_collect();
+        }
+        profiler_stop_capture();
+        try {
+            profiler_write_chrome_trace(config.profile_file);
+            std::cout << "Wrote a trace of " << frame_number << " frames to " << config.profile_file << "\n";
+        } catch (std::runtime_error const& e) {
+            std::cerr << e.what() << "\n";
+        }
+    }
+
+    // Dynamic offsets of the per-view and per-object data of the frame drawn to a swapchain image
+    std::array<uint32_t, 2> frame_offsets(size_t image_index) const {
+        return { static_cast<uint32_t>(image_index * view_stride), static_cast<uint32_t>(image_index * object_stride) };
+    }
+
+    void upload_snapshot(size_t image_index, SceneSnapshot const& snapshot) {
+        PROFILE_ZONE("Upload snapshot");
+        std::memcpy(view_mapping + image_index * view_stride, &snapshot.matrices, sizeof(Matrices));
+        glm::mat4* const objects = reinterpret_cast<glm::mat4*>(object_mapping + image_index * object_stride);
+        stream_matrices(objects, snapshot.instances.data(), snapshot.instances.size());
+        if (characters) {
+            // Characters stay in place, only their poses change. Poses follow the snapshot's time, so a replay
+            // animates them the same way.
+            stream_matrices(objects + snapshot.instances.size(), character_transforms.data(), 
+                            character_transforms.size());
+            characters->update_palettes(static_cast<uint32_t>(image_index), snapshot.time, workers);
+        }
+        lighting->upload(image_index, snapshot.matrices.view, snapshot.matrices.projection, camera_near, camera_far,
+                         scene_extent(), snapshot.lights);
+    }
+
+    void wait_for_frame_slot() {
+        PROFILE_ZONE("Wait for frame slot");
+        // Wait for the frame that used this slot last, which frees up a spot in the in-flight frames array
+        graphics_timeline->wait(frame_slot_values[current_frame]);
+        pacer.gpu_completed(current_frame);
+    }
+
+    void render_frame(SceneSnapshot const& snapshot) {
+        PROFILE_ZONE("Render frame");
         // 1. Get image from swapchain for rendering
         // 2. Execute the correct command buffer to render to this image
         // 3. Send it back to the swapchain for presenting
 
         // Step 1: Aqcuire image from swapchain
+        SwapchainSemaphores const& semaphores = swapchain_semaphores[current_frame];
         uint32_t image_index = device.acquireNextImageKHR(swapchain, std::numeric_limits<std::uint64_t>::max(), 
-                                                               sync_objects[current_frame].image_available, nullptr).value;
-        // Check if a previous frame is using this image
-        if (images_in_flight[image_index]) {
-            device.waitForFences(images_in_flight[image_index], true, std::numeric_limits<std::uint64_t>::max());
+                                                          semaphores.image_available, nullptr).value;
+        // The data of the image's previous frame is overwritten below. Usually that frame is older than the one
+        // waited for to get the frame slot, and the timeline knows it is done without asking the GPU.
+        graphics_timeline->wait(swapchain_image_values[image_index]);
+
+        // The previous frame using this image is done, so we can safely re-record its command buffer
+        if (dynamic_resolution) {
+            dynamic_resolution->update(image_index);
         }
+        build_draw_list(image_index, snapshot);
+        record_command_buffer(image_index, snapshot);
 
-        // Mark this image in use by the current frame
-        images_in_flight[image_index] = sync_objects[current_frame].frame_fence;
-
-        update_uniform_buffer(image_index);
+        upload_snapshot(image_index, snapshot);
 
         // Step 2: Submit command buffer
-        vk::SubmitInfo submit_info;
-        // These are the semaphores we want to wait for
-        vk::Semaphore wait_semaphores[] = { sync_objects[current_frame].image_available };
-        // At what stage we need to start waiting for the image. This means we can already start running the vertex shader
-        // even if the image is not available yet.
-        vk::PipelineStageFlags wait_stages[] = { vk::PipelineStageFlagBits::eColorAttachmentOutput };
-        submit_info.waitSemaphoreCount = 1;
-        submit_info.pWaitSemaphores = wait_semaphores;
-        submit_info.pWaitDstStageMask = wait_stages;
-
-        // Specify which command buffers to submit
-        submit_info.commandBufferCount = 1;
-        submit_info.pCommandBuffers = &command_buffers[image_index];
-        
-        // Specify the semaphores to signal when the operation is done
-        vk::Semaphore signal_semaphores[] = { sync_objects[current_frame].render_finished };
-        submit_info.signalSemaphoreCount = 1;
-        submit_info.pSignalSemaphores = signal_semaphores;
-        
-        // Reset the fence right before we actually need to use it
-        device.resetFences(sync_objects[current_frame].frame_fence);
+        // With dynamic resolution the scene goes first without waiting for the image, only the upscale needs it.
+        // Otherwise the scene waits for the image, but the vertex shader can already run before it is available.
+        std::array<SubmitBatch, 2> batches = {
+            SubmitBatch(command_buffers[image_index]),
+            SubmitBatch(dynamic_resolution ? upscale_command_buffers[image_index] : command_buffers[image_index])
+        };
+        size_t const batch_count = dynamic_resolution ? 2 : 1;
+        SubmitBatch& last_batch = batches[batch_count - 1];
+        last_batch.wait(semaphores.image_available, vk::PipelineStageFlagBits::eColorAttachmentOutput);
+        last_batch.signal(semaphores.render_finished);
 
-        // Submit the command buffer
-        graphics_queue.submit(submit_info, sync_objects[current_frame].frame_fence);
+        // Signals the frame's value on the timeline once every batch is done
+        uint64_t const frame_value = graphics_timeline->submit(
+            vk::ArrayProxy<SubmitBatch const>(batch_count, batches.data()));
+        frame_slot_values[current_frame] = frame_value;
+        swapchain_image_values[image_index] = frame_value;
 
         // Step 3: Present to the swapchain
         vk::PresentInfoKHR present_info;
         // Wait for the render_finished semaphore to signal before presenting
         present_info.waitSemaphoreCount = 1;
-        present_info.pWaitSemaphores = signal_semaphores;
+        present_info.pWaitSemaphores = &semaphores.render_finished;
 
         // Set the swapchain to present to
         vk::SwapchainKHR swapchains[] = { swapchain };
@@ -1301,14 +2696,274 @@ private:
         present_info.pImageIndices = &image_index;
 
         // Present!
+        PROFILE_ZONE("Present");
         present_queue.presentKHR(present_info);
     }
+
+    // Rendering to a swapchain image outside of the frame loop, for benchmarks
+    uint32_t acquire_image_blocking() {
+        vk::Fence const acquire_fence = device.createFence(vk::FenceCreateInfo{});
+        uint32_t const image_index = device.acquireNextImageKHR(swapchain, std::numeric_limits<std::uint64_t>::max(),
+                                                                nullptr, acquire_fence).value;
+        device.waitForFences(acquire_fence, true, std::numeric_limits<std::uint64_t>::max());
+        device.destroyFence(acquire_fence);
+        return image_index;
+    }
+
+    // Hand an image acquired with acquire_image_blocking back to the swapchain
+    void present_image(uint32_t image_index) {
+        vk::PresentInfoKHR present_info;
+        present_info.swapchainCount = 1;
+        present_info.pSwapchains = &swapchain;
+        present_info.pImageIndices = &image_index;
+        present_queue.presentKHR(present_info);
+    }
+
+    // Draws the scene with clustered and with brute force lighting at increasing light counts, timing both on the GPU
+    void benchmark_lights() {
+        constexpr std::array<size_t, 4> light_counts = { 10, 100, 1000, 10000 };
+
+        SceneSnapshot snapshot;
+        simulate(snapshot);
+
+        // Compile every permutation up front, so the generic pipelines are never measured
+        std::array<PipelineKey, 2> const scene_keys = scene_pipeline_keys;
+        std::array<PipelineKey, 2> clustered_keys = scene_keys;
+        std::array<PipelineKey, 2> brute_force_keys = scene_keys;
+        for (size_t i = 0; i < scene_keys.size(); ++i) {
+            clustered_keys[i].shader_features |= shader_feature_lighting | shader_feature_clustered_lights;
+            brute_force_keys[i].shader_features |= shader_feature_lighting;
+            brute_force_keys[i].shader_features &= ~shader_feature_clustered_lights;
+            pipeline_library->get_compiled(clustered_keys[i]);
+            pipeline_library->get_compiled(brute_force_keys[i]);
+        }
+
+        GpuTimer timer(physical_device, device, 3);
+
+        std::cout << "Lighting benchmark: " << scene.size() << " objects, " << ClusteredLighting::grid_x << "x" 
+                  << ClusteredLighting::grid_y << "x" << ClusteredLighting::grid_z << " clusters\n";
+        for (size_t count : light_counts) {
+            snapshot.lights = make_lights(count);
+
+            // The first round warms up caches and clocks, only the second one is reported
+            std::vector<double> milliseconds;
+            for (int round = 0; round < 2; ++round) {
+                descriptor_allocator->begin_frame(0);
+                frame_allocators[0]->reset();
+                uint32_t const image_index = acquire_image_blocking();
+                upload_snapshot(image_index, snapshot);
+                vk::DescriptorSet const lighting_set = descriptor_allocator->get(lighting->set_layout(), 
+                                                                                 lighting->descriptors());
+
+                vk::CommandBuffer cmd_buf = begin_single_time_command_buffer(device, transient_pool);
+                timer.reset(cmd_buf);
+                timer.begin(cmd_buf, 0);
+                lighting->record_binning(cmd_buf, lighting_set, image_index);
+                timer.end(cmd_buf, 0);
+                if (characters) {
+                    characters->record_skinning(cmd_buf, image_index);
+                }
+
+                for (uint32_t variant = 0; variant < 2; ++variant) {
+                    scene_pipeline_keys = variant == 0 ? clustered_keys : brute_force_keys;
+                    build_draw_list(image_index, snapshot);
+                    begin_scene_pass(cmd_buf, image_index, lighting_set);
+                    timer.begin(cmd_buf, 1 + variant);
+                    draw_list.record(cmd_buf, pipeline_layout, draw_stats);
+                    timer.end(cmd_buf, 1 + variant);
+                    cmd_buf.endRenderPass();
+                }
+
+                end_single_time_command_buffer(device, cmd_buf, transient_pool, graphics_queue);
+                milliseconds = timer.read_milliseconds();
+                present_image(image_index);
+            }
+
+            std::cout << "  " << count << " lights: binning " << milliseconds[0] << " ms, clustered " 
+                      << milliseconds[1] << " ms (" << milliseconds[0] + milliseconds[1] << " ms total), brute force "
+                      << milliseconds[2] << " ms\n";
+        }
+
+        scene_pipeline_keys = scene_keys;
+        device.waitIdle();
+    }
+
+    // Draws a large grid mesh with fixed-function vertex input, and with vertex pulling from standard and compact
+    // vertices, timing each on the GPU
+    void benchmark_vertex_pulling() {
+        if (!vertex_pulling_supported) {
+            return;
+        }
+
+        constexpr uint32_t grid_size = 512;
+        constexpr uint32_t draws_per_run = 16;
+        constexpr uint32_t run_count = 3;
+
+        std::vector<Vertex> vertices;
+        std::vector<uint32_t> indices;
+        make_grid_mesh(grid_size, vertices, indices);
+        std::vector<CompactVertex> compact_vertices;
+        compact_vertices.reserve(vertices.size());
+        for (auto const& vertex : vertices) {
+            compact_vertices.push_back(make_compact_vertex(vertex.pos, vertex.color, vertex.tex_coords));
+        }
+
+        GeometryPool standard_pool(physical_device, device, sizeof(Vertex), vertices.size(), indices.size(), 
+                                   pulled_vertex_usage());
+        MeshHandle const standard_mesh = standard_pool.add_mesh(vertices.data(), vertices.size(), 
+                                                                indices.data(), indices.size());
+        standard_pool.flush(transient_pool, graphics_queue);
+        GeometryPool compact_pool(physical_device, device, sizeof(CompactVertex), compact_vertices.size(), 
+                                  indices.size(), pulled_vertex_usage());
+        MeshHandle const compact_mesh = compact_pool.add_mesh(compact_vertices.data(), compact_vertices.size(), 
+                                                              indices.data(), indices.size());
+        compact_pool.flush(transient_pool, graphics_queue);
+
+        // Cover the whole framebuffer, flipping Y like the scene projection does so the winding stays the same
+        Matrices benchmark_matrices{ glm::mat4(1.0f), glm::mat4(1.0f) };
+        benchmark_matrices.projection[1][1] = -1.0f;
+        std::memcpy(view_mapping, &benchmark_matrices, sizeof(Matrices));
+        glm::mat4 const identity(1.0f);
+        std::memcpy(object_mapping, &identity, sizeof(glm::mat4));
+
+        PipelineKey pulled_key;
+        pulled_key.vertex_layout = vertex_layout_pulled;
+        vk::Pipeline const fixed_pipeline = pipeline_library->get_compiled(PipelineKey{});
+        vk::Pipeline const pulled_pipeline = pipeline_library->get_compiled(pulled_key);
+
+        DrawConstants fixed_constants;
+        DrawConstants standard_constants;
+        standard_constants.vertices = standard_pool.vertex_address(standard_mesh);
+        standard_constants.vertex_format = VertexFormat::Standard;
+        DrawConstants compact_constants;
+        compact_constants.vertices = compact_pool.vertex_address(compact_mesh);
+        compact_constants.vertex_format = VertexFormat::Compact;
+
+        GpuTimer timer(physical_device, device, run_count);
+        descriptor_allocator->begin_frame(0);
+        frame_allocators[0]->reset();
+
+        // The first round warms up caches and clocks, only the second one is reported
+        std::vector<double> milliseconds;
+        for (int round = 0; round < 2; ++round) {
+            uint32_t const image_index = acquire_image_blocking();
+
+            vk::CommandBuffer cmd_buf = begin_single_time_command_buffer(device, transient_pool);
+            timer.reset(cmd_buf);
+
+            vk::DescriptorSet const lighting_set = descriptor_allocator->get(lighting->set_layout(), 
+                                                                             lighting->descriptors());
+            begin_scene_pass(cmd_buf, image_index, lighting_set);
+            vk::DescriptorSet const descriptor_set = descriptor_allocator->get(descriptor_set_layout, material_descriptors(0));
+            cmd_buf.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipeline_layout, 0, descriptor_set, 
+                                       frame_offsets(0));
+
+            // Fixed-function vertex input
+            vk::DeviceSize const offset = 0;
+            cmd_buf.bindPipeline(vk::PipelineBindPoint::eGraphics, fixed_pipeline);
+            cmd_buf.bindVertexBuffers(0, standard_pool.vertex_buffer(), offset);
+            cmd_buf.bindIndexBuffer(standard_pool.index_buffer(), 0, vk::IndexType::eUint32);
+            cmd_buf.pushConstants<DrawConstants>(pipeline_layout, vk::ShaderStageFlagBits::eVertex, 0, fixed_constants);
+            timer.begin(cmd_buf, 0);
+            for (uint32_t i = 0; i < draws_per_run; ++i) {
+                cmd_buf.drawIndexed(indices.size(), 1, 0, 0, 0);
+            }
+            timer.end(cmd_buf, 0);
+
+            // Vertex pulling, standard and compact vertices
+            cmd_buf.bindPipeline(vk::PipelineBindPoint::eGraphics, pulled_pipeline);
+            cmd_buf.pushConstants<DrawConstants>(pipeline_layout, vk::ShaderStageFlagBits::eVertex, 0, standard_constants);
+            timer.begin(cmd_buf, 1);
+            for (uint32_t i = 0; i < draws_per_run; ++i) {
+                cmd_buf.drawIndexed(indices.size(), 1, 0, 0, 0);
+            }
+            timer.end(cmd_buf, 1);
+
+            cmd_buf.pushConstants<DrawConstants>(pipeline_layout, vk::ShaderStageFlagBits::eVertex, 0, compact_constants);
+            cmd_buf.bindIndexBuffer(compact_pool.index_buffer(), 0, vk::IndexType::eUint32);
+            timer.begin(cmd_buf, 2);
+            for (uint32_t i = 0; i < draws_per_run; ++i) {
+                cmd_buf.drawIndexed(indices.size(), 1, 0, 0, 0);
+            }
+            timer.end(cmd_buf, 2);
+
+            cmd_buf.endRenderPass();
+            end_single_time_command_buffer(device, cmd_buf, transient_pool, graphics_queue);
+            milliseconds = timer.read_milliseconds();
+            present_image(image_index);
+        }
+        device.waitIdle();
+
+        std::cout << "Vertex pulling benchmark: " << vertices.size() << " vertices, " << indices.size() / 3 
+                  << " triangles, " << draws_per_run << " draws per run\n"
+                  << "  fixed-function input:         " << milliseconds[0] << " ms (" << sizeof(Vertex) << " bytes per vertex)\n"
+                  << "  pulling, standard vertices:   " << milliseconds[1] << " ms (" << sizeof(Vertex) << " bytes per vertex)\n"
+                  << "  pulling, compact vertices:    " << milliseconds[2] << " ms (" << sizeof(CompactVertex) << " bytes per vertex)\n";
+    }
 };
 
 
-int main() {
+int main(int argc, char** argv) {
+    AppConfig config;
+    try {
+        config = parse_app_config(argc, argv);
+    } catch (std::exception const& e) {
+        std::cerr << e.what() << "\n";
+        print_usage(std::cerr, argv[0]);
+        return 1;
+    }
+
+    // Offline texture packing, the result can be loaded with --atlas
+    if (!config.pack_textures.empty()) {
+        try {
+            // Read every image at once, then decode them
+            ThreadPool workers(std::max(1u, std::thread::hardware_concurrency()));
+            AsyncFileReader file_reader(workers);
+            std::vector<std::string> const files = read_files(file_reader, config.pack_textures);
+            std::vector<TextureImage> images;
+            for (size_t i = 0; i < files.size(); ++i) {
+                images.push_back(decode_texture_image(config.pack_textures[i], files[i]));
+            }
+            uint32_t const page_size = choose_atlas_page_size(images, texture_detail_levels, atlas_min_page_size, 
+                                                              atlas_max_page_size);
+            Atlas const atlas = build_atlas(images, page_size, texture_detail_levels);
+            save_atlas(config.atlas_file, atlas);
+            std::cout << "Packed " << images.size() << " textures into " << atlas.layout.layer_count << " layers of "
+                      << page_size << "x" << page_size << ", written to " << config.atlas_file << "\n";
+        } catch (std::exception const& e) {
+            std::cerr << e.what() << "\n";
+            return 1;
+        }
+        return 0;
+    }
+
+    // Benchmark mode for the scene transform update, does not need a window or a Vulkan device
+    if (config.bench_transforms) {
+        benchmark_scene_transforms(*config.bench_transforms);
+        return 0;
+    }
+    // Runs on a headless device
+    if (config.bench_particles) {
+        benchmark_particles(read_particle_shaders(), *config.bench_particles);
+        return 0;
+    }
+
+    // A replay draws at the size it was captured at
+    size_t width = 1280;
+    size_t height = 720;
+    if (!config.replay_file.empty()) {
+        try {
+            CaptureHeader const header = read_capture_header(config.replay_file);
+            width = header.width;
+            height = header.height;
+        } catch (std::runtime_error const& e) {
+            std::cerr << e.what() << "\n";
+            return 1;
+        }
+    }
+
     glfwInit();
-    VulkanApp app(1280, 720, "Vulkan");
+    VulkanApp app(width, height, "Vulkan", config);
     app.run();
 
     return 0;